@@ -0,0 +1,577 @@
+/* scanbench.c */
+
+/* Scanner benchmark */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "perfctr.h"
+#include "scanfs.h"
+
+
+/* Materializes a parametric directory tree (unless one made with the
+ * same parameters is already there), then scans it repeatedly with
+ * scanfs( ) and reports the median of each measurement. The first scan
+ * only warms up the kernel's caches and is not counted.
+ *
+ * Syscalls are counted by the wrappers below, which the linker puts in
+ * place of scanfs( )'s calls to lstat( ), opendir( ), readdir( ) and
+ * closedir( ) (see -Wl,--wrap in meson.build). The 64-bit variants are
+ * wrapped too, as large file support renames them. opendir( ) makes two
+ * syscalls (open, fstat) and closedir( ) one. readdir( ) only calls
+ * getdents when its buffer runs dry, so the getdents calls are
+ * estimated when the directory is closed, from the size of the entries
+ * read: one per buffer's worth, plus the one that comes back empty.
+ * For glibc this comes close, erring high where the filesystem asks for
+ * a bigger buffer (st_blksize above READDIR_BUFFER_SIZE) */
+
+
+/* Name of the file recording generator parameters in the tree root */
+#define STAMP_FILE	".fsgen-params"
+
+/* Syscalls made by opendir( ) and closedir( ) (see above) */
+#define OPENDIR_SYSCALLS	2
+#define CLOSEDIR_SYSCALLS	1
+
+/* Smallest buffer glibc's readdir( ) reads entries into (bytes) */
+#define READDIR_BUFFER_SIZE	32768
+
+
+/* Points in a scan at which the time is recorded */
+typedef enum {
+	SCANBENCH_START,	/* scanfs( ) called */
+	SCANBENCH_SCANNED,	/* All entries read and stat'ed */
+	SCANBENCH_AGGREGATED,	/* Tree sorted, subtree totals done */
+	NUM_SCANBENCH_MARKS
+} ScanBenchMark;
+
+
+/* Generator parameters */
+struct GenParams {
+	int	fanout;		/* Subdirectories per directory */
+	int	depth;		/* Levels of subdirectories */
+	int	files;		/* Regular files per directory */
+	int	name_len;	/* Length of names */
+	int	symlink_pct;	/* Percentage of files made symlinks */
+	int	specials;	/* FIFOs and sockets per directory */
+	int64	max_size;	/* Maximum (sparse) file size */
+	guint32	seed;		/* Random seed */
+};
+
+/* Identifiers for command-line options */
+enum {
+	OPT_FANOUT,
+	OPT_DEPTH,
+	OPT_FILES,
+	OPT_NAME_LEN,
+	OPT_SYMLINKS,
+	OPT_SPECIALS,
+	OPT_MAX_SIZE,
+	OPT_SEED,
+	OPT_RUNS,
+	OPT_GENERATE_ONLY,
+	OPT_PERF_COUNTERS,
+	OPT_HELP
+};
+
+/* Command-line options */
+static struct option cli_opts[] = {
+	{ "fanout", required_argument, NULL, OPT_FANOUT },
+	{ "depth", required_argument, NULL, OPT_DEPTH },
+	{ "files", required_argument, NULL, OPT_FILES },
+	{ "name-len", required_argument, NULL, OPT_NAME_LEN },
+	{ "symlinks", required_argument, NULL, OPT_SYMLINKS },
+	{ "specials", required_argument, NULL, OPT_SPECIALS },
+	{ "max-size", required_argument, NULL, OPT_MAX_SIZE },
+	{ "seed", required_argument, NULL, OPT_SEED },
+	{ "runs", required_argument, NULL, OPT_RUNS },
+	{ "generate-only", no_argument, NULL, OPT_GENERATE_ONLY },
+	{ "perf-counters", no_argument, NULL, OPT_PERF_COUNTERS },
+	{ "help", no_argument, NULL, OPT_HELP },
+	{ NULL, 0, NULL, 0 }
+};
+
+/* Usage summary */
+static const char usage_summary[] = "\n"
+    "scanbench - fsv filesystem scanner benchmark\n"
+    "\n"
+    "Usage: %s [options] dir\n"
+    "  dir              Where to generate the test tree\n"
+    "  --fanout N       Subdirectories per directory (4)\n"
+    "  --depth N        Levels of subdirectories (4)\n"
+    "  --files N        Regular files per directory (50)\n"
+    "  --name-len N     Length of file names (12)\n"
+    "  --symlinks PCT   Percentage of files made symlinks (5)\n"
+    "  --specials N     FIFOs and sockets per directory (1)\n"
+    "  --max-size BYTES Maximum (sparse) file size (1048576)\n"
+    "  --seed N         Random seed (1)\n"
+    "  --runs N         Number of timed scans (7)\n"
+    "  --generate-only  Make the tree, but don't scan it\n"
+    "  --perf-counters  Also report CPU event counts per phase\n"
+    "  --help           Print this help and exit\n"
+    "\n";
+
+
+/* Syscall counters */
+static int64 num_lstat = 0;
+static int64 num_dir_syscalls = 0;	/* open, fstat, getdents, close */
+
+/* Size of the entries read from the directory open in this thread.
+ * scanfs( ) reads a directory through to closedir( ) on one thread */
+static __thread int64 dir_entry_bytes = 0;
+
+/* Times recorded during the current scan */
+static double mark_time[NUM_SCANBENCH_MARKS];
+
+/* Random number source for the generator */
+static GRand *rand_gen = NULL;
+
+/* Number of entries made by the generator */
+static int64 num_generated = 0;
+
+
+/* (The 64-bit variants are only reached where struct stat and struct
+ * dirent are the 64-bit ones) */
+int __real_lstat( const char *path, struct stat *buf );
+int __real_lstat64( const char *path, struct stat *buf );
+DIR *__real_opendir( const char *name );
+struct dirent *__real_readdir( DIR *dir );
+struct dirent *__real_readdir64( DIR *dir );
+int __real_closedir( DIR *dir );
+
+
+/* Counting wrapper for lstat( ) */
+int
+__wrap_lstat( const char *path, struct stat *buf )
+{
+	++num_lstat;
+	return __real_lstat( path, buf );
+}
+
+
+/* Counting wrapper for lstat64( ) */
+int
+__wrap_lstat64( const char *path, struct stat *buf )
+{
+	++num_lstat;
+	return __real_lstat64( path, buf );
+}
+
+
+/* Counting wrapper for opendir( ) */
+DIR *
+__wrap_opendir( const char *name )
+{
+	num_dir_syscalls += OPENDIR_SYSCALLS;
+	dir_entry_bytes = 0;
+	return __real_opendir( name );
+}
+
+
+/* Wrapper for readdir( ), adding up the size of the entries */
+struct dirent *
+__wrap_readdir( DIR *dir )
+{
+	struct dirent *de;
+
+	de = __real_readdir( dir );
+	if (de != NULL)
+		dir_entry_bytes += de->d_reclen;
+
+	return de;
+}
+
+
+/* Wrapper for readdir64( ), likewise */
+struct dirent *
+__wrap_readdir64( DIR *dir )
+{
+	struct dirent *de;
+
+	de = __real_readdir64( dir );
+	if (de != NULL)
+		dir_entry_bytes += de->d_reclen;
+
+	return de;
+}
+
+
+/* Counting wrapper for closedir( ). Also counts the getdents calls made
+ * while reading the directory (see above) */
+int
+__wrap_closedir( DIR *dir )
+{
+	num_dir_syscalls += CLOSEDIR_SYSCALLS;
+	num_dir_syscalls += (dir_entry_bytes + READDIR_BUFFER_SIZE - 1) / READDIR_BUFFER_SIZE + 1;
+	dir_entry_bytes = 0;
+
+	return __real_closedir( dir );
+}
+
+
+/* Records the time at some point in a scan */
+static void
+scanbench_mark( ScanBenchMark mark )
+{
+	mark_time[mark] = xgettime( );
+}
+
+
+/* scanfs( ) hook: all entries read in */
+static void
+scanned_cb( void *unused )
+{
+	scanbench_mark( SCANBENCH_SCANNED );
+}
+
+
+/* scanfs( ) hook: tree sorted and subtree totals computed */
+static void
+done_cb( GNode **node_table, unsigned int num_nodes, void *unused )
+{
+	xfree( node_table );
+	scanbench_mark( SCANBENCH_AGGREGATED );
+}
+
+
+/* Returns a random name of the configured length. The index prefix
+ * guarantees uniqueness within a directory */
+static const char *
+random_name( char prefix, int index, int len )
+{
+	static const char name_chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-.";
+	static char name[256];
+	int i;
+
+	len = CLAMP(len, 8, (int)sizeof(name) - 1);
+	snprintf( name, sizeof(name), "%c%06d", prefix, index );
+	for (i = 7; i < len; i++)
+		name[i] = name_chars[g_rand_int_range( rand_gen, 0, sizeof(name_chars) - 1 )];
+	name[len] = '\0';
+
+	return name;
+}
+
+
+/* Helper function for generate_tree( ). Fills in one directory */
+static void
+generate_recursive( const char *dir, const struct GenParams *params, int level )
+{
+	char *path;
+	char *prev_file = NULL;
+	int64 size;
+	int fd, i;
+
+	/* Regular files (sparse) and symlinks */
+	for (i = 0; i < params->files; i++) {
+		path = g_build_filename( dir, random_name( 'f', i, params->name_len ), NULL );
+		if ((prev_file != NULL) && (g_rand_int_range( rand_gen, 0, 100 ) < params->symlink_pct)) {
+			if (symlink( prev_file, path ))
+				g_error( "Cannot create symlink %s: %s", path, g_strerror( errno ) );
+			g_free( path );
+		}
+		else {
+			fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+			if (fd < 0)
+				g_error( "Cannot create %s: %s", path, g_strerror( errno ) );
+			/* Sizes spread evenly over orders of magnitude */
+			size = (int64)exp( g_rand_double( rand_gen ) * log( (double)params->max_size + 1.0 ) ) - 1;
+			if (ftruncate( fd, size ))
+				g_error( "Cannot size %s: %s", path, g_strerror( errno ) );
+			close( fd );
+			g_free( prev_file );
+			prev_file = path;
+		}
+		++num_generated;
+	}
+	g_free( prev_file );
+
+	/* Special files */
+	for (i = 0; i < params->specials; i++) {
+		path = g_build_filename( dir, random_name( 'p', i, params->name_len ), NULL );
+		if (mkfifo( path, 0644 ))
+			g_error( "Cannot create FIFO %s: %s", path, g_strerror( errno ) );
+		g_free( path );
+		path = g_build_filename( dir, random_name( 's', i, params->name_len ), NULL );
+		if (mknod( path, S_IFSOCK | 0644, 0 ))
+			g_error( "Cannot create socket %s: %s", path, g_strerror( errno ) );
+		g_free( path );
+		num_generated += 2;
+	}
+
+	if (level >= params->depth)
+		return;
+
+	/* Subdirectories */
+	for (i = 0; i < params->fanout; i++) {
+		path = g_build_filename( dir, random_name( 'd', i, params->name_len ), NULL );
+		if (mkdir( path, 0755 ))
+			g_error( "Cannot create directory %s: %s", path, g_strerror( errno ) );
+		++num_generated;
+		generate_recursive( path, params, level + 1 );
+		g_free( path );
+	}
+}
+
+
+/* Removes an old test tree. Done here rather than by a shell, so that
+ * no path can be taken for anything but a path. Symlinks are removed,
+ * not followed */
+static void
+remove_tree( const char *path )
+{
+	GDir *dir;
+	GError *error = NULL;
+	const char *name;
+	char *child;
+
+	if (g_file_test( path, G_FILE_TEST_IS_DIR ) && !g_file_test( path, G_FILE_TEST_IS_SYMLINK )) {
+		dir = g_dir_open( path, 0, &error );
+		if (dir == NULL)
+			g_error( "Cannot read directory %s: %s", path, error->message );
+		while ((name = g_dir_read_name( dir )) != NULL) {
+			child = g_build_filename( path, name, NULL );
+			remove_tree( child );
+			g_free( child );
+		}
+		g_dir_close( dir );
+	}
+
+	if (remove( path ))
+		g_error( "Cannot remove %s: %s", path, g_strerror( errno ) );
+}
+
+
+/* Makes the test tree in dir, unless it already holds one generated
+ * with the same parameters */
+static void
+generate_tree( const char *dir, const struct GenParams *params )
+{
+	char *stamp_path;
+	char *stamp;
+	char *prev_stamp = NULL;
+	double t0;
+
+	stamp = g_strdup_printf( "fanout=%d depth=%d files=%d name_len=%d symlinks=%d specials=%d max_size=%s seed=%u\n", params->fanout, params->depth, params->files, params->name_len, params->symlink_pct, params->specials, i64toa( params->max_size ), params->seed );
+	stamp_path = g_build_filename( dir, STAMP_FILE, NULL );
+
+	if (g_file_get_contents( stamp_path, &prev_stamp, NULL, NULL ) && !strcmp( stamp, prev_stamp )) {
+		printf( "Using existing tree in %s\n", dir );
+		g_free( prev_stamp );
+		g_free( stamp_path );
+		g_free( stamp );
+		return;
+	}
+	g_free( prev_stamp );
+
+	/* Start from scratch */
+	if (g_file_test( dir, G_FILE_TEST_EXISTS )) {
+		if (!g_file_test( stamp_path, G_FILE_TEST_EXISTS ))
+			g_error( "%s exists, and was not made by this program", dir );
+		remove_tree( dir );
+	}
+	if (g_mkdir_with_parents( dir, 0755 ))
+		g_error( "Cannot create %s: %s", dir, g_strerror( errno ) );
+
+	printf( "Generating tree in %s\n", dir );
+	t0 = xgettime( );
+	rand_gen = g_rand_new_with_seed( params->seed );
+	num_generated = 0;
+	generate_recursive( dir, params, 0 );
+	g_rand_free( rand_gen );
+	printf( "  %s entries in %.2f s\n", i64toa( num_generated ), xgettime( ) - t0 );
+
+	/* Stamp goes in last, so an interrupted run is redone */
+	if (!g_file_set_contents( stamp_path, stamp, -1, NULL ))
+		g_error( "Cannot write %s", stamp_path );
+
+	g_free( stamp_path );
+	g_free( stamp );
+}
+
+
+/* Compare function for sorting doubles */
+static int
+compare_double( const void *a, const void *b )
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* Returns the median of an array (which gets sorted), and its relative
+ * spread (median absolute deviation / median) */
+static double
+median( double *values, int n, double *spread )
+{
+	double *dev;
+	double m;
+	int i;
+
+	qsort( values, n, sizeof(double), compare_double );
+	m = values[n / 2];
+
+	dev = NEW_ARRAY(double, n);
+	for (i = 0; i < n; i++)
+		dev[i] = ABS(values[i] - m);
+	qsort( dev, n, sizeof(double), compare_double );
+	*spread = (m > 0.0) ? (dev[n / 2] / m) : 0.0;
+	xfree( dev );
+
+	return m;
+}
+
+
+/* Scans the tree repeatedly and prints results */
+static void
+run_benchmark( const char *dir, int runs )
+{
+	static const ScanfsHooks hooks = {
+		.scanned = scanned_cb,
+		.done = done_cb
+	};
+	struct rusage usage;
+	double *rate, *scan_time, *aggregate_time;
+	double spread;
+	int64 entries = 0;
+	int64 syscalls = 0;
+	int r;
+
+	rate = NEW_ARRAY(double, runs);
+	scan_time = NEW_ARRAY(double, runs);
+	aggregate_time = NEW_ARRAY(double, runs);
+
+	for (r = -1; r < runs; r++) {
+		num_lstat = 0;
+		num_dir_syscalls = 0;
+		scanbench_mark( SCANBENCH_START );
+		scanfs( dir, &hooks, NULL );
+		if (r < 0)
+			continue; /* warm-up */
+
+		/* Metanode and root directory aren't entries */
+		entries = 0;
+		for (int i = 0; i < NUM_NODE_TYPES; i++)
+			entries += DIR_NODE_DESC(root_dnode)->subtree.counts[i];
+		syscalls = num_lstat + num_dir_syscalls;
+
+		scan_time[r] = mark_time[SCANBENCH_SCANNED] - mark_time[SCANBENCH_START];
+		aggregate_time[r] = mark_time[SCANBENCH_AGGREGATED] - mark_time[SCANBENCH_START];
+		rate[r] = (double)num_lstat / MAX(scan_time[r], EPSILON);
+	}
+
+	getrusage( RUSAGE_SELF, &usage );
+
+	printf( "Scanned %s entries, %d runs (medians)\n", i64toa( entries ), runs );
+	printf( "  stats/sec:           %12.0f  (+/- %.1f%%)\n", median( rate, runs, &spread ), 100.0 * spread );
+	printf( "  syscalls/entry:      %12.3f\n", (double)syscalls / (double)MAX(1, entries) );
+	printf( "  scan time:           %12.4f s  (+/- %.1f%%)\n", median( scan_time, runs, &spread ), 100.0 * spread );
+	printf( "  time-to-aggregate:   %12.4f s  (+/- %.1f%%)\n", median( aggregate_time, runs, &spread ), 100.0 * spread );
+	printf( "  peak RSS:            %12ld KB\n", usage.ru_maxrss );
+	/* (Warm-up scan included) */
+	perfctr_report( );
+
+	xfree( rate );
+	xfree( scan_time );
+	xfree( aggregate_time );
+}
+
+
+int
+main( int argc, char **argv )
+{
+	struct GenParams params = { 4, 4, 50, 12, 5, 1, 1 << 20, 1 };
+	char *dir;
+	boolean generate_only = FALSE;
+	int runs = 7;
+	int opt_id;
+
+	for (;;) {
+		opt_id = getopt_long( argc, argv, "", cli_opts, NULL );
+		if (opt_id == -1)
+			break;
+		switch (opt_id) {
+			case OPT_FANOUT:
+			params.fanout = MAX(0, atoi( optarg ));
+			break;
+
+			case OPT_DEPTH:
+			params.depth = MAX(0, atoi( optarg ));
+			break;
+
+			case OPT_FILES:
+			params.files = MAX(0, atoi( optarg ));
+			break;
+
+			case OPT_NAME_LEN:
+			params.name_len = atoi( optarg );
+			break;
+
+			case OPT_SYMLINKS:
+			params.symlink_pct = CLAMP(atoi( optarg ), 0, 100);
+			break;
+
+			case OPT_SPECIALS:
+			params.specials = MAX(0, atoi( optarg ));
+			break;
+
+			case OPT_MAX_SIZE:
+			params.max_size = MAX(0, g_ascii_strtoll( optarg, NULL, 10 ));
+			break;
+
+			case OPT_SEED:
+			params.seed = (guint32)strtoul( optarg, NULL, 10 );
+			break;
+
+			case OPT_RUNS:
+			runs = MAX(1, atoi( optarg ));
+			break;
+
+			case OPT_GENERATE_ONLY:
+			generate_only = TRUE;
+			break;
+
+			case OPT_PERF_COUNTERS:
+			perfctr_enable( );
+			break;
+
+			case OPT_HELP:
+			default:
+			printf( usage_summary, argv[0] );
+			return (opt_id == OPT_HELP) ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (optind != (argc - 1)) {
+		printf( usage_summary, argv[0] );
+		return EXIT_FAILURE;
+	}
+
+	/* scanfs( ) changes the working directory */
+	dir = g_canonicalize_filename( argv[optind], NULL );
+
+	generate_tree( dir, &params );
+	if (!generate_only)
+		run_benchmark( dir, runs );
+
+	g_free( dir );
+
+	return EXIT_SUCCESS;
+}
+
+
+/* end scanbench.c */
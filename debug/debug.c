@@ -102,6 +102,50 @@ static GList *mem_block_info_list = NULL;
 static int total_blocks = 0;
 static size_t total_bytes = 0;
 
+/* Number of allocations (and reallocations) made so far */
+static unsigned long total_allocs = 0;
+
+/* Heap allocations made by the calling thread outside of exempt
+ * stretches (see debug_alloc_exempt_begin( )). With glibc, malloc( ) and
+ * friends are interposed below, so that this counts GLib's allocations
+ * (g_malloc( ), g_slice_*( ), GString, GArray...) along with ours.
+ * Elsewhere, only the xmalloc( ) family is counted */
+static __thread unsigned long thread_allocs = 0;
+static __thread int thread_exempt = 0;
+
+
+#ifdef __GLIBC__
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t nmemb, size_t size );
+extern void *__libc_realloc( void *block, size_t size );
+
+void *
+malloc( size_t size )
+{
+	if (thread_exempt == 0)
+		++thread_allocs;
+	return __libc_malloc( size );
+}
+
+
+void *
+calloc( size_t nmemb, size_t size )
+{
+	if (thread_exempt == 0)
+		++thread_allocs;
+	return __libc_calloc( nmemb, size );
+}
+
+
+void *
+realloc( void *block, size_t size )
+{
+	if (thread_exempt == 0)
+		++thread_allocs;
+	return __libc_realloc( block, size );
+}
+#endif /* __GLIBC__ */
+
 
 void
 debug_init( void )
@@ -240,6 +284,34 @@ debug_show_mem_totals( void )
 }
 
 
+/* Returns the number of heap allocations made so far by the calling
+ * thread, not counting exempt ones. Take the difference of two readings
+ * to count the allocations in between */
+unsigned long
+debug_alloc_count( void )
+{
+	return thread_allocs;
+}
+
+
+/* Allocations by the calling thread from here to the matching
+ * debug_alloc_exempt_end( ) are not counted by debug_alloc_count( ).
+ * These may nest */
+void
+debug_alloc_exempt_begin( void )
+{
+	++thread_exempt;
+}
+
+
+void
+debug_alloc_exempt_end( void )
+{
+	g_assert( thread_exempt > 0 );
+	--thread_exempt;
+}
+
+
 void
 debug_show_mem_summary( void )
 {
@@ -279,6 +351,11 @@ new_block_info( void *block, size_t size, const char *type, const char *src_file
 	/* Add to running totals */
 	total_bytes += size;
 	++total_blocks;
+	++total_allocs;
+#ifndef __GLIBC__
+	if (thread_exempt == 0)
+		++thread_allocs;
+#endif
 }
 
 
@@ -289,6 +366,11 @@ update_block_info( struct MemBlockInfo *mbi, void *block, size_t size )
 	/* Adjust running byte total */
 	total_bytes += size;
 	total_bytes -= mbi->size;
+	++total_allocs;
+#ifndef __GLIBC__
+	if (thread_exempt == 0)
+		++thread_allocs;
+#endif
 
 	/* Update block info */
 	mbi->block = block;
@@ -48,6 +48,9 @@
 
 void debug_init( void );
 void debug_show_mem_totals( void );
+unsigned long debug_alloc_count( void );
+void debug_alloc_exempt_begin( void );
+void debug_alloc_exempt_end( void );
 void debug_show_mem_summary( void );
 void debug_show_mem_stats( void );
 void *debug_malloc( size_t size, const char *source_file, int source_line );
@@ -14,13 +14,16 @@
 
 #include <gtk/gtk.h>
 
-#include "ogl.h" /* ogl_draw( ) */
+#include "ogl.h" /* ogl_draw( ), ogl_damage_all( ) */
 
 
 /* The framerate is maintained as a rolling average over this
  * length of time (in seconds) */
 #define FRAMERATE_AVERAGE_TIME 4.0
 
+/* Morph and scheduled event records are allocated this many at a time */
+#define ANIMATION_POOL_CHUNK 64
+
 
 /* Messages for framerate_iteration( ) */
 enum {
@@ -29,11 +32,18 @@ enum {
 };
 
 
-/* Scheduled event queue */
-static GList *schevent_queue = NULL;
+/* Scheduled event queue (linked through ScheduledEvent.next) */
+static ScheduledEvent *schevent_queue = NULL;
+
+/* Morph queue (linked through Morph.queue_next). Each entry is the
+ * current stage of a morphing variable */
+static Morph *morph_queue = NULL;
 
-/* Morph queue */
-static GList *morph_queue = NULL;
+/* Free lists of spent records. Starting a morph or scheduling an event
+ * happens on the order of once per frame during camera moves, so these
+ * are recycled rather than going back to the heap */
+static ScheduledEvent *schevent_pool = NULL;
+static Morph *morph_pool = NULL;
 
 /* Overall graphics framerate */
 /* TODO: Export framerate when there's something to use it */
@@ -43,6 +53,68 @@ static float framerate = 0.0;
 static boolean animation_active = FALSE;
 
 
+/* Takes a scheduled event record from the pool */
+static ScheduledEvent *
+schevent_alloc( void )
+{
+	ScheduledEvent *schevent;
+	int i;
+
+	if (schevent_pool == NULL) {
+		/* Refill pool */
+		schevent_pool = NEW_ARRAY(ScheduledEvent, ANIMATION_POOL_CHUNK);
+		for (i = 0; i < (ANIMATION_POOL_CHUNK - 1); i++)
+			schevent_pool[i].next = &schevent_pool[i + 1];
+		schevent_pool[ANIMATION_POOL_CHUNK - 1].next = NULL;
+	}
+
+	schevent = schevent_pool;
+	schevent_pool = schevent->next;
+
+	return schevent;
+}
+
+
+/* Returns a scheduled event record to the pool */
+static void
+schevent_release( ScheduledEvent *schevent )
+{
+	schevent->next = schevent_pool;
+	schevent_pool = schevent;
+}
+
+
+/* Takes a morph record from the pool */
+static Morph *
+morph_alloc( void )
+{
+	Morph *morph;
+	int i;
+
+	if (morph_pool == NULL) {
+		/* Refill pool */
+		morph_pool = NEW_ARRAY(Morph, ANIMATION_POOL_CHUNK);
+		for (i = 0; i < (ANIMATION_POOL_CHUNK - 1); i++)
+			morph_pool[i].next = &morph_pool[i + 1];
+		morph_pool[ANIMATION_POOL_CHUNK - 1].next = NULL;
+	}
+
+	morph = morph_pool;
+	morph_pool = morph->next;
+
+	return morph;
+}
+
+
+/* Returns a morph record to the pool */
+static void
+morph_release( Morph *morph )
+{
+	morph->next = morph_pool;
+	morph_pool = morph;
+}
+
+
 /* Schedules an event (callback) to occur after the given number of
  * frames have elapsed */
 void
@@ -50,17 +122,33 @@ schedule_event( void (*event_cb)( ), void *data, int nframes )
 {
 	ScheduledEvent *new_schevent;
 
-	new_schevent = NEW(ScheduledEvent);
+	new_schevent = schevent_alloc( );
 	new_schevent->nframes = nframes;
 	new_schevent->event_cb = event_cb;
 	new_schevent->data = data;
 
 	/* Make sure we're animating */
 	if (!animation_active)
-		redraw( );
+		redraw_damaged( );
 
 	/* Add new scheduled event to queue */
-	G_LIST_PREPEND(schevent_queue, new_schevent);
+	new_schevent->next = schevent_queue;
+	schevent_queue = new_schevent;
+}
+
+
+/* Removes a record from the scheduled event queue */
+static void
+schevent_unlink( ScheduledEvent *schevent )
+{
+	ScheduledEvent **link;
+
+	for (link = &schevent_queue; *link != NULL; link = &(*link)->next) {
+		if (*link == schevent) {
+			*link = schevent->next;
+			return;
+		}
+	}
 }
 
 
@@ -69,38 +157,67 @@ schedule_event( void (*event_cb)( ), void *data, int nframes )
 static boolean
 scheduled_event_iteration( void )
 {
-	ScheduledEvent *schevent;
-	GList *seq_llink;
+	ScheduledEvent *schevent, *next_schevent;
 	boolean event_executed = FALSE;
 
 	/* Update entries in queue, executing those that are
 	 * scheduled for the current frame */
-	seq_llink = schevent_queue;
-	while (seq_llink != NULL) {
-		schevent = (ScheduledEvent *)seq_llink->data;
+	schevent = schevent_queue;
+	while (schevent != NULL) {
 		if (--schevent->nframes <= 0) {
-			/* Execute event */
+			/* Execute event (it may schedule others, but
+			 * those go in at the head of the queue) */
 			(schevent->event_cb)( schevent->data );
-			/* Remove and free record */
-			seq_llink = seq_llink->next;
-			G_LIST_REMOVE(schevent_queue, schevent);
-			xfree( schevent );
+			/* Remove and recycle record */
+			next_schevent = schevent->next;
+			schevent_unlink( schevent );
+			schevent_release( schevent );
+			schevent = next_schevent;
 
 			event_executed = TRUE;
 		}
 		else
-			seq_llink = seq_llink->next;
+			schevent = schevent->next;
 	}
 
 	return (event_executed || (schevent_queue != NULL));
 }
 
 
-/* Checks if the two given morphs are on the same variable */
-static int
-compare_var( const Morph *morph1, const Morph *morph2 )
+/* Returns the queued morph on the given variable, or NULL if the
+ * variable is not being morphed */
+static Morph *
+morph_queue_find( double *var )
 {
-	return morph1->var != morph2->var;
+	Morph *morph;
+
+	for (morph = morph_queue; morph != NULL; morph = morph->queue_next) {
+		if (morph->var == var)
+			return morph;
+	}
+
+	return NULL;
+}
+
+
+/* Replaces a queued morph with another (or just removes it, if
+ * replacement is NULL) */
+static void
+morph_queue_replace( Morph *morph, Morph *replacement )
+{
+	Morph **link;
+
+	for (link = &morph_queue; *link != NULL; link = &(*link)->queue_next) {
+		if (*link == morph) {
+			if (replacement != NULL) {
+				replacement->queue_next = morph->queue_next;
+				*link = replacement;
+			}
+			else
+				*link = morph->queue_next;
+			return;
+		}
+	}
 }
 
 
@@ -127,13 +244,12 @@ morph_full( double *var, MorphType type, double target_value, double duration, v
 {
 	Morph *new_morph, *morph;
 	Morph *mlast;
-	GList *mq_llink;
 	double t_now;
 
 	t_now = xgettime( );
 
 	/* Create new morph record */
-	new_morph = NEW(Morph);
+	new_morph = morph_alloc( );
 	new_morph->type = type;
 	new_morph->var = var;
 	new_morph->start_value = *var;
@@ -144,21 +260,22 @@ morph_full( double *var, MorphType type, double target_value, double duration, v
 	new_morph->end_cb = end_cb;
 	new_morph->data = data;
 	new_morph->next = NULL;
+	new_morph->queue_next = NULL;
 
 	/* Check to see if the variable is already undergoing morphing */
-	mq_llink = g_list_find_custom( morph_queue, new_morph, (GCompareFunc)compare_var );
-	if (mq_llink == NULL) {
+	morph = morph_queue_find( var );
+	if (morph == NULL) {
 		/* Variable is not being morphed */
 		/* Make sure we're animating */
 		if (!animation_active)
-			redraw( );
+			redraw_damaged( );
 		/* Add new morph to queue */
-		G_LIST_PREPEND(morph_queue, new_morph);
+		new_morph->queue_next = morph_queue;
+		morph_queue = new_morph;
 	}
 	else {
 		/* Variable is already undergoing morphing. Append
 		 * new stage to the incumbent morph record(s) */
-		morph = (Morph *)mq_llink->data;
 		mlast = last_morph_stage( morph );
 		new_morph->t_start = mlast->t_end;
 		new_morph->t_end = mlast->t_end + duration;
@@ -182,15 +299,12 @@ morph( double *var, MorphType type, double target_value, double duration )
 void
 morph_finish( double *var )
 {
-	Morph finish_morph, *morph;
-	GList *mq_llink;
+	Morph *morph;
 
-	finish_morph.var = var;
-	mq_llink = g_list_find_custom( morph_queue, &finish_morph, (GCompareFunc)compare_var );
-	if (mq_llink == NULL)
+	morph = morph_queue_find( var );
+	if (morph == NULL)
 		return; /* Variable is not being morphed */
 
-	morph = (Morph *)mq_llink->data;
 	morph->t_end = 0.0;
 }
 
@@ -201,34 +315,39 @@ morph_finish( double *var )
 void
 morph_break( double *var )
 {
-	Morph break_morph, *morph, *mnext;
-	GList *mq_llink;
+	Morph *morph, *mnext;
 
-	break_morph.var = var;
-	mq_llink = g_list_find_custom( morph_queue, &break_morph, (GCompareFunc)compare_var );
-	if (mq_llink == NULL)
+	morph = morph_queue_find( var );
+	if (morph == NULL)
 		return; /* Variable is not being morphed */
 
 	/* Remove morph record */
-	morph = (Morph *)mq_llink->data;
-	G_LIST_REMOVE(morph_queue, morph);
+	morph_queue_replace( morph, NULL );
 
-	/* Free morph record, and any subsequent stages */
+	/* Recycle morph record, and any subsequent stages */
 	while (morph != NULL) {
 		mnext = morph->next;
-		xfree( morph );
+		morph_release( morph );
 		morph = mnext;
 	}
 }
 
 
+/* Returns TRUE if any morphs or scheduled events are pending, i.e. the
+ * scene is still in motion */
+boolean
+animation_busy( void )
+{
+	return (morph_queue != NULL) || (schevent_queue != NULL);
+}
+
+
 /* Driver routine for variable morphing.
  * Return value indicates whether state change occurred or not */
 static boolean
 morph_iteration( void )
 {
-	Morph *morph;
-	GList *mq_llink;
+	Morph *morph, *mnext;
 	double t_now;
 	double percent;
 	boolean state_changed = FALSE;
@@ -236,10 +355,8 @@ morph_iteration( void )
 	t_now = xgettime( );
 
 	/* Perform update of all morphing variables */
-	mq_llink = morph_queue;
-	while (mq_llink != NULL) {
-		morph = (Morph *)mq_llink->data;
-
+	morph = morph_queue;
+	while (morph != NULL) {
 		if (t_now >= morph->t_end) {
 			/* Morph complete - assign end value */
 			*(morph->var) = morph->end_value;
@@ -248,15 +365,17 @@ morph_iteration( void )
 			if (morph->end_cb != NULL)
 				(morph->end_cb)( morph );
 			if (morph->next != NULL) {
-				/* Drop in next stage */
-				mq_llink->data = morph->next;
+				/* Drop in next stage (which is
+				 * processed next) */
+				mnext = morph->next;
 			}
 			else {
 				/* Remove record from queue */
-				mq_llink = mq_llink->next;
-				G_LIST_REMOVE(morph_queue, morph);
+				mnext = morph->queue_next;
 			}
-			xfree( morph );
+			morph_queue_replace( morph, morph->next );
+			morph_release( morph );
+			morph = mnext;
                         continue;
 		}
 
@@ -298,7 +417,7 @@ morph_iteration( void )
 		if (morph->step_cb != NULL)
 			(morph->step_cb)( morph );
 
-		mq_llink = mq_llink->next;
+		morph = morph->queue_next;
 	}
 
 	return state_changed;
@@ -313,6 +432,7 @@ framerate_iteration( int mesg )
         static double sum_frametimes = 0.0;
         static double *frametimes;
 	static int num_frametimes = 0;
+	static int frametimes_size = 0;
 	static int f = 0;
 	double t_now, delta_t;
 	double average_frametime;
@@ -324,7 +444,8 @@ framerate_iteration( int mesg )
 	if (num_frametimes == 0) {
 		/* First-time initialization */
 		num_frametimes = 1;
-		frametimes = NEW_ARRAY(double, num_frametimes);
+		frametimes_size = 64;
+		frametimes = NEW_ARRAY(double, frametimes_size);
 		frametimes[0] = 0.0;
 		return;
 	}
@@ -363,7 +484,12 @@ framerate_iteration( int mesg )
 		 * after the current element, with value equal to that
 		 * of the oldest element */
 		++num_frametimes;
-		RESIZE(frametimes, num_frametimes, double);
+		if (num_frametimes > frametimes_size) {
+			/* Buffer only grows, so it stops being
+			 * reallocated once the framerate settles */
+			frametimes_size *= 2;
+			RESIZE(frametimes, frametimes_size, double);
+		}
 		if (f < (num_frametimes - 2))
 			memmove( &frametimes[f + 2], &frametimes[f + 1], (num_frametimes - f - 2) * sizeof(double) );
 		else
@@ -383,7 +509,6 @@ framerate_iteration( int mesg )
 			memmove( &frametimes[0], &frametimes[1], (num_frametimes - 1) * sizeof(double) );
 		}
 		--num_frametimes;
-		RESIZE(frametimes, num_frametimes, double);
 	}
 
 	f = (f + 1) % num_frametimes;
@@ -434,6 +559,17 @@ animation_loop(gpointer data)
 /* This is the official means of requesting a redraw */
 void
 redraw( void )
+{
+	ogl_damage_all( );
+	redraw_damaged( );
+}
+
+
+/* Requests a redraw that need only update the parts of the viewport
+ * declared damaged with ogl_damage_box( ). This also goes for state
+ * changes that otherwise show up on their own (e.g. camera moves) */
+void
+redraw_damaged( void )
 {
 	/* Ensure that animation loop is active */
 	if (!animation_active)
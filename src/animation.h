@@ -31,6 +31,7 @@ struct _ScheduledEvent {
 	void	(*event_cb)( void * );
 	/* ...with this arbitrary data pointer. */
 	void	*data;
+	ScheduledEvent *next;	/* Next event in queue */
 };
 
 typedef struct _Morph Morph;
@@ -48,6 +49,7 @@ struct _Morph {
 	void		(*end_cb)( Morph * );
 	void		*data;		/* Arbitrary data pointer */
 	Morph		*next;		/* Next morph (for chaining) */
+	Morph		*queue_next;	/* Next morphing variable in queue */
 };
 
 
@@ -56,7 +58,9 @@ void morph_full( double *var, MorphType type, double target_value, double durati
 void morph( double *var, MorphType type, double target_value, double duration );
 void morph_finish( double *var );
 void morph_break( double *var );
+boolean animation_busy( void );
 void redraw( void );
+void redraw_damaged( void );
 
 
 /* end animation.h */
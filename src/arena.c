@@ -0,0 +1,137 @@
+/* arena.c */
+
+/* Per-frame scratch memory */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "arena.h"
+
+#include "profile.h"
+
+
+/* Vertex and index arrays that only live for the duration of a draw call
+ * are carved out of a bump allocator, which is rewound at the start of
+ * every frame. When a frame needs more than the current block holds,
+ * further blocks are chained on; at the next reset these are coalesced
+ * into a single block big enough for the whole frame. So the heap is only
+ * touched while the arena warms up (or the scene gets more complex), and
+ * steady-state frames allocate nothing. Main thread only */
+
+
+/* Minimum block size (bytes) */
+#define ARENA_BLOCK_SIZE	65536
+
+/* Alignment of returned pointers */
+#define ARENA_ALIGN		16
+
+#define ARENA_ROUND_UP(n)	(((n) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+
+/* A block of arena memory. The data follows the header */
+struct ArenaBlock {
+	struct ArenaBlock *prev;	/* Previously filled block */
+	size_t		size;		/* Size of data area (bytes) */
+	size_t		used;		/* Bytes handed out */
+};
+
+#define ARENA_HEADER_SIZE	ARENA_ROUND_UP(sizeof(struct ArenaBlock))
+
+
+static struct {
+	struct ArenaBlock *block;	/* Current block */
+	size_t		capacity;	/* Total size of all blocks */
+	size_t		used;		/* Bytes handed out this frame */
+	size_t		high_water;	/* Most bytes used in any frame */
+} arena;
+
+
+/* Chains on a new block with room for at least size bytes */
+static void
+arena_grow( size_t size )
+{
+	struct ArenaBlock *block;
+
+	size = MAX(size, ARENA_BLOCK_SIZE);
+	debug_alloc_exempt_begin( );
+	block = (struct ArenaBlock *)xmalloc( ARENA_HEADER_SIZE + size );
+	debug_alloc_exempt_end( );
+	block->prev = arena.block;
+	block->size = size;
+	block->used = 0;
+
+	arena.block = block;
+	arena.capacity += size;
+}
+
+
+/* Returns size bytes of scratch memory. This is reclaimed wholesale by
+ * the next arena_reset( ), and must not be freed */
+void *
+arena_alloc( size_t size )
+{
+	struct ArenaBlock *block;
+	void *mem;
+
+	size = ARENA_ROUND_UP(MAX(size, 1));
+	if ((arena.block == NULL) || ((arena.block->used + size) > arena.block->size))
+		arena_grow( size );
+
+	block = arena.block;
+	mem = (char *)block + ARENA_HEADER_SIZE + block->used;
+	block->used += size;
+	arena.used += size;
+
+	return mem;
+}
+
+
+/* Releases everything handed out since the last reset. Called at the
+ * start of a frame */
+void
+arena_reset( void )
+{
+	struct ArenaBlock *block, *prev;
+	size_t capacity;
+
+	arena.high_water = MAX(arena.high_water, arena.used);
+	arena.used = 0;
+
+	if (arena.block == NULL)
+		return;
+
+	if (arena.block->prev != NULL) {
+		/* Last frame overflowed the first block. Replace the
+		 * chain with one block holding all of it */
+		capacity = arena.capacity;
+		block = arena.block;
+		while (block != NULL) {
+			prev = block->prev;
+			xfree( block );
+			block = prev;
+		}
+		arena.block = NULL;
+		arena.capacity = 0;
+		arena_grow( capacity );
+	}
+	arena.block->used = 0;
+
+	profile_gauge( "arena.capacity_bytes", (int64)arena.capacity );
+	profile_gauge( "arena.high_water_bytes", (int64)arena.high_water );
+}
+
+
+/* Returns the total size of the arena. This changes only when the arena
+ * grows */
+size_t
+arena_capacity( void )
+{
+	return arena.capacity;
+}
+
+
+/* end arena.c */
@@ -0,0 +1,26 @@
+/* arena.h */
+
+/* Per-frame scratch memory */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_ARENA_H
+	#error
+#endif
+#define FSV_ARENA_H
+
+
+/* Allocates an array of n elements, valid until the next frame */
+#define ARENA_NEW_ARRAY(type,n)	(type *)arena_alloc( (n) * sizeof(type) )
+
+
+void *arena_alloc( size_t size );
+void arena_reset( void );
+size_t arena_capacity( void );
+
+
+/* end arena.h */
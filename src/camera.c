@@ -20,6 +20,7 @@
 #include "filelist.h"
 #include "geometry.h"
 #include "gui.h"
+#include "layout.h" /* layout_small_files_node( ) */
 #include "window.h"
 
 
@@ -1058,6 +1059,11 @@ camera_look_at_full( GNode *node, MorphType mtype, double pan_time_override )
 		g_assert( dirtree_entry_expanded( node->parent ) );
 #endif
 
+	/* A file merged into a "small files" node has no place of its
+	 * own until the small files are shown individually */
+	if (layout_small_files_node( node ) != node)
+		geometry_show_small_files( node->parent );
+
 	/* Temporarily disable part of the user interface */
 	window_set_access( FALSE );
 
@@ -16,9 +16,8 @@
 #include <time.h>
 #include "nvstore.h"
 
-#include "animation.h" /* redraw( ) */
-#include "geometry.h"
-#include "window.h"
+#include "nodeattr.h"
+#include "perfctr.h"
 
 
 /* Some fnmatch headers don't define FNM_FILE_NAME */
@@ -113,6 +112,20 @@ static RGBcolor spectrum_underflow_color;
 static RGBcolor spectrum_colors[SPECTRUM_NUM_SHADES];
 static RGBcolor spectrum_overflow_color;
 
+/* Callbacks to the user interface */
+static const ColorHooks no_hooks = { NULL };
+static const ColorHooks *color_hooks = &no_hooks;
+static void *color_hooks_data = NULL;
+
+
+/* Sets the callbacks for the coloring code (hooks may be NULL) */
+void
+color_set_hooks( const ColorHooks *hooks, void *data )
+{
+	color_hooks = (hooks != NULL) ? hooks : &no_hooks;
+	color_hooks_data = data;
+}
+
 
 /* Copies a ColorConfig structure from one location to another */
 static void
@@ -209,6 +222,7 @@ node_type_color( GNode *node )
 static const RGBcolor *
 time_color( GNode *node )
 {
+	NodeAttrs attrs;
 	double x;
         time_t node_time;
 	int i;
@@ -217,18 +231,22 @@ time_color( GNode *node )
 	if (NODE_IS_DIR(node))
 		return node_type_color( node );
 
+	/* Until the timestamps are in, go by type */
+	if (!nodeattr_lookup( node, NODE_ATTR_TIMES, &attrs ))
+		return node_type_color( node );
+
 	/* Choose appropriate timestamp */
 	switch (color_config.by_timestamp.timestamp_type) {
 		case TIMESTAMP_ACCESS:
-		node_time = NODE_DESC(node)->atime;
+		node_time = attrs.atime;
 		break;
 
 		case TIMESTAMP_MODIFY:
-		node_time = NODE_DESC(node)->mtime;
+		node_time = attrs.mtime;
 		break;
 
 		case TIMESTAMP_ATTRIB:
-		node_time = NODE_DESC(node)->ctime;
+		node_time = attrs.ctime;
 		break;
 
 		SWITCH_FAIL
@@ -290,16 +308,17 @@ wpattern_color( GNode *node )
 }
 
 
-/* (Re)assigns colors to all nodes rooted at the given node */
-void
-color_assign_recursive( GNode *dnode )
+/* Helper function for color_assign_recursive( ) */
+static void
+assign_recursive( GNode *dnode )
 {
 	GNode *node;
 	const RGBcolor *color;
 
 	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
 
-	geometry_queue_rebuild( dnode );
+	if (color_hooks->dir_colored != NULL)
+		(color_hooks->dir_colored)( dnode, color_hooks_data );
 
 	node = dnode->children;
 	while (node != NULL) {
@@ -321,20 +340,63 @@ color_assign_recursive( GNode *dnode )
                 NODE_DESC(node)->color = color;
 
 		if (NODE_IS_DIR(node))
-			color_assign_recursive( node );
+			assign_recursive( node );
 
 		node = node->next;
 	}
 }
 
 
+/* Called once node timestamps have been read in */
+static void
+times_ready_cb( void *unused )
+{
+	if (color_hooks->message != NULL)
+		(color_hooks->message)( "", color_hooks_data );
+	if ((color_mode != COLOR_BY_TIMESTAMP) || (globals.fstree == NULL))
+		return;
+	if (color_hooks->colors_changing != NULL)
+		(color_hooks->colors_changing)( color_hooks_data );
+	assign_recursive( globals.fstree );
+	if (color_hooks->colors_changed != NULL)
+		(color_hooks->colors_changed)( color_hooks_data );
+}
+
+
+/* (Re)assigns colors to all nodes rooted at the given node */
+void
+color_assign_recursive( GNode *dnode )
+{
+	PerfScope perf;
+	int64 num_nodes = 0;
+	int i;
+
+	if ((color_mode == COLOR_BY_TIMESTAMP) && !nodeattr_have( NODE_ATTR_TIMES )) {
+		/* Timestamps aren't kept by default. Nodes go by type
+		 * until they are read in */
+		if (color_hooks->message != NULL)
+			(color_hooks->message)( _("Reading timestamps..."), color_hooks_data );
+		nodeattr_require( NODE_ATTR_TIMES, times_ready_cb, NULL );
+	}
+
+	perfctr_begin( &perf, PERF_PHASE_COLOR );
+	assign_recursive( dnode );
+	for (i = 0; i < NUM_NODE_TYPES; i++)
+		num_nodes += DIR_NODE_DESC(dnode)->subtree.counts[i];
+	perfctr_end( &perf, num_nodes );
+}
+
+
 /* Changes the current color mode */
 void
 color_set_mode( ColorMode mode )
 {
 	color_mode = mode;
+	if (color_hooks->colors_changing != NULL)
+		(color_hooks->colors_changing)( color_hooks_data );
 	color_assign_recursive( globals.fstree );
-	redraw( );
+	if (color_hooks->colors_changed != NULL)
+		(color_hooks->colors_changed)( color_hooks_data );
 }
 
 
@@ -581,8 +643,9 @@ color_init( void )
 	/* Read configuration file */
 	color_read_config( );
 
-	/* Update radio menu in window with configured color mode */
-	window_set_color_mode( color_mode );
+	/* Let the user interface show the configured color mode */
+	if (color_hooks->mode_loaded != NULL)
+		(color_hooks->mode_loaded)( color_mode, color_hooks_data );
 
 	/* Generate spectrum color table */
 	generate_spectrum_colors( );
@@ -46,6 +46,22 @@ struct WPatternGroup {
 	GList *wp_list; /* elements: char * */
 };
 
+/* Callbacks from the coloring code. Any of them may be NULL. They are
+ * called with the data pointer given to color_set_hooks( ) */
+typedef struct _ColorHooks ColorHooks;
+struct _ColorHooks {
+	/* Node colors are about to be reassigned */
+	void	(*colors_changing)( void *data );
+	/* The contents of a directory have been given colors */
+	void	(*dir_colored)( GNode *dnode, void *data );
+	/* Node colors have been reassigned */
+	void	(*colors_changed)( void *data );
+	/* Status message (an empty string clears it) */
+	void	(*message)( const char *message, void *data );
+	/* The color mode was read from the configuration */
+	void	(*mode_loaded)( ColorMode mode, void *data );
+};
+
 struct ColorConfig {
 	/* Node type colors */
 	struct ColorByNodeType {
@@ -71,6 +87,7 @@ struct ColorConfig {
 };
 
 
+void color_set_hooks( const ColorHooks *hooks, void *data );
 void color_config_destroy( struct ColorConfig *ccfg );
 ColorMode color_get_mode( void );
 void color_get_config( struct ColorConfig *ccfg );
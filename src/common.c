@@ -17,7 +17,7 @@
 #include <unistd.h>
 #include <sys/time.h>
 
-#include "gui.h" /* gui_update( ) */
+#include "nodeattr.h" /* nodeattr_get( ) */
 
 /* Node type icon XPM files */
 #include "xmaps/folder.xpm"
@@ -294,6 +294,7 @@ const char *
 node_absname( GNode *node )
 {
 	static char *absname = NULL;
+	static int absname_size = 0;
 	GNode *up_node;
 	int len, absname_len = 0;
 	int i;
@@ -308,9 +309,11 @@ node_absname( GNode *node )
 		up_node = up_node->parent;
 	}
 
-	if (absname != NULL)
-		xfree( absname );
-	absname = NEW_ARRAY(char, absname_len);
+	/* Buffer only grows (this is called as the pointer moves across nodes) */
+	if (absname_len > absname_size) {
+		absname_size = MAX(absname_len, 2 * absname_size);
+		RESIZE(absname, absname_size, char);
+	}
 
 	/* Build up absolute name */
 	i = absname_len;
@@ -355,7 +358,7 @@ node_named( const char *absname )
 	 * doesn't exist */
 	root_name = node_absname( root_dnode );
 	len = strlen( root_name );
-	if (!strncmp( root_name, absname, len )) {
+	if (!strncmp( root_name, absname, len ) && ((len == 1) || (absname[len] == '\0') || (absname[len] == '/'))) {
 		if (len == 1) {
 			/* An exception for when root_name is "/"
 			 * (absname_partial_copy should begin either with
@@ -458,8 +461,9 @@ get_file_type_desc( const char *filename )
 			return cmd_output;
 		}
 
-		/* Keep the GUI responsive */
-		gui_update( );
+		/* Keep the GUI (if any) responsive */
+		while (g_main_context_pending( NULL ))
+			g_main_context_iteration( NULL, FALSE );
 	}
 	pclose( cmd );
 	cmd_output[i] = '\0';
@@ -648,6 +652,7 @@ get_node_info( GNode *node )
 		NULL,	/* target */
 		NULL	/* abstarget */
 	};
+	NodeAttrs attrs;
 	struct passwd *pw;
 	struct group *gr;
 	static char blank[] = "-";
@@ -679,15 +684,18 @@ get_node_info( GNode *node )
 	ninfo.size_alloc = xstrredup( ninfo.size_alloc, i64toa( NODE_DESC(node)->size_alloc ) );
 	ninfo.size_alloc_abbr = xstrredup( ninfo.size_alloc_abbr, abbrev_size( NODE_DESC(node)->size_alloc ) );
 
+	/* Ownership and timestamps (possibly read in just now) */
+	nodeattr_get( node, &attrs );
+
 	/* User name */
-	pw = getpwuid( NODE_DESC(node)->user_id );
+	pw = getpwuid( attrs.user_id );
 	if (pw == NULL)
 		cstr = _("Unknown");
 	else
 		cstr = pw->pw_name;
 	ninfo.user_name = xstrredup( ninfo.user_name, cstr );
 	/* Group name */
-	gr = getgrgid( NODE_DESC(node)->group_id );
+	gr = getgrgid( attrs.group_id );
 	if (gr == NULL)
 		cstr = _("Unknown");
 	else
@@ -695,11 +703,11 @@ get_node_info( GNode *node )
 	ninfo.group_name = xstrredup( ninfo.group_name, cstr );
 
 	/* Timestamps - remember to strip ctime's trailing newlines */
-	ninfo.atime = xstrredup( ninfo.atime, ctime( &NODE_DESC(node)->atime ) );
+	ninfo.atime = xstrredup( ninfo.atime, ctime( &attrs.atime ) );
         ninfo.atime[strlen( ninfo.atime ) - 1] = '\0';
-	ninfo.mtime = xstrredup( ninfo.mtime, ctime( &NODE_DESC(node)->mtime ) );
+	ninfo.mtime = xstrredup( ninfo.mtime, ctime( &attrs.mtime ) );
         ninfo.mtime[strlen( ninfo.mtime ) - 1] = '\0';
-	ninfo.ctime = xstrredup( ninfo.ctime, ctime( &NODE_DESC(node)->ctime ) );
+	ninfo.ctime = xstrredup( ninfo.ctime, ctime( &attrs.ctime ) );
 	ninfo.ctime[strlen( ninfo.ctime ) - 1] = '\0';
 
 	/* For directories: subtree size */
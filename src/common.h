@@ -54,6 +54,8 @@
 	#include "debug.h"
 #else
 	#define _xfree xfree
+	#define debug_alloc_exempt_begin( )
+	#define debug_alloc_exempt_end( )
 #endif
 
 
@@ -192,15 +194,21 @@ struct _NodeDesc {
 	const char	*name;		/* Base name (w/o directory) */
 	int64		size;		/* Size (bytes) */
 	int64		size_alloc;	/* Size allocation on storage medium */
-	uid_t		user_id;	/* Owner UID */
-	gid_t		group_id;	/* Group GID */
 	bitfield	perms : 10;	/* Permission flags */
 	bitfield	flags : 2;	/* Extra (mode-specific) flags */
+	const RGBcolor	*color;		/* Node color */
+	double		geomparams[5];	/* Geometry parameters */
+};
+
+/* Attributes which few features use, and so are not kept in the node
+ * descriptor. These live in optional columns (see nodeattr.c) */
+typedef struct _NodeAttrs NodeAttrs;
+struct _NodeAttrs {
+	uid_t		user_id;	/* Owner UID */
+	gid_t		group_id;	/* Group GID */
 	time_t		atime;		/* Last access time */
 	time_t		mtime;		/* Last modification time */
 	time_t		ctime;		/* Last attribute change time */
-	const RGBcolor	*color;		/* Node color */
-	double		geomparams[5];	/* Geometry parameters */
 };
 
 /* Directories have their own extended descriptor */
@@ -217,10 +225,25 @@ struct _DirNodeDesc {
 	} subtree;
 	/* Following pointer should be of type GtkTreePath */
 	void		*tnode;	/* Directory tree entry */
+	/* Following pointer is owned by the gpumem module */
+	void		*gpu_owner;	/* Retained GPU resources */
+	/* First of the small files that the layout has merged into one
+	 * "N small files" node (NULL if none), and how many there are */
+	GNode		*small_files;
+	unsigned int	num_small_files;
 	/* Flag: TRUE if directory geometry is being drawn expanded */
 	bitfield	geom_expanded : 1;
-	/* Flags: TRUE if geometry in needs to be rebuilt and reuploaded */
-	// TODO for VBO's
+	/* Flag: TRUE if retained geometry needs to be rebuilt and
+	 * reuploaded */
+	bitfield	geom_dirty : 1;
+	/* Flag: TRUE if the small files are to be shown individually */
+	bitfield	small_files_shown : 1;
+	/* Flag: TRUE if the directory did not respond during the scan,
+	 * and so was left empty */
+	bitfield	unavailable : 1;
+	/* Flag: TRUE if the directory was below the sampling depth, and so
+	 * was left empty, with an estimated subtree size (see sample.c) */
+	bitfield	estimated : 1;
 };
 
 /* Generalized node descriptor */
@@ -23,9 +23,14 @@
 #include "colexp.h"
 #include "color.h"
 #include "dirtree.h" /* dirtree_entry_expanded( ) */
+#include "extstats.h"
 #include "filelist.h" /* dir_contents_list_add( ) */
 #include "fsv.h"
 #include "gui.h"
+#include "nodeattr.h"
+#include "rescan.h"
+#include "sample.h"
+#include "selection.h"
 #include "window.h"
 
 /* OK/Cancel button XPM's */
@@ -69,33 +74,310 @@ transient_end_cb( Morph *morph )
 
 /**** File -> Change root... ****/
 
+/* The directories already in the tree are offered as they are, and
+ * choosing one of them re-roots the tree with no rescan. Paths outside
+ * of it are completed from the disk, asynchronously, so that a slow
+ * (networked) filesystem never holds up the dialog */
+
+/* Number of directory entries to read from disk at a time */
+#define CRDIALOG_LIST_BATCH	64
+
+static struct ChangeRootDialog {
+	GtkWidget *entry_w;
+	GtkWidget *status_label_w;
+
+	/* Completions for the entry (absolute directory names) */
+	GtkListStore *completions;
+
+	/* Directory whose subdirectories are the completions */
+	char *listed_dir;
+
+	/* Cancels the reading of listed_dir from disk, if under way */
+	GCancellable *cancellable;
+} crdialog;
+
+
+/* Adds a completion for the entry */
+static void
+crdialog_completion_add( const char *dir, const char *name )
+{
+	GtkTreeIter iter;
+	char *absname;
+
+	absname = g_build_filename( dir, name, NULL );
+	gtk_list_store_append( crdialog.completions, &iter );
+	gtk_list_store_set( crdialog.completions, &iter, 0, absname, -1 );
+	g_free( absname );
+}
+
+
+/* Callback for the reading of a directory from disk, with another batch
+ * of entries. The cancellable comes along as data (with a reference) */
+static void
+crdialog_next_files_cb( GObject *enumerator, GAsyncResult *result, gpointer cancellable )
+{
+	GFileInfo *info;
+	GList *info_list, *il_llink;
+	boolean more;
+
+	info_list = g_file_enumerator_next_files_finish( G_FILE_ENUMERATOR(enumerator), result, NULL );
+	more = (info_list != NULL) && !g_cancellable_is_cancelled( G_CANCELLABLE(cancellable) );
+
+	if (more) {
+		il_llink = info_list;
+		while (il_llink != NULL) {
+			info = G_FILE_INFO(il_llink->data);
+			if (g_file_info_get_file_type( info ) == G_FILE_TYPE_DIRECTORY)
+				crdialog_completion_add( crdialog.listed_dir, g_file_info_get_name( info ) );
+			il_llink = il_llink->next;
+		}
+		/* Let the popup catch up */
+		gtk_entry_completion_complete( gtk_entry_get_completion( GTK_ENTRY(crdialog.entry_w) ) );
+
+		g_file_enumerator_next_files_async( G_FILE_ENUMERATOR(enumerator), CRDIALOG_LIST_BATCH, G_PRIORITY_DEFAULT, G_CANCELLABLE(cancellable), crdialog_next_files_cb, cancellable );
+	}
+	else {
+		/* Done, failed or called off */
+		g_object_unref( enumerator );
+		g_object_unref( cancellable );
+	}
+
+	g_list_free_full( info_list, g_object_unref );
+}
+
+
+/* Callback for the opening of a directory on disk */
+static void
+crdialog_enumerate_cb( GObject *file, GAsyncResult *result, gpointer cancellable )
+{
+	GFileEnumerator *enumerator;
+
+	enumerator = g_file_enumerate_children_finish( G_FILE(file), result, NULL );
+	if ((enumerator == NULL) || g_cancellable_is_cancelled( G_CANCELLABLE(cancellable) )) {
+		if (enumerator != NULL)
+			g_object_unref( enumerator );
+		g_object_unref( cancellable );
+		return;
+	}
+
+	g_file_enumerator_next_files_async( enumerator, CRDIALOG_LIST_BATCH, G_PRIORITY_DEFAULT, G_CANCELLABLE(cancellable), crdialog_next_files_cb, cancellable );
+}
+
+
+/* Offers the subdirectories of the given (absolute) directory as
+ * completions. They come straight from the tree if the directory is in
+ * it, otherwise they are read from disk in the background */
+static void
+crdialog_list_dir( const char *dir )
+{
+	GNode *dnode, *node;
+	GFile *file;
+	char *dir_absname;
+
+	if ((crdialog.listed_dir != NULL) && !strcmp( dir, crdialog.listed_dir ))
+		return;
+
+	/* Call off whatever was being read before */
+	if (crdialog.cancellable != NULL) {
+		g_cancellable_cancel( crdialog.cancellable );
+		g_object_unref( crdialog.cancellable );
+		crdialog.cancellable = NULL;
+	}
+	gtk_list_store_clear( crdialog.completions );
+	xfree( crdialog.listed_dir );
+	crdialog.listed_dir = xstrdup( dir );
+
+	dnode = node_named( dir );
+	if ((dnode != NULL) && NODE_IS_DIR(dnode)) {
+		/* node_absname( ) returns a static buffer */
+		dir_absname = xstrdup( node_absname( dnode ) );
+		node = dnode->children;
+		while (node != NULL) {
+			if (!NODE_IS_DIR(node))
+				break;
+			crdialog_completion_add( dir_absname, NODE_DESC(node)->name );
+			node = node->next;
+		}
+		xfree( dir_absname );
+		return;
+	}
+
+	crdialog.cancellable = g_cancellable_new( );
+	file = g_file_new_for_path( dir );
+	g_file_enumerate_children_async( file, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE, G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT, crdialog.cancellable, crdialog_enumerate_cb, g_object_ref( crdialog.cancellable ) );
+	g_object_unref( file );
+}
+
+
+/* Returns the absolute name of the directory in the entry (relative
+ * names are taken from the current root). The string must be freed */
+static char *
+crdialog_entry_dir( void )
+{
+	char *root_name;
+	char *dir;
+
+	root_name = xstrdup( node_absname( root_dnode ) );
+	dir = g_canonicalize_filename( gtk_entry_get_text( GTK_ENTRY(crdialog.entry_w) ), root_name );
+	xfree( root_name );
+
+	return dir;
+}
+
+
+/* Callback for changes to the text in the entry */
+static void
+crdialog_entry_changed_cb( GtkEditable *unused, gpointer data_unused )
+{
+	GNode *node;
+	const char *text;
+	char *dir;
+
+	/* Complete within the directory being typed in */
+	text = gtk_entry_get_text( GTK_ENTRY(crdialog.entry_w) );
+	if (g_path_is_absolute( text )) {
+		if (g_str_has_suffix( text, "/" ))
+			dir = g_canonicalize_filename( text, NULL );
+		else
+			dir = g_path_get_dirname( text );
+		crdialog_list_dir( dir );
+		g_free( dir );
+	}
+
+	dir = crdialog_entry_dir( );
+	node = node_named( dir );
+	if ((node != NULL) && NODE_IS_DIR(node))
+		gtk_label_set_text( GTK_LABEL(crdialog.status_label_w), _("In the current tree (no rescan needed)") );
+	else
+		gtk_label_set_text( GTK_LABEL(crdialog.status_label_w), _("Not in the current tree (will be scanned)") );
+	g_free( dir );
+}
+
+
+/* Callback for selection of a directory in the tree */
+static void
+crdialog_tree_select_cb( GtkTreeSelection *selection, gpointer data_unused )
+{
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+	GNode *dnode;
+
+	if (!gtk_tree_selection_get_selected( selection, &model, &iter ))
+		return;
+
+	gtk_tree_model_get( model, &iter, DIRTREE_NODE_COLUMN, &dnode, -1 );
+	gui_entry_set_text( crdialog.entry_w, node_absname( dnode ) );
+	gtk_editable_set_position( GTK_EDITABLE(crdialog.entry_w), -1 );
+}
+
+
+/* Callback for the OK button (or Enter in the entry) */
+static void
+crdialog_ok_button_cb( GtkWidget *unused, GtkWidget *window_w )
+{
+	GNode *dnode;
+	char *dir;
+
+	dir = crdialog_entry_dir( );
+	dnode = node_named( dir );
+	if ((dnode != NULL) ? !NODE_IS_DIR(dnode) : !g_file_test( dir, G_FILE_TEST_IS_DIR )) {
+		gtk_label_set_text( GTK_LABEL(crdialog.status_label_w), _("Not a directory") );
+		g_free( dir );
+		return;
+	}
+
+	gtk_widget_destroy( window_w );
+
+	if (globals.fsv_mode != FSV_SPLASH) {
+		if (dnode != NULL)
+			fsv_reroot( dnode );
+		else
+			fsv_load( dir );
+	}
+
+	g_free( dir );
+}
+
+
+/* Cleanup for the change-root dialog */
+static void
+crdialog_destroy_cb( GtkWidget *unused, gpointer data_unused )
+{
+	if (crdialog.cancellable != NULL) {
+		g_cancellable_cancel( crdialog.cancellable );
+		g_object_unref( crdialog.cancellable );
+	}
+	g_object_unref( crdialog.completions );
+	xfree( crdialog.listed_dir );
+	memset( &crdialog, 0, sizeof(struct ChangeRootDialog) );
+}
+
+
 void
 dialog_change_root( void )
 {
+	GtkWidget *window_w;
+	GtkWidget *main_vbox_w;
+	GtkWidget *hbox_w;
+	GtkWidget *tree_w;
+	GtkEntryCompletion *completion;
+	GtkTreeSelection *selection;
+	GtkTreePath *root_tpath;
 	const char *root_name;
 	char *dir;
 
-	/* Build initial directory name (with trailing slash) */
+	window_w = gui_dialog_window( _("Change Root Directory"), NULL );
+	gui_window_modalize( window_w, main_window_w );
+	gtk_widget_set_size_request( window_w, 500, 400 );
+	main_vbox_w = gui_vbox_add( window_w, 5 );
+	gui_box_set_packing( main_vbox_w, NO_EXPAND, NO_FILL, AT_START );
+
+	/* The directories already scanned (sharing the directory tree's
+	 * model, but not its expansion state) */
+	gui_label_add( main_vbox_w, _("Directories in the current tree:") );
+	tree_w = gui_tree_add( main_vbox_w );
+	gtk_tree_view_set_model( GTK_TREE_VIEW(tree_w), dirtree_model( ) );
+	root_tpath = gtk_tree_path_new_first( );
+	gtk_tree_view_expand_row( GTK_TREE_VIEW(tree_w), root_tpath, FALSE );
+	gtk_tree_path_free( root_tpath );
+	selection = gtk_tree_view_get_selection( GTK_TREE_VIEW(tree_w) );
+	g_signal_connect( G_OBJECT(selection), "changed", G_CALLBACK(crdialog_tree_select_cb), NULL );
+
+	/* Directory name entry, starting at the current root (with a
+	 * trailing slash, to offer its subdirectories) */
 	root_name = node_absname( root_dnode );
 	dir = NEW_ARRAY(char, strlen( root_name ) + 2);
 	strcpy( dir, root_name );
-	strcat( dir, "/" );
+	if (strcmp( root_name, "/" ))
+		strcat( dir, "/" );
+	crdialog.entry_w = gui_entry_add( main_vbox_w, NULL, crdialog_ok_button_cb, window_w );
+	crdialog.completions = gtk_list_store_new( 1, G_TYPE_STRING );
+	completion = gtk_entry_completion_new( );
+	gtk_entry_completion_set_model( completion, GTK_TREE_MODEL(crdialog.completions) );
+	gtk_entry_completion_set_text_column( completion, 0 );
+	gtk_entry_set_completion( GTK_ENTRY(crdialog.entry_w), completion );
+	g_object_unref( completion );
+	crdialog.status_label_w = gui_label_add( main_vbox_w, NULL );
+	g_signal_connect( G_OBJECT(crdialog.entry_w), "changed", G_CALLBACK(crdialog_entry_changed_cb), NULL );
+	gui_entry_set_text( crdialog.entry_w, dir );
+	gtk_editable_set_position( GTK_EDITABLE(crdialog.entry_w), -1 );
+	xfree( dir );
 
-	/* On networked filesystems, the file selection window can be
-	 * sloooow in coming up (as each directory component in the default
-	 * location has to be stat( )'ed-- takes >10 sec on MIT AFS!) */
-	gui_cursor( main_window_w, GDK_WATCH );
-	gui_update( );
+	/* Horizontal box for OK and Cancel buttons */
+	hbox_w = gui_hbox_add( main_vbox_w, 0 );
+	gtk_box_set_homogeneous( GTK_BOX(hbox_w), TRUE );
+	gui_box_set_packing( hbox_w, EXPAND, FILL, AT_START );
 
-	gchar *new_root = gui_dir_choose(_("Change Root Directory"), main_window_w, dir);
-	xfree( dir );
-	if (new_root && globals.fsv_mode != FSV_SPLASH)
-		fsv_load(new_root);
+	/* OK and Cancel buttons */
+	gui_button_with_pixbuf_xpm_add(hbox_w, button_ok_xpm, _("OK"), crdialog_ok_button_cb, window_w);
+	gui_hbox_add( hbox_w, 0 ); /* spacer */
+	gui_button_with_pixbuf_xpm_add(hbox_w, button_cancel_xpm, _("Cancel"), close_cb, window_w);
 
-	g_free(new_root);
+	/* Some cleanup will be required once the window goes away */
+	g_signal_connect(G_OBJECT(window_w), "destroy", G_CALLBACK(crdialog_destroy_cb), NULL);
 
-	gui_cursor( main_window_w, -1 );
-	gui_update( );
+	gtk_widget_show( window_w );
+	gtk_widget_grab_focus( crdialog.entry_w );
 }
 
 
@@ -1077,6 +1359,7 @@ static void
 dialog_node_properties( GNode *node )
 {
 	const struct NodeInfo *node_info;
+	NodeAttrs attrs;
 	GtkWidget *window_w;
 	GtkWidget *main_vbox_w;
 	GtkWidget *notebook_w;
@@ -1091,6 +1374,7 @@ dialog_node_properties( GNode *node )
 	GtkWidget *list_w;
 	GtkWidget *entry_w;
 	GNode *target_node;
+	int64 size_error;
 	char strbuf[1024];
 	char *proptext;
 
@@ -1099,6 +1383,7 @@ dialog_node_properties( GNode *node )
 	gui_cursor( main_window_w, GDK_WATCH );
 	gui_update( );
 	node_info = get_node_info( node );
+	nodeattr_get( node, &attrs );
 	gui_cursor( main_window_w, GDK_X_CURSOR );
 
 	window_w = gui_dialog_window( _("Properties"), NULL );
@@ -1159,6 +1444,11 @@ dialog_node_properties( GNode *node )
 			sprintf( strbuf, " (%s)", node_info->subtree_size_abbr );
 			STRRECAT(proptext, strbuf);
 		}
+		if (sample_subtree_error( node, &size_error )) {
+			/* Part of the subtree was only sampled */
+			sprintf( strbuf, _(", estimated +/- %s"), abbrev_size( size_error ) );
+			STRRECAT(proptext, strbuf);
+		}
 	}
 	else {
 		/* Size */
@@ -1175,11 +1465,11 @@ dialog_node_properties( GNode *node )
 	}
 	STRRECAT(proptext, "\n\n");
 	/* Owner (user) */
-	sprintf( strbuf, _("%s (uid %u)"), node_info->user_name, NODE_DESC(node)->user_id );
+	sprintf( strbuf, _("%s (uid %u)"), node_info->user_name, attrs.user_id );
 	STRRECAT(proptext, strbuf);
 	STRRECAT(proptext, "\n");
 	/* Group */
-	sprintf( strbuf, _("%s (gid %u)"), node_info->group_name, NODE_DESC(node)->group_id );
+	sprintf( strbuf, _("%s (gid %u)"), node_info->group_name, attrs.group_id );
 	STRRECAT(proptext, strbuf);
 
 	hbox_w = gui_hbox_add( NULL, 8 );
@@ -1252,6 +1542,10 @@ dialog_node_properties( GNode *node )
 			sprintf( strbuf, " (%s)", node_info->subtree_size_abbr );
 			STRRECAT(proptext, strbuf);
 		}
+		if (sample_subtree_error( node, &size_error )) {
+			sprintf( strbuf, _(", estimated +/- %s"), abbrev_size( size_error ) );
+			STRRECAT(proptext, strbuf);
+		}
 		gui_label_add( vbox2_w, proptext );
                 break;
 
@@ -1329,6 +1623,290 @@ dialog_node_properties( GNode *node )
 }
 
 
+/* Helper function for dialog_selection_summary( ). Returns the
+ * modification time of a node, and its name, as a single string */
+static char *
+selection_time_text( GNode *node )
+{
+	NodeAttrs attrs;
+	char *text;
+
+	if (node == NULL) {
+		/* Timestamps are still being read in */
+		return xstrdup( _("(Reading timestamps...)\n") );
+	}
+
+	nodeattr_get( node, &attrs );
+	text = xstrdup( ctime( &attrs.mtime ) );
+	text[strlen( text ) - 1] = '\0'; /* strip ctime's newline */
+	STRRECAT(text, "\n(");
+	STRRECAT(text, NODE_DESC(node)->name);
+	STRRECAT(text, ")");
+
+	return text;
+}
+
+
+/* The Selection summary dialog, shown after a marquee selection */
+void
+dialog_selection_summary( void )
+{
+	const SelectionStats *stats;
+	GtkWidget *window_w;
+	GtkWidget *main_vbox_w;
+	GtkWidget *table_w;
+	GtkWidget *hbox_w;
+	GtkWidget *label_w;
+	GtkWidget *separator_w;
+	char strbuf[1024];
+	char *text;
+	char *time_text;
+	int i;
+
+	stats = selection_stats( );
+	if (stats->num_nodes == 0)
+		return;
+
+	/* Oldest/newest need timestamps. If they aren't in memory, start
+	 * reading them in, for the next selection */
+	nodeattr_require( NODE_ATTR_TIMES, NULL, NULL );
+
+	window_w = gui_dialog_window( _("Selection"), NULL );
+	gui_window_modalize( window_w, main_window_w );
+	main_vbox_w = gui_vbox_add( window_w, 10 );
+	table_w = gui_table_add( main_vbox_w, 5, 2, FALSE, 0 );
+
+	/* Total size */
+	hbox_w = gui_hbox_add( NULL, 8 );
+	label_w = gui_label_add( hbox_w, _("Total size:") );
+	gui_widget_packing( label_w, NO_EXPAND, NO_FILL, AT_END );
+	gui_table_attach( table_w, hbox_w, 0, 1, 0, 1 );
+	sprintf( strbuf, _("%s bytes"), i64toa( stats->size ) );
+	if (stats->size >= 1024) {
+		strcat( strbuf, " (" );
+		strcat( strbuf, abbrev_size( stats->size ) );
+		strcat( strbuf, ")" );
+	}
+	hbox_w = gui_hbox_add( NULL, 8 );
+	gui_label_add( hbox_w, strbuf );
+	gui_table_attach( table_w, hbox_w, 1, 2, 0, 1 );
+
+	separator_w = gui_separator_add( NULL );
+	gui_table_attach( table_w, separator_w, 0, 2, 1, 2 );
+
+	/* Node counts, by type */
+	text = xstrdup( "" );
+	for (i = 1; i < NUM_NODE_TYPES; i++) {
+		if (stats->counts[i] == 0)
+			continue;
+		if (strlen( text ) > 0)
+			STRRECAT(text, "\n");
+		sprintf( strbuf, "%s %s", i64toa( stats->counts[i] ), _(node_type_plural_names[i]) );
+		STRRECAT(text, strbuf);
+	}
+	hbox_w = gui_hbox_add( NULL, 8 );
+	label_w = gui_label_add( hbox_w, _("Contents:") );
+	gui_widget_packing( label_w, NO_EXPAND, NO_FILL, AT_END );
+	gui_table_attach( table_w, hbox_w, 0, 1, 2, 3 );
+	hbox_w = gui_hbox_add( NULL, 8 );
+	label_w = gui_label_add( hbox_w, text );
+	gtk_label_set_justify( GTK_LABEL(label_w), GTK_JUSTIFY_LEFT );
+	gui_table_attach( table_w, hbox_w, 1, 2, 2, 3 );
+	xfree( text );
+
+	separator_w = gui_separator_add( NULL );
+	gui_table_attach( table_w, separator_w, 0, 2, 3, 4 );
+
+	/* Oldest/newest modification times */
+	hbox_w = gui_hbox_add( NULL, 8 );
+	label_w = gui_label_add( hbox_w, _("Oldest:\n\n\nNewest:\n") );
+	gui_widget_packing( label_w, NO_EXPAND, NO_FILL, AT_END );
+	gtk_label_set_justify( GTK_LABEL(label_w), GTK_JUSTIFY_RIGHT );
+	gui_table_attach( table_w, hbox_w, 0, 1, 4, 5 );
+	text = selection_time_text( stats->oldest_node );
+	STRRECAT(text, "\n");
+	time_text = selection_time_text( stats->newest_node );
+	STRRECAT(text, time_text);
+	xfree( time_text );
+	hbox_w = gui_hbox_add( NULL, 8 );
+	label_w = gui_label_add( hbox_w, text );
+	gtk_label_set_justify( GTK_LABEL(label_w), GTK_JUSTIFY_LEFT );
+	gui_table_attach( table_w, hbox_w, 1, 2, 4, 5 );
+	xfree( text );
+
+	/* Close button */
+	gui_button_add( main_vbox_w, _("Close"), close_cb, window_w );
+
+	gtk_widget_show( window_w );
+}
+
+
+/* The report of paths that did not respond during the scan (and so
+ * were left out of the tree). Elements of the list are char * */
+void
+dialog_unreachable( GList *absname_list )
+{
+	GtkWidget *window_w;
+	GtkWidget *main_vbox_w;
+	GtkWidget *scrollwin_w;
+	GList *llink;
+	char *text;
+
+	window_w = gui_dialog_window( _("Unreachable Paths"), NULL );
+	gui_window_modalize( window_w, main_window_w );
+	gtk_widget_set_size_request( window_w, 420, 240 );
+	main_vbox_w = gui_vbox_add( window_w, 10 );
+	gui_box_set_packing( main_vbox_w, NO_EXPAND, NO_FILL, AT_START );
+
+	gui_label_add( main_vbox_w, _("These did not respond in time, and were left empty:") );
+
+	text = xstrdup( "" );
+	for (llink = absname_list; llink != NULL; llink = llink->next) {
+		STRRECAT(text, (char *)llink->data);
+		if (llink->next != NULL)
+			STRRECAT(text, "\n");
+	}
+	scrollwin_w = gtk_scrolled_window_new( NULL, NULL );
+	gtk_scrolled_window_set_policy( GTK_SCROLLED_WINDOW(scrollwin_w), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC );
+	gtk_box_pack_start( GTK_BOX(main_vbox_w), scrollwin_w, TRUE, TRUE, 0 );
+	gtk_widget_show( scrollwin_w );
+	gui_text_area_add( scrollwin_w, text );
+	xfree( text );
+
+	/* Close button */
+	gui_button_add( main_vbox_w, _("Close"), close_cb, window_w );
+
+	gtk_widget_show( window_w );
+}
+
+
+
+/**** Bytes by extension ****/
+
+/* Initial number of extensions to make color groups for */
+#define EXTDIALOG_DEFAULT_GROUPS	8
+
+static struct ExtStatsDialog {
+	GtkWidget *list_w;
+	GtkWidget *status_label_w;
+	GtkWidget *groups_spin_w;
+	GtkWidget *colorize_button_w;
+
+	/* Copy of the totals (the cached ones go away if the tree
+	 * changes while the dialog is up) */
+	ExtStats stats;
+} extdialog;
+
+
+/* Called once the totals for the directory are in */
+static void
+extdialog_ready_cb( GNode *dnode, const ExtStats *stats, void *data_unused )
+{
+	GtkListStore *store;
+	GtkTreeIter iter;
+	const char *ext_name;
+	char strbuf[1024];
+	int i;
+
+	extdialog.stats = *stats; /* struct assign */
+	extdialog.stats.exts = NEW_ARRAY(ExtStat, MAX(stats->num_exts, 1));
+	memcpy( extdialog.stats.exts, stats->exts, stats->num_exts * sizeof(ExtStat) );
+
+	store = GTK_LIST_STORE(gtk_tree_view_get_model( GTK_TREE_VIEW(extdialog.list_w) ));
+	for (i = 0; i < stats->num_exts; i++) {
+		ext_name = stats->exts[i].ext;
+		if (ext_name[0] == '\0')
+			ext_name = _("(none)");
+		gtk_list_store_append( store, &iter );
+		gtk_list_store_set( store, &iter, EXTSTATS_EXT_COLUMN, ext_name, EXTSTATS_COUNT_COLUMN, stats->exts[i].count, EXTSTATS_SIZE_TEXT_COLUMN, abbrev_size( stats->exts[i].size ), EXTSTATS_SIZE_COLUMN, stats->exts[i].size, -1 );
+	}
+
+	sprintf( strbuf, _("%u files, %s, in %d extensions"), stats->total_count, abbrev_size( stats->total_size ), stats->num_exts );
+	gtk_label_set_text( GTK_LABEL(extdialog.status_label_w), strbuf );
+	gtk_widget_set_sensitive( extdialog.colorize_button_w, stats->num_exts > 0 );
+}
+
+
+/* Callback for the "Color by extension" button. Replaces the wildcard
+ * color groups with ones made for the largest extensions */
+static void
+extdialog_colorize_cb( GtkWidget *unused, gpointer data_unused )
+{
+	struct ColorConfig color_config;
+	int num_groups;
+
+	num_groups = gtk_spin_button_get_value_as_int( GTK_SPIN_BUTTON(extdialog.groups_spin_w) );
+
+	color_get_config( &color_config );
+	color_config_destroy( &color_config );
+	color_config.by_wpattern.wpgroup_list = extstats_wpattern_groups( &extdialog.stats, num_groups );
+	color_set_config( &color_config, COLOR_BY_WPATTERN );
+	window_set_color_mode( COLOR_BY_WPATTERN );
+	color_config_destroy( &color_config );
+}
+
+
+/* Cleanup for the bytes-by-extension dialog */
+static void
+extdialog_destroy_cb( GtkWidget *unused, gpointer data_unused )
+{
+	/* Counting may still be under way */
+	extstats_cancel( );
+
+	if (extdialog.stats.exts != NULL)
+		xfree( extdialog.stats.exts );
+	memset( &extdialog, 0, sizeof(struct ExtStatsDialog) );
+}
+
+
+/* The bytes-by-extension dialog, for the subtree of a directory */
+void
+dialog_ext_stats( GNode *dnode )
+{
+	GtkWidget *window_w;
+	GtkWidget *main_vbox_w;
+	GtkWidget *hbox_w;
+	GtkTreeSortable *sortable;
+	char strbuf[1024];
+
+	window_w = gui_dialog_window( _("Bytes by Extension"), NULL );
+	gui_window_modalize( window_w, main_window_w );
+	gtk_widget_set_size_request( window_w, 360, 420 );
+	main_vbox_w = gui_vbox_add( window_w, 5 );
+	gui_box_set_packing( main_vbox_w, NO_EXPAND, NO_FILL, AT_START );
+
+	snprintf( strbuf, sizeof(strbuf), _("Subtree of %s"), node_absname( dnode ) );
+	gui_label_add( main_vbox_w, strbuf );
+
+	extdialog.list_w = gui_extstats_list_new( main_vbox_w );
+	sortable = GTK_TREE_SORTABLE(gtk_tree_view_get_model( GTK_TREE_VIEW(extdialog.list_w) ));
+	gtk_tree_sortable_set_sort_column_id( sortable, EXTSTATS_SIZE_COLUMN, GTK_SORT_DESCENDING );
+	extdialog.status_label_w = gui_label_add( main_vbox_w, _("Counting...") );
+
+	/* Color groups for the top N extensions */
+	hbox_w = gui_hbox_add( main_vbox_w, 5 );
+	gui_label_add( hbox_w, _("Top") );
+	extdialog.groups_spin_w = gtk_spin_button_new_with_range( 1.0, 64.0, 1.0 );
+	gtk_spin_button_set_value( GTK_SPIN_BUTTON(extdialog.groups_spin_w), EXTDIALOG_DEFAULT_GROUPS );
+	gtk_box_pack_start( GTK_BOX(hbox_w), extdialog.groups_spin_w, FALSE, FALSE, 0 );
+	gtk_widget_show( extdialog.groups_spin_w );
+	extdialog.colorize_button_w = gui_button_add( hbox_w, _("Color by extension"), extdialog_colorize_cb, NULL );
+	gtk_widget_set_sensitive( extdialog.colorize_button_w, FALSE );
+
+	/* Close button */
+	gui_button_add( main_vbox_w, _("Close"), close_cb, window_w );
+
+	/* Some cleanup will be required once the window goes away */
+	g_signal_connect(G_OBJECT(window_w), "destroy", G_CALLBACK(extdialog_destroy_cb), NULL);
+
+	gtk_widget_show( window_w );
+
+	/* (May call back right away, if the totals are cached) */
+	extstats_request( dnode, extdialog_ready_cb, NULL );
+}
+
+
+
 /**** Context-sensitive right-click menu ****/
 
 /* (I know, it's not a dialog, but where else to put this? :-) */
@@ -1357,6 +1935,22 @@ expand_recursive_cb( GtkWidget *unused, GNode *dnode )
 }
 
 
+/* ditto */
+static void
+rescan_cb( GtkWidget *unused, GNode *dnode )
+{
+	rescan( dnode );
+}
+
+
+/* ditto */
+static void
+ext_stats_cb( GtkWidget *unused, GNode *dnode )
+{
+	dialog_ext_stats( dnode );
+}
+
+
 /* ditto */
 static void
 look_at_cb( GtkWidget *unused, GNode *node )
@@ -1403,6 +1997,10 @@ context_menu( GNode *node, GdkEventButton *ev_button )
 	}
 	if (node != globals.current_node)
 		gui_menu_item_add( popup_menu_w, _("Look at"), look_at_cb, node );
+	if (NODE_IS_DIR(node)) {
+		gui_menu_item_add( popup_menu_w, _("Rescan"), rescan_cb, node );
+		gui_menu_item_add( popup_menu_w, _("Bytes by extension"), ext_stats_cb, node );
+	}
 	gui_menu_item_add( popup_menu_w, _("Properties"), properties_cb, node );
 
 	gtk_menu_popup_at_pointer(GTK_MENU(popup_menu_w), NULL);
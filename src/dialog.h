@@ -22,6 +22,9 @@ void context_menu( GNode *node, GdkEventButton *ev_button );
 void dialog_change_root( void );
 void dialog_color_setup( void );
 void dialog_help( void );
+void dialog_selection_summary( void );
+void dialog_ext_stats( GNode *dnode );
+void dialog_unreachable( GList *absname_list );
 
 
 /* end dialog.h */
@@ -195,6 +195,15 @@ dirtree_pass_widget( GtkWidget *tree_w )
 }
 
 
+/* Returns the model behind the directory tree (for sharing with other
+ * tree views) */
+GtkTreeModel *
+dirtree_model( void )
+{
+	return gtk_tree_view_get_model( GTK_TREE_VIEW(dir_tree_w) );
+}
+
+
 /* Clears out all entries from the directory tree */
 void
 dirtree_clear( void )
@@ -352,4 +361,139 @@ dirtree_entry_expand_recursive( GNode *dnode )
 }
 
 
+/* Helper function for dirtree_entry_rebuild( ). Notes which directories
+ * (that already have an entry) are expanded */
+static void
+note_expanded_recursive( GNode *dnode, GList **expanded_list )
+{
+	GNode *node;
+
+	if ((DIR_NODE_DESC(dnode)->tnode != NULL) && dirtree_entry_expanded( dnode ))
+		G_LIST_PREPEND(*expanded_list, dnode);
+
+	node = dnode->children;
+	while (node != NULL) {
+		if (!NODE_IS_DIR(node))
+			break;
+		note_expanded_recursive( node, expanded_list );
+		node = node->next;
+	}
+}
+
+
+/* Compare function for ordering entries the way the scan adds them */
+static int
+compare_name( GNode *a, GNode *b )
+{
+	return strcoll( NODE_DESC(a)->name, NODE_DESC(b)->name );
+}
+
+
+/* Helper function for dirtree_entry_rebuild( ). Adds entries for all
+ * directories below the given one */
+static void
+add_entries_recursive( GNode *dnode )
+{
+	GNode *node;
+	GList *dir_list = NULL, *dl_llink;
+
+	node = dnode->children;
+	while (node != NULL) {
+		if (!NODE_IS_DIR(node))
+			break;
+		G_LIST_PREPEND(dir_list, node);
+		node = node->next;
+	}
+	G_LIST_SORT(dir_list, compare_name);
+
+	dl_llink = dir_list;
+	while (dl_llink != NULL) {
+		node = (GNode *)dl_llink->data;
+		if (DIR_NODE_DESC(node)->tnode != NULL)
+			gtk_tree_path_free( DIR_NODE_DESC(node)->tnode );
+		dirtree_entry_new( node );
+		add_entries_recursive( node );
+		dl_llink = dl_llink->next;
+	}
+
+	g_list_free( dir_list );
+}
+
+
+/* Replaces all entries below that of the given directory, after its
+ * contents have changed. Entries are identified by position, so every
+ * one of them has to be redone. Directories that were expanded before
+ * (and still exist) are expanded again */
+void
+dirtree_entry_rebuild( GNode *dnode )
+{
+	GtkTreeModel *model;
+	GtkTreeStore *store;
+	GtkTreeIter parent_iter, iter;
+	GList *expanded_list = NULL, *el_llink;
+
+	g_assert( NODE_IS_DIR(dnode) );
+
+	note_expanded_recursive( dnode, &expanded_list );
+
+	/* Removing the child rows must not be taken as a collapse */
+	block_colexp_handlers( );
+	model = gtk_tree_view_get_model( GTK_TREE_VIEW(dir_tree_w) );
+	store = GTK_TREE_STORE(model);
+	gtk_tree_model_get_iter( model, &parent_iter, DIR_NODE_DESC(dnode)->tnode );
+	while (gtk_tree_model_iter_children( model, &iter, &parent_iter ))
+		gtk_tree_store_remove( store, &iter );
+	unblock_colexp_handlers( );
+
+	add_entries_recursive( dnode );
+
+	/* Outermost first, so that expand_to_path doesn't open up
+	 * anything that wasn't open before */
+	expanded_list = g_list_reverse( expanded_list );
+	el_llink = expanded_list;
+	while (el_llink != NULL) {
+		dirtree_entry_expand( (GNode *)el_llink->data );
+		el_llink = el_llink->next;
+	}
+	g_list_free( expanded_list );
+
+	/* File list may be showing stale contents */
+	dirtree_current_dnode = NULL;
+}
+
+
+/* Helper function for dirtree_rebuild( ) */
+static void
+forget_entries_recursive( GNode *dnode )
+{
+	GNode *node;
+
+	if (DIR_NODE_DESC(dnode)->tnode != NULL) {
+		gtk_tree_path_free( DIR_NODE_DESC(dnode)->tnode );
+		DIR_NODE_DESC(dnode)->tnode = NULL;
+	}
+
+	node = dnode->children;
+	while (node != NULL) {
+		if (!NODE_IS_DIR(node))
+			break;
+		forget_entries_recursive( node );
+		node = node->next;
+	}
+}
+
+
+/* Replaces all entries in the directory tree, after the root directory
+ * has changed */
+void
+dirtree_rebuild( void )
+{
+	forget_entries_recursive( root_dnode );
+	dirtree_clear( );
+	dirtree_entry_new( root_dnode );
+	add_entries_recursive( root_dnode );
+	dirtree_no_more_entries( );
+}
+
+
 /* end dirtree.c */
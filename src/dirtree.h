@@ -18,9 +18,12 @@
 
 #ifdef __GTK_H__
 void dirtree_pass_widget( GtkWidget *tree_w );
+GtkTreeModel *dirtree_model( void );
 #endif
 void dirtree_clear( void );
 void dirtree_entry_new( GNode *dnode );
+void dirtree_entry_rebuild( GNode *dnode );
+void dirtree_rebuild( void );
 void dirtree_no_more_entries( void );
 void dirtree_entry_show( GNode *dnode );
 boolean dirtree_entry_expanded( GNode *dnode );
@@ -0,0 +1,446 @@
+/* extstats.c */
+
+/* Bytes and counts by filename extension */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "extstats.h"
+
+#include "color.h"
+#include "profile.h"
+#include "task.h"
+
+
+/* Totals are gathered in a single pass over the names and sizes of the
+ * files in a subtree, one job per directory on the task pool. Each job
+ * tallies its files in a private hash table, and hands back one entry
+ * per extension, keyed by the interned extension string; the main thread
+ * then sums those up from the bottom of the subtree. Every directory's
+ * totals are cached along the way, so looking at any part of a subtree
+ * already counted costs nothing. The cache goes whenever the tree
+ * changes. All state is main-thread only */
+
+
+/* Unit of work: tallying the files of one directory. Names and sizes
+ * are copied in, so that the tree is free to change (or go away) while
+ * the job is in flight */
+struct ExtStatsJob {
+	unsigned int	generation;	/* Request this belongs to */
+	GNode		*dnode;		/* (never looked at off the main thread) */
+	int		num_files;
+	char		*name_buf;	/* Names, one after another */
+	int64		*sizes;
+	ExtStat		*exts;		/* Results */
+	int		num_exts;
+};
+
+
+static struct {
+	/* Totals by directory (elements: ExtStats *) */
+	GHashTable	*cache;
+
+	/* Request in progress */
+	GNode		*dnode;
+	ExtStatsReadyFunc ready_cb;
+	void		*data;
+	TaskCancel	*cancel;
+	unsigned int	generation;
+	int		pending;	/* Jobs not yet done */
+	GHashTable	*done_jobs;	/* Directory -> struct ExtStatsJob */
+} ext;
+
+
+/* Returns the extension of a filename (the part after the last period),
+ * or an empty string if there is none. Leading periods, as in dotfiles,
+ * do not count, and neither does a trailing one. The string returned
+ * points into the name */
+const char *
+extstats_extension( const char *name )
+{
+	const char *dot;
+
+	dot = strrchr( name, '.' );
+	if ((dot == NULL) || (dot == name) || (dot[1] == '\0'))
+		return "";
+
+	return dot + 1;
+}
+
+
+/* Orders extension totals by size (largest first), then by count */
+static int
+compare_ext_stat( const ExtStat *a, const ExtStat *b )
+{
+	if (a->size != b->size)
+		return (a->size < b->size) ? 1 : -1;
+	if (a->count != b->count)
+		return (a->count < b->count) ? 1 : -1;
+
+	return strcmp( a->ext, b->ext );
+}
+
+
+/* Work function (runs on a pool thread) */
+static void
+count_task( void *data, TaskCancel *cancel )
+{
+	struct ExtStatsJob *job = (struct ExtStatsJob *)data;
+	GHashTable *index;
+	ExtStat *stat;
+	const char *name, *extension;
+	int i, n;
+
+	if (task_cancelled( cancel ))
+		return;
+
+	/* Values are indexes into job->exts, plus one */
+	index = g_hash_table_new( g_str_hash, g_str_equal );
+	job->exts = g_new( ExtStat, job->num_files );
+
+	name = job->name_buf;
+	for (i = 0; i < job->num_files; i++) {
+		extension = extstats_extension( name );
+		n = GPOINTER_TO_INT(g_hash_table_lookup( index, extension ));
+		if (n == 0) {
+			stat = &job->exts[job->num_exts++];
+			stat->ext = extension;
+			stat->size = 0;
+			stat->count = 0;
+			g_hash_table_insert( index, (char *)extension, GINT_TO_POINTER(job->num_exts) );
+		}
+		else
+			stat = &job->exts[n - 1];
+		stat->size += job->sizes[i];
+		++stat->count;
+		name += strlen( name ) + 1;
+	}
+	g_hash_table_destroy( index );
+
+	/* Only now are the (few) distinct extensions interned, as that
+	 * takes a global lock */
+	for (i = 0; i < job->num_exts; i++)
+		job->exts[i].ext = g_intern_string( job->exts[i].ext );
+
+	profile_count( "extstats.files", job->num_files );
+}
+
+
+/* Frees a job and its results */
+static void
+job_free( struct ExtStatsJob *job )
+{
+	g_free( job->name_buf );
+	g_free( job->sizes );
+	g_free( job->exts );
+	g_free( job );
+}
+
+
+/* Frees a cached set of totals */
+static void
+ext_stats_free( ExtStats *stats )
+{
+	xfree( stats->exts );
+	xfree( stats );
+}
+
+
+/* Adds extension totals into a merge table (interned extension ->
+ * ExtStat *) */
+static void
+merge_in( GHashTable *merge, const ExtStat *exts, int num_exts )
+{
+	ExtStat *stat;
+	int i;
+
+	for (i = 0; i < num_exts; i++) {
+		stat = (ExtStat *)g_hash_table_lookup( merge, exts[i].ext );
+		if (stat == NULL) {
+			stat = NEW(ExtStat);
+			stat->ext = exts[i].ext;
+			stat->size = 0;
+			stat->count = 0;
+			g_hash_table_insert( merge, (char *)stat->ext, stat );
+		}
+		stat->size += exts[i].size;
+		stat->count += exts[i].count;
+	}
+}
+
+
+/* Helper function for finish_request( ). Sums up (and caches) the
+ * totals of a directory, from those of its own files and of its
+ * subdirectories */
+static ExtStats *
+sum_recursive( GNode *dnode )
+{
+	struct ExtStatsJob *job;
+	ExtStats *stats, *sub_stats;
+	GHashTable *merge;
+	GHashTableIter iter;
+	GNode *node;
+	ExtStat *stat;
+	int i;
+
+	stats = (ExtStats *)g_hash_table_lookup( ext.cache, dnode );
+	if (stats != NULL)
+		return stats;
+
+	merge = g_hash_table_new( NULL, NULL );
+	job = (struct ExtStatsJob *)g_hash_table_lookup( ext.done_jobs, dnode );
+	if (job != NULL)
+		merge_in( merge, job->exts, job->num_exts );
+
+	/* Directories come first */
+	for (node = dnode->children; node != NULL; node = node->next) {
+		if (!NODE_IS_DIR(node))
+			break;
+		sub_stats = sum_recursive( node );
+		merge_in( merge, sub_stats->exts, sub_stats->num_exts );
+	}
+
+	stats = NEW(ExtStats);
+	stats->num_exts = g_hash_table_size( merge );
+	stats->exts = NEW_ARRAY(ExtStat, MAX(stats->num_exts, 1));
+	stats->total_size = 0;
+	stats->total_count = 0;
+	i = 0;
+	g_hash_table_iter_init( &iter, merge );
+	while (g_hash_table_iter_next( &iter, NULL, (gpointer *)&stat )) {
+		stats->exts[i++] = *stat; /* struct assign */
+		stats->total_size += stat->size;
+		stats->total_count += stat->count;
+		xfree( stat );
+	}
+	g_hash_table_destroy( merge );
+	qsort( stats->exts, stats->num_exts, sizeof(ExtStat), (int (*)( const void *, const void * ))compare_ext_stat );
+
+	g_hash_table_insert( ext.cache, dnode, stats );
+
+	return stats;
+}
+
+
+/* Wraps up the request once all of its jobs are done */
+static void
+finish_request( void )
+{
+	ExtStatsReadyFunc ready_cb;
+	GHashTableIter iter;
+	struct ExtStatsJob *job;
+	ExtStats *stats;
+	GNode *dnode;
+	void *data;
+
+	stats = sum_recursive( ext.dnode );
+
+	g_hash_table_iter_init( &iter, ext.done_jobs );
+	while (g_hash_table_iter_next( &iter, NULL, (gpointer *)&job ))
+		job_free( job );
+	g_hash_table_remove_all( ext.done_jobs );
+	task_cancel_unref( ext.cancel );
+	ext.cancel = NULL;
+
+	/* The callback may well make another request */
+	dnode = ext.dnode;
+	ready_cb = ext.ready_cb;
+	data = ext.data;
+	ext.dnode = NULL;
+	ext.ready_cb = NULL;
+	(ready_cb)( dnode, stats, data );
+}
+
+
+/* Completion callback (runs on the main thread) */
+static void
+count_done_cb( void *data, boolean cancelled )
+{
+	struct ExtStatsJob *job = (struct ExtStatsJob *)data;
+
+	if (cancelled || (job->generation != ext.generation)) {
+		job_free( job );
+		return;
+	}
+
+	g_hash_table_insert( ext.done_jobs, job->dnode, job );
+	if (--ext.pending == 0)
+		finish_request( );
+}
+
+
+/* Submits jobs for every directory in a subtree that does not yet have
+ * its totals cached */
+static void
+submit_recursive( GNode *dnode )
+{
+	struct ExtStatsJob *job;
+	GNode *node, *first_file = NULL;
+	size_t buf_size = 0, len;
+	char *p;
+	int i;
+
+	if (g_hash_table_lookup( ext.cache, dnode ) != NULL)
+		return;
+
+	/* Directories come first */
+	for (node = dnode->children; node != NULL; node = node->next) {
+		if (!NODE_IS_DIR(node)) {
+			first_file = node;
+			break;
+		}
+		submit_recursive( node );
+	}
+	if (first_file == NULL)
+		return;
+
+	job = g_new0( struct ExtStatsJob, 1 );
+	job->generation = ext.generation;
+	job->dnode = dnode;
+	for (node = first_file; node != NULL; node = node->next) {
+		++job->num_files;
+		buf_size += strlen( NODE_DESC(node)->name ) + 1;
+	}
+	job->name_buf = g_malloc( buf_size );
+	job->sizes = g_new( int64, job->num_files );
+
+	p = job->name_buf;
+	i = 0;
+	for (node = first_file; node != NULL; node = node->next) {
+		len = strlen( NODE_DESC(node)->name ) + 1;
+		memcpy( p, NODE_DESC(node)->name, len );
+		p += len;
+		job->sizes[i++] = NODE_DESC(node)->size;
+	}
+
+	++ext.pending;
+	task_submit( TASK_QUEUE_SEARCH, TASK_PRIORITY_NORMAL, ext.cancel, count_task, count_done_cb, job );
+}
+
+
+/* Asks for the totals of the given directory's subtree. The callback
+ * happens right away if they are already cached, otherwise once they
+ * have been counted up. Only one request is served at a time; a new one
+ * replaces whatever is in progress */
+void
+extstats_request( GNode *dnode, ExtStatsReadyFunc ready_cb, void *data )
+{
+	ExtStats *stats;
+
+	g_assert( NODE_IS_DIR(dnode) );
+
+	extstats_cancel( );
+
+	if (ext.cache == NULL) {
+		ext.cache = g_hash_table_new_full( NULL, NULL, NULL, (GDestroyNotify)ext_stats_free );
+		ext.done_jobs = g_hash_table_new( NULL, NULL );
+	}
+
+	stats = (ExtStats *)g_hash_table_lookup( ext.cache, dnode );
+	if (stats != NULL) {
+		(ready_cb)( dnode, stats, data );
+		return;
+	}
+
+	ext.dnode = dnode;
+	ext.ready_cb = ready_cb;
+	ext.data = data;
+	ext.cancel = task_cancel_new( );
+	ext.pending = 0;
+	submit_recursive( dnode );
+	if (ext.pending == 0) {
+		/* Nothing to count that isn't cached already */
+		finish_request( );
+	}
+}
+
+
+/* Calls off the request in progress (if any). Its callback will not
+ * happen */
+void
+extstats_cancel( void )
+{
+	GHashTableIter iter;
+	struct ExtStatsJob *job;
+
+	if (ext.cancel == NULL)
+		return;
+
+	task_cancel( ext.cancel );
+	task_cancel_unref( ext.cancel );
+	ext.cancel = NULL;
+	/* Stragglers are recognized by their generation */
+	++ext.generation;
+	ext.pending = 0;
+	ext.dnode = NULL;
+	ext.ready_cb = NULL;
+
+	g_hash_table_iter_init( &iter, ext.done_jobs );
+	while (g_hash_table_iter_next( &iter, NULL, (gpointer *)&job ))
+		job_free( job );
+	g_hash_table_remove_all( ext.done_jobs );
+}
+
+
+/* Throws out all totals. Called whenever the tree changes */
+void
+extstats_reset( void )
+{
+	extstats_cancel( );
+	if (ext.cache != NULL)
+		g_hash_table_remove_all( ext.cache );
+}
+
+
+/* Returns a newly allocated wildcard pattern group list (as used in
+ * struct ColorConfig) for the largest extensions in the given totals,
+ * one group per extension, with colors spread across the rainbow */
+GList *
+extstats_wpattern_groups( const ExtStats *stats, int max_groups )
+{
+	struct WPatternGroup *wpgroup;
+	GList *wpgroup_list = NULL;
+	const char *c;
+	char *wpattern, *p;
+	int num_groups = 0, n = 0;
+	int i;
+
+	for (i = 0; i < stats->num_exts; i++) {
+		if (stats->exts[i].ext[0] != '\0')
+			++num_groups;
+	}
+	num_groups = MIN(num_groups, max_groups);
+
+	for (i = 0; n < num_groups; i++) {
+		if (stats->exts[i].ext[0] == '\0')
+			continue;
+
+		/* "*.ext", with any wildcard characters in the extension
+		 * escaped */
+		wpattern = NEW_ARRAY(char, 2 * strlen( stats->exts[i].ext ) + 3);
+		strcpy( wpattern, "*." );
+		p = wpattern + 2;
+		for (c = stats->exts[i].ext; *c != '\0'; c++) {
+			if (strchr( "*?[]\\", *c ) != NULL)
+				*p++ = '\\';
+			*p++ = *c;
+		}
+		*p = '\0';
+
+		wpgroup = NEW(struct WPatternGroup);
+		wpgroup->color = color_spectrum_color( SPECTRUM_RAINBOW, (num_groups > 1) ? (double)n / (double)(num_groups - 1) : 0.0, NULL );
+		wpgroup->wp_list = NULL;
+		G_LIST_APPEND(wpgroup->wp_list, wpattern);
+		G_LIST_APPEND(wpgroup_list, wpgroup);
+		++n;
+	}
+
+	return wpgroup_list;
+}
+
+
+/* end extstats.c */
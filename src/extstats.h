@@ -0,0 +1,45 @@
+/* extstats.h */
+
+/* Bytes and counts by filename extension */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_EXTSTATS_H
+	#error
+#endif
+#define FSV_EXTSTATS_H
+
+
+/* Totals for one extension */
+typedef struct _ExtStat ExtStat;
+struct _ExtStat {
+	const char	*ext;		/* Interned; "" if none */
+	int64		size;
+	unsigned int	count;
+};
+
+/* Totals for a subtree, largest extension first */
+typedef struct _ExtStats ExtStats;
+struct _ExtStats {
+	ExtStat		*exts;
+	int		num_exts;
+	int64		total_size;
+	unsigned int	total_count;
+};
+
+/* Called (on the main thread) once the totals for a directory are in */
+typedef void (*ExtStatsReadyFunc)( GNode *dnode, const ExtStats *stats, void *data );
+
+
+const char *extstats_extension( const char *name );
+void extstats_request( GNode *dnode, ExtStatsReadyFunc ready_cb, void *data );
+void extstats_cancel( void );
+void extstats_reset( void );
+GList *extstats_wpattern_groups( const ExtStats *stats, int max_groups );
+
+
+/* end extstats.h */
@@ -222,6 +222,21 @@ filelist_show_entry( GNode *node )
 }
 
 
+/* Returns TRUE if the file list is showing the contents of the given
+ * directory, or of any directory below it */
+boolean
+filelist_showing_subtree( GNode *dnode )
+{
+	if (filelist_current_dnode == NULL)
+		return FALSE;
+
+	if (filelist_current_dnode == dnode)
+		return TRUE;
+
+	return g_node_is_ancestor( dnode, filelist_current_dnode );
+}
+
+
 /* Callback for a click in the file list area */
 static void
 filelist_select_cb(GtkTreeSelection *selection, gpointer data)
@@ -351,7 +366,7 @@ filelist_scan_monitor_init( void )
 
 /* Updates the scan-monitoring file list with the given values */
 void
-filelist_scan_monitor( int *node_counts, int64 *size_counts )
+filelist_scan_monitor( const int *node_counts, const int64 *size_counts )
 {
 	int64 size_total = 0;
 	int node_total = 0;
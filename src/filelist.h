@@ -22,9 +22,10 @@ GtkWidget *dir_contents_list( GNode *dnode );
 void filelist_reset_access( void );
 void filelist_populate( GNode *dnode );
 void filelist_show_entry( GNode *node );
+boolean filelist_showing_subtree( GNode *dnode );
 void filelist_init( void );
 void filelist_scan_monitor_init( void );
-void filelist_scan_monitor( int *node_counts, int64 *size_counts );
+void filelist_scan_monitor( const int *node_counts, const int64 *size_counts );
 
 
 /* end filelist.h */
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: Zlib
+
+#version 140
+
+// Expands node name labels into glyph quads. Each instance is one label;
+// vertices 6*i .. 6*i+5 make up the quad for character i. Vertices past
+// the end of the name collapse to a point, and are not rasterized.
+
+// Label records, three texels per label:
+//   (anchor.xyz, kind), (max_dims.xy, node ID low/high 16 bits) and
+//   (color.rgb, transform)
+// kind 0: straight, anchor is (x, y, z), max_dims is (width, depth)
+// kind 1: rotated, anchor is (r, theta, z), max_dims is (width, depth)
+// kind 2: curved, anchor is (r, theta, z) of the outer edge, max_dims is
+//         (depth, arc width)
+uniform samplerBuffer labels;
+// Per node ID: (offset into names, length)
+uniform usamplerBuffer name_index;
+// All node names, back to back
+uniform usamplerBuffer names;
+// MVP matrices, four texels (columns) each
+uniform samplerBuffer transforms;
+
+// Index of the record for instance 0 (each length bucket is drawn
+// separately)
+uniform int first_label;
+// Glyph size in the font texture (texture coordinates)
+uniform vec2 glyph_size;
+
+out vec2 Texcoord;
+out vec3 Color;
+
+// Glyph width / height
+const float char_aspect_ratio = 0.5;
+// Text can be squeezed to at most half its normal width
+const float text_max_squeeze = 2.0;
+
+// Corners of the two triangles of a quad: LL LR UL, UL LR UR
+const vec2 corners[6] = vec2[6](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0),
+                                vec2(0.0, 1.0), vec2(1.0, 0.0), vec2(1.0, 1.0));
+
+
+// Dimensions of each character, given the length of the string and the
+// dimensions it has to fit in (cf. get_char_dims() in tmaptext.c)
+vec2 char_dims(float len, vec2 max_dims) {
+  float max_width = len * max_dims.y * char_aspect_ratio;
+  float min_width = max_width / text_max_squeeze;
+
+  if (max_width > max_dims.x) {
+    float w = max_dims.x / len;
+    if (min_width > max_dims.x)
+      return vec2(w, text_max_squeeze * w / char_aspect_ratio);
+    return vec2(w, max_dims.y);
+  }
+  return vec2(max_dims.y * char_aspect_ratio, max_dims.y);
+}
+
+
+void main() {
+  int l = first_label + gl_InstanceID;
+  vec4 rec0 = texelFetch(labels, 3 * l);
+  vec4 rec1 = texelFetch(labels, 3 * l + 1);
+  vec4 rec2 = texelFetch(labels, 3 * l + 2);
+  int id = int(rec1.z) + (int(rec1.w) << 16);
+  uvec2 name = texelFetch(name_index, id).xy;
+  int i = gl_VertexID / 6;
+
+  if (i >= int(name.y)) {
+    gl_Position = vec4(0.0);
+    Texcoord = vec2(0.0);
+    Color = vec3(0.0);
+    return;
+  }
+
+  vec2 corner = corners[gl_VertexID % 6];
+  float len = float(name.y);
+  int kind = int(rec0.w);
+  vec2 xy;
+
+  if (kind == 2) {
+    // Curved
+    float r = rec0.x;
+    vec2 cdims = char_dims(len, vec2(radians(rec1.y) * r, rec1.x));
+    float text_r = r - 0.5 * cdims.y;
+    float char_arc_width = cdims.x / text_r;
+    float theta = radians(rec0.y) + (0.5 * (len - 1.0) - float(i)) * char_arc_width;
+    vec2 dir = vec2(cos(theta), sin(theta));
+    vec2 across = cdims.x * vec2(dir.y, -dir.x);
+    xy = text_r * dir + (corner.x - 0.5) * across + (corner.y - 0.5) * cdims.y * dir;
+  } else if (kind == 1) {
+    // Rotated
+    vec2 cdims = char_dims(len, rec1.xy);
+    vec2 dir = vec2(cos(radians(rec0.y)), sin(radians(rec0.y)));
+    vec2 hdelta = cdims.x * vec2(dir.y, -dir.x);
+    vec2 vdelta = cdims.y * dir;
+    xy = rec0.x * dir - 0.5 * (len * hdelta + vdelta) + (float(i) + corner.x) * hdelta + corner.y * vdelta;
+  } else {
+    // Straight
+    vec2 cdims = char_dims(len, rec1.xy);
+    xy = rec0.xy + vec2((float(i) + corner.x - 0.5 * len) * cdims.x, (corner.y - 0.5) * cdims.y);
+  }
+  int t = 4 * int(rec2.w);
+  mat4 mvp = mat4(texelFetch(transforms, t), texelFetch(transforms, t + 1),
+                  texelFetch(transforms, t + 2), texelFetch(transforms, t + 3));
+  gl_Position = mvp * vec4(xy, rec0.z, 1.0);
+  Color = rec2.rgb;
+
+  // Glyph in the font texture (32 glyphs per row, starting at ' ')
+  int g = int(texelFetch(names, int(name.x) + i).r);
+  if (g < 32 || g > 127)
+    g = 63; // question mark
+  vec2 t_c0 = vec2(float((g - 32) & 31), float((g - 32) >> 5)) * glyph_size;
+  Texcoord = t_c0 + vec2(corner.x, 1.0 - corner.y) * glyph_size;
+}
@@ -3,13 +3,13 @@
 #version 140
 
 in vec2 Texcoord;
+in vec3 Color;
 
-uniform vec3 color;
 uniform sampler2D tex;
 
 out vec4 outputColor;
 
 void main() {
   vec4 alpha = texture(tex, Texcoord);
-  outputColor = vec4(color, alpha.r);
+  outputColor = vec4(Color, alpha.r);
 }
@@ -5,10 +5,13 @@
 in vec3 position;
 in vec2 texcoord;
 out vec2 Texcoord;
+out vec3 Color;
 
 uniform mat4 mvp;
+uniform vec3 color;
 
 void main() {
   gl_Position = mvp * vec4(position, 1.0);
   Texcoord = texcoord;
+  Color = color;
 }
@@ -4,22 +4,55 @@
 
 in vec3 position;
 in vec3 normal;
+// Per-vertex node color and ID color (retained geometry only)
+in vec4 node_color;
+in vec4 node_id;
 
 out vec3 fragPos;
 out vec3 fragNormal;
 out vec4 lightPos;
+flat out vec4 vertColor;
 
 uniform mat4 mvp;
 uniform mat4 modelview;
 uniform mat3 normal_matrix;
 uniform vec4 light_pos;
 uniform bool lightning_enabled;
+// 0: use color uniform, 1: use node_color, 2: use node_id (selection)
+uniform int vertex_color_mode;
+// ID color of the highlighted node
+uniform vec4 highlight_id;
+// Selection mask, one texel per node ID (nonzero == selected)
+uniform samplerBuffer selection_mask;
+uniform bool selection_enabled;
+// Color that selected nodes are tinted toward
+const vec3 selection_tint = vec3(1.0, 1.0, 0.5);
+
+
+bool is_selected(vec4 id_color) {
+  ivec3 id_bytes = ivec3(id_color.rgb * 255.0 + 0.5);
+  int id = id_bytes.r + (id_bytes.g << 8) + (id_bytes.b << 16);
+  if (id >= textureSize(selection_mask))
+    return false;
+  return texelFetch(selection_mask, id).r > 0.0;
+}
 
 
 void main() {
   vec4 pos = vec4(position, 1.0);
   gl_Position = mvp * pos;
 
+  if (vertex_color_mode == 1) {
+    vertColor = node_color;
+    if (selection_enabled && is_selected(node_id))
+      vertColor.rgb = mix(vertColor.rgb, selection_tint, 0.5);
+    if (all(lessThan(abs(node_id.rgb - highlight_id.rgb), vec3(0.5 / 255.0))))
+      vertColor.rgb *= 1.3;
+  } else if (vertex_color_mode == 2)
+    vertColor = vec4(node_id.rgb, 1.0);
+  else
+    vertColor = vec4(0.0);
+
   if (lightning_enabled) {
     lightPos = modelview * light_pos;
 
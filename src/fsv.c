@@ -20,10 +20,25 @@
 #include "animation.h"
 #include "camera.h"
 #include "color.h" /* color_init( ) */
+#include "dialog.h" /* dialog_unreachable( ) */
+#include "dirtree.h"
 #include "filelist.h"
 #include "geometry.h"
+#include "gpumem.h" /* gpumem_set_budget( ) */
 #include "gui.h" /* gui_update( ) */
+#include "layout.h" /* layout_set_hooks( ), layout_set_small_files( ) */
+#include "mempressure.h"
+#include "metrics.h" /* metrics_serve( ) */
+#include "nodeattr.h" /* nodeattr_set_kept( ) */
+#include "perfctr.h" /* perfctr_enable( ) */
+#include "rescan.h" /* rescan_cancel_all( ) */
+#include "sample.h"
 #include "scanfs.h"
+#include "selection.h" /* selection_clear( ) */
+#include "snapshot.h"
+#include "task.h"
+#include "tiles.h" /* tiles_export( ) */
+#include "viewport.h" /* viewport_pass_node_table( ) */
 #include "window.h"
 
 
@@ -34,6 +49,17 @@ enum {
 	OPT_TREEV,
 	OPT_CACHEDIR,
 	OPT_NOCACHE,
+	OPT_THREADS,
+	OPT_GPU_BUDGET,
+	OPT_MEM_BUDGET,
+	OPT_KEEP_ATTRS,
+	OPT_PERF_COUNTERS,
+	OPT_SAMPLE_DEPTH,
+	OPT_SAVE_SNAPSHOT,
+	OPT_SMALL_FILES,
+	OPT_STAT_TIMEOUT,
+	OPT_METRICS,
+	OPT_EXPORT_TILES,
 	OPT_HELP
 };
 
@@ -48,6 +74,17 @@ static struct option cli_opts[] = {
 	{ "treev", no_argument, NULL, OPT_TREEV },
 	{ "cachedir", required_argument, NULL, OPT_CACHEDIR },
 	{ "nocache", no_argument, NULL, OPT_NOCACHE },
+	{ "threads", required_argument, NULL, OPT_THREADS },
+	{ "gpu-budget", required_argument, NULL, OPT_GPU_BUDGET },
+	{ "mem-budget", required_argument, NULL, OPT_MEM_BUDGET },
+	{ "keep-attrs", no_argument, NULL, OPT_KEEP_ATTRS },
+	{ "perf-counters", no_argument, NULL, OPT_PERF_COUNTERS },
+	{ "sample-depth", required_argument, NULL, OPT_SAMPLE_DEPTH },
+	{ "save-snapshot", required_argument, NULL, OPT_SAVE_SNAPSHOT },
+	{ "small-files", required_argument, NULL, OPT_SMALL_FILES },
+	{ "stat-timeout", required_argument, NULL, OPT_STAT_TIMEOUT },
+	{ "metrics", required_argument, NULL, OPT_METRICS },
+	{ "export-tiles", required_argument, NULL, OPT_EXPORT_TILES },
 	{ "help", no_argument, NULL, OPT_HELP },
 	{ NULL, 0, NULL, 0 }
 };
@@ -60,13 +97,284 @@ static const char usage_summary[] = __("\n"
     "\n"
     "Usage: %s [rootdir] [options]\n"
     "  rootdir      Root directory for visualization\n"
-    "               (defaults to current directory)\n"
+    "               (defaults to current directory),\n"
+    "               or a snapshot file\n"
     "  --mapv       Start in MapV mode (default)\n"
     "  --treev      Start in TreeV mode\n"
+    "  --threads N  Use N background threads\n"
+    "               (defaults to one per processor)\n"
+    "  --gpu-budget MB\n"
+    "               Keep at most MB megabytes of geometry\n"
+    "               on the graphics card (default 256)\n"
+    "  --mem-budget MB\n"
+    "               Give up caches when using more than MB\n"
+    "               megabytes of memory (default no limit)\n"
+    "  --keep-attrs Keep ownership and timestamps while scanning\n"
+    "               (otherwise read in when first needed)\n"
+    "  --perf-counters\n"
+    "               Count CPU events (cycles, cache misses...)\n"
+    "               per phase, for Runtime statistics\n"
+    "  --sample-depth N\n"
+    "               Read in directories only N levels deep, and\n"
+    "               estimate the rest from random samples\n"
+    "  --save-snapshot FILE\n"
+    "               Scan rootdir, save the tree to FILE and exit\n"
+    "               (the tree is not held in memory; FILE.spill\n"
+    "               is used as scratch space)\n"
+    "  --small-files [mapv:|treev:]PCT\n"
+    "               Show files under PCT percent of their\n"
+    "               directory's total as one node (in both\n"
+    "               modes, unless one is given)\n"
+    "  --stat-timeout SECS\n"
+    "               Skip directories that stop responding for\n"
+    "               SECS seconds, e.g. on a dead network mount\n"
+    "               (default 5; 0 waits forever)\n"
+    "  --metrics PATH|PORT\n"
+    "               Serve runtime statistics in Prometheus\n"
+    "               format on UNIX socket PATH, or on\n"
+    "               localhost TCP port PORT\n"
+    "  --export-tiles DIR\n"
+    "               Scan rootdir (or load the snapshot), write\n"
+    "               MapV tiles and a web page to view them\n"
+    "               with into DIR, and exit\n"
     "  --help       Print this help and exit\n"
     "\n");
 
 
+/* The scanner, layout engines and coloring know nothing of the user
+ * interface. These callbacks connect them to it */
+
+
+/* Paths that did not respond during the scan (elements: char *) */
+static GList *unreachable_list = NULL;
+
+
+/* scanfs( ) hook: scan starting */
+static void
+scan_begin_cb( GNode *old_fstree, void *unused )
+{
+	if (old_fstree != NULL)
+		geometry_free_recursive( old_fstree );
+	g_list_free_full( unreachable_list, _xfree );
+	unreachable_list = NULL;
+	dirtree_clear( );
+	filelist_scan_monitor_init( );
+}
+
+
+/* scanfs( ) hook: new directory */
+static void
+scan_dir_found_cb( GNode *dnode, void *unused )
+{
+	/* Create corresponding directory tree entry */
+	dirtree_entry_new( dnode );
+}
+
+
+/* scanfs( ) hook: reading a directory */
+static void
+scan_dir_begin_cb( const char *dir, void *unused )
+{
+	char strbuf[1024];
+
+	snprintf( strbuf, sizeof(strbuf), _("Scanning: %s"), dir );
+	window_statusbar( SB_RIGHT, strbuf );
+}
+
+
+/* scanfs( ) hook: directory entry done */
+static void
+scan_entry_done_cb( void *unused )
+{
+	/* Keep the user interface responsive */
+	gui_update( );
+}
+
+
+/* scanfs( ) hook: directory slow to respond */
+static void
+scan_stalled_cb( const char *dir, void *unused )
+{
+	char strbuf[1024];
+
+	snprintf( strbuf, sizeof(strbuf), _("Waiting for: %s"), dir );
+	window_statusbar( SB_RIGHT, strbuf );
+	gui_update( );
+}
+
+
+/* scanfs( ) hook: path skipped, as it did not respond */
+static void
+scan_unreachable_cb( const char *absname, void *unused )
+{
+	G_LIST_APPEND(unreachable_list, xstrdup( absname ));
+}
+
+
+/* scanfs( ) hook: dynamic progress readout */
+static void
+scan_progress_cb( const int *node_counts, const int64 *size_counts, int stats_per_sec, void *unused )
+{
+	char strbuf[64];
+
+	/* Running totals in file list area */
+	filelist_scan_monitor( node_counts, size_counts );
+
+	/* Stats-per-second readout in left statusbar */
+	sprintf( strbuf, _("%d stats/sec"), stats_per_sec );
+	window_statusbar( SB_LEFT, strbuf );
+	gui_update( );
+}
+
+
+/* scanfs( ) hook: all entries read in */
+static void
+scan_scanned_cb( void *unused )
+{
+	window_statusbar( SB_RIGHT, "" );
+	dirtree_no_more_entries( );
+	gui_update( );
+}
+
+
+/* scanfs( ) hook: tree complete */
+static void
+scan_done_cb( GNode **node_table, unsigned int num_nodes, void *unused )
+{
+	/* Pass off new node table to the viewport handler */
+	viewport_pass_node_table( node_table, num_nodes );
+}
+
+
+static const ScanfsHooks scan_hooks = {
+	scan_begin_cb,
+	scan_dir_found_cb,
+	scan_dir_begin_cb,
+	scan_entry_done_cb,
+	scan_progress_cb,
+	scan_scanned_cb,
+	scan_done_cb,
+	scan_stalled_cb,
+	scan_unreachable_cb
+};
+
+
+/* scanfs( ) hook for --save-snapshot (no interface) */
+static void
+save_unreachable_cb( const char *absname, void *unused )
+{
+	fprintf( stderr, _("Not responding, left empty: %s\n"), absname );
+}
+
+
+static const ScanfsHooks save_scan_hooks = {
+	.unreachable = save_unreachable_cb
+};
+
+
+/* Exports the MapV layout of a directory or snapshot as tiles, along
+ * with the viewer page (for --export-tiles). Returns 0 on success */
+static int
+export_tiles( const char *dir, const char *tiles_dir )
+{
+	GBytes *viewer;
+	char *filename;
+	int status;
+
+	if (!snapshot_probe( dir ))
+		scanfs( dir, &save_scan_hooks, NULL );
+	else if (snapshot_load( dir, &save_scan_hooks, NULL ) < 0)
+		return -1;
+
+	status = tiles_export( tiles_dir );
+	if (status < 0)
+		return status;
+
+	viewer = g_resources_lookup_data( "/jabl/fsv/fsv-tileviewer.html", 0, NULL );
+	filename = g_build_filename( tiles_dir, "index.html", NULL );
+	if (!g_file_set_contents( filename, g_bytes_get_data( viewer, NULL ), g_bytes_get_size( viewer ), NULL )) {
+		g_warning( "Cannot write %s", filename );
+		status = -1;
+	}
+	g_free( filename );
+	g_bytes_unref( viewer );
+
+	return status;
+}
+
+
+/* Layout hook: expansion state comes from the directory tree */
+static boolean
+layout_dir_expanded_cb( GNode *dnode, void *unused )
+{
+	return dirtree_entry_expanded( dnode );
+}
+
+
+/* Layout hook: stop any collapse/expand in progress */
+static void
+layout_dir_deploy_cb( GNode *dnode, void *unused )
+{
+	morph_break( &DIR_NODE_DESC(dnode)->deployment );
+}
+
+
+/* Layout/color hook: directory geometry needs rebuilding */
+static void
+dir_changed_cb( GNode *dnode, void *unused )
+{
+	geometry_queue_rebuild( dnode );
+}
+
+
+static const LayoutHooks layout_hooks = {
+	layout_dir_expanded_cb,
+	layout_dir_deploy_cb,
+	dir_changed_cb
+};
+
+
+/* Color hook: colors about to be reassigned */
+static void
+colors_changing_cb( void *unused )
+{
+	geometry_colors_changed( );
+}
+
+
+/* Color hook: colors reassigned */
+static void
+colors_changed_cb( void *unused )
+{
+	redraw( );
+}
+
+
+/* Color hook: status message */
+static void
+color_message_cb( const char *message, void *unused )
+{
+	window_statusbar( SB_RIGHT, message );
+}
+
+
+/* Color hook: update radio menu in window with configured color mode */
+static void
+color_mode_loaded_cb( ColorMode mode, void *unused )
+{
+	window_set_color_mode( mode );
+}
+
+
+static const ColorHooks color_hooks = {
+	colors_changing_cb,
+	dir_changed_cb,
+	colors_changed_cb,
+	color_message_cb,
+	color_mode_loaded_cb
+};
+
+
 /* Helper function for fsv_set_mode( ) */
 static void
 initial_camera_pan( char *mesg )
@@ -159,8 +467,21 @@ fsv_load( const char *dir )
 
 	gui_update( );
 
-	/* Scan filesystem */
-	scanfs( dir );
+	/* The selection refers to nodes of the old tree */
+	selection_clear( );
+
+	/* Scan filesystem, or load a snapshot of one (any partial
+	 * rescans are moot now) */
+	rescan_cancel_all( );
+	sample_cancel_all( );
+	if (!snapshot_probe( dir ))
+		scanfs( dir, &scan_hooks, NULL );
+	else if (snapshot_load( dir, &scan_hooks, NULL ) < 0) {
+		if (globals.fstree == NULL)
+			quit( _("Cannot load snapshot") );
+		/* Carry on with the tree we had */
+		window_statusbar( SB_RIGHT, _("Cannot load snapshot") );
+	}
 
 	/* Clear/reset node history */
 	g_list_free( globals.history );
@@ -177,6 +498,86 @@ fsv_load( const char *dir )
 	/* Initialize visualization */
 	globals.fsv_mode = FSV_NONE;
 	fsv_set_mode( initial_fsv_mode );
+
+	/* Fill in directories left to be sampled */
+	sample_start( );
+
+	/* Let the user know about anything left out */
+	if (unreachable_list != NULL) {
+		dialog_unreachable( unreachable_list );
+		g_list_free_full( unreachable_list, _xfree );
+		unreachable_list = NULL;
+	}
+}
+
+
+/* Helper function for fsv_reroot( ). Drops all references to nodes that
+ * are about to be freed */
+static void
+forget_recursive( GNode *node )
+{
+	GNode *child;
+
+	viewport_node_table_remove( node );
+
+	if (NODE_IS_DIR(node)) {
+		if (DIR_NODE_DESC(node)->tnode != NULL) {
+			gtk_tree_path_free( DIR_NODE_DESC(node)->tnode );
+			DIR_NODE_DESC(node)->tnode = NULL;
+		}
+
+		child = node->children;
+		while (child != NULL) {
+			forget_recursive( child );
+			child = child->next;
+		}
+	}
+}
+
+
+/* Makes a directory already in the tree the new root. Its subtree is
+ * reused as it is, so nothing gets scanned */
+void
+fsv_reroot( GNode *dnode )
+{
+	GNode *old_root_dnode;
+
+	g_assert( NODE_IS_DIR(dnode) );
+
+	if (dnode == root_dnode)
+		return;
+
+	/* Lock down interface */
+	window_set_access( FALSE );
+
+	/* Partial rescans, layouts and retained geometry are all in
+	 * terms of the old tree, and so is the selection */
+	rescan_cancel_all( );
+	sample_cancel_all( );
+	selection_clear( );
+	geometry_free_recursive( globals.fstree );
+
+	old_root_dnode = scanfs_reroot( dnode );
+	forget_recursive( old_root_dnode );
+	scanfs_node_free( old_root_dnode );
+
+	/* Directory tree entries are identified by position, so every
+	 * one of them has to be redone */
+	dirtree_rebuild( );
+
+	/* Clear/reset node history */
+	g_list_free( globals.history );
+	globals.history = NULL;
+	globals.current_node = root_dnode;
+
+	filelist_init( );
+
+	/* Initialize visualization, as for a new filesystem */
+	globals.fsv_mode = FSV_NONE;
+	fsv_set_mode( initial_fsv_mode );
+
+	/* Fill in directories left to be sampled */
+	sample_start( );
 }
 
 
@@ -202,7 +603,12 @@ int
 main( int argc, char **argv )
 {
 	int opt_id;
+	int num_threads = 0;
 	char *root_dir;
+	char *snapshot_file = NULL;
+	const char *metrics_address = NULL;
+	char *tiles_dir = NULL;
+	int sample_depth = -1;
 
 	/* Initialize global variables */
 	globals.fstree = NULL;
@@ -256,6 +662,70 @@ main( int argc, char **argv )
 			/* TODO: Implement caching */
 			break;
 
+			case OPT_THREADS:
+			/* --threads <n> */
+			num_threads = atoi( optarg );
+			break;
+
+			case OPT_GPU_BUDGET:
+			/* --gpu-budget <megabytes> */
+			gpumem_set_budget( (int64)atoi( optarg ) << 20 );
+			break;
+
+			case OPT_MEM_BUDGET:
+			/* --mem-budget <megabytes> */
+			mempressure_set_budget( (int64)atoi( optarg ) << 20 );
+			break;
+
+			case OPT_KEEP_ATTRS:
+			/* --keep-attrs */
+			nodeattr_set_kept( NODE_ATTR_ALL );
+			break;
+
+			case OPT_PERF_COUNTERS:
+			/* --perf-counters */
+			perfctr_enable( );
+			break;
+
+			case OPT_SAMPLE_DEPTH:
+			/* --sample-depth <levels> */
+			sample_depth = atoi( optarg );
+			break;
+
+			case OPT_SAVE_SNAPSHOT:
+			/* --save-snapshot <file> */
+			/* (Absolute, as the scan changes directory) */
+			snapshot_file = g_canonicalize_filename( optarg, NULL );
+			break;
+
+			case OPT_SMALL_FILES:
+			/* --small-files [mapv:|treev:]<percent> */
+			if (g_str_has_prefix( optarg, "mapv:" ))
+				layout_set_small_files( FSV_MAPV, 0.01 * g_ascii_strtod( optarg + 5, NULL ) );
+			else if (g_str_has_prefix( optarg, "treev:" ))
+				layout_set_small_files( FSV_TREEV, 0.01 * g_ascii_strtod( optarg + 6, NULL ) );
+			else {
+				layout_set_small_files( FSV_MAPV, 0.01 * g_ascii_strtod( optarg, NULL ) );
+				layout_set_small_files( FSV_TREEV, 0.01 * g_ascii_strtod( optarg, NULL ) );
+			}
+			break;
+
+			case OPT_STAT_TIMEOUT:
+			/* --stat-timeout <seconds> */
+			scanfs_set_stat_timeout( g_ascii_strtod( optarg, NULL ) );
+			break;
+
+			case OPT_METRICS:
+			/* --metrics <path|port> */
+			metrics_address = optarg;
+			break;
+
+			case OPT_EXPORT_TILES:
+			/* --export-tiles <dir> */
+			/* (Absolute, as the scan changes directory) */
+			tiles_dir = g_canonicalize_filename( optarg, NULL );
+			break;
+
 			case OPT_HELP:
 			/* --help */
 			default:
@@ -285,11 +755,45 @@ main( int argc, char **argv )
 		root_dir = xstrdup( "." );
 	}
 
+	/* (Before any scan, which may go on without the interface) */
+	if (metrics_address != NULL)
+		metrics_serve( metrics_address );
+
+	/* Start background task pool (which snapshot loading and tile
+	 * export use as well) */
+	task_init( num_threads );
+
+	if (snapshot_file != NULL) {
+		/* Scan and save, without bringing up the interface. The
+		 * scan goes straight to disk, so the tree need not fit in
+		 * memory */
+		SnapshotSpill *spill;
+
+		spill = snapshot_spill_new( snapshot_file );
+		if (spill == NULL)
+			exit( EXIT_FAILURE );
+		scanfs_stream( root_dir, snapshot_spill_node, &save_scan_hooks, spill );
+		exit( snapshot_spill_finish( spill, NODE_DESC(globals.fstree)->name ) < 0 ? EXIT_FAILURE : EXIT_SUCCESS );
+	}
+
+	if (tiles_dir != NULL) {
+		/* Export, likewise */
+		exit( export_tiles( root_dir, tiles_dir ) < 0 ? EXIT_FAILURE : EXIT_SUCCESS );
+	}
+
+	/* (Not for the above, which want exact totals) */
+	scanfs_set_sample_depth( sample_depth );
+
 	/* Initialize GTK+ */
 	gtk_init( &argc, &argv );
 
+	/* Connect the core to the user interface */
+	layout_set_hooks( &layout_hooks, NULL );
+	color_set_hooks( &color_hooks, NULL );
+
 	window_init( initial_fsv_mode );
 	color_init( );
+	mempressure_init( );
 
 	fsv_load( root_dir );
 	xfree( root_dir );
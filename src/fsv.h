@@ -15,6 +15,7 @@
 
 void fsv_set_mode( FsvMode mode );
 void fsv_load( const char *dir );
+void fsv_reroot( GNode *dnode );
 void fsv_write_config( void );
 
 
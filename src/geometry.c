@@ -17,10 +17,18 @@
 
 #include "about.h"
 #include "animation.h"
+#include "arena.h"
 #include "camera.h"
 #include "color.h"
-#include "dirtree.h" /* dirtree_entry_expanded( ) */
+#include "gpumem.h"
+#include "layout.h"
+#include "mempressure.h" /* mempressure_rebuilt( ) */
+#include "minimap.h"
 #include "ogl.h"
+#include "perfctr.h"
+#include "profile.h"
+#include "selection.h"
+#include "streambuf.h"
 #include "tmaptext.h"
 
 /* 3D geometry for splash screen */
@@ -61,6 +69,15 @@ typedef struct VertexPos {
 	GLfloat position[3];
 } VertexPos;
 
+// Vertex struct for retained (batched) geometry. Each vertex carries the
+// color and ID color of its node, so a whole directory can be drawn at once
+typedef struct BatchVertex {
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLubyte color[4];
+	GLubyte id[4];
+} BatchVertex;
+
 
 // Print the legacy and modern OpenGL projection and modelview matrices.
 // which = 0: both modelview and projection matrices
@@ -84,6 +101,44 @@ debug_print_matrices(int which)
 
 static unsigned int highlight_node_id;
 
+/* Bounding box of the highlighted node. This goes stale (and so invalid)
+ * once anything in MapV moves */
+static XYZvec highlight_c0, highlight_c1;
+static boolean highlight_box_valid = FALSE;
+
+/* Peak height of the MapV scene, for culling in partial redraws (negative
+ * when it needs working out again) */
+static double mapv_scene_top = -1.0;
+
+// Selection mask on the GPU: a texture buffer with one texel per node ID,
+// nonzero for selected nodes. Batched geometry looks this up in the vertex
+// shader, so selection changes don't require rebuilding any geometry.
+static struct {
+	GLuint buffer;
+	GLuint texture;
+	unsigned int size;	// Allocated size (bytes)
+	boolean enabled;	// TRUE if the mask is in use
+	boolean dirty;		// TRUE if the mask needs uploading
+	boolean full;		// TRUE if all of it does
+	unsigned int dirty_first, dirty_end; // Range of node IDs otherwise
+} selection_tbo = { 0, 0, 0, FALSE, FALSE, TRUE, 0, 0 };
+
+// Selection marquee as last drawn, so that it can be erased
+static boolean marquee_drawn = FALSE;
+static float marquee_drawn_ndc[4];
+
+// Color that selected nodes are tinted toward
+static const RGBcolor selection_tint = { 1.0, 1.0, 0.5 };
+
+// Unique color for a node ID, as used in RENDERMODE_SELECT
+static void
+node_id_color(unsigned int id, GLfloat color[3])
+{
+	color[0] = (GLfloat)((id & 0x000000FF) >> 0) / G_MAXUINT8;
+	color[1] = (GLfloat)((id & 0x0000FF00) >> 8) / G_MAXUINT8;
+	color[2] = (GLfloat)((id & 0x00FF0000) >> 16) / G_MAXUINT8;
+}
+
 // Set node color and lightning enabled uniform. GL Program must be in use when
 // calling this.
 static void
@@ -93,6 +148,12 @@ node_set_color(GNode *node)
 	color[3] = 1.0;	 // Alpha
 	if (gl.render_mode == RENDERMODE_RENDER) {
 		memcpy(color, NODE_DESC(node)->color, 3 * sizeof(GLfloat));
+		// Check selection (tint must match the vertex shader)
+		if (selection_node_selected(node)) {
+			color[0] = 0.5f * (color[0] + selection_tint.r);
+			color[1] = 0.5f * (color[1] + selection_tint.g);
+			color[2] = 0.5f * (color[2] + selection_tint.b);
+		}
 		// Check highlight
 		if (NODE_DESC(node)->id == highlight_node_id) {
 			for (size_t i = 0; i < 3; i++)
@@ -100,42 +161,41 @@ node_set_color(GNode *node)
 		}
 		glUniform1i(gl.lightning_enabled_location, 1);
 	} else {
-		GLuint c = NODE_DESC(node)->id;
-		// const char *name = NODE_DESC(node)->name;
-		GLuint r = (c & 0x000000FF) >> 0;
-		GLuint g = (c & 0x0000FF00) >> 8;
-		GLuint b = (c & 0x00FF0000) >> 16;
-		color[0] = (GLfloat)r / G_MAXUINT8;
-		color[1] = (GLfloat)g / G_MAXUINT8;
-		color[2] = (GLfloat)b / G_MAXUINT8;
-		// g_print("Painting node %s id %u with Color red %f green %f
-		// blue %f\n", 	name, c, (double)color[0], (double)color[1],
-		//(double)color[2]);
+		node_id_color(NODE_DESC(node)->id, color);
 		glUniform1i(gl.lightning_enabled_location, 0);
 	}
 
 	glUniform4fv(gl.color_location, 1, color);
 }
 
+
+/* Returns the name label of a "small files" node */
+static const char *
+small_files_label( GNode *node )
+{
+	static char strbuf[64];
+
+	sprintf( strbuf, _("%u small files"), DIR_NODE_DESC(node->parent)->num_small_files );
+
+	return strbuf;
+}
+
 static const RGBcolor color_black = {0, 0, 0};
 
 // Upload and draw a bunch of VertexPos vertices.
-// Note this is highly inefficient and implements every known modern GL
-// anti-pattern (e.g. does not take any advantage of batching, or keeping
-// vertex data on the GPU instead of reuploading it every time). But hey,
-// it's simple.
+// Note this does not take any advantage of batching, or of keeping
+// vertex data on the GPU. Uploads at least go through the streaming
+// ring, so they cost a memcpy and no implicit sync.
 static void
 drawVertexPos(GLenum mode, VertexPos *vert, size_t vert_cnt, const RGBcolor *color)
 {
-	static GLuint vbo;
-	if (!vbo)
-		glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(VertexPos) * vert_cnt, vert, GL_STREAM_DRAW);
+	GLintptr offset;
+
+	offset = streambuf_upload(GL_ARRAY_BUFFER, vert, sizeof(VertexPos) * vert_cnt);
 
 	glEnableVertexAttribArray(gl.position_location);
 	glVertexAttribPointer(gl.position_location, 3, GL_FLOAT, GL_FALSE,
-			      sizeof(VertexPos), (void *)offsetof(VertexPos, position));
+			      sizeof(VertexPos), (void *)(offset + offsetof(VertexPos, position)));
 
 	glUseProgram(gl.program);
 	glUniform4f(gl.color_location, color->r, color->g, color->b, 1);
@@ -143,9 +203,6 @@ drawVertexPos(GLenum mode, VertexPos *vert, size_t vert_cnt, const RGBcolor *col
 	glDrawArrays(mode, 0, vert_cnt);
 	glUseProgram(0);
 
-	// Avoid implicit sync by allowing GL to dealloc memory
-	glBufferData(GL_ARRAY_BUFFER, sizeof(VertexPos) * vert_cnt, NULL, GL_STREAM_DRAW);
-
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
@@ -161,19 +218,15 @@ drawVertex(GLenum mode, Vertex *vert, size_t vert_cnt, const RGBcolor *color, GN
 	else
 		g_assert(node != NULL);
 
-	static GLuint vbo;
-	if (!vbo) glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vert_cnt, vert,
-		     GL_STREAM_DRAW);
+	GLintptr offset = streambuf_upload(GL_ARRAY_BUFFER, vert, sizeof(Vertex) * vert_cnt);
 
 	glEnableVertexAttribArray(gl.position_location);
 	glVertexAttribPointer(gl.position_location, 3, GL_FLOAT, GL_FALSE,
 			      sizeof(Vertex),
-			      (void *)offsetof(Vertex, position));
+			      (void *)(offset + offsetof(Vertex, position)));
 	glEnableVertexAttribArray(gl.normal_location);
 	glVertexAttribPointer(gl.normal_location, 3, GL_FLOAT, GL_FALSE,
-			      sizeof(Vertex), (void *)offsetof(Vertex, normal));
+			      sizeof(Vertex), (void *)(offset + offsetof(Vertex, normal)));
 
 	glUseProgram(gl.program);
 	if (color) {
@@ -184,11 +237,75 @@ drawVertex(GLenum mode, Vertex *vert, size_t vert_cnt, const RGBcolor *color, GN
 	glDrawArrays(mode, 0, vert_cnt);
 	glUseProgram(0);
 
-	// Avoid implicit sync by allowing GL to dealloc memory
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vert_cnt, NULL,
-		     GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+// Fill in the per-node part of a BatchVertex
+static void
+batchVertexSetNode(BatchVertex *bvert, GNode *node)
+{
+	const RGBcolor *color = NODE_DESC(node)->color;
+	unsigned int id = NODE_DESC(node)->id;
+
+	bvert->color[0] = (GLubyte)(CLAMP(color->r, 0.0f, 1.0f) * G_MAXUINT8 + 0.5f);
+	bvert->color[1] = (GLubyte)(CLAMP(color->g, 0.0f, 1.0f) * G_MAXUINT8 + 0.5f);
+	bvert->color[2] = (GLubyte)(CLAMP(color->b, 0.0f, 1.0f) * G_MAXUINT8 + 0.5f);
+	bvert->color[3] = G_MAXUINT8;
+	bvert->id[0] = (id & 0x000000FF) >> 0;
+	bvert->id[1] = (id & 0x0000FF00) >> 8;
+	bvert->id[2] = (id & 0x00FF0000) >> 16;
+	bvert->id[3] = G_MAXUINT8;
+}
+
+
+// Draw retained geometry: a vertex buffer of BatchVertex and an index
+// buffer of GLuint triangle indices. Colors come from the vertices, and
+// the highlighted node is brightened in the shader.
+static void
+drawBatch(GLuint vbo, GLuint ebo, GLsizei idx_cnt)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glEnableVertexAttribArray(gl.position_location);
+	glVertexAttribPointer(gl.position_location, 3, GL_FLOAT, GL_FALSE,
+			      sizeof(BatchVertex), (void *)offsetof(BatchVertex, position));
+	glEnableVertexAttribArray(gl.normal_location);
+	glVertexAttribPointer(gl.normal_location, 3, GL_FLOAT, GL_FALSE,
+			      sizeof(BatchVertex), (void *)offsetof(BatchVertex, normal));
+	glEnableVertexAttribArray(gl.node_color_location);
+	glVertexAttribPointer(gl.node_color_location, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+			      sizeof(BatchVertex), (void *)offsetof(BatchVertex, color));
+	glEnableVertexAttribArray(gl.node_id_location);
+	glVertexAttribPointer(gl.node_id_location, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+			      sizeof(BatchVertex), (void *)offsetof(BatchVertex, id));
+
+	glUseProgram(gl.program);
+	if (gl.render_mode == RENDERMODE_RENDER) {
+		GLfloat hl[4] = {0, 0, 0, 1};
+		node_id_color(highlight_node_id, hl);
+		glUniform4fv(gl.highlight_id_location, 1, hl);
+		glUniform1i(gl.vertex_color_mode_location, 1);
+		glUniform1i(gl.lightning_enabled_location, 1);
+		glUniform1i(gl.selection_enabled_location, selection_tbo.enabled);
+		if (selection_tbo.enabled) {
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_BUFFER, selection_tbo.texture);
+			glActiveTexture(GL_TEXTURE0);
+		}
+	} else {
+		glUniform1i(gl.vertex_color_mode_location, 2);
+		glUniform1i(gl.lightning_enabled_location, 0);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glDrawElements(GL_TRIANGLES, idx_cnt, GL_UNSIGNED_INT, 0);
+	glUniform1i(gl.vertex_color_mode_location, 0);
+	glUseProgram(0);
 
+	// Other drawing paths don't supply these
+	glDisableVertexAttribArray(gl.node_color_location);
+	glDisableVertexAttribArray(gl.node_id_location);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 /**** DISC VISUALIZATION **************************************/
@@ -196,8 +313,6 @@ drawVertex(GLenum mode, Vertex *vert, size_t vert_cnt, const RGBcolor *color, GN
 
 /* Geometry constants */
 #define DISCV_CURVE_GRANULARITY		15.0
-#define DISCV_LEAF_RANGE_ARC_WIDTH	315.0
-#define DISCV_LEAF_STEM_PROPORTION	0.5
 
 /* Messages for discv_draw_recursive( ) */
 enum {
@@ -228,154 +343,6 @@ geometry_discv_node_pos( GNode *node )
 }
 
 
-/* Compare function for sorting nodes (by size) */
-static int
-discv_node_compare( GNode *a, GNode *b )
-{
-	int64 a_size, b_size;
-
-	a_size = NODE_DESC(a)->size;
-	if (NODE_IS_DIR(a))
-		a_size += DIR_NODE_DESC(a)->subtree.size;
-
-	b_size = NODE_DESC(b)->size;
-	if (NODE_IS_DIR(b))
-		b_size += DIR_NODE_DESC(b)->subtree.size;
-
-	if (a_size < b_size)
-		return 1;
-	if (a_size > b_size)
-		return -1;
-
-	return strcmp( NODE_DESC(a)->name, NODE_DESC(b)->name );
-}
-
-
-/* Helper function for discv_init( ) */
-static void
-discv_init_recursive( GNode *dnode, double stem_theta )
-{
-	DiscVGeomParams *gparams;
-	GNode *node;
-	GList *node_list = NULL, *nl_llink;
-	int64 node_size;
-	double dir_radius, radius, dist;
-	double arc_width, total_arc_width = 0.0;
-	double theta0, theta1;
-	double k;
-	boolean even = TRUE;
-	boolean stagger, out = TRUE;
-
-	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
-
-	if (NODE_IS_DIR(dnode)) {
-		morph_break( &DIR_NODE_DESC(dnode)->deployment );
-		if (dirtree_entry_expanded( dnode ))
-			DIR_NODE_DESC(dnode)->deployment = 1.0;
-		else
-			DIR_NODE_DESC(dnode)->deployment = 0.0;
-		geometry_queue_rebuild( dnode );
-	}
-
-	/* If this directory has no children,
-	 * there is nothing further to do here */
-	if (dnode->children == NULL)
-		return;
-
-	dir_radius = DISCV_GEOM_PARAMS(dnode)->radius;
-
-	/* Assign radii (and arc widths, temporarily) to leaf nodes */
-	node = dnode->children;
-	while (node != NULL) {
-		node_size = MAX(64, NODE_DESC(node)->size);
-                if (NODE_IS_DIR(node))
-			node_size += DIR_NODE_DESC(node)->subtree.size;
-		/* Area of disc == node_size */
-		radius = sqrt( (double)node_size / PI );
-		/* Center-to-center distance (parent to leaf) */
-		dist = dir_radius + radius * (1.0 + DISCV_LEAF_STEM_PROPORTION);
-		arc_width = 2.0 * DEG(asin( radius / dist ));
-		gparams = DISCV_GEOM_PARAMS(node);
-		gparams->radius = radius;
-		gparams->theta = arc_width; /* temporary value */
-		gparams->pos.x = dist; /* temporary value */
-		total_arc_width += arc_width;
-		node = node->next;
-	}
-
-	/* Create a list of leaf nodes, sorted by size */
-	node = dnode->children;
-	while (node != NULL) {
-		G_LIST_PREPEND(node_list, node);
-		node = node->next;
-	}
-	G_LIST_SORT(node_list, discv_node_compare);
-
-	k = DISCV_LEAF_RANGE_ARC_WIDTH / total_arc_width;
-	/* If this is going to be a tight fit, stagger the leaf nodes */
-	stagger = k <= 1.0;
-
-	/* Assign angle positions to leaf nodes, arranging them in clockwise
-	 * order (spread out to occupy the entire available range), and
-	 * recurse into subdirectories */
-	theta0 = stem_theta - 180.0;
-	theta1 = stem_theta + 180.0;
-	nl_llink = node_list;
-	while (nl_llink != NULL) {
-		node = nl_llink->data;
-		gparams = DISCV_GEOM_PARAMS(node);
-		arc_width = k * gparams->theta;
-		dist = gparams->pos.x;
-		if (stagger && out) {
-			/* Push leaf out */
-			dist += 2.0 * gparams->radius;
-		}
-		if (nl_llink->prev == NULL) {
-			/* First (largest) node */
-			gparams->theta = theta0;
-			theta0 += 0.5 * arc_width;
-			theta1 -= 0.5 * arc_width;
-			out = !out;
-		}
-		else if (even) {
-			gparams->theta = theta0 + 0.5 * arc_width;
-			theta0 += arc_width;
-			out = !out;
-		}
-		else {
-			gparams->theta = theta1 - 0.5 * arc_width;
-			theta1 -= arc_width;
-		}
-		gparams->pos.x = dist * cos( RAD(gparams->theta) );
-		gparams->pos.y = dist * sin( RAD(gparams->theta) );
-		if (NODE_IS_DIR(node))
-			discv_init_recursive( node, gparams->theta + 180.0 );
-		even = !even;
-		nl_llink = nl_llink->next;
-	}
-
-	g_list_free( node_list );
-}
-
-
-static void
-discv_init( void )
-{
-	DiscVGeomParams *gparams;
-
-	gparams = DISCV_GEOM_PARAMS(globals.fstree);
-	gparams->radius = 0.0;
-	gparams->theta = 0.0;
-
-	discv_init_recursive( globals.fstree, 270.0 );
-
-	gparams->pos.x = 0.0;
-	gparams->pos.y = - DISCV_GEOM_PARAMS(root_dnode)->radius;
-
-	/* DiscV mode is entirely 2D, normal should always be {0, 0, 1} */
-}
-
-
 /* Draws a DiscV node. dir_deployment is deployment of parent directory */
 static void
 discv_gldraw_node( GNode *node, double dir_deployment )
@@ -393,7 +360,7 @@ discv_gldraw_node( GNode *node, double dir_deployment )
 
 	/* Draw disc */
 	size_t vert_cnt = seg_count + 2;
-	Vertex *vert = NEW_ARRAY(Vertex, vert_cnt);
+	Vertex *vert = ARENA_NEW_ARRAY(Vertex, vert_cnt);
 	vert[0] = (Vertex){{center.x, center.y, 0}, {0, 0, 1}};
 	for (s = 0; s <= seg_count; s++) {
 		theta = (double)s / (double)seg_count * 360.0;
@@ -402,7 +369,6 @@ discv_gldraw_node( GNode *node, double dir_deployment )
 		vert[s + 1] = (Vertex){{p.x, p.y, 0}, {0, 0, 1}};
 	}
 	drawVertex(GL_TRIANGLE_FAN, vert, vert_cnt, NULL, node);
-	xfree(vert);
 }
 
 
@@ -541,10 +507,6 @@ discv_draw( boolean high_detail )
 /**** MAP VISUALIZATION ***************************************/
 
 
-/* Geometry constants */
-#define MAPV_BORDER_PROPORTION	0.01
-#define MAPV_ROOT_ASPECT_RATIO	1.2
-
 /* Messages for mapv_draw_recursive( ) */
 enum {
 	MAPV_DRAW_GEOMETRY,
@@ -552,24 +514,6 @@ enum {
 };
 
 
-/* Node side face offset ratios, by node type
- * (these define the obliqueness of a node's side faces) */
-static const float mapv_side_slant_ratios[NUM_NODE_TYPES] = {
-	NIL,	/* Metanode (not used) */
-	0.032,	/* Directory */
-	0.064,	/* Regular file */
-	0.333,	/* Symlink */
-	0.0,	/* FIFO */
-	0.0,	/* Socket */
-	0.25,	/* Character device */
-	0.25,	/* Block device */
-	0.0	/* Unknown */
-};
-
-/* Heights of directory and leaf nodes */
-static double mapv_dir_height = 384.0;
-static double mapv_leaf_height = 128.0;
-
 /* Previous steady-state positions of the cursor corners
  * (if the cursor is moving from A to B, these delineate A) */
 static XYZvec mapv_cursor_prev_c0;
@@ -604,7 +548,7 @@ geometry_mapv_max_expanded_height( GNode *dnode )
 
 	g_assert( NODE_IS_DIR(dnode) );
 
-	if (dirtree_entry_expanded( dnode )) {
+	if (layout_dir_expanded( dnode )) {
 		node = dnode->children;
 		while (node != NULL) {
 			height = MAPV_GEOM_PARAMS(node)->height;
@@ -624,202 +568,54 @@ geometry_mapv_max_expanded_height( GNode *dnode )
 }
 
 
-/* Helper function for mapv_init( ).
- * This is, in essence, the MapV layout engine */
-static void
-mapv_init_recursive( GNode *dnode )
-{
-	struct MapVBlock {
-		GNode *node;
-		double area;
-	} *block, *next_first_block;
-	struct MapVRow {
-		struct MapVBlock *first_block;
-		double area;
-	} *row = NULL;
-	MapVGeomParams *gparams;
+/* Returns the peak height of everything drawn on top of a directory
+ * (measured relative to its top face), taking any subdirectory not fully
+ * collapsed at its full height. This bounds the contents over the whole
+ * course of a collapse or expand */
+static double
+mapv_peak_height( GNode *dnode )
+{
 	GNode *node;
-	GList *block_list = NULL, *block_llink;
-	GList *row_list = NULL, *row_llink;
-	XYvec dir_dims, block_dims;
-	XYvec start_pos, pos;
-	double area, dir_area, total_block_area = 0.0;
-	double nominal_border, border;
-	double scale_factor;
-	double a, b, k;
-	int64 size;
+	double height, peak = 0.0;
 
-	g_assert( NODE_IS_DIR(dnode) );
-
-	morph_break( &DIR_NODE_DESC(dnode)->deployment );
-	if (dirtree_entry_expanded( dnode ))
-		DIR_NODE_DESC(dnode)->deployment = 1.0;
-	else
-		DIR_NODE_DESC(dnode)->deployment = 0.0;
-	geometry_queue_rebuild( dnode );
-
-	/* If this directory has no children,
-	 * there is nothing further to do here */
-	if (dnode->children == NULL)
-		return;
-
-	/* Obtain dimensions of top face of directory */
-	dir_dims.x = MAPV_NODE_WIDTH(dnode);
-	dir_dims.y = MAPV_NODE_DEPTH(dnode);
-	k = mapv_side_slant_ratios[NODE_DIRECTORY];
-	dir_dims.x -= 2.0 * MIN(MAPV_GEOM_PARAMS(dnode)->height, k * dir_dims.x);
-	dir_dims.y -= 2.0 * MIN(MAPV_GEOM_PARAMS(dnode)->height, k * dir_dims.y);
-
-	/* Approximate/nominal node border width (nodes will be spaced
-	 * apart at about twice this distance) */
-	a = MAPV_BORDER_PROPORTION * sqrt( dir_dims.x * dir_dims.y );
-	b = MIN(dir_dims.x, dir_dims.y) / 3.0;
-	nominal_border = MIN(a, b);
-
-	/* Trim half a border width off the perimeter of the directory,
-	 * so that nodes aren't laid down too close to the edges */
-	dir_dims.x -= nominal_border;
-	dir_dims.y -= nominal_border;
-	dir_area = dir_dims.x * dir_dims.y;
-
-	/* First pass
-	 * 1. Create blocks. (A block is equivalent to a node, except
-	 *    that it includes the node's surrounding border area)
-	 * 2. Find total area of the blocks
-	 * 3. Create a list of the blocks */
 	node = dnode->children;
 	while (node != NULL) {
-		size = MAX(256, NODE_DESC(node)->size);
-		if (NODE_IS_DIR(node))
-			size += DIR_NODE_DESC(node)->subtree.size;
-		k = sqrt( (double)size ) + nominal_border;
-		area = SQR(k);
-		total_block_area += area;
-
-		block = NEW(struct MapVBlock);
-		block->node = node;
-		block->area = area;
-		G_LIST_APPEND(block_list, block);
-
-		node = node->next;
-	}
-
-	/* The blocks are going to have a total area greater than the
-	 * directory can provide, so they'll have to be scaled down */
-	scale_factor = dir_area / total_block_area;
-
-	/* Second pass
-	 * 1. Scale down the blocks
-	 * 2. Generate a first-draft set of rows */
-	block_llink = block_list;
-	while (block_llink != NULL) {
-		block = (struct MapVBlock *)block_llink->data;
-		block->area *= scale_factor;
-
-		if (row == NULL) {
-			/* Begin new row */
-			row = NEW(struct MapVRow);
-			row->first_block = block;
-			row->area = 0.0;
-			G_LIST_APPEND(row_list, row);
+		height = MAPV_GEOM_PARAMS(node)->height;
+		if (NODE_IS_DIR(node)) {
+			if (!DIR_COLLAPSED(node) || layout_dir_expanded( node ))
+				height += mapv_peak_height( node );
+			peak = MAX(peak, height);
 		}
-
-		/* Add block to row */
-		row->area += block->area;
-
-		/* Dimensions of block (block_dims.y == depth of row) */
-		block_dims.y = row->area / dir_dims.x;
-		block_dims.x = block->area / block_dims.y;
-
-		/* Check aspect ratio of block */
-		if ((block_dims.x / block_dims.y) < 1.0) {
-			/* Next block will go into next row */
-			row = NULL;
+		else {
+			peak = MAX(peak, height);
+			break;
 		}
-
-		block_llink = block_llink->next;
+		node = node->next;
 	}
 
-	/* Third pass - optimize layout */
-	/* Note to self: write layout optimization routine sometime */
-
-	/* Fourth pass - output final arrangement
-	 * Start at right/rear corner, laying out rows of (mostly)
-	 * successively smaller blocks */
-	start_pos.x = MAPV_NODE_CENTER_X(dnode) + 0.5 * dir_dims.x;
-	start_pos.y = MAPV_NODE_CENTER_Y(dnode) + 0.5 * dir_dims.y;
-	pos.y = start_pos.y;
-	block_llink = block_list;
-	row_llink = row_list;
-	while (row_llink != NULL) {
-		row = (struct MapVRow *)row_llink->data;
-		block_dims.y = row->area / dir_dims.x;
-		pos.x = start_pos.x;
-
-		/* Note first block of next row */
-		if (row_llink->next == NULL)
-			next_first_block = NULL;
-		else
-			next_first_block = ((struct MapVRow *)row_llink->next->data)->first_block;
-
-		/* Output one row */
-		while (block_llink != NULL) {
-			block = (struct MapVBlock *)block_llink->data;
-			if (block == next_first_block)
-				break; /* finished with row */
-			block_dims.x = block->area / block_dims.y;
-
-			size = MAX(256, NODE_DESC(block->node)->size);
-			if (NODE_IS_DIR(block->node))
-				size += DIR_NODE_DESC(block->node)->subtree.size;
-			area = scale_factor * (double)size;
-
-			/* Calculate exact width of block's border region */
-			k = block_dims.x + block_dims.y;
-			/* Note: area == scaled area of node,
-			 * block->area == scaled area of node + border */
-			border = 0.25 * (k - sqrt( SQR(k) - 4.0 * (block->area - area) ));
-
-			/* Assign geometry
-			 * (Note: pos is right/rear corner of block) */
-			gparams = MAPV_GEOM_PARAMS(block->node);
-			gparams->c0.x = pos.x - block_dims.x + border;
-			gparams->c0.y = pos.y - block_dims.y + border;
-			gparams->c1.x = pos.x - border;
-			gparams->c1.y = pos.y - border;
-
-			if (NODE_IS_DIR(block->node)) {
-				gparams->height = mapv_dir_height;
-
-				/* Recurse into directory */
-				mapv_init_recursive( block->node );
-			}
-			else
-				gparams->height = mapv_leaf_height;
+	return peak;
+}
 
-			pos.x -= block_dims.x;
-			block_llink = block_llink->next;
-		}
 
-		pos.y -= block_dims.y;
-		row_llink = row_llink->next;
-	}
+/* Checks whether a directory, and everything on top of it, can be seen
+ * in the region being redrawn */
+static boolean
+mapv_dir_damaged( GNode *dnode )
+{
+	XYZvec c0, c1;
 
-	/* Clean up */
+	if (mapv_scene_top < 0.0)
+		mapv_scene_top = MAPV_GEOM_PARAMS(globals.fstree)->height + mapv_peak_height( globals.fstree );
 
-	block_llink = block_list;
-	while (block_llink != NULL) {
-		xfree( block_llink->data );
-		block_llink = block_llink->next;
-	}
-	g_list_free( block_list );
+	/* Anything above the footprint counts */
+	c0.x = MAPV_GEOM_PARAMS(dnode)->c0.x;
+	c0.y = MAPV_GEOM_PARAMS(dnode)->c0.y;
+	c0.z = 0.0;
+	c1.x = MAPV_GEOM_PARAMS(dnode)->c1.x;
+	c1.y = MAPV_GEOM_PARAMS(dnode)->c1.y;
+	c1.z = mapv_scene_top;
 
-	row_llink = row_list;
-	while (row_llink != NULL) {
-		xfree( row_llink->data );
-		row_llink = row_llink->next;
-	}
-	g_list_free( row_list );
+	return ogl_box_damaged( &c0, &c1 );
 }
 
 
@@ -827,24 +623,9 @@ mapv_init_recursive( GNode *dnode )
 static void
 mapv_init( void )
 {
-	MapVGeomParams *gparams;
-	XYvec root_dims;
 	double k;
 
-	/* Determine dimensions of bottommost (root) node */
-	root_dims.y = sqrt( (double)DIR_NODE_DESC(globals.fstree)->subtree.size / MAPV_ROOT_ASPECT_RATIO );
-	root_dims.x = MAPV_ROOT_ASPECT_RATIO * root_dims.y;
-
-	/* Set up base geometry */
-	MAPV_GEOM_PARAMS(globals.fstree)->height = 0.0;
-	gparams = MAPV_GEOM_PARAMS(root_dnode);
-	gparams->c0.x = -0.5 * root_dims.x;
-	gparams->c0.y = -0.5 * root_dims.y;
-	gparams->c1.x = 0.5 * root_dims.x;
-	gparams->c1.y = 0.5 * root_dims.y;
-	gparams->height = mapv_dir_height;
-
-	mapv_init_recursive( root_dnode );
+	layout_mapv( );
 
 	/* Initial cursor state */
 	if (globals.current_node == root_dnode)
@@ -874,9 +655,25 @@ mapv_camera_pan_finished( void )
 }
 
 
-/* Draws a MapV node */
+/* Triangle indices for the vertices of a MapV node */
+static const GLushort mapv_node_elements[] = {
+	0,  1,  2,  2,  1,  3,	 // Rear face
+	4,  5,  6,  6,  5,  7,	 // Right face
+	8,  9,  10, 10, 9,  11,	 // Front face
+	12, 13, 14, 14, 13, 15,	 // Left face
+	16, 17, 18, 18, 17, 19	 // Top face
+};
+
+/* Vertices per MapV node */
+#define MAPV_NODE_VERTICES	20
+
+/* Index count per MapV node */
+#define MAPV_NODE_ELEMENTS	G_N_ELEMENTS(mapv_node_elements)
+
+
+/* Computes the vertices of a MapV node */
 static void
-mapv_gldraw_node( GNode *node )
+mapv_node_vertices( GNode *node, Vertex *vertex_data )
 {
 	MapVGeomParams *gparams;
 	XYZvec dims;
@@ -902,7 +699,7 @@ mapv_gldraw_node( GNode *node )
 
 	gparams = MAPV_GEOM_PARAMS(node);
 
-	Vertex vertex_data[] = {
+	const Vertex vert[MAPV_NODE_VERTICES] = {
 	    {{gparams->c0.x, gparams->c1.y, 0.0}, /* Rear face */
 	     {0.0, normal.y, normal_z_ny}},
 	    {{gparams->c0.x + offset.x, gparams->c1.y - offset.y,
@@ -954,35 +751,37 @@ mapv_gldraw_node( GNode *node )
 	    {{gparams->c1.x - offset.x, gparams->c1.y - offset.y,
 	      gparams->height},	 // 3
 	     {0.0f, 0.0f, 1.0f}}};
-	static const GLushort elements[] = {
-	    0,	1,  2,	2,  1,	3,   // Rear face
-	    4,	5,  6,	6,  5,	7,   // Right face
-	    8,	9,  10, 10, 9,	11,  // Front face
-	    12, 13, 14, 14, 13, 15,  // Left face
-	    16, 17, 18, 18, 17, 19   // Top face
-	};
+
+	memcpy( vertex_data, vert, sizeof(vert) );
+}
+
+
+/* Draws a MapV node */
+static void
+mapv_gldraw_node( GNode *node )
+{
+	Vertex vertex_data[MAPV_NODE_VERTICES];
+
+	mapv_node_vertices( node, vertex_data );
+
 	ogl_error();
 	//debug_print_matrices(0);
-	static GLuint vbo;
-	if (!vbo)
-		glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data), &vertex_data, GL_DYNAMIC_DRAW);
+	GLintptr offset = streambuf_upload(GL_ARRAY_BUFFER, vertex_data, sizeof(vertex_data));
 
 	static GLuint ebo;
 	if (!ebo) {
 		glGenBuffers(1, &ebo);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), &elements, GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(mapv_node_elements), &mapv_node_elements, GL_STATIC_DRAW);
 	}
 
 	glEnableVertexAttribArray(gl.position_location);
 	glVertexAttribPointer(gl.position_location, 3, GL_FLOAT, GL_FALSE,
-			      sizeof(Vertex), (void *)offsetof(Vertex, position));
+			      sizeof(Vertex), (void *)(offset + offsetof(Vertex, position)));
 
 	glEnableVertexAttribArray(gl.normal_location);
 	glVertexAttribPointer(gl.normal_location, 3, GL_FLOAT, GL_FALSE,
-			      sizeof(Vertex), (void *)offsetof(Vertex, normal));
+			      sizeof(Vertex), (void *)(offset + offsetof(Vertex, normal)));
 
 	ogl_error();
 
@@ -1005,10 +804,9 @@ mapv_gldraw_node( GNode *node )
 #endif
 #endif
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	GLsizei cnt = sizeof(elements) / sizeof(GLushort);
+	GLsizei cnt = MAPV_NODE_ELEMENTS;
 	glDrawElements(GL_TRIANGLES, cnt, GL_UNSIGNED_SHORT, 0);
 	glUseProgram(0);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data), NULL, GL_DYNAMIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
@@ -1063,21 +861,72 @@ mapv_gldraw_folder( GNode *dnode )
 
 
 /* Builds the children of a directory (but not the directory itself;
- * that geometry belongs to the parent) */
+ * that geometry belongs to the parent) into retained buffers */
 static void
 mapv_build_dir( GNode *dnode )
 {
+	Vertex vertex_data[MAPV_NODE_VERTICES];
+	BatchVertex *bvert;
+	GLuint *elements;
 	GNode *node;
+	int num_nodes, n, i;
 
 	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
 
+	/* Rebuilding is allowed to allocate, even in a steady frame */
+	debug_alloc_exempt_begin( );
+
+	/* (The small files, if merged, are drawn as one) */
+	num_nodes = layout_num_children_shown( dnode );
+	bvert = NEW_ARRAY(BatchVertex, num_nodes * MAPV_NODE_VERTICES);
+	elements = NEW_ARRAY(GLuint, num_nodes * MAPV_NODE_ELEMENTS);
+
 	node = dnode->children;
-	while (node != NULL) {
-		/* Draw node */
-		mapv_gldraw_node( node );
-		ogl_error();
+	for (n = 0; n < num_nodes; n++) {
+		mapv_node_vertices( node, vertex_data );
+		for (i = 0; i < MAPV_NODE_VERTICES; i++) {
+			BatchVertex *bv = &bvert[n * MAPV_NODE_VERTICES + i];
+			memcpy( bv->position, vertex_data[i].position, sizeof(bv->position) );
+			memcpy( bv->normal, vertex_data[i].normal, sizeof(bv->normal) );
+			batchVertexSetNode( bv, node );
+		}
+		for (i = 0; i < (int)MAPV_NODE_ELEMENTS; i++)
+			elements[n * MAPV_NODE_ELEMENTS + i] = n * MAPV_NODE_VERTICES + mapv_node_elements[i];
 		node = node->next;
 	}
+
+	gpumem_upload( dnode, GPUMEM_GEOMETRY_VERTICES, GL_ARRAY_BUFFER, bvert, num_nodes * MAPV_NODE_VERTICES * sizeof(BatchVertex), num_nodes * MAPV_NODE_VERTICES );
+	gpumem_upload( dnode, GPUMEM_GEOMETRY_INDICES, GL_ELEMENT_ARRAY_BUFFER, elements, num_nodes * MAPV_NODE_ELEMENTS * sizeof(GLuint), num_nodes * MAPV_NODE_ELEMENTS );
+
+	xfree( bvert );
+	xfree( elements );
+
+	DIR_NODE_DESC(dnode)->geom_dirty = FALSE;
+	debug_alloc_exempt_end( );
+}
+
+
+/* Draws the children of a directory, (re)building their retained
+ * geometry first if it is stale or has been evicted */
+static void
+mapv_draw_dir( GNode *dnode )
+{
+	GLuint vbo, ebo;
+	GLsizei idx_cnt;
+
+	if (dnode->children == NULL)
+		return;
+
+	vbo = gpumem_lookup( dnode, GPUMEM_GEOMETRY_VERTICES, NULL );
+	ebo = gpumem_lookup( dnode, GPUMEM_GEOMETRY_INDICES, &idx_cnt );
+	if (DIR_NODE_DESC(dnode)->geom_dirty || (vbo == 0) || (ebo == 0)) {
+		mapv_build_dir( dnode );
+		vbo = gpumem_lookup( dnode, GPUMEM_GEOMETRY_VERTICES, NULL );
+		ebo = gpumem_lookup( dnode, GPUMEM_GEOMETRY_INDICES, &idx_cnt );
+	}
+
+	drawBatch( vbo, ebo, idx_cnt );
+	ogl_error();
 }
 
 
@@ -1108,7 +957,10 @@ mapv_apply_label( GNode *node )
 	else
 		label_pos.z = MAPV_GEOM_PARAMS(node)->height;
 
-	text_draw_straight( NODE_DESC(node)->name, &label_pos, &label_dims );
+	if (layout_is_small_files( node ))
+		text_draw_straight( small_files_label( node ), &label_pos, &label_dims );
+	else
+		text_label_straight( node, &label_pos, &label_dims );
 }
 
 
@@ -1146,7 +998,7 @@ mapv_draw_recursive( GNode *dnode, int action )
 		if (dir_collapsed)
 			mapv_gldraw_folder(dnode);
 		else
-			mapv_build_dir(dnode);
+			mapv_draw_dir(dnode);
 	}
 	ogl_error();
 
@@ -1165,6 +1017,8 @@ mapv_draw_recursive( GNode *dnode, int action )
 			{
 				if (!NODE_IS_DIR(node))
 					mapv_apply_label(node);
+				if (node == dir_ndesc->small_files)
+					break;
 				node = node->next;
 			}
 		}
@@ -1174,12 +1028,14 @@ mapv_draw_recursive( GNode *dnode, int action )
 	dir_ndesc->geom_expanded = !dir_collapsed;
 
 	if (!dir_collapsed) {
-		/* Recurse into subdirectories */
+		/* Recurse into subdirectories (in partial redraws, only
+		 * those that show in the damaged region) */
 		node = dnode->children;
 		while (node != NULL) {
 			if (!NODE_IS_DIR(node))
 				break;
-			mapv_draw_recursive( node, action );
+			if (mapv_dir_damaged( node ))
+				mapv_draw_recursive( node, action );
 			node = node->next;
 		}
 	}
@@ -1196,6 +1052,7 @@ mapv_gldraw_cursor( const XYZvec *c0, const XYZvec *c1 )
 	static const double bar_part = SQR(SQR(MAGIC_NUMBER - 1.0));
 	XYZvec corner_dims;
 	XYZvec p, delta;
+	GLintptr offset;
 	int i, c;
 
 	corner_dims.x = bar_part * (c1->x - c0->x);
@@ -1203,9 +1060,6 @@ mapv_gldraw_cursor( const XYZvec *c0, const XYZvec *c1 )
 	corner_dims.z = bar_part * (c1->z - c0->z);
 
 	cursor_pre( );
-	static GLuint vbo;
-	if (!vbo) glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	for (i = 0; i < 2; i++) {
 		if (i == 0)
 			cursor_hidden_part( );
@@ -1249,16 +1103,13 @@ mapv_gldraw_cursor( const XYZvec *c0, const XYZvec *c1 )
 				{{p.x, p.y, p.z + delta.z}}
 			};
 
-			glBufferData(GL_ARRAY_BUFFER, sizeof(vert),
-				     vert, GL_STREAM_DRAW);
+			offset = streambuf_upload(GL_ARRAY_BUFFER, vert, sizeof(vert));
 			glEnableVertexAttribArray(gl.position_location);
 			glVertexAttribPointer(
 			    gl.position_location, 3, GL_FLOAT, GL_FALSE,
 			    sizeof(VertexPos),
-			    (void *)offsetof(VertexPos, position));
+			    (void *)(offset + offsetof(VertexPos, position)));
 			glDrawArrays(GL_LINES, 0, 6);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(vert),
-				     NULL, GL_STREAM_DRAW);
 		}
 	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -1323,23 +1174,11 @@ mapv_draw( boolean high_detail )
 
 
 /* Geometry constants */
-#define TREEV_MIN_ARC_WIDTH		90.0
-#define TREEV_MAX_ARC_WIDTH		225.0
 #define TREEV_BRANCH_WIDTH		256.0
-#define TREEV_MIN_CORE_RADIUS		8192.0
-#define TREEV_CORE_GROW_FACTOR		1.25
 #define TREEV_CURVE_GRANULARITY		5.0
-#define TREEV_PLATFORM_HEIGHT		158.2
-#define TREEV_PLATFORM_SPACING_WIDTH	512.0
-#define TREEV_LEAF_HEIGHT_MULTIPLIER	1.0
 #define TREEV_LEAF_PADDING		(0.125 * TREEV_LEAF_NODE_EDGE)
 #define TREEV_PLATFORM_PADDING		(0.5 * TREEV_PLATFORM_SPACING_WIDTH)
 
-/* Extra flags for TreeV mode */
-enum {
-	TREEV_NEED_REARRANGE	= 1 << 0
-};
-
 /* Messages for treev_draw_recursive( ) */
 enum {
 	/* Note: don't change order of these */
@@ -1360,9 +1199,6 @@ static RGBcolor treev_leaf_label_color = { 0.0, 0.0, 0.0 };
 static XYvec *inner_edge_buf = NULL;
 static XYvec *outer_edge_buf = NULL;
 
-/* Radius of innermost loop */
-static double treev_core_radius;
-
 /* Previous steady-state positions of the cursor corners */
 static RTZvec treev_cursor_prev_c0;
 static RTZvec treev_cursor_prev_c1;
@@ -1375,7 +1211,7 @@ boolean
 geometry_treev_is_leaf( GNode *node )
 {
 	if (NODE_IS_DIR(node))
-		if (dirtree_entry_expanded( node ))
+		if (layout_dir_expanded( node ))
 			return FALSE;
 
 	return TRUE;
@@ -1390,7 +1226,7 @@ geometry_treev_platform_r0( GNode *dnode )
 	double r0 = 0.0;
 
 	if (NODE_IS_METANODE(dnode))
-		return treev_core_radius;
+		return layout_treev_core_radius( );
 
 	up_node = dnode->parent;
 	while (up_node != NULL) {
@@ -1398,7 +1234,7 @@ geometry_treev_platform_r0( GNode *dnode )
 		r0 += TREEV_GEOM_PARAMS(up_node)->platform.depth;
 		up_node = up_node->parent;
 	}
-	r0 += treev_core_radius;
+	r0 += layout_treev_core_radius( );
 
 	return r0;
 }
@@ -1552,214 +1388,21 @@ treev_get_corners( GNode *node, RTZvec *c0, RTZvec *c1 )
 }
 
 
-/* This assigns an arc width and depth to a directory platform.
- * Note: depth value is only an estimate; the final value can only be
- * determined by actually laying down leaf nodes */
-static void
-treev_reshape_platform( GNode *dnode, double r0 )
-{
-#define edge05 (0.5 * TREEV_LEAF_NODE_EDGE)
-#define edge15 (1.5 * TREEV_LEAF_NODE_EDGE)
-	static const double w = TREEV_PLATFORM_SPACING_WIDTH;
-	static const double w_2 = SQR(TREEV_PLATFORM_SPACING_WIDTH);
-	static const double w_3 = SQR(TREEV_PLATFORM_SPACING_WIDTH) * TREEV_PLATFORM_SPACING_WIDTH;
-	static const double w_4 = SQR(TREEV_PLATFORM_SPACING_WIDTH) * SQR(TREEV_PLATFORM_SPACING_WIDTH);
-	double area;
-	double A, A_2, A_3, r, r_2, r_3, r_4, ka, kb, kc, kd, d, theta;
-	double depth, arc_width, min_arc_width;
-	double k;
-	int n;
-
-	/* Estimated area, based on number of (immediate) children */
-	n = g_list_length( (GList *)dnode->children );
-	k = edge15 * ceil( sqrt( (double)MAX(1, n) ) ) + edge05;
-	area = SQR(k);
-
-	/* Known: Area and inner radius of directory, plus the fact that
-	 * the aspect ratio (length_of_outer_edge / depth) is exactly 1.
-	 * Unknown: depth and arc width of directory.
-	 * Raw and distilled equations:
-	 * { A ~= PI*theta/360*((r + d)^2 - r^2) - w*d,
-	 * s ~= PI*theta*(r + d)/180 - w,
-	 * s/d = 1  -->  s = d,
-	 * theta = 180*(d + w)/(PI*(r + d)),
-	 * d^3 + (2*r + w)*d^2 + (2*w*r - 2*A - w)*d - 2*A*r = 0,
-	 * A = area, w = TREEV_PLATFORM_SPACING_WIDTH, r = r0,
-	 * s = (length of outer edge), d = depth, theta = arc_width }
-	 * Solution: Thank god for Maple */
-	A = area;
-	A_2 = SQR(A);
-	A_3 = A*A_2;
-	r = r0;
-	r_2 = SQR(r);
-	r_3 = r*r_2;
-	r_4 = SQR(r_2);
-	ka = 72.0*(A*r - w*(A + r)) - 64.0*r_3 + 48.0*r_2*w - 36.0*w_2 + 24.0*r*w_2 - 8.0*w_3;
-#define T1 72.0*A*w_2 - 132.0*A*r*w_2 - 240.0*A*w*r_3 + 120.0*A*w_2*r_2 - 24.0*A_2*w*r - 60.0*w_3*r
-#define T2 12.0*(w_2*r_2 + A_2*w_2 - w_4*r + w_4*r_2 + A*w_3 + w_3)
-#define T3 48.0*(w_2*r_4 - w_2*r_3 - w_3*r_3) + 96.0*(A_3 + w_3*r_2)
-#define T4 192.0*A*r_4 + 156.0*A_2*r_2 + 3.0*w_4 + 144.0*A_2*w + 264.0*A*w*r_2
-	kb = 12.0*sqrt( T1 + T2 + T3 + T4 );
-#undef T1
-#undef T2
-#undef T3
-#undef T4
-	kc = cos( atan2( kb, ka ) / 3.0 );
-	kd = cbrt( hypot( ka, kb ) );
-	/* Bring it all together */
-	d = (- w - 2.0*r)/3.0 + ((8.0*r_2 - 4.0*w*r + 2.0*w_2)/3.0 + 4.0*A + 2.0*w)*kc/kd + kc*kd/6.0;
-	theta = 180.0*(d + w)/(PI*(r + d));
-
-	depth = d;
-	arc_width = theta;
-
-	/* Adjust depth upward to accomodate an integral number of rows */
-	depth += (edge15 - fmod( depth - edge05, edge15 )) + edge05;
-
-	/* Final arc width must be at least large enough to yield an
-	 * inner edge length that is two leaf node edges long */
-	min_arc_width = (180.0 * (2.0 * TREEV_LEAF_NODE_EDGE + TREEV_PLATFORM_SPACING_WIDTH) / PI) / r0;
-
-	TREEV_GEOM_PARAMS(dnode)->platform.arc_width = MAX(min_arc_width, arc_width);
-	TREEV_GEOM_PARAMS(dnode)->platform.depth = depth;
-
-	/* Directory will need rebuilding, obviously */
-	geometry_queue_rebuild( dnode );
-
-#undef edge05
-#undef edge15
-}
-
-
-/* Helper function for treev_arrange( ). @reshape_tree flag should be TRUE
- * if platform radiuses have changed (thus requiring reshaping) */
-static void
-treev_arrange_recursive( GNode *dnode, double r0, boolean reshape_tree )
-{
-	GNode *node;
-	double subtree_r0;
-	double arc_width, subtree_arc_width = 0.0;
-	double theta;
-
-	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
-
-	if (!reshape_tree && !(NODE_DESC(dnode)->flags & TREEV_NEED_REARRANGE))
-		return;
-
-	if (reshape_tree && NODE_IS_DIR(dnode)) {
-		if (geometry_treev_is_leaf(dnode)) {
-			/* Ensure directory leaf gets repositioned */
-			geometry_queue_rebuild( dnode );
-			return;
-		}
-		else {
-			/* Reshape directory platform */
-			treev_reshape_platform( dnode, r0 );
-		}
-	}
-
-	/* Recurse into expanded subdirectories, and obtain the overall
-	 * arc width of the subtree */
-	subtree_r0 = r0 + TREEV_GEOM_PARAMS(dnode)->platform.depth + TREEV_PLATFORM_SPACING_DEPTH;
-	node = dnode->children;
-	while (node != NULL) {
-		if (!NODE_IS_DIR(node))
-			break;
-		treev_arrange_recursive( node, subtree_r0, reshape_tree );
-		arc_width = DIR_NODE_DESC(node)->deployment * MAX(TREEV_GEOM_PARAMS(node)->platform.arc_width, TREEV_GEOM_PARAMS(node)->platform.subtree_arc_width);
-		TREEV_GEOM_PARAMS(node)->platform.theta = arc_width; /* temporary value */
-		subtree_arc_width += arc_width;
-		node = node->next;
-	}
-	TREEV_GEOM_PARAMS(dnode)->platform.subtree_arc_width = subtree_arc_width;
-
-	/* Spread the subdirectories, sweeping counterclockwise */
-	theta = -0.5 * subtree_arc_width;
-	node = dnode->children;
-	while (node != NULL) {
-                if (!NODE_IS_DIR(node))
-			break;
-		arc_width = TREEV_GEOM_PARAMS(node)->platform.theta;
-		TREEV_GEOM_PARAMS(node)->platform.theta = theta + 0.5 * arc_width;
-		theta += arc_width;
-		node = node->next;
-	}
-
-	/* Clear the "need rearrange" flag */
-	NODE_DESC(dnode)->flags &= ~TREEV_NEED_REARRANGE;
-}
-
-
 /* Top-level call to arrange the branches of the currently expanded tree,
  * as needed when directories collapse/expand (initial_arrange == FALSE),
  * or when tree is initially created (initial_arrange == TRUE) */
 static void
 treev_arrange( boolean initial_arrange )
 {
-	boolean resized = FALSE;
-
-	treev_arrange_recursive( globals.fstree, treev_core_radius, initial_arrange );
-
-	/* Check that the tree's total arc width is within bounds */
-	for (;;) {
-		if (TREEV_GEOM_PARAMS(globals.fstree)->platform.subtree_arc_width > TREEV_MAX_ARC_WIDTH) {
-			/* Grow core radius */
-			treev_core_radius *= TREEV_CORE_GROW_FACTOR;
-			treev_arrange_recursive( globals.fstree, treev_core_radius, TRUE );
-			resized = TRUE;
-		}
-		else if ((TREEV_GEOM_PARAMS(globals.fstree)->platform.subtree_arc_width < TREEV_MIN_ARC_WIDTH) && (TREEV_GEOM_PARAMS(globals.fstree)->platform.depth > TREEV_MIN_CORE_RADIUS)) {
-			/* Shrink core radius */
-			treev_core_radius = MAX(TREEV_MIN_CORE_RADIUS, treev_core_radius / TREEV_CORE_GROW_FACTOR);
-			treev_arrange_recursive( globals.fstree, treev_core_radius, TRUE );
-			resized = TRUE;
-		}
-		else
-			break;
-	}
-
-	if (resized && camera_moving( )) {
-		/* Camera's destination has moved, so it will need a
-		 * flight path correction */
-		camera_pan_break( );
-		camera_look_at_full( globals.current_node, MORPH_INV_QUADRATIC, -1.0 );
-	}
-}
+	boolean resized;
 
+	resized = layout_treev_arrange( initial_arrange );
 
-/* Helper function for treev_init( ) */
-static void
-treev_init_recursive( GNode *dnode )
-{
-	GNode *node;
-	int64 size;
-
-	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
-
-	if (NODE_IS_DIR(dnode)) {
-		morph_break( &DIR_NODE_DESC(dnode)->deployment );
-		if (dirtree_entry_expanded( dnode ))
-			DIR_NODE_DESC(dnode)->deployment = 1.0;
-		else
-			DIR_NODE_DESC(dnode)->deployment = 0.0;
-		geometry_queue_rebuild( dnode );
-	}
-
-	NODE_DESC(dnode)->flags = 0;
-
-	/* Assign heights to leaf nodes */
-	node = dnode->children;
-	while (node != NULL) {
-		size = MAX(64, NODE_DESC(node)->size);
-		if (NODE_IS_DIR(node)) {
-			size += DIR_NODE_DESC(node)->subtree.size;
-			TREEV_GEOM_PARAMS(node)->platform.height = TREEV_PLATFORM_HEIGHT;
-			TREEV_GEOM_PARAMS(node)->platform.arc_width = TREEV_MIN_ARC_WIDTH;
-			TREEV_GEOM_PARAMS(node)->platform.subtree_arc_width = TREEV_MIN_ARC_WIDTH;
-			treev_init_recursive( node );
-		}
-		TREEV_GEOM_PARAMS(node)->leaf.height = sqrt( (double)size ) * TREEV_LEAF_HEIGHT_MULTIPLIER;
-		node = node->next;
+	if (resized && camera_moving( )) {
+		/* Camera's destination has moved, so it will need a
+		 * flight path correction */
+		camera_pan_break( );
+		camera_look_at_full( globals.current_node, MORPH_INV_QUADRATIC, -1.0 );
 	}
 }
 
@@ -1768,7 +1411,6 @@ treev_init_recursive( GNode *dnode )
 static void
 treev_init( void )
 {
-	TreeVGeomParams *gparams;
 	int num_points;
 
 	/* Allocate point buffers */
@@ -1778,21 +1420,7 @@ treev_init( void )
 	if (outer_edge_buf == NULL)
 		outer_edge_buf = NEW_ARRAY(XYvec, num_points);
 
-	treev_core_radius = TREEV_MIN_CORE_RADIUS;
-
-	gparams = TREEV_GEOM_PARAMS(globals.fstree);
-	gparams->platform.theta = 90.0;
-	gparams->platform.depth = 0.0;
-	gparams->platform.arc_width = TREEV_MAX_ARC_WIDTH;
-	gparams->platform.height = 0.0;
-
-	gparams = TREEV_GEOM_PARAMS(root_dnode);
-	gparams->leaf.theta = 0.0;
-	gparams->leaf.distance = (0.5 * TREEV_PLATFORM_SPACING_DEPTH);
-	gparams->platform.theta = 0.0;
-
-	treev_init_recursive( globals.fstree );
-	treev_arrange( TRUE );
+	layout_treev( );
 
 	/* Initial cursor state */
 	treev_get_corners( root_dnode, &treev_cursor_prev_c0, &treev_cursor_prev_c1 );
@@ -1833,6 +1461,9 @@ treev_queue_rearrange( GNode *dnode )
 		up_node = up_node->parent;
 	}
 
+	/* Everything may shift sideways */
+	minimap_invalidate( NULL );
+
 	queue_uncached_draw( );
 }
 
@@ -1898,8 +1529,8 @@ treev_gldraw_platform( GNode *dnode, double r0 )
 
 	size_t vert_cnt = seg_count * (8 + 4) + 8;
 	size_t idx_len = 0;
-	Vertex *vert = NEW_ARRAY(Vertex, vert_cnt);
-	GLushort *idx = NEW_ARRAY(GLushort, vert_cnt * 2);
+	Vertex *vert = ARENA_NEW_ARRAY(Vertex, vert_cnt);
+	GLushort *idx = ARENA_NEW_ARRAY(GLushort, vert_cnt * 2);
 
 	/* Draw inner edge */
 	for (s = 0; s < seg_count; s++) {
@@ -2009,40 +1640,26 @@ treev_gldraw_platform( GNode *dnode, double r0 )
 	g_assert(s2 + (seg_count - 1) * 4 + 3 < vert_cnt);
 	g_assert(idx_len <= vert_cnt * 2);
 
-	static GLuint vbo;
-	if (!vbo)
-		glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vert_cnt, vert, GL_DYNAMIC_DRAW);
-
-	static GLuint ebo;
-	if (!ebo)
-		glGenBuffers(1, &ebo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * idx_len, idx, GL_DYNAMIC_DRAW);
+	GLintptr offset = streambuf_upload(GL_ARRAY_BUFFER, vert, sizeof(Vertex) * vert_cnt);
+	GLintptr idx_offset = streambuf_upload(GL_ELEMENT_ARRAY_BUFFER, idx, sizeof(GLushort) * idx_len);
 
 	glEnableVertexAttribArray(gl.position_location);
 	glVertexAttribPointer(gl.position_location, 3, GL_FLOAT, GL_FALSE,
-			      sizeof(Vertex), (void *)offsetof(Vertex, position));
+			      sizeof(Vertex), (void *)(offset + offsetof(Vertex, position)));
 
 	glEnableVertexAttribArray(gl.normal_location);
 	glVertexAttribPointer(gl.normal_location, 3, GL_FLOAT, GL_FALSE,
-			      sizeof(Vertex), (void *)offsetof(Vertex, normal));
+			      sizeof(Vertex), (void *)(offset + offsetof(Vertex, normal)));
 
 	glUseProgram(gl.program);
 
 	node_set_color(dnode);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glDrawElements(GL_TRIANGLES, idx_len, GL_UNSIGNED_SHORT, 0);
+	glDrawElements(GL_TRIANGLES, idx_len, GL_UNSIGNED_SHORT, (void *)idx_offset);
 
 	glUseProgram(0);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vert_cnt, NULL, GL_DYNAMIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	xfree(vert);
-	xfree(idx);
 }
 
 
@@ -2153,11 +1770,7 @@ treev_gldraw_leaf( GNode *node, double r0, boolean full_node )
 	    8,	9,  10, 10, 9,	11,  // Back
 	    12, 13, 14, 14, 13, 15   // Left
 	};
-	static GLuint vbo;
-	if (!vbo)
-		glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vside), &vside, GL_DYNAMIC_DRAW);
+	GLintptr offset = streambuf_upload(GL_ARRAY_BUFFER, vside, sizeof(vside));
 
 	static GLuint ebo;
 	if (!ebo) {
@@ -2168,11 +1781,11 @@ treev_gldraw_leaf( GNode *node, double r0, boolean full_node )
 
 	glEnableVertexAttribArray(gl.position_location);
 	glVertexAttribPointer(gl.position_location, 3, GL_FLOAT, GL_FALSE,
-			      sizeof(Vertex), (void *)offsetof(Vertex, position));
+			      sizeof(Vertex), (void *)(offset + offsetof(Vertex, position)));
 
 	glEnableVertexAttribArray(gl.normal_location);
 	glVertexAttribPointer(gl.normal_location, 3, GL_FLOAT, GL_FALSE,
-			      sizeof(Vertex), (void *)offsetof(Vertex, normal));
+			      sizeof(Vertex), (void *)(offset + offsetof(Vertex, normal)));
 
 	glUseProgram(gl.program);
 
@@ -2183,7 +1796,6 @@ treev_gldraw_leaf( GNode *node, double r0, boolean full_node )
 	glDrawElements(GL_TRIANGLES, cnt, GL_UNSIGNED_SHORT, 0);
 
 	glUseProgram(0);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vside), NULL, GL_DYNAMIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
@@ -2262,7 +1874,7 @@ treev_gldraw_loop( double loop_r )
 
 	/* Draw loop */
 	static size_t vert_cnt = (seg_count + 1) * 2;
-	Vertex *vert = NEW_ARRAY(Vertex, vert_cnt);
+	Vertex *vert = ARENA_NEW_ARRAY(Vertex, vert_cnt);
 	for (s = 0; s <= seg_count; s++) {
 		theta = 360.0 * (double)s / (double)seg_count;
 		sin_theta = sin( RAD(theta) );
@@ -2278,7 +1890,6 @@ treev_gldraw_loop( double loop_r )
 		vert[2 * s + 1] = (Vertex){{p1.x, p1.y, 0}, {0, 0, 1}};
 	}
 	drawVertex(GL_TRIANGLE_STRIP, vert, vert_cnt, &branch_color, NULL);
-	xfree(vert);
 }
 
 
@@ -2345,7 +1956,7 @@ treev_gldraw_outbranch( double r1, double theta0, double theta1 )
 	seg_arc_width = (arc_width + supp_arc_width) / (double)seg_count;
 
 	const size_t vert_cnt = 4 + (seg_count + 1) * 2;
-	Vertex *vert = NEW_ARRAY(Vertex, vert_cnt);
+	Vertex *vert = ARENA_NEW_ARRAY(Vertex, vert_cnt);
 	/* Branch stem */
 	vert[0] = (Vertex){{p0.x, p0.y, 0}, {0, 0, 1}};
 	vert[1] = (Vertex){{p1.x, p0.y, 0}, {0, 0, 1}};
@@ -2370,13 +1981,13 @@ treev_gldraw_outbranch( double r1, double theta0, double theta1 )
 		theta += seg_arc_width;
 	}
 	drawVertex(GL_TRIANGLE_STRIP, vert, vert_cnt, &branch_color, NULL);
-	xfree(vert);
 }
 
 
-/* Arranges/draws leaf nodes on a directory */
+/* Arranges leaf nodes on a directory, and sets the final depth of its
+ * platform */
 static void
-treev_build_dir( GNode *dnode, double r0 )
+treev_arrange_leaves( GNode *dnode, double r0 )
 {
 #define edge05 (0.5 * TREEV_LEAF_NODE_EDGE)
 #define edge15 (1.5 * TREEV_LEAF_NODE_EDGE)
@@ -2388,10 +1999,13 @@ treev_build_dir( GNode *dnode, double r0 )
 	g_assert( NODE_IS_DIR(dnode) );
 
 	/* Build rows of leaf nodes, going from the inner edge outward
-	 * (this will require laying down nodes in reverse order) */
-	remaining_node_count = g_list_length( (GList *)dnode->children );
+	 * (this will require laying down nodes in reverse order, the
+	 * small files counting as one node) */
+	remaining_node_count = layout_num_children_shown( dnode );
 	pos.r = r0 + TREEV_LEAF_NODE_EDGE;
-	node = (GNode *)g_list_last( (GList *)dnode->children );
+	node = DIR_NODE_DESC(dnode)->small_files;
+	if (node == NULL)
+		node = (GNode *)g_list_last( (GList *)dnode->children );
 	while (node != NULL) {
 		/* Calculate (available) arc length of row */
 		arc_len = (PI / 180.0) * pos.r * TREEV_GEOM_PARAMS(dnode)->platform.arc_width - TREEV_PLATFORM_SPACING_WIDTH;
@@ -2405,7 +2019,6 @@ treev_build_dir( GNode *dnode, double r0 )
 		for (n = 0; (n < row_node_count) && (node != NULL); n++) {
 			TREEV_GEOM_PARAMS(node)->leaf.theta = pos.theta;
 			TREEV_GEOM_PARAMS(node)->leaf.distance = pos.r - r0;
-			treev_gldraw_leaf( node, r0, !NODE_IS_DIR(node) );
 			pos.theta -= inter_arc_width;
 			node = node->prev;
 		}
@@ -2413,19 +2026,38 @@ treev_build_dir( GNode *dnode, double r0 )
 		remaining_node_count -= row_node_count;
 		pos.r += edge15;
 	}
+	layout_small_files_share( dnode );
 
 	/* Official directory depth */
 	pos.r -= edge05;
 	TREEV_GEOM_PARAMS(dnode)->platform.depth = pos.r - r0;
 
-	/* Draw underlying directory */
-	treev_gldraw_platform( dnode, r0 );
-
 #undef edge05
 #undef edge15
 }
 
 
+/* Arranges/draws leaf nodes on a directory */
+static void
+treev_build_dir( GNode *dnode, double r0 )
+{
+	GNode *node;
+
+	treev_arrange_leaves( dnode, r0 );
+
+	node = dnode->children;
+	while (node != NULL) {
+		treev_gldraw_leaf( node, r0, !NODE_IS_DIR(node) );
+		if (node == DIR_NODE_DESC(dnode)->small_files)
+			break;
+		node = node->next;
+	}
+
+	/* Draw underlying directory */
+	treev_gldraw_platform( dnode, r0 );
+}
+
+
 /* Draws a node name label. is_leaf indicates whether the given node should
  * be labeled as a leaf, or as a directory platform (if applicable) */
 static void
@@ -2449,7 +2081,10 @@ treev_apply_label( GNode *node, double r0, boolean is_leaf )
 		label_pos.r = r0 + TREEV_GEOM_PARAMS(node)->leaf.distance;
 		label_pos.theta = TREEV_GEOM_PARAMS(node)->leaf.theta;
 		label_pos.z = height + TREEV_GEOM_PARAMS(node->parent)->platform.height;
-		text_draw_straight_rotated( NODE_DESC(node)->name, &label_pos, &leaf_label_dims );
+		if (layout_is_small_files( node ))
+			text_draw_straight_rotated( small_files_label( node ), &label_pos, &leaf_label_dims );
+		else
+			text_label_straight_rotated( node, &label_pos, &leaf_label_dims );
 	}
 	else {
 		/* Label directory platform, inside its inner edge */
@@ -2458,7 +2093,7 @@ treev_apply_label( GNode *node, double r0, boolean is_leaf )
 		label_pos.z = 0.0;
 		platform_label_dims.r = ((2.0 - MAGIC_NUMBER) * TREEV_PLATFORM_SPACING_DEPTH);
 		platform_label_dims.theta = TREEV_GEOM_PARAMS(node)->platform.arc_width - (180.0 * TREEV_PLATFORM_SPACING_WIDTH / PI) / label_pos.r;
-		text_draw_curved( NODE_DESC(node)->name, &label_pos, &platform_label_dims );
+		text_label_curved( node, &label_pos, &platform_label_dims );
 	}
 }
 
@@ -2598,6 +2233,8 @@ treev_draw_recursive( GNode *dnode, double prev_r0, double r0, int action )
 			{
 				if (!NODE_IS_DIR(node))
 					treev_apply_label(node, r0, TRUE);
+				if (node == dir_ndesc->small_files)
+					break;
 				node = node->next;
 			}
 		}
@@ -2626,6 +2263,7 @@ treev_gldraw_cursor( RTZvec *c0, RTZvec *c1 )
 	double theta;
 	double sin_theta, cos_theta;
 	int seg_count;
+	GLintptr offset;
 	int i, c, s;
 
 	g_assert( c1->r > c0->r );
@@ -2639,9 +2277,6 @@ treev_gldraw_cursor( RTZvec *c0, RTZvec *c1 )
 	seg_count = (int)ceil( corner_dims.theta / TREEV_CURVE_GRANULARITY );
 
 	cursor_pre( );
-	static GLuint vbo;
-	if (!vbo) glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	for (i = 0; i <= 1; i++) {
 		if (i == 0)
 			cursor_hidden_part( );
@@ -2684,7 +2319,7 @@ treev_gldraw_cursor( RTZvec *c0, RTZvec *c1 )
 			cp1.y = (p.r + delta.r) * sin_theta;
 
 			const size_t vert_cnt = 4 + seg_count + 1;
-			VertexPos *vert = NEW_ARRAY(VertexPos, vert_cnt);
+			VertexPos *vert = ARENA_NEW_ARRAY(VertexPos, vert_cnt);
 			vert[0] = (VertexPos){{cp0.x, cp0.y, p.z + delta.z}}; // Vertical axis start
 			vert[1] = (VertexPos){{cp0.x, cp0.y, p.z}}; // Vertical axis end
 			vert[2] = (VertexPos){{cp1.x, cp1.y, p.z}}; // Radial axis end
@@ -2697,18 +2332,13 @@ treev_gldraw_cursor( RTZvec *c0, RTZvec *c1 )
 				vert[4 + s] = (VertexPos){{cp0.x, cp0.y, p.z}};
 			}
 
-			glBufferData(GL_ARRAY_BUFFER,
-				     sizeof(VertexPos) * vert_cnt, vert,
-				     GL_STREAM_DRAW);
+			offset = streambuf_upload(GL_ARRAY_BUFFER, vert, sizeof(VertexPos) * vert_cnt);
 			glEnableVertexAttribArray(gl.position_location);
 			glVertexAttribPointer(
 			    gl.position_location, 3, GL_FLOAT, GL_FALSE,
 			    sizeof(VertexPos),
-			    (void *)offsetof(VertexPos, position));
+			    (void *)(offset + offsetof(VertexPos, position)));
 			glDrawArrays(GL_LINE_STRIP, 0, vert_cnt);
-			glBufferData(GL_ARRAY_BUFFER,
-				     sizeof(VertexPos) * vert_cnt, NULL,
-				     GL_STREAM_DRAW);
 		}
 	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -2748,7 +2378,7 @@ treev_draw( boolean high_detail )
 
 	/* Draw low-detail geometry */
 
-	treev_draw_recursive( globals.fstree, NIL, treev_core_radius, TREEV_DRAW_GEOMETRY_WITH_BRANCHES );
+	treev_draw_recursive( globals.fstree, NIL, layout_treev_core_radius( ), TREEV_DRAW_GEOMETRY_WITH_BRANCHES );
 
 	if (fstree_low_draw_stage <= 1)
 		++fstree_low_draw_stage;
@@ -2758,7 +2388,7 @@ treev_draw( boolean high_detail )
 
 		/* Node name labels */
 		text_pre();
-		treev_draw_recursive(globals.fstree, NIL, treev_core_radius, TREEV_DRAW_LABELS);
+		treev_draw_recursive(globals.fstree, NIL, layout_treev_core_radius( ), TREEV_DRAW_LABELS);
 		text_post();
 
 		if (fstree_high_draw_stage <= 1)
@@ -2826,24 +2456,314 @@ queue_uncached_draw( void )
 }
 
 
+/* Marks the screen region of a directory and its contents as needing
+ * redraw. Only MapV changes can be localized this way, as TreeV
+ * directories push their neighbors around */
+static void
+damage_dir( GNode *dnode )
+{
+	XYZvec c0, c1;
+
+	/* Things on top of this directory may be moving */
+	highlight_box_valid = FALSE;
+	mapv_scene_top = -1.0;
+
+	if (ogl_full_redraw_pending( ))
+		return;
+	if (NODE_IS_METANODE(dnode) || (globals.fsv_mode != FSV_MAPV)) {
+		ogl_damage_all( );
+		return;
+	}
+
+	geometry_node_extents( dnode, &c0, &c1 );
+	c1.z += mapv_peak_height( dnode );
+	ogl_damage_box( &c0, &c1 );
+}
+
+
 /* Flags a directory's geometry for rebuilding */
 void
 geometry_queue_rebuild( GNode *dnode )
 {
+	DIR_NODE_DESC(dnode)->geom_dirty = TRUE;
+	minimap_invalidate( dnode );
+	damage_dir( dnode );
 	queue_uncached_draw( );
 }
 
 
-/* Sets up filesystem tree geometry for the specified mode */
+/* Layout of the whole tree in a mode other than the current one, put
+ * away when that mode was left. Records are in pre-order (see
+ * layout_cache_save_recursive( )), so they need no node pointers or IDs,
+ * but are only good for as long as the tree is exactly the same. Directory
+ * records hold on to the mode's retained GPU buffers as well; these are
+ * evicted (least recently used first) when over budget, in which case
+ * they are rebuilt on the next draw */
+struct LayoutCacheNode {
+	double		geomparams[5];
+	bitfield	flags : 2;
+};
+
+struct LayoutCacheDir {
+	double		geomparams2[3];
+	void		*gpu_owner;	/* (see gpumem_detach( )) */
+	GNode		*small_files;
+	unsigned int	num_small_files;
+	bitfield	geom_expanded : 1;
+	bitfield	geom_dirty : 1;
+};
+
+struct LayoutCache {
+	boolean		valid;
+	struct LayoutCacheNode *nodes;
+	struct LayoutCacheDir *dirs;
+	unsigned int	num_nodes;
+	unsigned int	num_dirs;
+	double		treev_core_radius;
+};
+
+static struct LayoutCache layout_cache[FSV_SPLASH];
+
+/* Mode whose layout is currently in the tree */
+static FsvMode layout_mode = FSV_NONE;
+
+/* Modes whose put-away layouts were given up under memory pressure */
+static boolean layout_shed[FSV_SPLASH];
+
+
+/* Returns the number of nodes in the tree (metanode included) */
+static int64
+fstree_num_nodes( void )
+{
+	int64 num_nodes = 1;
+	int i;
+
+	for (i = 0; i < NUM_NODE_TYPES; i++)
+		num_nodes += DIR_NODE_DESC(globals.fstree)->subtree.counts[i];
+
+	return num_nodes;
+}
+
+
+/* Helper function for layout_cache_save( ) */
+static void
+layout_cache_save_recursive( GNode *node, struct LayoutCache *cache )
+{
+	struct LayoutCacheNode *cnode;
+	struct LayoutCacheDir *cdir;
+	GNode *child;
+
+	cnode = &cache->nodes[cache->num_nodes++];
+	memcpy( cnode->geomparams, NODE_DESC(node)->geomparams, sizeof(cnode->geomparams) );
+	cnode->flags = NODE_DESC(node)->flags;
+
+	if (NODE_IS_DIR(node) || NODE_IS_METANODE(node)) {
+		cdir = &cache->dirs[cache->num_dirs++];
+		memcpy( cdir->geomparams2, DIR_NODE_DESC(node)->geomparams2, sizeof(cdir->geomparams2) );
+		cdir->gpu_owner = gpumem_detach( node );
+		cdir->geom_expanded = DIR_NODE_DESC(node)->geom_expanded;
+		cdir->geom_dirty = DIR_NODE_DESC(node)->geom_dirty;
+		cdir->small_files = DIR_NODE_DESC(node)->small_files;
+		cdir->num_small_files = DIR_NODE_DESC(node)->num_small_files;
+
+		child = node->children;
+		while (child != NULL) {
+			layout_cache_save_recursive( child, cache );
+			child = child->next;
+		}
+	}
+}
+
+
+/* Puts away the layout (and retained buffers) of the given mode */
+static void
+layout_cache_save( FsvMode mode )
+{
+	struct LayoutCache *cache = &layout_cache[mode];
+	DirNodeDesc *fstree_ndesc = DIR_NODE_DESC(globals.fstree);
+	unsigned int num_nodes;
+
+	g_assert( !cache->valid );
+
+	num_nodes = (unsigned int)fstree_num_nodes( );
+	cache->nodes = NEW_ARRAY(struct LayoutCacheNode, num_nodes);
+	cache->dirs = NEW_ARRAY(struct LayoutCacheDir, 1 + fstree_ndesc->subtree.counts[NODE_DIRECTORY]);
+	cache->num_nodes = 0;
+	cache->num_dirs = 0;
+	layout_cache_save_recursive( globals.fstree, cache );
+	g_assert( cache->num_nodes == num_nodes );
+
+	cache->treev_core_radius = layout_treev_core_radius( );
+	cache->valid = TRUE;
+
+	profile_gauge( "geometry.layout_cache_bytes", (int64)num_nodes * sizeof(struct LayoutCacheNode) + (int64)cache->num_dirs * sizeof(struct LayoutCacheDir) );
+}
+
+
+/* Helper function for layout_cache_restore( ) */
+static void
+layout_cache_restore_recursive( GNode *node, struct LayoutCache *cache )
+{
+	struct LayoutCacheNode *cnode;
+	struct LayoutCacheDir *cdir;
+	GNode *child;
+
+	cnode = &cache->nodes[cache->num_nodes++];
+	memcpy( NODE_DESC(node)->geomparams, cnode->geomparams, sizeof(cnode->geomparams) );
+	NODE_DESC(node)->flags = cnode->flags;
+
+	if (NODE_IS_DIR(node) || NODE_IS_METANODE(node)) {
+		cdir = &cache->dirs[cache->num_dirs++];
+		memcpy( DIR_NODE_DESC(node)->geomparams2, cdir->geomparams2, sizeof(cdir->geomparams2) );
+		gpumem_free( node );
+		gpumem_attach( node, cdir->gpu_owner );
+		DIR_NODE_DESC(node)->geom_expanded = cdir->geom_expanded;
+		DIR_NODE_DESC(node)->geom_dirty = cdir->geom_dirty;
+		DIR_NODE_DESC(node)->small_files = cdir->small_files;
+		DIR_NODE_DESC(node)->num_small_files = cdir->num_small_files;
+
+		child = node->children;
+		while (child != NULL) {
+			layout_cache_restore_recursive( child, cache );
+			child = child->next;
+		}
+	}
+}
+
+
+/* Frees a cache record */
+static void
+layout_cache_free( struct LayoutCache *cache )
+{
+	xfree( cache->nodes );
+	xfree( cache->dirs );
+	memset( cache, 0, sizeof(struct LayoutCache) );
+}
+
+
+/* Brings back the put-away layout of the given mode. Returns FALSE if
+ * there is none, and the layout has to be computed afresh */
+static boolean
+layout_cache_restore( FsvMode mode )
+{
+	struct LayoutCache *cache = &layout_cache[mode];
+
+	if (!cache->valid) {
+		profile_count( "geometry.layout_cache_misses", 1 );
+		if (layout_shed[mode]) {
+			/* Caller lays the tree out again */
+			layout_shed[mode] = FALSE;
+			mempressure_rebuilt( MEMPRESSURE_LAYOUTS );
+		}
+		return FALSE;
+	}
+
+	cache->num_nodes = 0;
+	cache->num_dirs = 0;
+	layout_cache_restore_recursive( globals.fstree, cache );
+	layout_treev_set_core_radius( cache->treev_core_radius );
+	layout_cache_free( cache );
+
+	profile_count( "geometry.layout_cache_hits", 1 );
+	profile_gauge( "geometry.layout_cache_bytes", 0 );
+
+	return TRUE;
+}
+
+
+/* Drops the retained buffers held by put-away layouts, keeping the
+ * layouts themselves */
+static void
+layout_cache_drop_buffers( void )
+{
+	struct LayoutCache *cache;
+	unsigned int i;
+	int m;
+
+	for (m = 0; m < FSV_SPLASH; m++) {
+		cache = &layout_cache[m];
+		if (!cache->valid)
+			continue;
+		for (i = 0; i < cache->num_dirs; i++) {
+			gpumem_discard( cache->dirs[i].gpu_owner );
+			cache->dirs[i].gpu_owner = NULL;
+			cache->dirs[i].geom_dirty = TRUE;
+		}
+	}
+}
+
+
+/* Throws away all put-away layouts. Called whenever the tree, or the
+ * expansion state of any directory, changes */
+static void
+layout_cache_clear( void )
+{
+	int m;
+
+	layout_cache_drop_buffers( );
+	for (m = 0; m < FSV_SPLASH; m++) {
+		if (layout_cache[m].valid)
+			layout_cache_free( &layout_cache[m] );
+		layout_shed[m] = FALSE;
+	}
+}
+
+
+/* Gives up the layouts put away for other modes, under memory pressure.
+ * Going back to such a mode lays the tree out afresh. Returns FALSE if
+ * there were none */
+boolean
+geometry_shed_layouts( void )
+{
+	boolean any = FALSE;
+	int m;
+
+	layout_cache_drop_buffers( );
+	for (m = 0; m < FSV_SPLASH; m++) {
+		if (layout_cache[m].valid) {
+			layout_cache_free( &layout_cache[m] );
+			layout_shed[m] = TRUE;
+			any = TRUE;
+		}
+	}
+	profile_gauge( "geometry.layout_cache_bytes", 0 );
+
+	return any;
+}
+
+
+/* Sets up filesystem tree geometry for the specified mode. Coming back
+ * to a mode visited before, its layout is simply restored, unless the
+ * tree or its expansion state has changed in the meantime */
 void
 geometry_init( FsvMode mode )
 {
+	PerfScope perf;
+
+	/* Selection and minimap are in terms of the old layout */
+	selection_clear( );
+	minimap_reset( );
+	ogl_damage_all( );
+	highlight_box_valid = FALSE;
+	mapv_scene_top = -1.0;
+
+	if (mode != layout_mode) {
+		if (layout_mode != FSV_NONE)
+			layout_cache_save( layout_mode );
+		layout_mode = mode;
+		if (layout_cache_restore( mode )) {
+			queue_uncached_draw( );
+			return;
+		}
+	}
+
 	DIR_NODE_DESC(globals.fstree)->deployment = 1.0;
 	geometry_queue_rebuild( globals.fstree );
 
+	perfctr_begin( &perf, PERF_PHASE_LAYOUT );
 	switch (mode) {
 		case FSV_DISCV:
-		discv_init( );
+		layout_discv( );
 		break;
 
 		case FSV_MAPV:
@@ -2856,6 +2776,7 @@ geometry_init( FsvMode mode )
 
 		SWITCH_FAIL
 	}
+	perfctr_end( &perf, fstree_num_nodes( ) );
 
 	color_assign_recursive( globals.fstree );
 }
@@ -3140,10 +3061,113 @@ splash_draw( void )
 }
 
 
+/* Brings the GPU copy of the selection mask up to date */
+static void
+selection_mask_upload( void )
+{
+	const guint8 *mask;
+	unsigned int mask_size;
+	GLint max_texels;
+
+	unsigned int first, end;
+
+	if (!selection_tbo.dirty)
+		return;
+	selection_tbo.dirty = FALSE;
+
+	mask = selection_mask( &mask_size );
+	if (mask == NULL) {
+		/* Changes made meanwhile won't be tracked */
+		selection_tbo.enabled = FALSE;
+		selection_tbo.full = TRUE;
+		return;
+	}
+
+	glGetIntegerv( GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels );
+	if (mask_size > (unsigned int)max_texels) {
+		/* Batched geometry can't show the selection, but the
+		 * statistics are still valid */
+		selection_tbo.enabled = FALSE;
+		selection_tbo.full = TRUE;
+		return;
+	}
+
+	if (selection_tbo.buffer == 0) {
+		glGenBuffers( 1, &selection_tbo.buffer );
+		glGenTextures( 1, &selection_tbo.texture );
+	}
+	glBindBuffer( GL_TEXTURE_BUFFER, selection_tbo.buffer );
+	if (mask_size != selection_tbo.size) {
+		glBufferData( GL_TEXTURE_BUFFER, mask_size, mask, GL_DYNAMIC_DRAW );
+		gpumem_pin( (int64)mask_size - (int64)selection_tbo.size );
+		selection_tbo.size = mask_size;
+	}
+	else if (selection_tbo.full)
+		glBufferSubData( GL_TEXTURE_BUFFER, 0, mask_size, mask );
+	else {
+		/* Only the part covering nodes that changed */
+		first = MIN(selection_tbo.dirty_first, mask_size);
+		end = MIN(selection_tbo.dirty_end, mask_size);
+		if (end > first)
+			glBufferSubData( GL_TEXTURE_BUFFER, first, end - first, mask + first );
+	}
+	glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+	selection_tbo.full = FALSE;
+	selection_tbo.dirty_first = G_MAXUINT;
+	selection_tbo.dirty_end = 0;
+
+	glBindTexture( GL_TEXTURE_BUFFER, selection_tbo.texture );
+	glTexBuffer( GL_TEXTURE_BUFFER, GL_R8, selection_tbo.buffer );
+	glBindTexture( GL_TEXTURE_BUFFER, 0 );
+
+	selection_tbo.enabled = TRUE;
+}
+
+
+/* Draws the selection marquee (as an overlay, in screen space) */
+static void
+selection_draw_marquee( void )
+{
+	VertexPos vert[4];
+	RGBcolor marquee_color = { 1.0, 1.0, 0.5 };
+	mat4 tmp_projection, tmp_modelview;
+	float ndc[4];
+
+	marquee_drawn = selection_marquee( ndc );
+	if (!marquee_drawn)
+		return;
+	memcpy( marquee_drawn_ndc, ndc, sizeof(marquee_drawn_ndc) );
+
+	glm_mat4_copy( gl.projection, tmp_projection );
+	glm_mat4_copy( gl.modelview, tmp_modelview );
+	glm_mat4_identity( gl.projection );
+	glm_mat4_identity( gl.modelview );
+	ogl_upload_matrices( FALSE );
+
+	vert[0].position[0] = ndc[0]; vert[0].position[1] = ndc[1];
+	vert[1].position[0] = ndc[2]; vert[1].position[1] = ndc[1];
+	vert[2].position[0] = ndc[2]; vert[2].position[1] = ndc[3];
+	vert[3].position[0] = ndc[0]; vert[3].position[1] = ndc[3];
+	for (int i = 0; i < 4; i++)
+		vert[i].position[2] = 0.0f;
+
+	glDisable( GL_DEPTH_TEST );
+	glLineWidth( 1.0 );
+	drawVertexPos( GL_LINE_LOOP, vert, 4, &marquee_color );
+	glEnable( GL_DEPTH_TEST );
+
+	glm_mat4_copy( tmp_projection, gl.projection );
+	glm_mat4_copy( tmp_modelview, gl.modelview );
+	ogl_upload_matrices( FALSE );
+}
+
+
 /* Top-level call to draw viewport content */
 void
 geometry_draw( boolean high_detail )
 {
+	PerfScope perf;
+
 	if (about( ABOUT_CHECK )) {
 		/* Currently giving About presentation */
 		if (high_detail)
@@ -3151,6 +3175,9 @@ geometry_draw( boolean high_detail )
 		return;
 	}
 
+	selection_mask_upload( );
+
+	perfctr_begin( &perf, PERF_PHASE_DRAW );
 	switch (globals.fsv_mode) {
 		case FSV_SPLASH:
 		splash_draw( );
@@ -3170,6 +3197,10 @@ geometry_draw( boolean high_detail )
 
 		SWITCH_FAIL
 	}
+	perfctr_end( &perf, (globals.fsv_mode == FSV_SPLASH) ? 0 : fstree_num_nodes( ) );
+
+	if (gl.render_mode == RENDERMODE_RENDER)
+		selection_draw_marquee( );
 }
 
 
@@ -3201,6 +3232,9 @@ geometry_colexp_initiated( GNode *dnode )
 {
 	g_assert( NODE_IS_DIR(dnode) );
 
+	/* Layouts put away for other modes assume the old state */
+	layout_cache_clear( );
+
 	/* A newly expanding directory in TreeV mode will probably
 	 * need (re)shaping (it may be appearing for the first time,
 	 * or its inner radius may have changed) */
@@ -3220,8 +3254,10 @@ geometry_colexp_in_progress( GNode *dnode )
 	 * properly, then directory geometry has to be rebuilt */
         if (DIR_NODE_DESC(dnode)->geom_expanded != (DIR_NODE_DESC(dnode)->deployment > EPSILON))
 		geometry_queue_rebuild( dnode );
-        else
+        else {
+		damage_dir( dnode );
 		queue_uncached_draw( );
+	}
 
 	if (globals.fsv_mode == FSV_TREEV) {
 		/* Take care of shifting angles */
@@ -3230,6 +3266,76 @@ geometry_colexp_in_progress( GNode *dnode )
 }
 
 
+/* This is called when the contents of a directory have been replaced
+ * (see rescan.c). Only the directory's own subtree is laid out anew;
+ * the directory keeps its place and footprint in its parent */
+void
+geometry_subtree_changed( GNode *dnode )
+{
+	g_assert( NODE_IS_DIR(dnode) );
+
+	layout_cache_clear( );
+
+	switch (globals.fsv_mode) {
+		case FSV_DISCV:
+		layout_discv_subtree( dnode );
+		break;
+
+		case FSV_MAPV:
+		layout_mapv_subtree( dnode );
+		break;
+
+		case FSV_TREEV:
+		layout_treev_subtree( dnode, geometry_treev_platform_r0( dnode ) );
+		/* Width of the subtree may have changed */
+		treev_queue_rearrange( dnode );
+		break;
+
+		case FSV_SPLASH:
+		/* Tree will be laid out when the scan completes */
+		return;
+
+		SWITCH_FAIL
+	}
+
+	/* The directory itself is drawn with its parent's contents */
+	if (NODE_IS_DIR(dnode->parent))
+		geometry_queue_rebuild( dnode->parent );
+
+	color_assign_recursive( dnode );
+}
+
+
+/* Shows the small files of a directory individually, instead of as one
+ * "N small files" node. The directory's contents are laid out anew */
+void
+geometry_show_small_files( GNode *dnode )
+{
+	g_assert( NODE_IS_DIR(dnode) );
+
+	if (DIR_NODE_DESC(dnode)->small_files == NULL)
+		return;
+
+	DIR_NODE_DESC(dnode)->small_files_shown = TRUE;
+	geometry_subtree_changed( dnode );
+
+	/* TreeV leaves are otherwise placed as they are drawn, and the
+	 * newly shown ones may be looked at before that */
+	if ((globals.fsv_mode == FSV_TREEV) && !DIR_COLLAPSED(dnode))
+		treev_arrange_leaves( dnode, geometry_treev_platform_r0( dnode ) );
+}
+
+
+/* This is called when node colors are about to be reassigned. Colors
+ * are baked into retained geometry, so buffers kept for other modes
+ * have to go (their layouts are still good) */
+void
+geometry_colors_changed( void )
+{
+	layout_cache_drop_buffers( );
+}
+
+
 /* This tells if the specified node should be highlighted.  */
 boolean
 geometry_should_highlight(GNode *node)
@@ -3254,6 +3360,98 @@ geometry_should_highlight(GNode *node)
 }
 
 
+/* Gets the bounding box of a node, as drawn in the current layout.
+ * Returns FALSE if this is not available (DiscV mode) */
+boolean
+geometry_node_extents( GNode *node, XYZvec *c0, XYZvec *c1 )
+{
+	RTZvec rtz_c0, rtz_c1;
+	double r, theta, x, y;
+	double axis_theta;
+	int i;
+
+	switch (globals.fsv_mode) {
+		case FSV_MAPV:
+		c0->x = MAPV_GEOM_PARAMS(node)->c0.x;
+		c0->y = MAPV_GEOM_PARAMS(node)->c0.y;
+		c0->z = geometry_mapv_node_z0( node );
+		c1->x = MAPV_GEOM_PARAMS(node)->c1.x;
+		c1->y = MAPV_GEOM_PARAMS(node)->c1.y;
+		c1->z = c0->z + MAPV_GEOM_PARAMS(node)->height;
+		return TRUE;
+
+		case FSV_TREEV:
+		treev_get_corners( node, &rtz_c0, &rtz_c1 );
+		c0->x = c0->y = G_MAXDOUBLE;
+		c1->x = c1->y = - G_MAXDOUBLE;
+		/* Outer corners of the polar region... */
+		for (i = 0; i < 4; i++) {
+			r = (i & 1) ? rtz_c1.r : rtz_c0.r;
+			theta = (i & 2) ? rtz_c1.theta : rtz_c0.theta;
+			x = r * cos( RAD(theta) );
+			y = r * sin( RAD(theta) );
+			c0->x = MIN(c0->x, x);
+			c0->y = MIN(c0->y, y);
+			c1->x = MAX(c1->x, x);
+			c1->y = MAX(c1->y, y);
+		}
+		/* ...plus the points where its outer edge crosses an axis */
+		axis_theta = 90.0 * ceil( rtz_c0.theta / 90.0 );
+		for (; axis_theta <= rtz_c1.theta; axis_theta += 90.0) {
+			x = rtz_c1.r * cos( RAD(axis_theta) );
+			y = rtz_c1.r * sin( RAD(axis_theta) );
+			c0->x = MIN(c0->x, x);
+			c0->y = MIN(c0->y, y);
+			c1->x = MAX(c1->x, x);
+			c1->y = MAX(c1->y, y);
+		}
+		c0->z = rtz_c0.z;
+		c1->z = rtz_c1.z;
+		return TRUE;
+
+		case FSV_DISCV:
+		case FSV_SPLASH:
+		return FALSE;
+
+		SWITCH_FAIL
+	}
+
+	return FALSE;
+}
+
+
+/* This is called when the selection changes, with the nodes that were
+ * selected or deselected. Only those and the marquee are redrawn */
+void
+geometry_selection_changed( GNode **nodes, unsigned int num_nodes )
+{
+	XYZvec c0, c1;
+	float ndc[4];
+	unsigned int id, i;
+
+	selection_tbo.dirty = TRUE;
+	for (i = 0; i < num_nodes; i++) {
+		id = NODE_DESC(nodes[i])->id;
+		selection_tbo.dirty_first = MIN(selection_tbo.dirty_first, id);
+		selection_tbo.dirty_end = MAX(selection_tbo.dirty_end, id + 1);
+	}
+
+	if (globals.fsv_mode != FSV_MAPV)
+		ogl_damage_all( );
+	else {
+		if (marquee_drawn)
+			ogl_damage_ndc_outline( marquee_drawn_ndc );
+		if (selection_marquee( ndc ))
+			ogl_damage_ndc_outline( ndc );
+		for (i = 0; (i < num_nodes) && !ogl_full_redraw_pending( ); i++) {
+			geometry_node_extents( nodes[i], &c0, &c1 );
+			ogl_damage_box( &c0, &c1 );
+		}
+	}
+	redraw_damaged( );
+}
+
+
 /* Draws a single node, in its absolute position */
 __attribute__((unused)) static void
 draw_node( GNode *node )
@@ -3299,14 +3497,36 @@ draw_node( GNode *node )
 void
 geometry_highlight_node( GNode *node, boolean strong )
 {
-	if (!node)
-		highlight_node_id = 0;
-	else {
-		highlight_node_id = NODE_DESC(node)->id;
+	unsigned int node_id;
+
+	node_id = (node == NULL) ? 0 : NODE_DESC(node)->id;
+	if (node_id == highlight_node_id) {
+		/* Nothing to redraw; the frame only gets put back up */
+		if (node != NULL)
+			redraw_damaged( );
+		return;
+	}
+
+	/* Only the previously and newly highlighted nodes need redrawing */
+	if (highlight_node_id != 0) {
+		if (highlight_box_valid)
+			ogl_damage_box( &highlight_c0, &highlight_c1 );
+		else
+			ogl_damage_all( );
+	}
+	highlight_node_id = node_id;
+	highlight_box_valid = FALSE;
+	if (node != NULL) {
 		//g_print("Highlighting node %u %s\n", highlight_node_id, NODE_DESC(node)->name);
-		//draw_node(node);
-		redraw();
+		if (globals.fsv_mode == FSV_MAPV) {
+			geometry_node_extents( node, &highlight_c0, &highlight_c1 );
+			highlight_box_valid = TRUE;
+			ogl_damage_box( &highlight_c0, &highlight_c1 );
+		}
+		else
+			ogl_damage_all( );
 	}
+	redraw_damaged( );
 }
 
 
@@ -3315,14 +3535,19 @@ geometry_highlight_node( GNode *node, boolean strong )
 void
 geometry_free_recursive( GNode *dnode )
 {
-	//DirNodeDesc *dir_ndesc;
 	GNode *node;
 
 	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
 
-	//dir_ndesc = DIR_NODE_DESC(dnode);
+	/* Put-away layouts won't match the tree anymore. If the whole
+	 * tree is going, then so is the current layout */
+	layout_cache_clear( );
+	if (NODE_IS_METANODE(dnode))
+		layout_mode = FSV_NONE;
 
-	// TODO delete VBO's?
+	/* Release retained buffers */
+	gpumem_free( dnode );
+	minimap_forget( dnode );
 
 	/* Recurse into subdirectories */
 	node = dnode->children;
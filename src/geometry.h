@@ -18,6 +18,7 @@
 
 /* Exported geometry constants */
 #define TREEV_LEAF_NODE_EDGE		256.0
+#define TREEV_PLATFORM_SPACING_WIDTH	512.0
 #define TREEV_PLATFORM_SPACING_DEPTH	2048.0
 
 #define DISCV_GEOM_PARAMS(node)		((DiscVGeomParams *)(NODE_DESC(node)->geomparams))
@@ -93,7 +94,13 @@ void geometry_draw( boolean high_detail );
 void geometry_camera_pan_finished( void );
 void geometry_colexp_initiated( GNode *dnode );
 void geometry_colexp_in_progress( GNode *dnode );
+void geometry_subtree_changed( GNode *dnode );
+void geometry_show_small_files( GNode *dnode );
+void geometry_colors_changed( void );
+boolean geometry_shed_layouts( void );
 boolean geometry_should_highlight(GNode *node);
+boolean geometry_node_extents( GNode *node, XYZvec *c0, XYZvec *c1 );
+void geometry_selection_changed( GNode **nodes, unsigned int num_nodes );
 void geometry_highlight_node( GNode *node, boolean strong );
 void geometry_free_recursive( GNode *dnode );
 
@@ -0,0 +1,456 @@
+/* gpumem.c */
+
+/* GPU memory budget */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "gpumem.h"
+
+#include "mempressure.h" /* mempressure_rebuilt( ) */
+#include "profile.h"
+
+
+/* Retained GPU resources are accounted per owning directory. Owners with
+ * resident data sit in an LRU list, most recently drawn first; when the
+ * total goes over budget at the end of a frame, whole directories are
+ * evicted from the tail of the list. Evicted data is not lost, just
+ * forgotten: the geometry code sees a missing buffer on the next draw
+ * and rebuilds it. Software rasterizers (e.g. llvmpipe) keep "GPU"
+ * buffers in system memory, so without a budget a large tree could
+ * exhaust host RAM as well */
+
+
+/* A resident resource */
+struct GpuResource {
+	GLuint		name;		/* Buffer/texture name (0 if none) */
+	GLenum		target;		/* Buffer target, or GL_TEXTURE_2D */
+	size_t		size;		/* Size (bytes) */
+	GLsizei		count;		/* Element count (caller-defined) */
+};
+
+/* Per-directory accounting record. DirNodeDesc.gpu_owner points here */
+typedef struct _GpuOwner GpuOwner;
+struct _GpuOwner {
+	GNode		*dnode;
+	struct GpuResource res[NUM_GPUMEM_SLOTS];
+	size_t		size;		/* Sum of resource sizes */
+	unsigned int	last_frame;	/* Frame in which last used */
+	GList		lru_link;	/* Link in LRU list (data == self) */
+	boolean		resident;	/* TRUE if in LRU list */
+	boolean		evicted;	/* TRUE if data was evicted and not
+					 * yet rebuilt */
+	boolean		shed;		/* ditto, under memory pressure */
+};
+
+
+/* LRU list of owners with resident data (head == most recent) */
+static GQueue lru_queue = G_QUEUE_INIT;
+
+/* Budget and current usage (bytes) */
+static int64 budget = (int64)GPUMEM_DEFAULT_BUDGET_MB << 20;
+static int64 resident_size = 0;
+static int64 pinned_size = 0;
+
+/* Frame counter */
+static unsigned int frame = 1;
+
+/* Names awaiting deletion. Resources may be released at times when
+ * there is no current GL context (e.g. while a new scan tears down the
+ * old tree), so deletion is deferred to the end of the next frame */
+static GArray *dead_buffers = NULL;
+static GArray *dead_textures = NULL;
+
+/* Running totals */
+static int64 num_uploads = 0;
+static int64 num_rebuilds = 0;
+static int64 num_evictions = 0;
+static int64 num_evicted_bytes = 0;
+
+
+/* Returns the accounting record of a directory, creating it if needed */
+static GpuOwner *
+owner_get( GNode *dnode )
+{
+	DirNodeDesc *dir_ndesc;
+	GpuOwner *owner;
+
+	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
+
+	dir_ndesc = DIR_NODE_DESC(dnode);
+	owner = (GpuOwner *)dir_ndesc->gpu_owner;
+	if (owner == NULL) {
+		owner = g_slice_new0(GpuOwner);
+		owner->dnode = dnode;
+		owner->lru_link.data = owner;
+		dir_ndesc->gpu_owner = owner;
+	}
+
+	return owner;
+}
+
+
+/* Marks an owner as used in the current frame, and moves it to the head
+ * of the LRU list */
+static void
+owner_touch( GpuOwner *owner )
+{
+	owner->last_frame = frame;
+
+	if (owner->resident) {
+		if (lru_queue.head == &owner->lru_link)
+			return;
+		g_queue_unlink( &lru_queue, &owner->lru_link );
+	}
+	g_queue_push_head_link( &lru_queue, &owner->lru_link );
+	owner->resident = TRUE;
+}
+
+
+/* Queues a resource for deletion and clears its record */
+static void
+resource_release( GpuOwner *owner, struct GpuResource *res )
+{
+	if (res->name != 0) {
+		if (res->target == GL_TEXTURE_2D) {
+			if (dead_textures == NULL)
+				dead_textures = g_array_new( FALSE, FALSE, sizeof(GLuint) );
+			g_array_append_val( dead_textures, res->name );
+		}
+		else {
+			if (dead_buffers == NULL)
+				dead_buffers = g_array_new( FALSE, FALSE, sizeof(GLuint) );
+			g_array_append_val( dead_buffers, res->name );
+		}
+	}
+
+	owner->size -= res->size;
+	resident_size -= res->size;
+	memset( res, 0, sizeof(struct GpuResource) );
+}
+
+
+/* Releases all resources of an owner, and takes it off the LRU list */
+static void
+owner_release( GpuOwner *owner )
+{
+	int s;
+
+	for (s = 0; s < NUM_GPUMEM_SLOTS; s++)
+		resource_release( owner, &owner->res[s] );
+	g_assert( owner->size == 0 );
+
+	if (owner->resident) {
+		g_queue_unlink( &lru_queue, &owner->lru_link );
+		owner->resident = FALSE;
+	}
+}
+
+
+/* Updates the profiler with current residency */
+static void
+update_gauges( void )
+{
+	profile_gauge( "gpu.budget_bytes", budget );
+	profile_gauge( "gpu.resident_bytes", resident_size + pinned_size );
+	profile_gauge( "gpu.resident_dirs", lru_queue.length );
+}
+
+
+/* Uploads data into one of a directory's retained buffers (creating the
+ * buffer if necessary), and returns the buffer name. count is stored
+ * along with the buffer, for the caller's benefit (e.g. index count) */
+GLuint
+gpumem_upload( GNode *dnode, GpuMemSlot slot, GLenum target, const void *data, size_t size, GLsizei count )
+{
+	GpuOwner *owner;
+	struct GpuResource *res;
+
+	owner = owner_get( dnode );
+	res = &owner->res[slot];
+	g_assert( res->name == 0 || res->target == target );
+
+	if (res->name == 0) {
+		glGenBuffers( 1, &res->name );
+		res->target = target;
+	}
+	glBindBuffer( target, res->name );
+	glBufferData( target, size, data, GL_STATIC_DRAW );
+	glBindBuffer( target, 0 );
+
+	owner->size += size - res->size;
+	resident_size += (int64)size - (int64)res->size;
+	res->size = size;
+	res->count = count;
+
+	++num_uploads;
+	profile_count( "gpu.uploads", 1 );
+	profile_count( "gpu.upload_bytes", size );
+	if (owner->evicted) {
+		/* Data is back after an eviction */
+		owner->evicted = FALSE;
+		++num_rebuilds;
+		profile_count( "gpu.rebuilds", 1 );
+		if (owner->shed) {
+			owner->shed = FALSE;
+			mempressure_rebuilt( MEMPRESSURE_GEOMETRY );
+		}
+	}
+
+	owner_touch( owner );
+
+	return res->name;
+}
+
+
+/* Accounts a texture created by the caller as a retained resource of the
+ * given directory. Ownership of the texture passes to this module */
+void
+gpumem_account_texture( GNode *dnode, GpuMemSlot slot, GLuint texture, size_t size )
+{
+	GpuOwner *owner;
+	struct GpuResource *res;
+
+	owner = owner_get( dnode );
+	res = &owner->res[slot];
+	if (res->name != texture)
+		resource_release( owner, res );
+	else {
+		/* Same texture, new contents */
+		owner->size -= res->size;
+		resident_size -= res->size;
+	}
+
+	res->name = texture;
+	res->target = GL_TEXTURE_2D;
+	res->size = size;
+	res->count = 0;
+	owner->size += size;
+	resident_size += size;
+
+	++num_uploads;
+	profile_count( "gpu.uploads", 1 );
+	profile_count( "gpu.upload_bytes", size );
+	if (owner->evicted) {
+		owner->evicted = FALSE;
+		++num_rebuilds;
+		profile_count( "gpu.rebuilds", 1 );
+		if (owner->shed) {
+			owner->shed = FALSE;
+			mempressure_rebuilt( MEMPRESSURE_GEOMETRY );
+		}
+	}
+
+	owner_touch( owner );
+}
+
+
+/* Returns the name of a directory's retained resource, or 0 if it is not
+ * resident (never built, or evicted). The count given at upload time is
+ * returned in count, if non-NULL. Looking up a resource counts as using
+ * it, for purposes of eviction */
+GLuint
+gpumem_lookup( GNode *dnode, GpuMemSlot slot, GLsizei *count )
+{
+	GpuOwner *owner;
+	struct GpuResource *res;
+
+	owner = (GpuOwner *)DIR_NODE_DESC(dnode)->gpu_owner;
+	if ((owner == NULL) || (owner->res[slot].name == 0)) {
+		if (count != NULL)
+			*count = 0;
+		return 0;
+	}
+
+	res = &owner->res[slot];
+	if (count != NULL)
+		*count = res->count;
+	owner_touch( owner );
+
+	return res->name;
+}
+
+
+/* Takes a directory's retained resources away from it, without releasing
+ * them, and returns a handle to them (NULL if there are none). Detached
+ * resources stay accounted, and are evicted in LRU order like any others.
+ * The handle must eventually go to gpumem_attach( ) or gpumem_discard( ) */
+void *
+gpumem_detach( GNode *dnode )
+{
+	DirNodeDesc *dir_ndesc;
+	GpuOwner *owner;
+
+	dir_ndesc = DIR_NODE_DESC(dnode);
+	owner = (GpuOwner *)dir_ndesc->gpu_owner;
+	if (owner != NULL) {
+		owner->dnode = NULL;
+		dir_ndesc->gpu_owner = NULL;
+	}
+
+	return owner;
+}
+
+
+/* Gives detached resources back to a directory (which must have none) */
+void
+gpumem_attach( GNode *dnode, void *handle )
+{
+	GpuOwner *owner = (GpuOwner *)handle;
+
+	g_assert( DIR_NODE_DESC(dnode)->gpu_owner == NULL );
+
+	if (owner != NULL)
+		owner->dnode = dnode;
+	DIR_NODE_DESC(dnode)->gpu_owner = owner;
+}
+
+
+/* Releases detached resources.
+ * (Needn't be called with a current GL context) */
+void
+gpumem_discard( void *handle )
+{
+	GpuOwner *owner = (GpuOwner *)handle;
+
+	if (owner == NULL)
+		return;
+
+	owner_release( owner );
+	g_slice_free( GpuOwner, owner );
+
+	update_gauges( );
+}
+
+
+/* Releases all retained resources of a directory, and forgets about it.
+ * (Needn't be called with a current GL context) */
+void
+gpumem_free( GNode *dnode )
+{
+	gpumem_discard( gpumem_detach( dnode ) );
+}
+
+
+/* Accounts for GPU memory which is not owned by any directory and is
+ * never evicted (e.g. the font texture). delta may be negative */
+void
+gpumem_pin( int64 delta )
+{
+	pinned_size += delta;
+	g_assert( pinned_size >= 0 );
+	update_gauges( );
+}
+
+
+/* Evicts least-recently-used directories until at least size bytes have
+ * been released, stopping at the first directory used in or after frame
+ * keep_frame. Returns the number of bytes released */
+static int64
+evict( int64 size, unsigned int keep_frame, boolean shed )
+{
+	GpuOwner *owner;
+	int64 released = 0;
+
+	while ((released < size) && (lru_queue.tail != NULL)) {
+		owner = (GpuOwner *)lru_queue.tail->data;
+		if (owner->last_frame >= keep_frame)
+			break; /* everything else is in use */
+		released += owner->size;
+		owner_release( owner );
+		owner->evicted = TRUE;
+		owner->shed = shed;
+		++num_evictions;
+		profile_count( "gpu.evictions", 1 );
+	}
+
+	num_evicted_bytes += released;
+	profile_count( "gpu.evicted_bytes", released );
+	update_gauges( );
+
+	return released;
+}
+
+
+/* Evicts least-recently-used directories until at least size bytes have
+ * been released (or nothing evictable is left). Directories used in the
+ * current frame are never evicted. Returns the number of bytes released */
+int64
+gpumem_evict( int64 size )
+{
+	return evict( size, frame, FALSE );
+}
+
+
+/* Evicts every directory which was not drawn in the last frame (i.e. is
+ * off-screen, or belongs to a layout put away for another mode). Call
+ * between frames. Returns FALSE if there were none */
+boolean
+gpumem_evict_offscreen( void )
+{
+	return evict( G_MAXINT64, frame - 1, TRUE ) > 0;
+}
+
+
+/* Call at the end of every rendered frame (with the GL context current).
+ * Enforces the budget and deletes released resources */
+void
+gpumem_frame_end( void )
+{
+	int64 total;
+
+	total = resident_size + pinned_size;
+	if (total > budget)
+		gpumem_evict( total - budget );
+
+	if ((dead_buffers != NULL) && (dead_buffers->len > 0)) {
+		glDeleteBuffers( dead_buffers->len, (GLuint *)dead_buffers->data );
+		g_array_set_size( dead_buffers, 0 );
+	}
+	if ((dead_textures != NULL) && (dead_textures->len > 0)) {
+		glDeleteTextures( dead_textures->len, (GLuint *)dead_textures->data );
+		g_array_set_size( dead_textures, 0 );
+	}
+
+	++frame;
+	update_gauges( );
+}
+
+
+/* Sets the budget (in bytes). Takes effect at the end of the next frame */
+void
+gpumem_set_budget( int64 size )
+{
+	budget = MAX(0, size);
+	update_gauges( );
+}
+
+
+/* Returns the budget (in bytes) */
+int64
+gpumem_get_budget( void )
+{
+	return budget;
+}
+
+
+/* Fills in residency statistics */
+void
+gpumem_get_stats( GpuMemStats *stats )
+{
+	stats->budget = budget;
+	stats->resident = resident_size + pinned_size;
+	stats->pinned = pinned_size;
+	stats->num_owners = lru_queue.length;
+	stats->uploads = num_uploads;
+	stats->rebuilds = num_rebuilds;
+	stats->evictions = num_evictions;
+	stats->evicted_bytes = num_evicted_bytes;
+}
+
+
+/* end gpumem.c */
@@ -0,0 +1,62 @@
+/* gpumem.h */
+
+/* GPU memory budget */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_GPUMEM_H
+	#error
+#endif
+#define FSV_GPUMEM_H
+
+
+#include <epoxy/gl.h>
+
+
+/* Default GPU memory budget, in megabytes */
+#define GPUMEM_DEFAULT_BUDGET_MB	256
+
+/* Resources a directory may keep resident on the GPU */
+typedef enum {
+	GPUMEM_GEOMETRY_VERTICES,	/* Children geometry (vertex buffer) */
+	GPUMEM_GEOMETRY_INDICES,	/* Children geometry (index buffer) */
+	GPUMEM_LABELS,			/* Label geometry / data */
+	GPUMEM_TEXTURE,			/* Per-directory texture */
+	NUM_GPUMEM_SLOTS
+} GpuMemSlot;
+
+/* Residency statistics */
+typedef struct _GpuMemStats GpuMemStats;
+struct _GpuMemStats {
+	int64		budget;		/* Budget (bytes) */
+	int64		resident;	/* Bytes currently resident */
+	int64		pinned;		/* Of which not evictable */
+	int		num_owners;	/* Directories with resident data */
+	int64		uploads;	/* Total uploads */
+	int64		rebuilds;	/* Uploads following an eviction */
+	int64		evictions;	/* Directories evicted */
+	int64		evicted_bytes;	/* Bytes released by eviction */
+};
+
+
+GLuint gpumem_upload( GNode *dnode, GpuMemSlot slot, GLenum target, const void *data, size_t size, GLsizei count );
+void gpumem_account_texture( GNode *dnode, GpuMemSlot slot, GLuint texture, size_t size );
+GLuint gpumem_lookup( GNode *dnode, GpuMemSlot slot, GLsizei *count );
+void *gpumem_detach( GNode *dnode );
+void gpumem_attach( GNode *dnode, void *handle );
+void gpumem_discard( void *handle );
+void gpumem_free( GNode *dnode );
+void gpumem_pin( int64 delta );
+int64 gpumem_evict( int64 size );
+boolean gpumem_evict_offscreen( void );
+void gpumem_frame_end( void );
+void gpumem_set_budget( int64 size );
+int64 gpumem_get_budget( void );
+void gpumem_get_stats( GpuMemStats *stats );
+
+
+/* end gpumem.h */
@@ -423,6 +423,49 @@ gui_filelist_scan_new(GtkWidget *parent_w)
 	return view;
 }
 
+/* The list widget for the bytes-by-extension dialog (fitted into a
+ * scrolled window). Clicking on a column header sorts by it */
+GtkWidget *
+gui_extstats_list_new(GtkWidget *parent_w)
+{
+	static const char *titles[] = { "Extension", "Files", "Size" };
+	static const int sort_columns[] = { EXTSTATS_EXT_COLUMN, EXTSTATS_COUNT_COLUMN, EXTSTATS_SIZE_COLUMN };
+	GtkWidget *scrollwin_w;
+	int i;
+
+	/* Make the scrolled window widget */
+	scrollwin_w = gtk_scrolled_window_new( NULL, NULL );
+	gtk_scrolled_window_set_policy( GTK_SCROLLED_WINDOW(scrollwin_w), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC );
+        parent_child_full( parent_w, scrollwin_w, EXPAND, FILL );
+
+	/* Make the tree view widget */
+	GtkWidget *view = gtk_tree_view_new();
+
+	for (i = 0; i < 3; i++) {
+		GtkTreeViewColumn *col = gtk_tree_view_column_new();
+		gtk_tree_view_column_set_title(col, _(titles[i]));
+		gtk_tree_view_column_set_sort_column_id(col, sort_columns[i]);
+		gtk_tree_view_append_column(GTK_TREE_VIEW(view), col);
+
+		GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+		if (i > 0)
+			g_object_set(G_OBJECT(renderer), "xalign", 1.0, NULL);
+		gtk_tree_view_column_pack_start(col, renderer, TRUE);
+		gtk_tree_view_column_add_attribute(col, renderer, "text", i);
+	}
+
+	GtkListStore *liststore = gtk_list_store_new(EXTSTATS_NUM_COLS,
+		G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_INT64);
+	GtkTreeModel *model = GTK_TREE_MODEL(liststore);
+	gtk_tree_view_set_model(GTK_TREE_VIEW(view), model);
+	g_object_unref(model);
+
+	gtk_container_add( GTK_CONTAINER(scrollwin_w), view );
+	gtk_widget_show(view);
+
+	return view;
+}
+
 /* The tree widget (fitted into a scrolled window) */
 GtkWidget *
 gui_tree_add( GtkWidget *parent_w )
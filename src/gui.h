@@ -70,6 +70,16 @@ enum
 	DIALOG_WPATTERN_ROWDATA_COLUMN, // Hidden, contains WpListRowData
 	DIALOG_WPATTERN_NUM_COLS
 };
+
+// For the TreeView (bytes by extension)
+enum
+{
+	EXTSTATS_EXT_COLUMN = 0,
+	EXTSTATS_COUNT_COLUMN,
+	EXTSTATS_SIZE_TEXT_COLUMN,
+	EXTSTATS_SIZE_COLUMN, // Hidden, sort key for the size text
+	EXTSTATS_NUM_COLS
+};
 #endif /* __GTK_H__ */
 
 
@@ -88,6 +98,7 @@ GtkWidget *gui_colorpicker_add( GtkWidget *parent_w, RGBcolor *init_color, const
 void gui_colorpicker_set_color( GtkWidget *colorpicker_w, RGBcolor *color );
 GtkWidget *gui_filelist_new(GtkWidget *parent_w);
 GtkWidget *gui_filelist_scan_new(GtkWidget *parent_w);
+GtkWidget *gui_extstats_list_new(GtkWidget *parent_w);
 GtkWidget *gui_tree_add( GtkWidget *parent_w );
 GtkTreePath *gui_tree_node_add( GtkWidget *tree_w, GtkTreePath *parent, Icon icon_pair[2], const char *text, boolean expanded, GNode *data );
 void gui_cursor( GtkWidget *widget, int glyph );
@@ -0,0 +1,949 @@
+/* layout.c */
+
+/* Layout engines */
+
+/* fsv - 3D File System Visualizer
+ * Copyright (C)1999 Daniel Richard G. <skunk@mit.edu>
+ * SPDX-FileCopyrightText: 2021 Janne Blomqvist <blomqvist.janne@gmail.com>
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "layout.h"
+
+#include "geometry.h" /* *_GEOM_PARAMS( ) */
+
+
+/* The layout engines assign each node its place in the visualization
+ * (the geometry parameters in its descriptor) from the sizes in the
+ * tree, and nothing else. What is expanded, and what has to be done
+ * when a directory moves, is up to whoever is showing the layout */
+
+
+/* Callbacks to the viewer */
+static const LayoutHooks no_hooks = { NULL };
+static const LayoutHooks *layout_hooks = &no_hooks;
+static void *layout_hooks_data = NULL;
+
+
+/* Sets the callbacks for all layout engines (hooks may be NULL) */
+void
+layout_set_hooks( const LayoutHooks *hooks, void *data )
+{
+	layout_hooks = (hooks != NULL) ? hooks : &no_hooks;
+	layout_hooks_data = data;
+}
+
+
+/* Checks if a directory is shown expanded */
+boolean
+layout_dir_expanded( GNode *dnode )
+{
+	if (layout_hooks->dir_expanded == NULL)
+		return TRUE;
+
+	return (layout_hooks->dir_expanded)( dnode, layout_hooks_data );
+}
+
+
+/* Reports a change in a directory's geometry to the viewer */
+static void
+dir_changed( GNode *dnode )
+{
+	if (layout_hooks->dir_changed != NULL)
+		(layout_hooks->dir_changed)( dnode, layout_hooks_data );
+}
+
+
+/* Sets a directory fully deployed or not, as it is expanded or not */
+static void
+dir_deploy( GNode *dnode )
+{
+	if (layout_hooks->dir_deploy != NULL)
+		(layout_hooks->dir_deploy)( dnode, layout_hooks_data );
+
+	if (layout_dir_expanded( dnode ))
+		DIR_NODE_DESC(dnode)->deployment = 1.0;
+	else
+		DIR_NODE_DESC(dnode)->deployment = 0.0;
+	dir_changed( dnode );
+}
+
+
+/**** SMALL FILES *********************************************/
+
+
+/* Directories full of tiny files come out as a multitude of specks, which
+ * cost as much to lay out and draw as anything else. Files that account
+ * for less than a given fraction of their directory's total can instead
+ * be merged into a single "N small files" node. As directory contents
+ * are sorted by decreasing size (files after subdirectories), these are
+ * always the last few children. The first of them stands for the lot in
+ * the layout, and the others share its place */
+
+
+/* Fewest number of files worth merging */
+#define SMALL_FILES_MIN_COUNT	2
+
+
+/* Fraction of a directory's total size under which a file is merged
+ * with the other small files, by mode (0 == never) */
+static double small_files_fraction[FSV_SPLASH] = { 0.0, 0.0, 0.0 };
+
+
+/* Sets the small file fraction of a mode. Only MapV and TreeV merge
+ * small files */
+void
+layout_set_small_files( FsvMode mode, double fraction )
+{
+	g_assert( (mode == FSV_MAPV) || (mode == FSV_TREEV) );
+
+	small_files_fraction[mode] = CLAMP(fraction, 0.0, 1.0);
+}
+
+
+/* Works out which of a directory's children get merged into a "small
+ * files" node, if any */
+static void
+small_files_gather( GNode *dnode, FsvMode mode )
+{
+	DirNodeDesc *dir_ndesc;
+	GNode *node, *first_node = NULL;
+	int64 threshold;
+	unsigned int n = 0;
+
+	g_assert( NODE_IS_DIR(dnode) );
+
+	dir_ndesc = DIR_NODE_DESC(dnode);
+	dir_ndesc->small_files = NULL;
+	dir_ndesc->num_small_files = 0;
+
+	if ((small_files_fraction[mode] <= 0.0) || dir_ndesc->small_files_shown)
+		return;
+
+	threshold = (int64)(small_files_fraction[mode] * (double)dir_ndesc->subtree.size);
+	node = g_node_last_child( dnode );
+	while ((node != NULL) && !NODE_IS_DIR(node) && (NODE_DESC(node)->size < threshold)) {
+		first_node = node;
+		++n;
+		node = node->prev;
+	}
+
+	if (n >= SMALL_FILES_MIN_COUNT) {
+		dir_ndesc->small_files = first_node;
+		dir_ndesc->num_small_files = n;
+	}
+}
+
+
+/* Returns the node standing for the given one in the layout: the "small
+ * files" node it has been merged into, if any, or else itself */
+GNode *
+layout_small_files_node( GNode *node )
+{
+	GNode *first_node;
+
+	if (NODE_IS_DIR(node) || NODE_IS_METANODE(node))
+		return node;
+
+	/* Everything from the first small file onward is as small */
+	first_node = DIR_NODE_DESC(node->parent)->small_files;
+	if ((first_node != NULL) && (NODE_DESC(node)->size <= NODE_DESC(first_node)->size))
+		return first_node;
+
+	return node;
+}
+
+
+/* Checks if a node is a "small files" node */
+boolean
+layout_is_small_files( GNode *node )
+{
+	if (NODE_IS_DIR(node) || NODE_IS_METANODE(node))
+		return FALSE;
+
+	return node == DIR_NODE_DESC(node->parent)->small_files;
+}
+
+
+/* Returns the combined size of a directory's merged small files */
+int64
+layout_small_files_size( GNode *dnode )
+{
+	GNode *node;
+	int64 size = 0;
+
+	node = DIR_NODE_DESC(dnode)->small_files;
+	while (node != NULL) {
+		size += NODE_DESC(node)->size;
+		node = node->next;
+	}
+
+	return size;
+}
+
+
+/* Returns the number of nodes that a directory's contents come to in
+ * the layout, with a "small files" node counting as one */
+int
+layout_num_children_shown( GNode *dnode )
+{
+	int n;
+
+	n = (int)g_node_n_children( dnode );
+	if (DIR_NODE_DESC(dnode)->small_files != NULL)
+		n -= (int)DIR_NODE_DESC(dnode)->num_small_files - 1;
+
+	return n;
+}
+
+
+/* Has the small files merged into a "small files" node take its place,
+ * once the layout has put it somewhere */
+void
+layout_small_files_share( GNode *dnode )
+{
+	GNode *first_node, *node;
+
+	first_node = DIR_NODE_DESC(dnode)->small_files;
+	if (first_node == NULL)
+		return;
+
+	node = first_node->next;
+	while (node != NULL) {
+		memcpy( NODE_DESC(node)->geomparams, NODE_DESC(first_node)->geomparams, sizeof(NODE_DESC(node)->geomparams) );
+		node = node->next;
+	}
+}
+
+
+/**** DISC VISUALIZATION **************************************/
+
+
+/* Geometry constants */
+#define DISCV_LEAF_RANGE_ARC_WIDTH	315.0
+#define DISCV_LEAF_STEM_PROPORTION	0.5
+
+
+/* Compare function for sorting nodes (by size) */
+static int
+discv_node_compare( GNode *a, GNode *b )
+{
+	int64 a_size, b_size;
+
+	a_size = NODE_DESC(a)->size;
+	if (NODE_IS_DIR(a))
+		a_size += DIR_NODE_DESC(a)->subtree.size;
+
+	b_size = NODE_DESC(b)->size;
+	if (NODE_IS_DIR(b))
+		b_size += DIR_NODE_DESC(b)->subtree.size;
+
+	if (a_size < b_size)
+		return 1;
+	if (a_size > b_size)
+		return -1;
+
+	return strcmp( NODE_DESC(a)->name, NODE_DESC(b)->name );
+}
+
+
+/* Helper function for layout_discv( ) */
+static void
+discv_init_recursive( GNode *dnode, double stem_theta )
+{
+	DiscVGeomParams *gparams;
+	GNode *node;
+	GList *node_list = NULL, *nl_llink;
+	int64 node_size;
+	double dir_radius, radius, dist;
+	double arc_width, total_arc_width = 0.0;
+	double theta0, theta1;
+	double k;
+	boolean even = TRUE;
+	boolean stagger, out = TRUE;
+
+	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
+
+	if (NODE_IS_DIR(dnode)) {
+		dir_deploy( dnode );
+		/* (Small files are not merged in DiscV mode) */
+		small_files_gather( dnode, FSV_DISCV );
+	}
+
+	/* If this directory has no children,
+	 * there is nothing further to do here */
+	if (dnode->children == NULL)
+		return;
+
+	dir_radius = DISCV_GEOM_PARAMS(dnode)->radius;
+
+	/* Assign radii (and arc widths, temporarily) to leaf nodes */
+	node = dnode->children;
+	while (node != NULL) {
+		node_size = MAX(64, NODE_DESC(node)->size);
+                if (NODE_IS_DIR(node))
+			node_size += DIR_NODE_DESC(node)->subtree.size;
+		/* Area of disc == node_size */
+		radius = sqrt( (double)node_size / PI );
+		/* Center-to-center distance (parent to leaf) */
+		dist = dir_radius + radius * (1.0 + DISCV_LEAF_STEM_PROPORTION);
+		arc_width = 2.0 * DEG(asin( radius / dist ));
+		gparams = DISCV_GEOM_PARAMS(node);
+		gparams->radius = radius;
+		gparams->theta = arc_width; /* temporary value */
+		gparams->pos.x = dist; /* temporary value */
+		total_arc_width += arc_width;
+		node = node->next;
+	}
+
+	/* Create a list of leaf nodes, sorted by size */
+	node = dnode->children;
+	while (node != NULL) {
+		G_LIST_PREPEND(node_list, node);
+		node = node->next;
+	}
+	G_LIST_SORT(node_list, discv_node_compare);
+
+	k = DISCV_LEAF_RANGE_ARC_WIDTH / total_arc_width;
+	/* If this is going to be a tight fit, stagger the leaf nodes */
+	stagger = k <= 1.0;
+
+	/* Assign angle positions to leaf nodes, arranging them in clockwise
+	 * order (spread out to occupy the entire available range), and
+	 * recurse into subdirectories */
+	theta0 = stem_theta - 180.0;
+	theta1 = stem_theta + 180.0;
+	nl_llink = node_list;
+	while (nl_llink != NULL) {
+		node = nl_llink->data;
+		gparams = DISCV_GEOM_PARAMS(node);
+		arc_width = k * gparams->theta;
+		dist = gparams->pos.x;
+		if (stagger && out) {
+			/* Push leaf out */
+			dist += 2.0 * gparams->radius;
+		}
+		if (nl_llink->prev == NULL) {
+			/* First (largest) node */
+			gparams->theta = theta0;
+			theta0 += 0.5 * arc_width;
+			theta1 -= 0.5 * arc_width;
+			out = !out;
+		}
+		else if (even) {
+			gparams->theta = theta0 + 0.5 * arc_width;
+			theta0 += arc_width;
+			out = !out;
+		}
+		else {
+			gparams->theta = theta1 - 0.5 * arc_width;
+			theta1 -= arc_width;
+		}
+		gparams->pos.x = dist * cos( RAD(gparams->theta) );
+		gparams->pos.y = dist * sin( RAD(gparams->theta) );
+		if (NODE_IS_DIR(node))
+			discv_init_recursive( node, gparams->theta + 180.0 );
+		even = !even;
+		nl_llink = nl_llink->next;
+	}
+
+	g_list_free( node_list );
+}
+
+
+/* Lays out the whole tree in DiscV mode */
+void
+layout_discv( void )
+{
+	DiscVGeomParams *gparams;
+
+	gparams = DISCV_GEOM_PARAMS(globals.fstree);
+	gparams->radius = 0.0;
+	gparams->theta = 0.0;
+
+	discv_init_recursive( globals.fstree, 270.0 );
+
+	gparams->pos.x = 0.0;
+	gparams->pos.y = - DISCV_GEOM_PARAMS(root_dnode)->radius;
+
+	/* DiscV mode is entirely 2D, normal should always be {0, 0, 1} */
+}
+
+
+/* Lays out the contents of a directory anew in DiscV mode. The
+ * directory itself keeps its place */
+void
+layout_discv_subtree( GNode *dnode )
+{
+	discv_init_recursive( dnode, DISCV_GEOM_PARAMS(dnode)->theta + 180.0 );
+}
+
+
+/**** MAP VISUALIZATION ***************************************/
+
+
+/* Geometry constants */
+#define MAPV_BORDER_PROPORTION	0.01
+#define MAPV_ROOT_ASPECT_RATIO	1.2
+
+
+/* Node side face offset ratios, by node type
+ * (these define the obliqueness of a node's side faces) */
+const float mapv_side_slant_ratios[NUM_NODE_TYPES] = {
+	NIL,	/* Metanode (not used) */
+	0.032,	/* Directory */
+	0.064,	/* Regular file */
+	0.333,	/* Symlink */
+	0.0,	/* FIFO */
+	0.0,	/* Socket */
+	0.25,	/* Character device */
+	0.25,	/* Block device */
+	0.0	/* Unknown */
+};
+
+/* Heights of directory and leaf nodes */
+static double mapv_dir_height = 384.0;
+static double mapv_leaf_height = 128.0;
+
+
+/* Helper function for layout_mapv( ).
+ * This is, in essence, the MapV layout engine */
+static void
+mapv_init_recursive( GNode *dnode )
+{
+	struct MapVBlock {
+		GNode *node;
+		int64 size;
+		double area;
+	} *block, *next_first_block;
+	struct MapVRow {
+		struct MapVBlock *first_block;
+		double area;
+	} *row = NULL;
+	MapVGeomParams *gparams;
+	GNode *node;
+	GList *block_list = NULL, *block_llink;
+	GList *row_list = NULL, *row_llink;
+	XYvec dir_dims, block_dims;
+	XYvec start_pos, pos;
+	double area, dir_area, total_block_area = 0.0;
+	double nominal_border, border;
+	double scale_factor;
+	double a, b, k;
+	int64 size;
+
+	g_assert( NODE_IS_DIR(dnode) );
+
+	dir_deploy( dnode );
+	small_files_gather( dnode, FSV_MAPV );
+
+	/* If this directory has no children,
+	 * there is nothing further to do here */
+	if (dnode->children == NULL)
+		return;
+
+	/* Obtain dimensions of top face of directory */
+	dir_dims.x = MAPV_NODE_WIDTH(dnode);
+	dir_dims.y = MAPV_NODE_DEPTH(dnode);
+	k = mapv_side_slant_ratios[NODE_DIRECTORY];
+	dir_dims.x -= 2.0 * MIN(MAPV_GEOM_PARAMS(dnode)->height, k * dir_dims.x);
+	dir_dims.y -= 2.0 * MIN(MAPV_GEOM_PARAMS(dnode)->height, k * dir_dims.y);
+
+	/* Approximate/nominal node border width (nodes will be spaced
+	 * apart at about twice this distance) */
+	a = MAPV_BORDER_PROPORTION * sqrt( dir_dims.x * dir_dims.y );
+	b = MIN(dir_dims.x, dir_dims.y) / 3.0;
+	nominal_border = MIN(a, b);
+
+	/* Trim half a border width off the perimeter of the directory,
+	 * so that nodes aren't laid down too close to the edges */
+	dir_dims.x -= nominal_border;
+	dir_dims.y -= nominal_border;
+	dir_area = dir_dims.x * dir_dims.y;
+
+	/* First pass
+	 * 1. Create blocks. (A block is equivalent to a node, except
+	 *    that it includes the node's surrounding border area)
+	 * 2. Find total area of the blocks
+	 * 3. Create a list of the blocks */
+	node = dnode->children;
+	while (node != NULL) {
+		if (node == DIR_NODE_DESC(dnode)->small_files) {
+			/* One block for all the small files */
+			size = MAX(256, layout_small_files_size( dnode ));
+		}
+		else {
+			size = MAX(256, NODE_DESC(node)->size);
+			if (NODE_IS_DIR(node))
+				size += DIR_NODE_DESC(node)->subtree.size;
+		}
+		k = sqrt( (double)size ) + nominal_border;
+		area = SQR(k);
+		total_block_area += area;
+
+		block = NEW(struct MapVBlock);
+		block->node = node;
+		block->size = size;
+		block->area = area;
+		G_LIST_APPEND(block_list, block);
+
+		if (node == DIR_NODE_DESC(dnode)->small_files)
+			break;
+		node = node->next;
+	}
+
+	/* The blocks are going to have a total area greater than the
+	 * directory can provide, so they'll have to be scaled down */
+	scale_factor = dir_area / total_block_area;
+
+	/* Second pass
+	 * 1. Scale down the blocks
+	 * 2. Generate a first-draft set of rows */
+	block_llink = block_list;
+	while (block_llink != NULL) {
+		block = (struct MapVBlock *)block_llink->data;
+		block->area *= scale_factor;
+
+		if (row == NULL) {
+			/* Begin new row */
+			row = NEW(struct MapVRow);
+			row->first_block = block;
+			row->area = 0.0;
+			G_LIST_APPEND(row_list, row);
+		}
+
+		/* Add block to row */
+		row->area += block->area;
+
+		/* Dimensions of block (block_dims.y == depth of row) */
+		block_dims.y = row->area / dir_dims.x;
+		block_dims.x = block->area / block_dims.y;
+
+		/* Check aspect ratio of block */
+		if ((block_dims.x / block_dims.y) < 1.0) {
+			/* Next block will go into next row */
+			row = NULL;
+		}
+
+		block_llink = block_llink->next;
+	}
+
+	/* Third pass - optimize layout */
+	/* Note to self: write layout optimization routine sometime */
+
+	/* Fourth pass - output final arrangement
+	 * Start at right/rear corner, laying out rows of (mostly)
+	 * successively smaller blocks */
+	start_pos.x = MAPV_NODE_CENTER_X(dnode) + 0.5 * dir_dims.x;
+	start_pos.y = MAPV_NODE_CENTER_Y(dnode) + 0.5 * dir_dims.y;
+	pos.y = start_pos.y;
+	block_llink = block_list;
+	row_llink = row_list;
+	while (row_llink != NULL) {
+		row = (struct MapVRow *)row_llink->data;
+		block_dims.y = row->area / dir_dims.x;
+		pos.x = start_pos.x;
+
+		/* Note first block of next row */
+		if (row_llink->next == NULL)
+			next_first_block = NULL;
+		else
+			next_first_block = ((struct MapVRow *)row_llink->next->data)->first_block;
+
+		/* Output one row */
+		while (block_llink != NULL) {
+			block = (struct MapVBlock *)block_llink->data;
+			if (block == next_first_block)
+				break; /* finished with row */
+			block_dims.x = block->area / block_dims.y;
+
+			area = scale_factor * (double)block->size;
+
+			/* Calculate exact width of block's border region */
+			k = block_dims.x + block_dims.y;
+			/* Note: area == scaled area of node,
+			 * block->area == scaled area of node + border */
+			border = 0.25 * (k - sqrt( SQR(k) - 4.0 * (block->area - area) ));
+
+			/* Assign geometry
+			 * (Note: pos is right/rear corner of block) */
+			gparams = MAPV_GEOM_PARAMS(block->node);
+			gparams->c0.x = pos.x - block_dims.x + border;
+			gparams->c0.y = pos.y - block_dims.y + border;
+			gparams->c1.x = pos.x - border;
+			gparams->c1.y = pos.y - border;
+
+			if (NODE_IS_DIR(block->node)) {
+				gparams->height = mapv_dir_height;
+
+				/* Recurse into directory */
+				mapv_init_recursive( block->node );
+			}
+			else
+				gparams->height = mapv_leaf_height;
+
+			pos.x -= block_dims.x;
+			block_llink = block_llink->next;
+		}
+
+		pos.y -= block_dims.y;
+		row_llink = row_llink->next;
+	}
+
+	layout_small_files_share( dnode );
+
+	/* Clean up */
+
+	block_llink = block_list;
+	while (block_llink != NULL) {
+		xfree( block_llink->data );
+		block_llink = block_llink->next;
+	}
+	g_list_free( block_list );
+
+	row_llink = row_list;
+	while (row_llink != NULL) {
+		xfree( row_llink->data );
+		row_llink = row_llink->next;
+	}
+	g_list_free( row_list );
+}
+
+
+/* Lays out the whole tree in MapV mode */
+void
+layout_mapv( void )
+{
+	MapVGeomParams *gparams;
+	XYvec root_dims;
+
+	/* Determine dimensions of bottommost (root) node */
+	root_dims.y = sqrt( (double)DIR_NODE_DESC(globals.fstree)->subtree.size / MAPV_ROOT_ASPECT_RATIO );
+	root_dims.x = MAPV_ROOT_ASPECT_RATIO * root_dims.y;
+
+	/* Set up base geometry */
+	MAPV_GEOM_PARAMS(globals.fstree)->height = 0.0;
+	gparams = MAPV_GEOM_PARAMS(root_dnode);
+	gparams->c0.x = -0.5 * root_dims.x;
+	gparams->c0.y = -0.5 * root_dims.y;
+	gparams->c1.x = 0.5 * root_dims.x;
+	gparams->c1.y = 0.5 * root_dims.y;
+	gparams->height = mapv_dir_height;
+
+	mapv_init_recursive( root_dnode );
+}
+
+
+/* Lays out the contents of a directory anew in MapV mode, within the
+ * directory's current footprint */
+void
+layout_mapv_subtree( GNode *dnode )
+{
+	mapv_init_recursive( dnode );
+}
+
+
+/**** TREE VISUALIZATION **************************************/
+
+
+/* Geometry constants */
+#define TREEV_MIN_ARC_WIDTH		90.0
+#define TREEV_MAX_ARC_WIDTH		225.0
+#define TREEV_MIN_CORE_RADIUS		8192.0
+#define TREEV_CORE_GROW_FACTOR		1.25
+#define TREEV_PLATFORM_HEIGHT		158.2
+#define TREEV_LEAF_HEIGHT_MULTIPLIER	1.0
+
+
+/* Radius of innermost loop */
+static double treev_core_radius;
+
+
+/* Checks if a node is currently a leaf (i.e. a collapsed directory or
+ * some other node), or not (an expanded directory) */
+static boolean
+treev_is_leaf( GNode *node )
+{
+	if (NODE_IS_DIR(node))
+		if (layout_dir_expanded( node ))
+			return FALSE;
+
+	return TRUE;
+}
+
+
+/* This assigns an arc width and depth to a directory platform.
+ * Note: depth value is only an estimate; the final value can only be
+ * determined by actually laying down leaf nodes */
+static void
+treev_reshape_platform( GNode *dnode, double r0 )
+{
+#define edge05 (0.5 * TREEV_LEAF_NODE_EDGE)
+#define edge15 (1.5 * TREEV_LEAF_NODE_EDGE)
+	static const double w = TREEV_PLATFORM_SPACING_WIDTH;
+	static const double w_2 = SQR(TREEV_PLATFORM_SPACING_WIDTH);
+	static const double w_3 = SQR(TREEV_PLATFORM_SPACING_WIDTH) * TREEV_PLATFORM_SPACING_WIDTH;
+	static const double w_4 = SQR(TREEV_PLATFORM_SPACING_WIDTH) * SQR(TREEV_PLATFORM_SPACING_WIDTH);
+	double area;
+	double A, A_2, A_3, r, r_2, r_3, r_4, ka, kb, kc, kd, d, theta;
+	double depth, arc_width, min_arc_width;
+	double k;
+	int n;
+
+	/* Estimated area, based on number of (immediate) children */
+	n = layout_num_children_shown( dnode );
+	k = edge15 * ceil( sqrt( (double)MAX(1, n) ) ) + edge05;
+	area = SQR(k);
+
+	/* Known: Area and inner radius of directory, plus the fact that
+	 * the aspect ratio (length_of_outer_edge / depth) is exactly 1.
+	 * Unknown: depth and arc width of directory.
+	 * Raw and distilled equations:
+	 * { A ~= PI*theta/360*((r + d)^2 - r^2) - w*d,
+	 * s ~= PI*theta*(r + d)/180 - w,
+	 * s/d = 1  -->  s = d,
+	 * theta = 180*(d + w)/(PI*(r + d)),
+	 * d^3 + (2*r + w)*d^2 + (2*w*r - 2*A - w)*d - 2*A*r = 0,
+	 * A = area, w = TREEV_PLATFORM_SPACING_WIDTH, r = r0,
+	 * s = (length of outer edge), d = depth, theta = arc_width }
+	 * Solution: Thank god for Maple */
+	A = area;
+	A_2 = SQR(A);
+	A_3 = A*A_2;
+	r = r0;
+	r_2 = SQR(r);
+	r_3 = r*r_2;
+	r_4 = SQR(r_2);
+	ka = 72.0*(A*r - w*(A + r)) - 64.0*r_3 + 48.0*r_2*w - 36.0*w_2 + 24.0*r*w_2 - 8.0*w_3;
+#define T1 72.0*A*w_2 - 132.0*A*r*w_2 - 240.0*A*w*r_3 + 120.0*A*w_2*r_2 - 24.0*A_2*w*r - 60.0*w_3*r
+#define T2 12.0*(w_2*r_2 + A_2*w_2 - w_4*r + w_4*r_2 + A*w_3 + w_3)
+#define T3 48.0*(w_2*r_4 - w_2*r_3 - w_3*r_3) + 96.0*(A_3 + w_3*r_2)
+#define T4 192.0*A*r_4 + 156.0*A_2*r_2 + 3.0*w_4 + 144.0*A_2*w + 264.0*A*w*r_2
+	kb = 12.0*sqrt( T1 + T2 + T3 + T4 );
+#undef T1
+#undef T2
+#undef T3
+#undef T4
+	kc = cos( atan2( kb, ka ) / 3.0 );
+	kd = cbrt( hypot( ka, kb ) );
+	/* Bring it all together */
+	d = (- w - 2.0*r)/3.0 + ((8.0*r_2 - 4.0*w*r + 2.0*w_2)/3.0 + 4.0*A + 2.0*w)*kc/kd + kc*kd/6.0;
+	theta = 180.0*(d + w)/(PI*(r + d));
+
+	depth = d;
+	arc_width = theta;
+
+	/* Adjust depth upward to accomodate an integral number of rows */
+	depth += (edge15 - fmod( depth - edge05, edge15 )) + edge05;
+
+	/* Final arc width must be at least large enough to yield an
+	 * inner edge length that is two leaf node edges long */
+	min_arc_width = (180.0 * (2.0 * TREEV_LEAF_NODE_EDGE + TREEV_PLATFORM_SPACING_WIDTH) / PI) / r0;
+
+	TREEV_GEOM_PARAMS(dnode)->platform.arc_width = MAX(min_arc_width, arc_width);
+	TREEV_GEOM_PARAMS(dnode)->platform.depth = depth;
+
+	/* Directory will need rebuilding, obviously */
+	dir_changed( dnode );
+
+#undef edge05
+#undef edge15
+}
+
+
+/* Helper function for layout_treev_arrange( ). @reshape_tree flag should
+ * be TRUE if platform radiuses have changed (thus requiring reshaping) */
+static void
+treev_arrange_recursive( GNode *dnode, double r0, boolean reshape_tree )
+{
+	GNode *node;
+	double subtree_r0;
+	double arc_width, subtree_arc_width = 0.0;
+	double theta;
+
+	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
+
+	if (!reshape_tree && !(NODE_DESC(dnode)->flags & TREEV_NEED_REARRANGE))
+		return;
+
+	if (reshape_tree && NODE_IS_DIR(dnode)) {
+		if (treev_is_leaf(dnode)) {
+			/* Ensure directory leaf gets repositioned */
+			dir_changed( dnode );
+			return;
+		}
+		else {
+			/* Reshape directory platform */
+			treev_reshape_platform( dnode, r0 );
+		}
+	}
+
+	/* Recurse into expanded subdirectories, and obtain the overall
+	 * arc width of the subtree */
+	subtree_r0 = r0 + TREEV_GEOM_PARAMS(dnode)->platform.depth + TREEV_PLATFORM_SPACING_DEPTH;
+	node = dnode->children;
+	while (node != NULL) {
+		if (!NODE_IS_DIR(node))
+			break;
+		treev_arrange_recursive( node, subtree_r0, reshape_tree );
+		arc_width = DIR_NODE_DESC(node)->deployment * MAX(TREEV_GEOM_PARAMS(node)->platform.arc_width, TREEV_GEOM_PARAMS(node)->platform.subtree_arc_width);
+		TREEV_GEOM_PARAMS(node)->platform.theta = arc_width; /* temporary value */
+		subtree_arc_width += arc_width;
+		node = node->next;
+	}
+	TREEV_GEOM_PARAMS(dnode)->platform.subtree_arc_width = subtree_arc_width;
+
+	/* Spread the subdirectories, sweeping counterclockwise */
+	theta = -0.5 * subtree_arc_width;
+	node = dnode->children;
+	while (node != NULL) {
+                if (!NODE_IS_DIR(node))
+			break;
+		arc_width = TREEV_GEOM_PARAMS(node)->platform.theta;
+		TREEV_GEOM_PARAMS(node)->platform.theta = theta + 0.5 * arc_width;
+		theta += arc_width;
+		node = node->next;
+	}
+
+	/* Clear the "need rearrange" flag */
+	NODE_DESC(dnode)->flags &= ~TREEV_NEED_REARRANGE;
+}
+
+
+/* Arranges the branches of the currently expanded tree, as needed when
+ * directories collapse/expand (initial_arrange == FALSE), or when tree
+ * is initially created (initial_arrange == TRUE). Returns TRUE if the
+ * core radius had to change, moving everything */
+boolean
+layout_treev_arrange( boolean initial_arrange )
+{
+	boolean resized = FALSE;
+
+	treev_arrange_recursive( globals.fstree, treev_core_radius, initial_arrange );
+
+	/* Check that the tree's total arc width is within bounds */
+	for (;;) {
+		if (TREEV_GEOM_PARAMS(globals.fstree)->platform.subtree_arc_width > TREEV_MAX_ARC_WIDTH) {
+			/* Grow core radius */
+			treev_core_radius *= TREEV_CORE_GROW_FACTOR;
+			treev_arrange_recursive( globals.fstree, treev_core_radius, TRUE );
+			resized = TRUE;
+		}
+		else if ((TREEV_GEOM_PARAMS(globals.fstree)->platform.subtree_arc_width < TREEV_MIN_ARC_WIDTH) && (TREEV_GEOM_PARAMS(globals.fstree)->platform.depth > TREEV_MIN_CORE_RADIUS)) {
+			/* Shrink core radius */
+			treev_core_radius = MAX(TREEV_MIN_CORE_RADIUS, treev_core_radius / TREEV_CORE_GROW_FACTOR);
+			treev_arrange_recursive( globals.fstree, treev_core_radius, TRUE );
+			resized = TRUE;
+		}
+		else
+			break;
+	}
+
+	return resized;
+}
+
+
+/* Helper function for layout_treev( ) */
+static void
+treev_init_recursive( GNode *dnode )
+{
+	GNode *node;
+	int64 size;
+
+	g_assert( NODE_IS_DIR(dnode) || NODE_IS_METANODE(dnode) );
+
+	if (NODE_IS_DIR(dnode)) {
+		dir_deploy( dnode );
+		small_files_gather( dnode, FSV_TREEV );
+	}
+
+	NODE_DESC(dnode)->flags = 0;
+
+	/* Assign heights to leaf nodes */
+	node = dnode->children;
+	while (node != NULL) {
+		if (node == DIR_NODE_DESC(dnode)->small_files) {
+			/* One leaf for all the small files */
+			size = MAX(64, layout_small_files_size( dnode ));
+			TREEV_GEOM_PARAMS(node)->leaf.height = sqrt( (double)size ) * TREEV_LEAF_HEIGHT_MULTIPLIER;
+			break;
+		}
+		size = MAX(64, NODE_DESC(node)->size);
+		if (NODE_IS_DIR(node)) {
+			size += DIR_NODE_DESC(node)->subtree.size;
+			TREEV_GEOM_PARAMS(node)->platform.height = TREEV_PLATFORM_HEIGHT;
+			TREEV_GEOM_PARAMS(node)->platform.arc_width = TREEV_MIN_ARC_WIDTH;
+			TREEV_GEOM_PARAMS(node)->platform.subtree_arc_width = TREEV_MIN_ARC_WIDTH;
+			treev_init_recursive( node );
+		}
+		TREEV_GEOM_PARAMS(node)->leaf.height = sqrt( (double)size ) * TREEV_LEAF_HEIGHT_MULTIPLIER;
+		node = node->next;
+	}
+
+	if (NODE_IS_DIR(dnode))
+		layout_small_files_share( dnode );
+}
+
+
+/* Lays out the whole tree in TreeV mode */
+void
+layout_treev( void )
+{
+	TreeVGeomParams *gparams;
+
+	treev_core_radius = TREEV_MIN_CORE_RADIUS;
+
+	gparams = TREEV_GEOM_PARAMS(globals.fstree);
+	gparams->platform.theta = 90.0;
+	gparams->platform.depth = 0.0;
+	gparams->platform.arc_width = TREEV_MAX_ARC_WIDTH;
+	gparams->platform.height = 0.0;
+
+	gparams = TREEV_GEOM_PARAMS(root_dnode);
+	gparams->leaf.theta = 0.0;
+	gparams->leaf.distance = (0.5 * TREEV_PLATFORM_SPACING_DEPTH);
+	gparams->platform.theta = 0.0;
+
+	treev_init_recursive( globals.fstree );
+	layout_treev_arrange( TRUE );
+}
+
+
+/* Lays out the contents of a directory anew in TreeV mode. r0 is the
+ * inner radius of the directory's platform. The caller is responsible
+ * for rearranging the tree afterward, as the subtree may have changed
+ * in width */
+void
+layout_treev_subtree( GNode *dnode, double r0 )
+{
+	int64 size;
+
+	/* Height of the directory as a leaf */
+	size = MAX(64, NODE_DESC(dnode)->size) + DIR_NODE_DESC(dnode)->subtree.size;
+	TREEV_GEOM_PARAMS(dnode)->leaf.height = sqrt( (double)size ) * TREEV_LEAF_HEIGHT_MULTIPLIER;
+	treev_init_recursive( dnode );
+	if (!treev_is_leaf( dnode ))
+		treev_arrange_recursive( dnode, r0, TRUE );
+}
+
+
+/* Returns the radius of the innermost loop in TreeV mode */
+double
+layout_treev_core_radius( void )
+{
+	return treev_core_radius;
+}
+
+
+/* Puts back a core radius saved along with a TreeV layout */
+void
+layout_treev_set_core_radius( double radius )
+{
+	treev_core_radius = radius;
+}
+
+
+/* end layout.c */
@@ -0,0 +1,60 @@
+/* layout.h */
+
+/* Layout engines */
+
+/* fsv - 3D File System Visualizer
+ * Copyright (C)1999 Daniel Richard G. <skunk@mit.edu>
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_LAYOUT_H
+	#error
+#endif
+#define FSV_LAYOUT_H
+
+
+/* Extra node flags for TreeV mode */
+enum {
+	TREEV_NEED_REARRANGE	= 1 << 0
+};
+
+
+/* Callbacks from the layout engines. Any of them may be NULL. They are
+ * called with the data pointer given to layout_set_hooks( ) */
+typedef struct _LayoutHooks LayoutHooks;
+struct _LayoutHooks {
+	/* Whether a directory is shown expanded (if NULL, all are) */
+	boolean	(*dir_expanded)( GNode *dnode, void *data );
+	/* A directory's deployment is about to be set anew */
+	void	(*dir_deploy)( GNode *dnode, void *data );
+	/* A directory's geometry, or that of its contents, has changed */
+	void	(*dir_changed)( GNode *dnode, void *data );
+};
+
+
+/* Node side face offset ratios in MapV mode, by node type */
+extern const float mapv_side_slant_ratios[NUM_NODE_TYPES];
+
+
+void layout_set_hooks( const LayoutHooks *hooks, void *data );
+boolean layout_dir_expanded( GNode *dnode );
+void layout_set_small_files( FsvMode mode, double fraction );
+GNode *layout_small_files_node( GNode *node );
+boolean layout_is_small_files( GNode *node );
+int64 layout_small_files_size( GNode *dnode );
+int layout_num_children_shown( GNode *dnode );
+void layout_small_files_share( GNode *dnode );
+void layout_discv( void );
+void layout_discv_subtree( GNode *dnode );
+void layout_mapv( void );
+void layout_mapv_subtree( GNode *dnode );
+void layout_treev( void );
+void layout_treev_subtree( GNode *dnode, double r0 );
+boolean layout_treev_arrange( boolean initial_arrange );
+double layout_treev_core_radius( void );
+void layout_treev_set_core_radius( double radius );
+
+
+/* end layout.h */
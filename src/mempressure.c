@@ -0,0 +1,193 @@
+/* mempressure.c */
+
+/* Memory pressure response */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "mempressure.h"
+
+#include <gio/gio.h>
+#include <unistd.h> /* sysconf( ) */
+#ifdef __GLIBC__
+	#include <malloc.h> /* malloc_trim( ) */
+#endif
+
+#include "animation.h" /* redraw( ) */
+#include "geometry.h" /* geometry_shed_layouts( ) */
+#include "gpumem.h" /* gpumem_evict_offscreen( ) */
+#include "minimap.h" /* minimap_shed( ) */
+#include "profile.h"
+#include "tmaptext.h" /* text_names_shed( ) */
+
+
+/* Long sessions over big trees accumulate caches which can all be
+ * recomputed from the tree itself. When memory runs short, either by
+ * word of the system (GMemoryMonitor warnings) or by our own resident
+ * set going over budget, they are given up in order, cheapest to rebuild
+ * first, for as far as the pressure demands. Each cache rebuilds itself
+ * when next needed, and reports back with mempressure_rebuilt( ) */
+
+
+/* Interval between resident set checks (milliseconds) */
+#define MEMPRESSURE_CHECK_INTERVAL	2000
+
+
+/* Sheddable caches. Shed functions return FALSE if there was nothing to
+ * give up. Profiler names must be static strings */
+static const struct {
+	boolean		(*shed)( void );
+	const char	*shed_name;
+	const char	*rebuilt_name;
+} stages[NUM_MEMPRESSURE_CACHES] = {
+	{ minimap_shed, "mempressure.shed.minimap", "mempressure.rebuilt.minimap" },
+	{ text_names_shed, "mempressure.shed.labels", "mempressure.rebuilt.labels" },
+	{ gpumem_evict_offscreen, "mempressure.shed.geometry", "mempressure.rebuilt.geometry" },
+	{ geometry_shed_layouts, "mempressure.shed.layouts", "mempressure.rebuilt.layouts" }
+};
+
+/* Caches shed and not yet rebuilt */
+static boolean stage_shed[NUM_MEMPRESSURE_CACHES];
+
+/* Resident set budget (bytes, 0 if none), and number of caches shed
+ * since the resident set last went over it */
+static int64 rss_budget = 0;
+static int rss_num_shed = 0;
+
+
+/* Returns the resident set size of the process (bytes), or -1 if it
+ * cannot be determined */
+static int64
+get_rss( void )
+{
+	FILE *statm;
+	unsigned long size, resident;
+	int n;
+
+	statm = fopen( "/proc/self/statm", "r" );
+	if (statm == NULL)
+		return -1;
+	n = fscanf( statm, "%lu %lu", &size, &resident );
+	fclose( statm );
+	if (n != 2)
+		return -1;
+
+	return (int64)resident * (int64)sysconf( _SC_PAGESIZE );
+}
+
+
+/* Gives up the first num_caches caches (all of them, if num_caches is
+ * larger than the number there are). Caches already shed are skipped */
+void
+mempressure_shed( int num_caches )
+{
+	boolean any = FALSE;
+	int i;
+
+	num_caches = MIN(num_caches, NUM_MEMPRESSURE_CACHES);
+	for (i = 0; i < num_caches; i++) {
+		if (stage_shed[i] || !(stages[i].shed)( ))
+			continue;
+		stage_shed[i] = TRUE;
+		profile_count( stages[i].shed_name, 1 );
+		any = TRUE;
+	}
+	if (!any)
+		return;
+
+#ifdef __GLIBC__
+	/* Hand freed heap pages back to the system */
+	malloc_trim( 0 );
+#endif
+	/* GL resources are released at the end of the next frame */
+	redraw( );
+}
+
+
+/* Called by a cache which was shed, when it is next built again */
+void
+mempressure_rebuilt( MemPressureCache cache )
+{
+	if (!stage_shed[cache])
+		return;
+
+	stage_shed[cache] = FALSE;
+	profile_count( stages[cache].rebuilt_name, 1 );
+}
+
+
+/* Timeout callback for resident set checks. While over budget, one more
+ * cache is given up at every check */
+static gboolean
+rss_check_cb( gpointer data )
+{
+	int64 rss;
+
+	rss = get_rss( );
+	if (rss < 0)
+		return FALSE; /* no way of telling */
+	profile_gauge( "mempressure.rss_bytes", rss );
+
+	if ((rss_budget == 0) || (rss <= rss_budget)) {
+		rss_num_shed = 0;
+		return TRUE;
+	}
+
+	profile_count( "mempressure.over_budget", 1 );
+	rss_num_shed = MIN(rss_num_shed + 1, NUM_MEMPRESSURE_CACHES);
+	mempressure_shed( rss_num_shed );
+
+	return TRUE;
+}
+
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+/* Signal handler for system low-memory warnings. The more urgent the
+ * warning, the more is given up */
+static void
+low_memory_warning_cb( GMemoryMonitor *monitor, GMemoryMonitorWarningLevel level, gpointer data )
+{
+	profile_count( "mempressure.warnings", 1 );
+
+	/* Low: minimap and labels. Medium: off-screen geometry as well.
+	 * Critical: everything */
+	if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_CRITICAL)
+		mempressure_shed( NUM_MEMPRESSURE_CACHES );
+	else if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_MEDIUM)
+		mempressure_shed( MEMPRESSURE_GEOMETRY + 1 );
+	else
+		mempressure_shed( MEMPRESSURE_LABELS + 1 );
+}
+#endif
+
+
+/* Sets the resident set budget (in bytes, 0 for none) */
+void
+mempressure_set_budget( int64 size )
+{
+	rss_budget = MAX(0, size);
+}
+
+
+/* Starts listening for memory pressure. Call once, from the main thread */
+void
+mempressure_init( void )
+{
+#if GLIB_CHECK_VERSION(2, 64, 0)
+	GMemoryMonitor *monitor;
+
+	/* Monitor is kept for the lifetime of the program */
+	monitor = g_memory_monitor_dup_default( );
+	if (monitor != NULL)
+		g_signal_connect( monitor, "low-memory-warning", G_CALLBACK(low_memory_warning_cb), NULL );
+#endif
+
+	g_timeout_add( MEMPRESSURE_CHECK_INTERVAL, rss_check_cb, NULL );
+}
+
+
+/* end mempressure.c */
@@ -0,0 +1,33 @@
+/* mempressure.h */
+
+/* Memory pressure response */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_MEMPRESSURE_H
+	#error
+#endif
+#define FSV_MEMPRESSURE_H
+
+
+/* Sheddable caches, in the order in which they are given up */
+typedef enum {
+	MEMPRESSURE_MINIMAP,	/* Minimap texture and node list */
+	MEMPRESSURE_LABELS,	/* Node names uploaded for labels */
+	MEMPRESSURE_GEOMETRY,	/* Retained geometry of off-screen dirs */
+	MEMPRESSURE_LAYOUTS,	/* Layouts put away for other modes */
+	NUM_MEMPRESSURE_CACHES
+} MemPressureCache;
+
+
+void mempressure_init( void );
+void mempressure_set_budget( int64 size );
+void mempressure_shed( int num_caches );
+void mempressure_rebuilt( MemPressureCache cache );
+
+
+/* end mempressure.h */
@@ -0,0 +1,368 @@
+/* metrics.c */
+
+/* Statistics endpoint */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+/* The runtime statistics (see profile.c) are served in the Prometheus
+ * text exposition format, over plain HTTP, on a UNIX socket or on a TCP
+ * port bound to the loopback address. E.g.
+ *
+ *     curl --unix-socket /tmp/fsv.sock http://localhost/metrics
+ *
+ * Requests are answered one at a time, on a thread of their own, so the
+ * endpoint stays up while the main thread is busy with a scan */
+
+
+#include "common.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "profile.h"
+
+
+/* Longest request head read in (bytes) */
+#define METRICS_MAX_REQUEST	4096
+
+/* Time a client may take to send its request (seconds) */
+#define METRICS_CLIENT_TIMEOUT	5
+
+
+/* A statistic, as seen when the response was put together */
+struct MetricsEntry {
+	const char	*name;
+	ProfileKind	kind;
+	int64		value;
+};
+
+
+/* Quantiles given for series */
+static const double quantiles[] = { 0.5, 0.9, 0.99 };
+static const char *quantile_labels[] = { "0.5", "0.9", "0.99" };
+
+/* Listening socket */
+static int listen_fd = -1;
+
+/* Path of the UNIX socket (NULL if on a TCP port) */
+static char *socket_path = NULL;
+
+
+/* profile_foreach( ) callback: takes a copy of a statistic */
+static void
+collect_cb( const char *name, ProfileKind kind, int64 value, GArray *entries )
+{
+	struct MetricsEntry entry;
+
+	entry.name = name;
+	entry.kind = kind;
+	entry.value = value;
+	g_array_append_val( entries, entry );
+}
+
+
+/* Appends the exposition name of a statistic ("fsv_" prefix, and
+ * anything that is not a letter or digit turned into an underscore),
+ * plus a suffix */
+static void
+append_name( GString *text, const char *name, const char *suffix )
+{
+	const char *c;
+
+	g_string_append( text, "fsv_" );
+	for (c = name; *c != '\0'; c++)
+		g_string_append_c( text, g_ascii_isalnum( *c ) ? *c : '_' );
+	g_string_append( text, suffix );
+}
+
+
+/* Appends a "# TYPE" line */
+static void
+append_type( GString *text, const char *name, const char *suffix, const char *type )
+{
+	g_string_append( text, "# TYPE " );
+	append_name( text, name, suffix );
+	g_string_append_printf( text, " %s\n", type );
+}
+
+
+/* Appends one sample line */
+static void
+append_value( GString *text, const char *name, const char *suffix, const char *labels, int64 value )
+{
+	append_name( text, name, suffix );
+	g_string_append_printf( text, "%s %" G_GINT64_FORMAT "\n", labels, value );
+}
+
+
+/* Looks for a statistic by name among the entries */
+static const struct MetricsEntry *
+find_entry( GArray *entries, const char *name )
+{
+	int i;
+
+	for (i = 0; i < (int)entries->len; i++) {
+		if (!strcmp( g_array_index(entries, struct MetricsEntry, i).name, name ))
+			return &g_array_index(entries, struct MetricsEntry, i);
+	}
+
+	return NULL;
+}
+
+
+/* Appends the hit ratio of a cache, given its "..._hits" counter, if
+ * there is a matching "..._misses" counter */
+static void
+append_hit_ratio( GString *text, GArray *entries, const struct MetricsEntry *hits )
+{
+	const struct MetricsEntry *misses;
+	char *prefix, *misses_name;
+	int64 total;
+
+	if (!g_str_has_suffix( hits->name, "_hits" ))
+		return;
+
+	prefix = g_strndup( hits->name, strlen( hits->name ) - strlen( "_hits" ) );
+	misses_name = g_strconcat( prefix, "_misses", NULL );
+	misses = find_entry( entries, misses_name );
+	total = hits->value + ((misses != NULL) ? misses->value : 0);
+	if ((misses != NULL) && (total > 0)) {
+		append_type( text, prefix, "_hit_ratio", "gauge" );
+		append_name( text, prefix, "_hit_ratio" );
+		g_string_append_printf( text, " %.6f\n", (double)hits->value / (double)total );
+	}
+	g_free( misses_name );
+	g_free( prefix );
+}
+
+
+/* Returns all statistics in the Prometheus text format. Counters get
+ * the conventional "_total" suffix, series become summaries (recent
+ * quantiles, plus sum and count), and caches with hit/miss counters get
+ * a hit ratio gauge. Result must be freed with g_free( ) */
+char *
+metrics_text( void )
+{
+	const struct MetricsEntry *entry;
+	GString *text;
+	GArray *entries;
+	int64 values[G_N_ELEMENTS(quantiles)];
+	int64 sum;
+	int i, j;
+
+	entries = g_array_new( FALSE, FALSE, sizeof(struct MetricsEntry) );
+	profile_foreach( (void (*)( const char *, ProfileKind, int64, void * ))collect_cb, entries );
+
+	text = g_string_new( NULL );
+	for (i = 0; i < (int)entries->len; i++) {
+		entry = &g_array_index(entries, struct MetricsEntry, i);
+		switch (entry->kind) {
+			case PROFILE_COUNTER:
+			append_type( text, entry->name, "_total", "counter" );
+			append_value( text, entry->name, "_total", "", entry->value );
+			append_hit_ratio( text, entries, entry );
+			break;
+
+			case PROFILE_GAUGE:
+			append_type( text, entry->name, "", "gauge" );
+			append_value( text, entry->name, "", "", entry->value );
+			break;
+
+			case PROFILE_SAMPLES:
+			if (!profile_quantiles( entry->name, quantiles, G_N_ELEMENTS(quantiles), values, &sum ))
+				break;
+			append_type( text, entry->name, "", "summary" );
+			for (j = 0; j < (int)G_N_ELEMENTS(quantiles); j++) {
+				char labels[32];
+				sprintf( labels, "{quantile=\"%s\"}", quantile_labels[j] );
+				append_value( text, entry->name, "", labels, values[j] );
+			}
+			append_value( text, entry->name, "_sum", "", sum );
+			append_value( text, entry->name, "_count", "", entry->value );
+			break;
+
+			SWITCH_FAIL
+		}
+	}
+	g_array_free( entries, TRUE );
+
+	return g_string_free( text, FALSE );
+}
+
+
+/* Writes out a whole buffer. (A client that hangs up early must not
+ * raise SIGPIPE, hence send( ) rather than write( )) */
+static void
+send_all( int fd, const char *buf, size_t len )
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send( fd, buf, len, MSG_NOSIGNAL );
+		if ((n < 0) && (errno == EINTR))
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+
+/* Answers one request. Only GET is understood, for /metrics (or /) */
+static void
+serve_client( int fd )
+{
+	struct timeval timeout = { METRICS_CLIENT_TIMEOUT, 0 };
+	char request[METRICS_MAX_REQUEST + 1];
+	const char *status, *path;
+	char *body, *head;
+	ssize_t n;
+	size_t len = 0;
+
+	/* Read in the request line and headers (the rest is ignored) */
+	setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+	request[0] = '\0';
+	while (len < METRICS_MAX_REQUEST) {
+		n = recv( fd, request + len, METRICS_MAX_REQUEST - len, 0 );
+		if ((n < 0) && (errno == EINTR))
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+		request[len] = '\0';
+		if (strstr( request, "\r\n\r\n" ) != NULL)
+			break;
+	}
+
+	body = NULL;
+	if (!g_str_has_prefix( request, "GET " ))
+		status = "405 Method Not Allowed";
+	else {
+		path = request + strlen( "GET " );
+		if (g_str_has_prefix( path, "/metrics " ) || g_str_has_prefix( path, "/ " )) {
+			status = "200 OK";
+			body = metrics_text( );
+		}
+		else
+			status = "404 Not Found";
+	}
+	if (body == NULL)
+		body = g_strconcat( status, "\n", NULL );
+
+	head = g_strdup_printf( "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", status, (unsigned int)strlen( body ) );
+	send_all( fd, head, strlen( head ) );
+	send_all( fd, body, strlen( body ) );
+	g_free( head );
+	g_free( body );
+}
+
+
+/* Thread function: accepts and answers connections */
+static gpointer
+serve_thread( gpointer unused )
+{
+	int fd;
+
+	for (;;) {
+		fd = accept( listen_fd, NULL, NULL );
+		if (fd < 0) {
+			if ((errno == EINTR) || (errno == ECONNABORTED))
+				continue;
+			g_warning( "Metrics endpoint stopped: %s", g_strerror( errno ) );
+			break;
+		}
+		serve_client( fd );
+		close( fd );
+	}
+
+	return NULL;
+}
+
+
+/* atexit( ) handler: removes the UNIX socket */
+static void
+remove_socket( void )
+{
+	unlink( socket_path );
+}
+
+
+/* Starts serving statistics. The address is either a TCP port number
+ * (on 127.0.0.1), or the path of a UNIX socket to create. A socket
+ * already at the path (likely left behind by an earlier run) is
+ * replaced. Returns 0 on success, -1 on failure */
+int
+metrics_serve( const char *address )
+{
+	struct sockaddr_un sun;
+	struct sockaddr_in sin;
+	struct stat st;
+	int one = 1;
+
+	g_assert( listen_fd < 0 );
+
+	if ((*address != '\0') && (strspn( address, "0123456789" ) == strlen( address ))) {
+		/* Localhost TCP port */
+		memset( &sin, 0, sizeof(struct sockaddr_in) );
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons( (unsigned short)atoi( address ) );
+		sin.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+		listen_fd = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+		if (listen_fd >= 0) {
+			setsockopt( listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+			if (bind( listen_fd, (struct sockaddr *)&sin, sizeof(struct sockaddr_in) ) < 0) {
+				close( listen_fd );
+				listen_fd = -1;
+			}
+		}
+	}
+	else if (strlen( address ) >= sizeof(sun.sun_path))
+		errno = ENAMETOOLONG;
+	else {
+		/* UNIX socket */
+		memset( &sun, 0, sizeof(struct sockaddr_un) );
+		sun.sun_family = AF_UNIX;
+		strcpy( sun.sun_path, address );
+		if ((lstat( address, &st ) == 0) && S_ISSOCK(st.st_mode))
+			unlink( address );
+		listen_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+		if (listen_fd >= 0) {
+			if (bind( listen_fd, (struct sockaddr *)&sun, sizeof(struct sockaddr_un) ) < 0) {
+				close( listen_fd );
+				listen_fd = -1;
+			}
+			else {
+				/* (Absolute, as the scan changes directory) */
+				socket_path = g_canonicalize_filename( address, NULL );
+				atexit( remove_socket );
+			}
+		}
+	}
+
+	if ((listen_fd < 0) || (listen( listen_fd, 8 ) < 0)) {
+		g_warning( "Cannot serve metrics on %s: %s", address, g_strerror( errno ) );
+		if (listen_fd >= 0)
+			close( listen_fd );
+		listen_fd = -1;
+		return -1;
+	}
+
+	g_thread_unref( g_thread_new( "fsv-metrics", serve_thread, NULL ) );
+
+	return 0;
+}
+
+
+/* end metrics.c */
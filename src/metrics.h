@@ -0,0 +1,21 @@
+/* metrics.h */
+
+/* Statistics endpoint */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_METRICS_H
+	#error
+#endif
+#define FSV_METRICS_H
+
+
+char *metrics_text( void );
+int metrics_serve( const char *address );
+
+
+/* end metrics.h */
@@ -0,0 +1,853 @@
+/* minimap.c */
+
+/* Overview minimap */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "minimap.h"
+
+#include <epoxy/gl.h>
+
+#include "about.h"
+#include "animation.h" /* redraw( ) */
+#include "geometry.h"
+#include "gpumem.h"
+#include "mempressure.h" /* mempressure_rebuilt( ) */
+#include "ogl.h"
+#include "profile.h"
+#include "streambuf.h"
+
+
+/* The minimap is a top-down picture of the whole layout, kept in a
+ * mipmapped texture. Level 0 is divided into tiles, which are redrawn
+ * only when directories within them change; the coarser levels of the
+ * pyramid are then regenerated from it. Each frame, the pyramid level
+ * nearest the inset size is copied into a corner of the viewport, and
+ * the ground footprint of the camera's view is outlined on top */
+
+
+/* Texture dimensions (pixels, level 0) and number of pyramid levels */
+#define MINIMAP_TEX_SIZE	512
+#define MINIMAP_LEVELS		10
+/* Tiles per side */
+#define MINIMAP_TILES		8
+#define MINIMAP_TILE_SIZE	(MINIMAP_TEX_SIZE / MINIMAP_TILES)
+
+/* Inset size, as a fraction of the smaller viewport dimension, and its
+ * distance from the viewport edges (pixels) */
+#define MINIMAP_INSET_FRACTION	0.25
+#define MINIMAP_INSET_MIN_SIZE	64
+#define MINIMAP_INSET_MARGIN	8
+
+/* Minimum interval between tile updates (milliseconds). Collapse and
+ * expand animations can invalidate tiles on every frame */
+#define MINIMAP_UPDATE_INTERVAL	250
+
+
+/* A node as seen from above */
+struct MinimapEntry {
+	GNode	*node;
+	GLfloat	x0, y0;
+	GLfloat	x1, y1;
+	GLubyte	color[4];
+};
+
+/* Where a directory's entries are: its own, then those of everything
+ * below it, up to end */
+struct MinimapRange {
+	GNode		*dnode;
+	unsigned int	first;
+	unsigned int	end;
+};
+
+/* Vertex format for tile drawing */
+typedef struct MinimapVertex {
+	GLfloat position[3];
+	GLubyte color[4];
+} MinimapVertex;
+
+
+/* Pyramid texture, and one framebuffer per level */
+static GLuint minimap_texture = 0;
+static GLuint level_fbo[MINIMAP_LEVELS];
+static GLuint vbo = 0;
+
+/* TRUE if the texture is to be released at the next frame */
+static boolean texture_shed = FALSE;
+
+/* Visible nodes, in drawing order (parents before children) */
+static GArray *entry_array = NULL;
+static boolean entries_stale = TRUE;
+
+/* Entry ranges of expanded directories (MapV only), and directories
+ * whose entries are to be collected anew. A change to a directory in
+ * MapV leaves everything outside it alone, so only its own entries need
+ * redoing */
+static GHashTable *dir_ranges = NULL;
+static GHashTable *stale_dirs = NULL;
+
+/* World region covered by the texture (a square) */
+static boolean mapped = FALSE;
+static double world_x0, world_y0, world_size;
+
+/* Tiles needing redraw */
+static boolean tile_dirty[MINIMAP_TILES * MINIMAP_TILES];
+static boolean all_tiles_dirty = TRUE;
+static boolean any_tile_dirty = TRUE;
+
+/* Time of last tile update, and pending update timeout */
+static double t_last_update = -1.0;
+static guint update_source_id = 0;
+
+/* Inset location as of the last frame (GL window coordinates, i.e.
+ * lower-left origin), and viewport height */
+static int inset_x, inset_y, inset_size = 0;
+static int viewport_height;
+
+
+/* Makes the entry for a node. Returns FALSE if it has no extents */
+static boolean
+make_entry( GNode *node, struct MinimapEntry *entry )
+{
+	const RGBcolor *color;
+	XYZvec c0, c1;
+
+	if (!geometry_node_extents( node, &c0, &c1 ))
+		return FALSE;
+
+	entry->node = node;
+	entry->x0 = c0.x;
+	entry->y0 = c0.y;
+	entry->x1 = c1.x;
+	entry->y1 = c1.y;
+	color = NODE_DESC(node)->color;
+	entry->color[0] = (GLubyte)(CLAMP(color->r, 0.0f, 1.0f) * G_MAXUINT8 + 0.5f);
+	entry->color[1] = (GLubyte)(CLAMP(color->g, 0.0f, 1.0f) * G_MAXUINT8 + 0.5f);
+	entry->color[2] = (GLubyte)(CLAMP(color->b, 0.0f, 1.0f) * G_MAXUINT8 + 0.5f);
+	entry->color[3] = G_MAXUINT8;
+
+	return TRUE;
+}
+
+
+/* Helper function for collect_entries( ) and collect_subtree( ). In
+ * MapV, the range of every expanded directory shown is logged as well */
+static void
+collect_recursive( GNode *dnode, GArray *range_log )
+{
+	struct MinimapEntry entry;
+	struct MinimapRange range;
+	GNode *node;
+	boolean expanded, shown;
+
+	node = dnode->children;
+	while (node != NULL) {
+		expanded = NODE_IS_DIR(node) && !DIR_COLLAPSED(node);
+		range.first = entry_array->len;
+		/* Directory platforms are visible from above in MapV, but
+		 * in TreeV only leaves are worth showing */
+		shown = (!expanded || (globals.fsv_mode == FSV_MAPV)) && make_entry( node, &entry );
+		if (shown)
+			g_array_append_val( entry_array, entry );
+		if (expanded) {
+			collect_recursive( node, range_log );
+			if (shown && (globals.fsv_mode == FSV_MAPV)) {
+				range.dnode = node;
+				range.end = entry_array->len;
+				g_array_append_val( range_log, range );
+			}
+		}
+		/* The small files, if merged, are shown as one */
+		if (node == DIR_NODE_DESC(dnode)->small_files)
+			break;
+		node = node->next;
+	}
+}
+
+
+static void
+range_free( struct MinimapRange *range )
+{
+	xfree( range );
+}
+
+
+/* Enters logged directory ranges into dir_ranges, with entry indices
+ * offset by base */
+static void
+add_ranges( GArray *range_log, unsigned int base )
+{
+	struct MinimapRange *range;
+	unsigned int i;
+
+	if (dir_ranges == NULL)
+		dir_ranges = g_hash_table_new_full( NULL, NULL, NULL, (GDestroyNotify)range_free );
+
+	for (i = 0; i < range_log->len; i++) {
+		range = NEW(struct MinimapRange);
+		*range = g_array_index(range_log, struct MinimapRange, i);
+		range->first += base;
+		range->end += base;
+		g_hash_table_replace( dir_ranges, range->dnode, range );
+	}
+}
+
+
+/* Gathers the visible nodes of the current layout, and (re)establishes
+ * the world region covered by the texture if the layout has outgrown it */
+static void
+collect_entries( void )
+{
+	struct MinimapEntry *entry;
+	GArray *range_log;
+	double x0 = G_MAXDOUBLE, y0 = G_MAXDOUBLE;
+	double x1 = - G_MAXDOUBLE, y1 = - G_MAXDOUBLE;
+	double size;
+	unsigned int i;
+
+	if (entry_array == NULL)
+		entry_array = g_array_new( FALSE, FALSE, sizeof(struct MinimapEntry) );
+	g_array_set_size( entry_array, 0 );
+	if (dir_ranges != NULL)
+		g_hash_table_remove_all( dir_ranges );
+	if (stale_dirs != NULL)
+		g_hash_table_remove_all( stale_dirs );
+	range_log = g_array_new( FALSE, FALSE, sizeof(struct MinimapRange) );
+	collect_recursive( globals.fstree, range_log );
+	add_ranges( range_log, 0 );
+	g_array_free( range_log, TRUE );
+	entries_stale = FALSE;
+
+	for (i = 0; i < entry_array->len; i++) {
+		entry = &g_array_index(entry_array, struct MinimapEntry, i);
+		x0 = MIN(x0, entry->x0);
+		y0 = MIN(y0, entry->y0);
+		x1 = MAX(x1, entry->x1);
+		y1 = MAX(y1, entry->y1);
+	}
+	if (entry_array->len == 0)
+		return;
+
+	if (mapped && (x0 >= world_x0) && (y0 >= world_y0) && (x1 <= (world_x0 + world_size)) && (y1 <= (world_y0 + world_size)))
+		return;
+
+	/* Square region centered on the layout, with a little margin */
+	size = 1.05 * MAX(MAX(x1 - x0, y1 - y0), EPSILON);
+	world_x0 = 0.5 * (x0 + x1 - size);
+	world_y0 = 0.5 * (y0 + y1 - size);
+	world_size = size;
+	mapped = TRUE;
+	all_tiles_dirty = TRUE;
+	any_tile_dirty = TRUE;
+}
+
+
+/* Returns TRUE if an entry lies within the world region covered by the
+ * texture */
+static boolean
+entry_in_region( const struct MinimapEntry *entry )
+{
+	if ((entry->x0 < world_x0) || (entry->y0 < world_y0))
+		return FALSE;
+	if ((entry->x1 > (world_x0 + world_size)) || (entry->y1 > (world_y0 + world_size)))
+		return FALSE;
+
+	return TRUE;
+}
+
+
+/* Gathers the visible nodes below a directory anew, in place of its old
+ * entries. Returns FALSE if that can't be done here, and everything is
+ * to be collected instead */
+static boolean
+collect_subtree( GNode *dnode )
+{
+	struct MinimapRange *range, *other;
+	struct MinimapEntry *entry;
+	GHashTableIter iter;
+	GArray *full_array, *sub_array, *range_log;
+	unsigned int old_end, i;
+	int delta;
+	boolean in_region;
+
+	range = (dir_ranges != NULL) ? g_hash_table_lookup( dir_ranges, dnode ) : NULL;
+	if ((range == NULL) || (g_array_index(entry_array, struct MinimapEntry, range->first).node != dnode))
+		return FALSE;
+
+	entry = &g_array_index(entry_array, struct MinimapEntry, range->first);
+	if (!make_entry( dnode, entry ))
+		return FALSE;
+
+	/* (collect_recursive( ) appends to entry_array) */
+	full_array = entry_array;
+	entry_array = g_array_new( FALSE, FALSE, sizeof(struct MinimapEntry) );
+	range_log = g_array_new( FALSE, FALSE, sizeof(struct MinimapRange) );
+	if (!DIR_COLLAPSED(dnode))
+		collect_recursive( dnode, range_log );
+	sub_array = entry_array;
+	entry_array = full_array;
+
+	/* Everything must stay within the mapped region */
+	in_region = entry_in_region( entry );
+	for (i = 0; (i < sub_array->len) && in_region; i++)
+		in_region = entry_in_region( &g_array_index(sub_array, struct MinimapEntry, i) );
+	if (!in_region) {
+		g_array_free( sub_array, TRUE );
+		g_array_free( range_log, TRUE );
+		return FALSE;
+	}
+
+	/* Directories formerly below are forgotten, then those after (and
+	 * above) are moved along */
+	for (i = range->first + 1; i < range->end; i++)
+		g_hash_table_remove( dir_ranges, g_array_index(entry_array, struct MinimapEntry, i).node );
+	old_end = range->end;
+	delta = (int)sub_array->len - (int)(old_end - range->first - 1);
+	if (delta != 0) {
+		g_hash_table_iter_init( &iter, dir_ranges );
+		while (g_hash_table_iter_next( &iter, NULL, (gpointer *)&other )) {
+			if (other->first >= old_end)
+				other->first += delta;
+			if (other->end >= old_end)
+				other->end += delta;
+		}
+	}
+
+	g_array_remove_range( entry_array, range->first + 1, old_end - range->first - 1 );
+	g_array_insert_vals( entry_array, range->first + 1, sub_array->data, sub_array->len );
+	add_ranges( range_log, range->first + 1 );
+	g_array_free( sub_array, TRUE );
+	g_array_free( range_log, TRUE );
+
+	profile_count( "minimap.subtree_collects", 1 );
+
+	return TRUE;
+}
+
+
+/* Brings the entries up to date: those of changed directories alone, if
+ * possible, otherwise all of them */
+static void
+update_entries( void )
+{
+	GHashTableIter iter;
+	GNode *dnode;
+
+	if (!entries_stale && (stale_dirs != NULL)) {
+		g_hash_table_iter_init( &iter, stale_dirs );
+		while (!entries_stale && g_hash_table_iter_next( &iter, (gpointer *)&dnode, NULL ))
+			entries_stale = !collect_subtree( dnode );
+		g_hash_table_remove_all( stale_dirs );
+	}
+	if (entries_stale)
+		collect_entries( );
+}
+
+
+/* Returns the range of tiles covering a world-space rectangle */
+static void
+tile_range( double x0, double y0, double x1, double y1, int *tx0, int *ty0, int *tx1, int *ty1 )
+{
+	double k = (double)MINIMAP_TILES / world_size;
+
+	*tx0 = CLAMP((int)floor( (x0 - world_x0) * k ), 0, MINIMAP_TILES - 1);
+	*ty0 = CLAMP((int)floor( (y0 - world_y0) * k ), 0, MINIMAP_TILES - 1);
+	*tx1 = CLAMP((int)floor( (x1 - world_x0) * k ), 0, MINIMAP_TILES - 1);
+	*ty1 = CLAMP((int)floor( (y1 - world_y0) * k ), 0, MINIMAP_TILES - 1);
+}
+
+
+/* Creates the pyramid texture and its framebuffers */
+static void
+texture_setup( void )
+{
+	int level, size;
+
+	glGenTextures( 1, &minimap_texture );
+	glBindTexture( GL_TEXTURE_2D, minimap_texture );
+	for (level = 0; level < MINIMAP_LEVELS; level++) {
+		size = MAX(1, MINIMAP_TEX_SIZE >> level);
+		glTexImage2D( GL_TEXTURE_2D, level, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	}
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, MINIMAP_LEVELS - 1 );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+
+	glGenFramebuffers( MINIMAP_LEVELS, level_fbo );
+	for (level = 0; level < MINIMAP_LEVELS; level++) {
+		glBindFramebuffer( GL_FRAMEBUFFER, level_fbo[level] );
+		glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, minimap_texture, level );
+	}
+
+	glGenBuffers( 1, &vbo );
+
+	/* Whole pyramid is 4/3 the size of level 0 */
+	gpumem_pin( (4 * 4 * MINIMAP_TEX_SIZE * MINIMAP_TEX_SIZE) / 3 );
+}
+
+
+/* Releases the pyramid texture, its framebuffers and the vertex buffer */
+static void
+texture_release( void )
+{
+	glDeleteFramebuffers( MINIMAP_LEVELS, level_fbo );
+	glDeleteTextures( 1, &minimap_texture );
+	glDeleteBuffers( 1, &vbo );
+	minimap_texture = 0;
+	vbo = 0;
+	gpumem_pin( - (int64)(4 * 4 * MINIMAP_TEX_SIZE * MINIMAP_TEX_SIZE) / 3 );
+}
+
+
+/* Fills in the six vertices (two triangles) of an entry */
+static void
+entry_vertices( const struct MinimapEntry *entry, MinimapVertex *vert )
+{
+	static const int corner_x[6] = { 0, 1, 1, 0, 1, 0 };
+	static const int corner_y[6] = { 0, 0, 1, 0, 1, 1 };
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		vert[i].position[0] = corner_x[i] ? entry->x1 : entry->x0;
+		vert[i].position[1] = corner_y[i] ? entry->y1 : entry->y0;
+		vert[i].position[2] = 0.0f;
+		memcpy( vert[i].color, entry->color, 4 * sizeof(GLubyte) );
+	}
+}
+
+
+/* Redraws dirty tiles, and regenerates the coarser pyramid levels.
+ * The caller's framebuffer binding and viewport must be restored
+ * afterward */
+static void
+update_tiles( void )
+{
+	struct MinimapEntry *entry;
+	MinimapVertex *vertices;
+	guint32 tile_start[MINIMAP_TILES * MINIMAP_TILES + 1];
+	guint32 tile_fill[MINIMAP_TILES * MINIMAP_TILES];
+	mat4 tmp_projection, tmp_modelview;
+	unsigned int i, num_vertices, num_tiles = 0;
+	int tx0, ty0, tx1, ty1, tx, ty, t;
+	double t0;
+
+	t0 = xgettime( );
+
+	update_entries( );
+	if (!mapped)
+		return;
+	if (all_tiles_dirty) {
+		for (t = 0; t < (MINIMAP_TILES * MINIMAP_TILES); t++)
+			tile_dirty[t] = TRUE;
+	}
+
+	/* Bin entries by (dirty) tile, preserving drawing order */
+	memset( tile_start, 0, sizeof(tile_start) );
+	for (i = 0; i < entry_array->len; i++) {
+		entry = &g_array_index(entry_array, struct MinimapEntry, i);
+		tile_range( entry->x0, entry->y0, entry->x1, entry->y1, &tx0, &ty0, &tx1, &ty1 );
+		for (ty = ty0; ty <= ty1; ty++)
+			for (tx = tx0; tx <= tx1; tx++)
+				if (tile_dirty[ty * MINIMAP_TILES + tx])
+					tile_start[ty * MINIMAP_TILES + tx + 1] += 6;
+	}
+	for (t = 1; t <= (MINIMAP_TILES * MINIMAP_TILES); t++)
+		tile_start[t] += tile_start[t - 1];
+	num_vertices = tile_start[MINIMAP_TILES * MINIMAP_TILES];
+	memcpy( tile_fill, tile_start, sizeof(tile_fill) );
+	vertices = NEW_ARRAY(MinimapVertex, MAX(1, num_vertices));
+	for (i = 0; i < entry_array->len; i++) {
+		entry = &g_array_index(entry_array, struct MinimapEntry, i);
+		tile_range( entry->x0, entry->y0, entry->x1, entry->y1, &tx0, &ty0, &tx1, &ty1 );
+		for (ty = ty0; ty <= ty1; ty++) {
+			for (tx = tx0; tx <= tx1; tx++) {
+				t = ty * MINIMAP_TILES + tx;
+				if (!tile_dirty[t])
+					continue;
+				entry_vertices( entry, &vertices[tile_fill[t]] );
+				tile_fill[t] += 6;
+			}
+		}
+	}
+
+	glBindBuffer( GL_ARRAY_BUFFER, vbo );
+	glBufferData( GL_ARRAY_BUFFER, num_vertices * sizeof(MinimapVertex), vertices, GL_STREAM_DRAW );
+	xfree( vertices );
+	glEnableVertexAttribArray( gl.position_location );
+	glVertexAttribPointer( gl.position_location, 3, GL_FLOAT, GL_FALSE, sizeof(MinimapVertex), (void *)offsetof(MinimapVertex, position) );
+	glEnableVertexAttribArray( gl.node_color_location );
+	glVertexAttribPointer( gl.node_color_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(MinimapVertex), (void *)offsetof(MinimapVertex, color) );
+	glDisableVertexAttribArray( gl.normal_location );
+
+	/* Straight-down view of the whole region */
+	glm_mat4_copy( gl.projection, tmp_projection );
+	glm_mat4_copy( gl.modelview, tmp_modelview );
+	glm_ortho( world_x0, world_x0 + world_size, world_y0, world_y0 + world_size, -1.0f, 1.0f, gl.projection );
+	glm_mat4_identity( gl.modelview );
+	ogl_upload_matrices( FALSE );
+
+	glBindFramebuffer( GL_FRAMEBUFFER, level_fbo[0] );
+	glViewport( 0, 0, MINIMAP_TEX_SIZE, MINIMAP_TEX_SIZE );
+	glDisable( GL_DEPTH_TEST );
+	glDisable( GL_CULL_FACE );
+	glEnable( GL_SCISSOR_TEST );
+	glClearColor( 0.1, 0.1, 0.1, 1.0 );
+
+	glUseProgram( gl.program );
+	glUniform1i( gl.vertex_color_mode_location, 1 );
+	glUniform1i( gl.lightning_enabled_location, 0 );
+	glUniform1i( gl.selection_enabled_location, 0 );
+	glUniform4f( gl.highlight_id_location, -1.0f, -1.0f, -1.0f, 1.0f );
+	for (ty = 0; ty < MINIMAP_TILES; ty++) {
+		for (tx = 0; tx < MINIMAP_TILES; tx++) {
+			t = ty * MINIMAP_TILES + tx;
+			if (!tile_dirty[t])
+				continue;
+			glScissor( tx * MINIMAP_TILE_SIZE, ty * MINIMAP_TILE_SIZE, MINIMAP_TILE_SIZE, MINIMAP_TILE_SIZE );
+			glClear( GL_COLOR_BUFFER_BIT );
+			if (tile_start[t + 1] > tile_start[t])
+				glDrawArrays( GL_TRIANGLES, tile_start[t], tile_start[t + 1] - tile_start[t] );
+			tile_dirty[t] = FALSE;
+			++num_tiles;
+		}
+	}
+	glUniform1i( gl.vertex_color_mode_location, 0 );
+	glUniform1i( gl.lightning_enabled_location, 1 );
+	glUseProgram( 0 );
+
+	glClearColor( 0.0, 0.0, 0.0, 0.0 );
+	glDisable( GL_SCISSOR_TEST );
+	glEnable( GL_CULL_FACE );
+	glEnable( GL_DEPTH_TEST );
+	glDisableVertexAttribArray( gl.node_color_location );
+	/* Avoid implicit sync by allowing GL to dealloc memory */
+	glBufferData( GL_ARRAY_BUFFER, num_vertices * sizeof(MinimapVertex), NULL, GL_STREAM_DRAW );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	glm_mat4_copy( tmp_projection, gl.projection );
+	glm_mat4_copy( tmp_modelview, gl.modelview );
+	ogl_upload_matrices( FALSE );
+
+	/* Rebuild the rest of the pyramid */
+	glBindTexture( GL_TEXTURE_2D, minimap_texture );
+	glGenerateMipmap( GL_TEXTURE_2D );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+
+	all_tiles_dirty = FALSE;
+	any_tile_dirty = FALSE;
+
+	profile_count( "minimap.updates", 1 );
+	profile_count( "minimap.tiles_drawn", num_tiles );
+	profile_gauge( "minimap.update_usec", (int64)(1.0e6 * (xgettime( ) - t0)) );
+}
+
+
+/* Timeout callback for deferred tile updates */
+static gboolean
+update_timeout_cb( gpointer data )
+{
+	update_source_id = 0;
+	redraw( );
+
+	return FALSE;
+}
+
+
+/* Finds where the camera's view meets the ground plane (z = 0). Rays
+ * which don't reach the ground are cut off at the far clipping plane */
+static void
+view_footprint( XYvec corners[4] )
+{
+	static const float ndc_x[4] = { -1.0f, 1.0f, 1.0f, -1.0f };
+	static const float ndc_y[4] = { -1.0f, -1.0f, 1.0f, 1.0f };
+	mat4 mvp, inv;
+	vec4 p_near, p_far;
+	double t;
+	int c;
+
+	glm_mat4_mul( gl.projection, gl.modelview, mvp );
+	glm_mat4_inv( mvp, inv );
+
+	for (c = 0; c < 4; c++) {
+		vec4 n = { ndc_x[c], ndc_y[c], -1.0f, 1.0f };
+		vec4 f = { ndc_x[c], ndc_y[c], 1.0f, 1.0f };
+		glm_mat4_mulv( inv, n, p_near );
+		glm_mat4_mulv( inv, f, p_far );
+		glm_vec4_scale( p_near, 1.0f / p_near[3], p_near );
+		glm_vec4_scale( p_far, 1.0f / p_far[3], p_far );
+
+		if (ABS(p_far[2] - p_near[2]) > EPSILON)
+			t = CLAMP(- p_near[2] / (p_far[2] - p_near[2]), 0.0, 1.0);
+		else
+			t = 1.0;
+		corners[c].x = p_near[0] + t * (p_far[0] - p_near[0]);
+		corners[c].y = p_near[1] + t * (p_far[1] - p_near[1]);
+	}
+}
+
+
+/* Draws the view outline and inset border */
+static void
+draw_outline( void )
+{
+	XYvec footprint[4];
+	GLfloat vert[8][3];
+	mat4 tmp_projection, tmp_modelview;
+	GLintptr offset;
+	double k;
+	int i;
+
+	view_footprint( footprint );
+
+	for (i = 0; i < 4; i++) {
+		vert[i][0] = footprint[i].x;
+		vert[i][1] = footprint[i].y;
+		vert[i][2] = 0.0f;
+	}
+	/* Border (one pixel inside the edge of the inset) */
+	k = world_size / (double)inset_size;
+	vert[4][0] = vert[7][0] = world_x0 + 0.5 * k;
+	vert[5][0] = vert[6][0] = world_x0 + world_size - 0.5 * k;
+	vert[4][1] = vert[5][1] = world_y0 + 0.5 * k;
+	vert[6][1] = vert[7][1] = world_y0 + world_size - 0.5 * k;
+	for (i = 4; i < 8; i++)
+		vert[i][2] = 0.0f;
+
+	glm_mat4_copy( gl.projection, tmp_projection );
+	glm_mat4_copy( gl.modelview, tmp_modelview );
+	glm_ortho( world_x0, world_x0 + world_size, world_y0, world_y0 + world_size, -1.0f, 1.0f, gl.projection );
+	glm_mat4_identity( gl.modelview );
+	ogl_upload_matrices( FALSE );
+
+	glViewport( inset_x, inset_y, inset_size, inset_size );
+	glScissor( inset_x, inset_y, inset_size, inset_size );
+	glEnable( GL_SCISSOR_TEST );
+	glDisable( GL_DEPTH_TEST );
+
+	offset = streambuf_upload( GL_ARRAY_BUFFER, vert, sizeof(vert) );
+	glEnableVertexAttribArray( gl.position_location );
+	glVertexAttribPointer( gl.position_location, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (void *)offset );
+	glDisableVertexAttribArray( gl.normal_location );
+
+	glUseProgram( gl.program );
+	glUniform1i( gl.lightning_enabled_location, 0 );
+	glLineWidth( 2.0 );
+	glUniform4f( gl.color_location, 1.0, 1.0, 1.0, 1.0 );
+	glDrawArrays( GL_LINE_LOOP, 0, 4 );
+	glLineWidth( 1.0 );
+	glUniform4f( gl.color_location, 0.5, 0.5, 0.5, 1.0 );
+	glDrawArrays( GL_LINE_LOOP, 4, 4 );
+	glUniform1i( gl.lightning_enabled_location, 1 );
+	glUseProgram( 0 );
+
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	glEnable( GL_DEPTH_TEST );
+	glDisable( GL_SCISSOR_TEST );
+
+	glm_mat4_copy( tmp_projection, gl.projection );
+	glm_mat4_copy( tmp_modelview, gl.modelview );
+	ogl_upload_matrices( FALSE );
+}
+
+
+/* Call when a new layout is put in place (new tree, or mode change) */
+void
+minimap_reset( void )
+{
+	mapped = FALSE;
+	entries_stale = TRUE;
+	all_tiles_dirty = TRUE;
+	any_tile_dirty = TRUE;
+	if (entry_array != NULL)
+		g_array_set_size( entry_array, 0 );
+	if (dir_ranges != NULL)
+		g_hash_table_remove_all( dir_ranges );
+	if (stale_dirs != NULL)
+		g_hash_table_remove_all( stale_dirs );
+}
+
+
+/* Gives up the minimap, to be drawn anew when next shown. The texture
+ * goes at the next frame (when there is a GL context). Returns FALSE if
+ * there was nothing to give up */
+boolean
+minimap_shed( void )
+{
+	if (minimap_texture == 0)
+		return FALSE;
+
+	if (entry_array != NULL) {
+		g_array_free( entry_array, TRUE );
+		entry_array = NULL;
+	}
+	texture_shed = TRUE;
+	minimap_reset( );
+
+	return TRUE;
+}
+
+
+/* Marks the minimap region covered by a directory as needing redraw.
+ * NULL means everything */
+void
+minimap_invalidate( GNode *dnode )
+{
+	XYZvec c0, c1;
+	int tx0, ty0, tx1, ty1, tx, ty;
+
+	/* TreeV directories push their neighbors around as they change,
+	 * so only MapV changes can be localized */
+	if ((dnode == NULL) || NODE_IS_METANODE(dnode) || !mapped || (globals.fsv_mode != FSV_MAPV) || !geometry_node_extents( dnode, &c0, &c1 )) {
+		entries_stale = TRUE;
+		all_tiles_dirty = TRUE;
+		any_tile_dirty = TRUE;
+		return;
+	}
+
+	if (!entries_stale) {
+		if (stale_dirs == NULL)
+			stale_dirs = g_hash_table_new( NULL, NULL );
+		g_hash_table_add( stale_dirs, dnode );
+	}
+	any_tile_dirty = TRUE;
+	if (all_tiles_dirty)
+		return;
+
+	tile_range( c0.x, c0.y, c1.x, c1.y, &tx0, &ty0, &tx1, &ty1 );
+	for (ty = ty0; ty <= ty1; ty++)
+		for (tx = tx0; tx <= tx1; tx++)
+			tile_dirty[ty * MINIMAP_TILES + tx] = TRUE;
+	any_tile_dirty = TRUE;
+}
+
+
+/* Call when a directory is about to be freed */
+void
+minimap_forget( GNode *dnode )
+{
+	if (dir_ranges != NULL)
+		g_hash_table_remove( dir_ranges, dnode );
+	if (stale_dirs != NULL)
+		g_hash_table_remove( stale_dirs, dnode );
+}
+
+
+/* Draws the minimap inset into the current framebuffer, given the
+ * viewport (x, y, width, height). Call at the end of a frame */
+void
+minimap_draw( const int viewport[4] )
+{
+	GLint draw_fbo = 0;
+	int level;
+	double t_now;
+
+	inset_size = 0;
+	if (texture_shed) {
+		/* Given up under memory pressure */
+		if (minimap_texture != 0)
+			texture_release( );
+		texture_shed = FALSE;
+	}
+	if ((globals.fsv_mode != FSV_MAPV) && (globals.fsv_mode != FSV_TREEV))
+		return;
+	if (about( ABOUT_CHECK ))
+		return;
+
+	if (minimap_texture == 0) {
+		texture_setup( );
+		mempressure_rebuilt( MEMPRESSURE_MINIMAP );
+	}
+
+	glGetIntegerv( GL_DRAW_FRAMEBUFFER_BINDING, &draw_fbo );
+
+	/* Bring tiles up to date, but not too often */
+	if (any_tile_dirty || entries_stale) {
+		t_now = xgettime( );
+		if (!mapped || ((t_now - t_last_update) >= (0.001 * MINIMAP_UPDATE_INTERVAL))) {
+			debug_alloc_exempt_begin( );
+			update_tiles( );
+			debug_alloc_exempt_end( );
+			t_last_update = t_now;
+			glBindFramebuffer( GL_FRAMEBUFFER, draw_fbo );
+		}
+		else if (update_source_id == 0)
+			update_source_id = g_timeout_add( MINIMAP_UPDATE_INTERVAL, update_timeout_cb, NULL );
+	}
+	if (!mapped) {
+		glViewport( viewport[0], viewport[1], viewport[2], viewport[3] );
+		return;
+	}
+
+	/* Inset goes in the lower right corner */
+	inset_size = (int)(MINIMAP_INSET_FRACTION * MIN(viewport[2], viewport[3]));
+	inset_size = CLAMP(inset_size, MINIMAP_INSET_MIN_SIZE, MINIMAP_TEX_SIZE);
+	inset_x = viewport[0] + viewport[2] - inset_size - MINIMAP_INSET_MARGIN;
+	inset_y = viewport[1] + MINIMAP_INSET_MARGIN;
+	viewport_height = viewport[3];
+
+	/* Pyramid level closest to (but not smaller than) the inset */
+	level = 0;
+	while ((level < (MINIMAP_LEVELS - 1)) && ((MINIMAP_TEX_SIZE >> (level + 1)) >= inset_size))
+		++level;
+
+	glBindFramebuffer( GL_READ_FRAMEBUFFER, level_fbo[level] );
+	glBindFramebuffer( GL_DRAW_FRAMEBUFFER, draw_fbo );
+	glBlitFramebuffer( 0, 0, MINIMAP_TEX_SIZE >> level, MINIMAP_TEX_SIZE >> level, inset_x, inset_y, inset_x + inset_size, inset_y + inset_size, GL_COLOR_BUFFER_BIT, GL_LINEAR );
+	glBindFramebuffer( GL_FRAMEBUFFER, draw_fbo );
+
+	draw_outline( );
+
+	glViewport( viewport[0], viewport[1], viewport[2], viewport[3] );
+}
+
+
+/* Tells if viewport location (x,y) (where (0,0) indicates the upper-left
+ * corner) is inside the minimap inset */
+boolean
+minimap_contains( int x, int y )
+{
+	int gl_y = viewport_height - y;
+
+	if (inset_size == 0)
+		return FALSE;
+
+	return (x >= inset_x) && (x < (inset_x + inset_size)) && (gl_y >= inset_y) && (gl_y < (inset_y + inset_size));
+}
+
+
+/* Returns the node shown at viewport location (x,y) in the minimap, or
+ * NULL if there is none */
+GNode *
+minimap_node_at( int x, int y )
+{
+	struct MinimapEntry *entry;
+	double wx, wy;
+	int i;
+
+	if (!minimap_contains( x, y ))
+		return NULL;
+
+	update_entries( );
+
+	wx = world_x0 + world_size * (double)(x - inset_x) / (double)inset_size;
+	wy = world_y0 + world_size * (double)(viewport_height - y - inset_y) / (double)inset_size;
+
+	/* Later entries are drawn on top of earlier ones */
+	for (i = (int)entry_array->len - 1; i >= 0; i--) {
+		entry = &g_array_index(entry_array, struct MinimapEntry, i);
+		if ((wx >= entry->x0) && (wx <= entry->x1) && (wy >= entry->y0) && (wy <= entry->y1))
+			return entry->node;
+	}
+
+	return NULL;
+}
+
+
+/* end minimap.c */
@@ -0,0 +1,26 @@
+/* minimap.h */
+
+/* Overview minimap */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_MINIMAP_H
+	#error
+#endif
+#define FSV_MINIMAP_H
+
+
+void minimap_reset( void );
+boolean minimap_shed( void );
+void minimap_invalidate( GNode *dnode );
+void minimap_forget( GNode *dnode );
+void minimap_draw( const int viewport[4] );
+boolean minimap_contains( int x, int y );
+GNode *minimap_node_at( int x, int y );
+
+
+/* end minimap.h */
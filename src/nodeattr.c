@@ -0,0 +1,462 @@
+/* nodeattr.c */
+
+/* Optional node attributes */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "nodeattr.h"
+
+#include "profile.h"
+#include "task.h"
+
+
+/* Ownership and timestamps are only needed for coloring by timestamp,
+ * node properties and selection summaries, so they are not kept in the
+ * node descriptors. Instead, each group of attributes is a column (an
+ * array indexed by node ID) that exists only once something asks for
+ * it. A column is either filled in by the scan (if it was told to keep
+ * it), or backfilled later by re-statting every node on the task pool.
+ * Until a column is complete, callers either do without it, or wait to
+ * be called back. All column state is main-thread only */
+
+
+/* Minimum column size (entries) */
+#define NODEATTR_MIN_SIZE	1024
+
+
+/* Entries in the columns */
+struct OwnerAttrs {
+	uid_t		user_id;
+	gid_t		group_id;
+};
+
+struct TimeAttrs {
+	time_t		atime;
+	time_t		mtime;
+	time_t		ctime;
+};
+
+/* Someone waiting for columns to be completed */
+struct Waiter {
+	unsigned int	columns;
+	NodeAttrReadyFunc ready_cb;
+	void		*data;
+};
+
+/* Unit of backfill work: re-statting the contents of one directory.
+ * Everything the pool thread needs is copied in, so that the tree is
+ * free to change (or go away) while the job is in flight */
+struct BackfillJob {
+	unsigned int	generation;	/* Backfill this belongs to */
+	char		*dir;		/* Absolute name of directory */
+	int		num_entries;
+	unsigned int	*ids;		/* Node IDs */
+	char		**names;	/* Base names (into name_buf) */
+	char		*name_buf;
+	NodeAttrs	*attrs;		/* Results */
+	boolean		*ok;		/* Stat succeeded */
+};
+
+
+static struct {
+	unsigned int	kept;		/* Columns filled in by the scan */
+	unsigned int	present;	/* Columns being kept up to date */
+	unsigned int	complete;	/* Columns valid for every node */
+	struct OwnerAttrs *owner;
+	struct TimeAttrs *times;
+	unsigned int	size;		/* Entries allocated per column */
+
+	/* Backfill in progress */
+	TaskCancel	*cancel;
+	unsigned int	generation;
+	unsigned int	backfill_columns;
+	int		pending;	/* Jobs not yet done */
+	GList		*waiters;	/* Elements are of type struct Waiter */
+} attr;
+
+
+/* Fills in the optional attributes from a stat buffer */
+void
+nodeattr_from_stat( const struct stat *st, NodeAttrs *attrs )
+{
+	attrs->user_id = st->st_uid;
+	attrs->group_id = st->st_gid;
+	attrs->atime = st->st_atime;
+	attrs->mtime = st->st_mtime;
+	attrs->ctime = st->st_ctime;
+}
+
+
+/* Reports column memory use */
+static void
+update_gauges( void )
+{
+	int64 bytes = 0;
+
+	if (attr.owner != NULL)
+		bytes += (int64)attr.size * sizeof(struct OwnerAttrs);
+	if (attr.times != NULL)
+		bytes += (int64)attr.size * sizeof(struct TimeAttrs);
+	profile_gauge( "nodeattr.bytes", bytes );
+}
+
+
+/* Makes sure every present column has an entry for the given node ID */
+static void
+columns_reserve( unsigned int id )
+{
+	unsigned int new_size;
+
+	if (id < attr.size)
+		return;
+
+	new_size = MAX(id + 1, MAX(2 * attr.size, NODEATTR_MIN_SIZE));
+	if (attr.present & NODE_ATTR_OWNER) {
+		RESIZE(attr.owner, new_size, struct OwnerAttrs);
+		memset( &attr.owner[attr.size], 0, (new_size - attr.size) * sizeof(struct OwnerAttrs) );
+	}
+	if (attr.present & NODE_ATTR_TIMES) {
+		RESIZE(attr.times, new_size, struct TimeAttrs);
+		memset( &attr.times[attr.size], 0, (new_size - attr.size) * sizeof(struct TimeAttrs) );
+	}
+	attr.size = new_size;
+	update_gauges( );
+}
+
+
+/* Brings the given columns into existence (empty, if new) */
+static void
+columns_add( unsigned int columns )
+{
+	if ((columns & NODE_ATTR_OWNER) && (attr.owner == NULL)) {
+		attr.owner = NEW_ARRAY(struct OwnerAttrs, MAX(attr.size, 1));
+		memset( attr.owner, 0, attr.size * sizeof(struct OwnerAttrs) );
+	}
+	if ((columns & NODE_ATTR_TIMES) && (attr.times == NULL)) {
+		attr.times = NEW_ARRAY(struct TimeAttrs, MAX(attr.size, 1));
+		memset( attr.times, 0, attr.size * sizeof(struct TimeAttrs) );
+	}
+	attr.present |= columns;
+	update_gauges( );
+}
+
+
+/* Selects the columns which scans fill in as they go */
+void
+nodeattr_set_kept( unsigned int columns )
+{
+	attr.kept = columns;
+}
+
+
+/* Helper function for nodeattr_reset( ) and backfill_start( ) */
+static void
+backfill_cancel( void )
+{
+	if (attr.cancel == NULL)
+		return;
+
+	task_cancel( attr.cancel );
+	task_cancel_unref( attr.cancel );
+	attr.cancel = NULL;
+	/* Stragglers are recognized by their generation */
+	++attr.generation;
+	attr.backfill_columns = 0;
+	attr.pending = 0;
+}
+
+
+/* Throws out all columns. Called at the start of a new scan; the kept
+ * columns will be complete once it is done */
+void
+nodeattr_reset( void )
+{
+	GList *llink;
+
+	backfill_cancel( );
+	for (llink = attr.waiters; llink != NULL; llink = llink->next)
+		xfree( llink->data );
+	g_list_free( attr.waiters );
+	attr.waiters = NULL;
+
+	if (attr.owner != NULL) {
+		xfree( attr.owner );
+		attr.owner = NULL;
+	}
+	if (attr.times != NULL) {
+		xfree( attr.times );
+		attr.times = NULL;
+	}
+	attr.size = 0;
+	attr.present = 0;
+	attr.complete = attr.kept;
+	columns_add( attr.kept );
+}
+
+
+/* Declares exactly the given columns complete, for a tree whose
+ * attributes come from somewhere other than a scan (e.g. a snapshot).
+ * Call after nodeattr_reset( ), and before storing any attributes */
+void
+nodeattr_set_complete( unsigned int columns )
+{
+	columns_add( columns );
+	attr.complete = columns;
+}
+
+
+/* Records the attributes of a node, in whichever columns exist */
+void
+nodeattr_store( unsigned int id, const NodeAttrs *attrs )
+{
+	if (attr.present == 0)
+		return;
+
+	columns_reserve( id );
+	if (attr.present & NODE_ATTR_OWNER) {
+		attr.owner[id].user_id = attrs->user_id;
+		attr.owner[id].group_id = attrs->group_id;
+	}
+	if (attr.present & NODE_ATTR_TIMES) {
+		attr.times[id].atime = attrs->atime;
+		attr.times[id].mtime = attrs->mtime;
+		attr.times[id].ctime = attrs->ctime;
+	}
+}
+
+
+/* Returns TRUE if the given columns are complete */
+boolean
+nodeattr_have( unsigned int columns )
+{
+	return (attr.complete & columns) == columns;
+}
+
+
+/* Fills in the given columns' attributes of a node, from memory. Returns
+ * FALSE (leaving attrs alone) if any of the columns is not complete */
+boolean
+nodeattr_lookup( GNode *node, unsigned int columns, NodeAttrs *attrs )
+{
+	unsigned int id = NODE_DESC(node)->id;
+
+	if (!nodeattr_have( columns ))
+		return FALSE;
+
+	/* Nodes without an entry were never statted (the metanode) */
+	if (columns & NODE_ATTR_OWNER) {
+		attrs->user_id = (id < attr.size) ? attr.owner[id].user_id : 0;
+		attrs->group_id = (id < attr.size) ? attr.owner[id].group_id : 0;
+	}
+	if (columns & NODE_ATTR_TIMES) {
+		attrs->atime = (id < attr.size) ? attr.times[id].atime : 0;
+		attrs->mtime = (id < attr.size) ? attr.times[id].mtime : 0;
+		attrs->ctime = (id < attr.size) ? attr.times[id].ctime : 0;
+	}
+
+	return TRUE;
+}
+
+
+/* Fills in all attributes of a node. Whatever is not in memory is read
+ * in from the filesystem on the spot (attributes which cannot be read
+ * come out as zero) */
+void
+nodeattr_get( GNode *node, NodeAttrs *attrs )
+{
+	struct stat st;
+	unsigned int missing;
+
+	missing = NODE_ATTR_ALL & ~attr.complete;
+	if (missing) {
+		memset( attrs, 0, sizeof(NodeAttrs) );
+		if (!lstat( node_absname( node ), &st )) {
+			nodeattr_from_stat( &st, attrs );
+			profile_count( "nodeattr.lazy_stats", 1 );
+		}
+	}
+	nodeattr_lookup( node, NODE_ATTR_ALL & ~missing, attrs );
+}
+
+
+/* Calls back everyone whose columns are now complete */
+static void
+notify_waiters( void )
+{
+	struct Waiter *waiter;
+	GList *llink, *next;
+
+	llink = attr.waiters;
+	while (llink != NULL) {
+		next = llink->next;
+		waiter = (struct Waiter *)llink->data;
+		if (nodeattr_have( waiter->columns )) {
+			G_LIST_REMOVE(attr.waiters, waiter);
+			(waiter->ready_cb)( waiter->data );
+			xfree( waiter );
+		}
+		llink = next;
+	}
+}
+
+
+/* Backfill work function (runs on a pool thread) */
+static void
+backfill_task( void *data, TaskCancel *cancel )
+{
+	struct BackfillJob *job = (struct BackfillJob *)data;
+	struct stat st;
+	char *absname;
+	int i;
+
+	for (i = 0; i < job->num_entries; i++) {
+		if (task_cancelled( cancel ))
+			return;
+		absname = g_build_filename( job->dir, job->names[i], NULL );
+		job->ok[i] = !lstat( absname, &st );
+		if (job->ok[i])
+			nodeattr_from_stat( &st, &job->attrs[i] );
+		g_free( absname );
+	}
+	profile_count( "nodeattr.backfill_stats", job->num_entries );
+}
+
+
+/* Backfill completion callback (runs on the main thread) */
+static void
+backfill_done_cb( void *data, boolean cancelled )
+{
+	struct BackfillJob *job = (struct BackfillJob *)data;
+	int i;
+
+	if (!cancelled && (job->generation == attr.generation)) {
+		for (i = 0; i < job->num_entries; i++) {
+			if (job->ok[i])
+				nodeattr_store( job->ids[i], &job->attrs[i] );
+		}
+		if (--attr.pending == 0) {
+			/* All done */
+			attr.complete |= attr.backfill_columns;
+			attr.backfill_columns = 0;
+			task_cancel_unref( attr.cancel );
+			attr.cancel = NULL;
+			notify_waiters( );
+		}
+	}
+
+	g_free( job->dir );
+	g_free( job->ids );
+	g_free( job->names );
+	g_free( job->name_buf );
+	g_free( job->attrs );
+	g_free( job->ok );
+	g_free( job );
+}
+
+
+/* Helper function for backfill_start( ). Submits one job per directory */
+static void
+backfill_submit_recursive( GNode *dnode )
+{
+	struct BackfillJob *job;
+	GNode *node;
+	size_t buf_size = 0, len;
+	char *p;
+	int i;
+
+	job = g_new0( struct BackfillJob, 1 );
+	job->generation = attr.generation;
+	job->dir = g_strdup( node_absname( dnode ) );
+	for (node = dnode->children; node != NULL; node = node->next) {
+		++job->num_entries;
+		buf_size += strlen( NODE_DESC(node)->name ) + 1;
+	}
+	job->ids = g_new( unsigned int, job->num_entries );
+	job->names = g_new( char *, job->num_entries );
+	job->name_buf = g_malloc( MAX(buf_size, 1) );
+	job->attrs = g_new( NodeAttrs, job->num_entries );
+	job->ok = g_new( boolean, job->num_entries );
+
+	p = job->name_buf;
+	i = 0;
+	for (node = dnode->children; node != NULL; node = node->next) {
+		len = strlen( NODE_DESC(node)->name ) + 1;
+		memcpy( p, NODE_DESC(node)->name, len );
+		job->ids[i] = NODE_DESC(node)->id;
+		job->names[i++] = p;
+		p += len;
+	}
+
+	++attr.pending;
+	task_submit( TASK_QUEUE_SCAN, TASK_PRIORITY_LOW, attr.cancel, backfill_task, backfill_done_cb, job );
+
+	/* Directories come first */
+	for (node = dnode->children; node != NULL; node = node->next) {
+		if (!NODE_IS_DIR(node))
+			break;
+		backfill_submit_recursive( node );
+	}
+}
+
+
+/* Starts re-statting the whole tree to fill in the given columns */
+static void
+backfill_start( unsigned int columns )
+{
+	/* A backfill already under way starts over, covering both sets
+	 * of columns */
+	columns |= attr.backfill_columns;
+	backfill_cancel( );
+
+	columns_add( columns );
+	attr.backfill_columns = columns;
+	attr.cancel = task_cancel_new( );
+	backfill_submit_recursive( globals.fstree );
+}
+
+
+/* Asks for the given columns to be completed. ready_cb (if not NULL) is
+ * called with data once they are, which may be right away. Only one
+ * request per ready_cb/data pair is remembered */
+void
+nodeattr_require( unsigned int columns, NodeAttrReadyFunc ready_cb, void *data )
+{
+	struct Waiter *waiter = NULL;
+	unsigned int missing;
+	GList *llink;
+
+	if (nodeattr_have( columns )) {
+		if (ready_cb != NULL)
+			(ready_cb)( data );
+		return;
+	}
+
+	missing = columns & ~attr.complete;
+	if ((missing & ~attr.backfill_columns) && (globals.fstree != NULL))
+		backfill_start( missing );
+
+	if (ready_cb == NULL)
+		return;
+
+	for (llink = attr.waiters; llink != NULL; llink = llink->next) {
+		waiter = (struct Waiter *)llink->data;
+		if ((waiter->ready_cb == ready_cb) && (waiter->data == data))
+			break;
+	}
+	if (llink == NULL) {
+		waiter = NEW(struct Waiter);
+		waiter->columns = 0;
+		waiter->ready_cb = ready_cb;
+		waiter->data = data;
+		G_LIST_APPEND(attr.waiters, waiter);
+	}
+	waiter->columns |= columns;
+}
+
+
+/* end nodeattr.c */
@@ -0,0 +1,42 @@
+/* nodeattr.h */
+
+/* Optional node attributes */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_NODEATTR_H
+	#error
+#endif
+#define FSV_NODEATTR_H
+
+
+#include <sys/stat.h>
+
+
+/* Attribute columns (bit flags) */
+typedef enum {
+	NODE_ATTR_OWNER = 1 << 0,	/* User and group IDs */
+	NODE_ATTR_TIMES = 1 << 1,	/* Access/modify/change times */
+	NODE_ATTR_ALL = NODE_ATTR_OWNER | NODE_ATTR_TIMES
+} NodeAttrColumn;
+
+/* Called (on the main thread) once requested columns are complete */
+typedef void (*NodeAttrReadyFunc)( void *data );
+
+
+void nodeattr_from_stat( const struct stat *st, NodeAttrs *attrs );
+void nodeattr_set_kept( unsigned int columns );
+void nodeattr_reset( void );
+void nodeattr_set_complete( unsigned int columns );
+void nodeattr_store( unsigned int id, const NodeAttrs *attrs );
+boolean nodeattr_have( unsigned int columns );
+boolean nodeattr_lookup( GNode *node, unsigned int columns, NodeAttrs *attrs );
+void nodeattr_get( GNode *node, NodeAttrs *attrs );
+void nodeattr_require( unsigned int columns, NodeAttrReadyFunc ready_cb, void *data );
+
+
+/* end nodeattr.h */
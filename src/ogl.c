@@ -17,15 +17,98 @@
 #include <gtk/gtkglarea.h>
 #include <GL/glu.h> /* gluPickMatrix( ) */
 
-#include "animation.h" /* redraw( ) */
+#include "about.h" /* about( ) */
+#include "animation.h" /* animation_busy( ), redraw( ) */
+#include "arena.h"
 #include "camera.h"
 #include "geometry.h"
+#include "gpumem.h" /* gpumem_frame_end( ) */
+#include "minimap.h" /* minimap_draw( ) */
+#include "profile.h"
+#include "streambuf.h" /* streambuf_frame_end( ) */
 #include "tmaptext.h" /* text_init( ) */
 
 
+/* Frame time that reduced-resolution rendering tries to hold (seconds) */
+#define OGL_TARGET_FRAME_TIME	(1.0 / 30.0)
+
+/* Lower limit on the render scale */
+#define OGL_MIN_RENDER_SCALE	0.25
+
+/* Time without rendering after which a reduced-resolution image is
+ * replaced with a full-resolution one (milliseconds) */
+#define OGL_SETTLE_TIME		150
+
+/* Limit on separately kept damage rectangles. Past this, overlapping
+ * ones are merged */
+#define OGL_MAX_DAMAGE_RECTS	8
+
+/* Damage covering more than this fraction of the viewport is cheaper to
+ * handle with a full frame */
+#define OGL_MAX_DAMAGE_AREA	0.5
+
+/* Extra margin around projected damage (pixels), to catch edge lines and
+ * antialiasing */
+#define OGL_DAMAGE_MARGIN	2
+
+
 /* Main viewport OpenGL area widget */
 static GtkWidget *viewport_gl_area_w = NULL;
 
+/* Offscreen color + depth render target */
+typedef struct {
+	GLuint	fbo;
+	GLuint	color_rb;
+	GLuint	depth_rb;
+	int	width;
+	int	height;
+} OffscreenTarget;
+
+/* Offscreen target for reduced-resolution rendering. It is allocated at
+ * full viewport size, and reduced frames are drawn into its lower-left
+ * corner, so changing the scale doesn't require reallocation */
+static OffscreenTarget lowres = { 0, 0, 0, 0, 0 };
+
+/* Full-resolution frames are drawn here, then copied to the widget. With
+ * the camera at rest, the next frame is made by redrawing only the
+ * damaged regions of this one (see ogl_damage_box( )) */
+static OffscreenTarget frame_cache = { 0, 0, 0, 0, 0 };
+
+/* Whether frame_cache holds a complete image of the current scene, and
+ * of which mode */
+static boolean frame_cache_valid = FALSE;
+static FsvMode frame_cache_mode = FSV_NONE;
+
+/* Screen regions (of frame_cache) to be redrawn in the next frame, each
+ * as x0, y0, x1, y1 */
+static struct {
+	boolean	all;
+	int	num_rects;
+	int	rects[OGL_MAX_DAMAGE_RECTS][4];
+} damage = { TRUE, 0 };
+
+/* Combined projection/modelview transform of the last full-resolution
+ * frame, for projecting damage to the screen */
+static mat4 frame_mvp;
+
+/* Damage rectangle being redrawn, while culling (NULL otherwise) */
+static const int *cull_rect = NULL;
+
+/* Current render scale (1.0 == full resolution) */
+static double render_scale = 1.0;
+
+/* Start time of previous render, and whether it was at reduced
+ * resolution */
+static double t_prev_render = -1.0;
+static boolean prev_render_reduced = FALSE;
+
+/* Camera state as of the previous render */
+static union AnyCamera prev_camera;
+
+/* Pending full-resolution "settle" frame */
+static guint settle_source_id = 0;
+static boolean settle_frame = FALSE;
+
 FsvGlState gl;
 AboutGlState aboutGL;
 
@@ -149,10 +232,16 @@ ogl_init( void )
 
 	gl.color_location = glGetUniformLocation(gl.program, "color");
 	gl.lightning_enabled_location = glGetUniformLocation(gl.program, "lightning_enabled");
+	gl.vertex_color_mode_location = glGetUniformLocation(gl.program, "vertex_color_mode");
+	gl.highlight_id_location = glGetUniformLocation(gl.program, "highlight_id");
+	gl.selection_mask_location = glGetUniformLocation(gl.program, "selection_mask");
+	gl.selection_enabled_location = glGetUniformLocation(gl.program, "selection_enabled");
 
 	/* get the location of the "position" and "color" attributes */
 	gl.position_location = glGetAttribLocation(gl.program, "position");
 	gl.normal_location = glGetAttribLocation(gl.program, "normal");
+	gl.node_color_location = glGetAttribLocation(gl.program, "node_color");
+	gl.node_id_location = glGetAttribLocation(gl.program, "node_id");
 
 
 	// Shader programs for the splash and about screens
@@ -195,6 +284,10 @@ ogl_init( void )
 	glUniform1f(gl.diffuse_location, light_diffuse[0]);
 	glUniform1f(gl.specular_location, light_specular[0]);
 	glUniform4fv(gl.light_pos_location, 1, light_position);
+	glUniform1i(gl.vertex_color_mode_location, 0);
+	/* Selection mask texture buffer lives on texture unit 1 */
+	glUniform1i(gl.selection_mask_location, 1);
+	glUniform1i(gl.selection_enabled_location, 0);
 	glUseProgram(0);
 	glUseProgram(aboutGL.program);
 	glUniform1f(aboutGL.ambient_location, light_ambient[0]);
@@ -403,6 +496,332 @@ ogl_draw( void )
 }
 
 
+/* Marks the whole viewport as needing redraw in the next frame */
+void
+ogl_damage_all( void )
+{
+	damage.all = TRUE;
+	damage.num_rects = 0;
+}
+
+
+/* Returns TRUE if the next frame is to be redrawn in full anyway, so that
+ * working out what to damage can be skipped */
+boolean
+ogl_full_redraw_pending( void )
+{
+	return damage.all || !frame_cache_valid;
+}
+
+
+/* Helper function. Gets the rectangle of frame_cache covered by a box in
+ * world space, as of the last full-resolution frame, clipped to the
+ * viewport (so it may come out empty). Returns FALSE if the box reaches
+ * behind the camera */
+static boolean
+project_box( const XYZvec *c0, const XYZvec *c1, int rect[4] )
+{
+	vec4 p, q;
+	double x0 = G_MAXDOUBLE, y0 = G_MAXDOUBLE;
+	double x1 = - G_MAXDOUBLE, y1 = - G_MAXDOUBLE;
+	double w, h;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		p[0] = (i & 1) ? c1->x : c0->x;
+		p[1] = (i & 2) ? c1->y : c0->y;
+		p[2] = (i & 4) ? c1->z : c0->z;
+		p[3] = 1.0f;
+		glm_mat4_mulv( frame_mvp, p, q );
+		if (q[3] < EPSILON)
+			return FALSE;
+		x0 = MIN(x0, q[0] / q[3]);
+		y0 = MIN(y0, q[1] / q[3]);
+		x1 = MAX(x1, q[0] / q[3]);
+		y1 = MAX(y1, q[1] / q[3]);
+	}
+
+	/* Normalized device coordinates to pixels */
+	w = (double)frame_cache.width;
+	h = (double)frame_cache.height;
+	x0 = floor( 0.5 * (x0 + 1.0) * w ) - OGL_DAMAGE_MARGIN;
+	y0 = floor( 0.5 * (y0 + 1.0) * h ) - OGL_DAMAGE_MARGIN;
+	x1 = ceil( 0.5 * (x1 + 1.0) * w ) + OGL_DAMAGE_MARGIN;
+	y1 = ceil( 0.5 * (y1 + 1.0) * h ) + OGL_DAMAGE_MARGIN;
+	rect[0] = (int)CLAMP(x0, 0.0, w);
+	rect[1] = (int)CLAMP(y0, 0.0, h);
+	rect[2] = (int)CLAMP(x1, 0.0, w);
+	rect[3] = (int)CLAMP(y1, 0.0, h);
+
+	return TRUE;
+}
+
+
+/* Helper function. Checks whether two rectangles overlap */
+static boolean
+rects_overlap( const int a[4], const int b[4] )
+{
+	return (a[0] < b[2]) && (b[0] < a[2]) && (a[1] < b[3]) && (b[1] < a[3]);
+}
+
+
+/* Helper function. Adds a rectangle of frame_cache to the damaged region */
+static void
+damage_rect( int rect[4] )
+{
+	int64 area = 0;
+	int i, j;
+
+	if (damage.all)
+		return;
+	if ((rect[2] <= rect[0]) || (rect[3] <= rect[1]))
+		return; /* not on screen */
+
+	/* Absorb overlapping rectangles (or any one, if there is no room
+	 * left), so that no pixel gets drawn twice */
+	i = 0;
+	while (i < damage.num_rects) {
+		if (rects_overlap( rect, damage.rects[i] ) || (damage.num_rects == OGL_MAX_DAMAGE_RECTS)) {
+			rect[0] = MIN(rect[0], damage.rects[i][0]);
+			rect[1] = MIN(rect[1], damage.rects[i][1]);
+			rect[2] = MAX(rect[2], damage.rects[i][2]);
+			rect[3] = MAX(rect[3], damage.rects[i][3]);
+			--damage.num_rects;
+			for (j = 0; j < 4; j++)
+				damage.rects[i][j] = damage.rects[damage.num_rects][j];
+			i = 0;
+		}
+		else
+			++i;
+	}
+	for (j = 0; j < 4; j++)
+		damage.rects[damage.num_rects][j] = rect[j];
+	++damage.num_rects;
+
+	/* Past a point, patching up is no cheaper than starting over */
+	for (i = 0; i < damage.num_rects; i++)
+		area += (int64)(damage.rects[i][2] - damage.rects[i][0]) * (damage.rects[i][3] - damage.rects[i][1]);
+	if (area > (int64)(OGL_MAX_DAMAGE_AREA * frame_cache.width * frame_cache.height))
+		ogl_damage_all( );
+}
+
+
+/* Marks the screen region covered by a box in world space as needing
+ * redraw in the next frame. This only goes for a camera at rest; if it
+ * moves, the whole frame is redrawn anyway */
+void
+ogl_damage_box( const XYZvec *c0, const XYZvec *c1 )
+{
+	int rect[4];
+
+	if (ogl_full_redraw_pending( ))
+		return;
+	if (!project_box( c0, c1, rect )) {
+		ogl_damage_all( );
+		return;
+	}
+	damage_rect( rect );
+}
+
+
+/* Marks the outline of a screen rectangle, given in normalized device
+ * coordinates (x0, y0, x1, y1), as needing redraw in the next frame. This
+ * is for line overlays drawn in screen space, like the selection marquee.
+ * The sides go in as separate strips, so that the inside is left alone */
+void
+ogl_damage_ndc_outline( const float ndc[4] )
+{
+	double w, h;
+	int x0, y0, x1, y1;
+	int rect[4];
+
+	if (ogl_full_redraw_pending( ))
+		return;
+
+	w = (double)frame_cache.width;
+	h = (double)frame_cache.height;
+	x0 = (int)floor( 0.5 * (ndc[0] + 1.0) * w );
+	y0 = (int)floor( 0.5 * (ndc[1] + 1.0) * h );
+	x1 = (int)ceil( 0.5 * (ndc[2] + 1.0) * w );
+	y1 = (int)ceil( 0.5 * (ndc[3] + 1.0) * h );
+
+	/* Bottom and top sides, then left and right between them */
+	rect[0] = MAX(0, x0 - OGL_DAMAGE_MARGIN);
+	rect[2] = MIN(frame_cache.width, x1 + OGL_DAMAGE_MARGIN);
+	rect[1] = MAX(0, y0 - OGL_DAMAGE_MARGIN);
+	rect[3] = MIN(frame_cache.height, y0 + OGL_DAMAGE_MARGIN);
+	damage_rect( rect );
+	rect[1] = MAX(0, y1 - OGL_DAMAGE_MARGIN);
+	rect[3] = MIN(frame_cache.height, y1 + OGL_DAMAGE_MARGIN);
+	damage_rect( rect );
+	rect[1] = MAX(0, y0 + OGL_DAMAGE_MARGIN);
+	rect[3] = MIN(frame_cache.height, y1 - OGL_DAMAGE_MARGIN);
+	rect[0] = MAX(0, x0 - OGL_DAMAGE_MARGIN);
+	rect[2] = MIN(frame_cache.width, x0 + OGL_DAMAGE_MARGIN);
+	damage_rect( rect );
+	rect[0] = MAX(0, x1 - OGL_DAMAGE_MARGIN);
+	rect[2] = MIN(frame_cache.width, x1 + OGL_DAMAGE_MARGIN);
+	damage_rect( rect );
+}
+
+
+/* Checks whether any part of a box in world space is within the damaged
+ * region being redrawn, so that drawing it can be skipped if not. This
+ * is always TRUE outside of a partial redraw */
+boolean
+ogl_box_damaged( const XYZvec *c0, const XYZvec *c1 )
+{
+	int rect[4];
+
+	if (cull_rect == NULL)
+		return TRUE;
+	if (!project_box( c0, c1, rect ))
+		return TRUE;
+	if ((rect[2] <= rect[0]) || (rect[3] <= rect[1]))
+		return FALSE; /* not on screen */
+
+	return rects_overlap( rect, cull_rect );
+}
+
+
+/* Timeout callback: once rendering has stopped for a while, replaces a
+ * reduced-resolution image with a full-resolution one */
+static gboolean
+settle_timeout_cb( gpointer data )
+{
+	if (camera_moving( ) || animation_busy( ))
+		return TRUE; /* keep waiting */
+	if ((xgettime( ) - t_prev_render) < (0.001 * OGL_SETTLE_TIME))
+		return TRUE;
+
+	settle_source_id = 0;
+	if (prev_render_reduced) {
+		settle_frame = TRUE;
+		ogl_draw( );
+	}
+
+	return FALSE;
+}
+
+
+/* (Re)allocates an offscreen target to match the viewport size. Returns
+ * TRUE if its contents are now undefined */
+static boolean
+offscreen_setup( OffscreenTarget *target, int width, int height )
+{
+	if ((target->fbo != 0) && (target->width == width) && (target->height == height))
+		return FALSE;
+
+	if (target->fbo == 0) {
+		glGenFramebuffers( 1, &target->fbo );
+		glGenRenderbuffers( 1, &target->color_rb );
+		glGenRenderbuffers( 1, &target->depth_rb );
+	}
+	else
+		gpumem_pin( - 8 * (int64)target->width * target->height );
+
+	glBindRenderbuffer( GL_RENDERBUFFER, target->color_rb );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, width, height );
+	glBindRenderbuffer( GL_RENDERBUFFER, target->depth_rb );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height );
+	glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+	glBindFramebuffer( GL_FRAMEBUFFER, target->fbo );
+	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target->color_rb );
+	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->depth_rb );
+	if (glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE)
+		g_warning( "Offscreen framebuffer incomplete" );
+
+	target->width = width;
+	target->height = height;
+	/* Color + depth, 4 bytes each */
+	gpumem_pin( 8 * (int64)width * height );
+
+	return TRUE;
+}
+
+
+/* Decides the resolution of the coming frame. Reduced resolution is used
+ * while anything is in motion: the camera (panning, or under manual
+ * control), or the scene itself (e.g. collapse and expand morphs, which
+ * can be slow on huge trees with the camera at rest). The scale adapts
+ * toward a steady frame time, so fast frames stay at full resolution.
+ * Returns the scale */
+static double
+choose_render_scale( boolean camera_changed )
+{
+	double t_now, delta_t;
+	boolean moving;
+
+	/* Frame period, start to start */
+	t_now = xgettime( );
+	delta_t = t_now - t_prev_render;
+	t_prev_render = t_now;
+
+	/* (Only while animating is the frame period set by the cost of
+	 * drawing, rather than by input events) */
+	moving = camera_moving( ) || camera_changed || animation_busy( );
+
+	if (settle_frame || !moving || (globals.fsv_mode == FSV_SPLASH)) {
+		settle_frame = FALSE;
+		return 1.0;
+	}
+
+	/* Only consecutive frames say anything about the frame rate */
+	if (delta_t < 1.0) {
+		/* Pixel count goes as the square of the scale, so adjust
+		 * by the square root of the time ratio (damped) */
+		double k = sqrt( OGL_TARGET_FRAME_TIME / MAX(delta_t, EPSILON) );
+		render_scale *= CLAMP(k, 0.8, 1.1);
+		render_scale = CLAMP(render_scale, OGL_MIN_RENDER_SCALE, 1.0);
+	}
+
+	return render_scale;
+}
+
+
+#ifdef DEBUG
+/* Heap allocation count at the start of the frame being rendered */
+static unsigned long frame_start_allocs;
+
+
+/* Helper function for render( ). Notes heap activity so far */
+static void
+frame_allocs_begin( void )
+{
+	frame_start_allocs = debug_alloc_count( );
+}
+
+
+/* Helper function for render( ). Apart from the first frame in a new
+ * mode, a frame should not touch the heap at all, except to rebuild
+ * retained geometry, update the minimap or grow the frame arena (which
+ * are exempted where they happen, see debug_alloc_exempt_begin( )). All
+ * other heap allocations on the main thread, GLib's included, are
+ * counted. Setting FSV_CHECK_FRAME_ALLOCS in the environment makes this
+ * fatal, so a static camera or a pan can be used to catch regressions */
+static void
+frame_allocs_end( boolean mode_switched )
+{
+	static int check = -1;
+	unsigned long allocs;
+
+	if (check < 0)
+		check = g_getenv( "FSV_CHECK_FRAME_ALLOCS" ) != NULL;
+
+	allocs = debug_alloc_count( ) - frame_start_allocs;
+	profile_gauge( "frame.heap_allocs", (int64)allocs );
+
+	if (mode_switched || (allocs == 0))
+		return;
+
+	profile_count( "frame.steady_alloc_frames", 1 );
+	if (check)
+		g_error( "Steady-state frame made %lu heap allocations", allocs );
+}
+#endif /* DEBUG */
+
+
 static gboolean
 render(GtkGLArea *area, GdkGLContext *context)
 {
@@ -418,16 +837,124 @@ render(GtkGLArea *area, GdkGLContext *context)
 	// draw your object
 	static FsvMode prev_mode = FSV_NONE;
 
+	GLint viewport[4], area_fbo = 0;
+	int width, height, i;
+	double scale, t0;
+	boolean camera_changed, partial;
+
+	t0 = xgettime( );
 	ogl_error();
-	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+	/* Scratch memory from the previous frame is no longer in use */
+	arena_reset( );
+#ifdef DEBUG
+	frame_allocs_begin( );
+#endif
+
+	camera_changed = memcmp( &prev_camera, camera, sizeof(union AnyCamera) ) != 0;
+	memcpy( &prev_camera, camera, sizeof(union AnyCamera) );
+
+	/* Render at reduced resolution into the offscreen target? */
+	scale = choose_render_scale( camera_changed );
+	glGetIntegerv( GL_VIEWPORT, viewport );
+	width = MAX(1, (int)(scale * viewport[2] + 0.5));
+	height = MAX(1, (int)(scale * viewport[3] + 0.5));
+	if ((width == viewport[2]) && (height == viewport[3]))
+		scale = 1.0;
+
+	/* GtkGLArea renders into a framebuffer of its own */
+	glGetIntegerv( GL_DRAW_FRAMEBUFFER_BINDING, &area_fbo );
+	if (scale < 1.0) {
+		offscreen_setup( &lowres, viewport[2], viewport[3] );
+		glBindFramebuffer( GL_FRAMEBUFFER, lowres.fbo );
+		frame_cache_valid = FALSE;
+	}
+	else {
+		if (offscreen_setup( &frame_cache, width, height ))
+			frame_cache_valid = FALSE;
+		glBindFramebuffer( GL_FRAMEBUFFER, frame_cache.fbo );
+	}
+	glViewport( 0, 0, width, height );
+
+	/* Only patch up the previous frame if the camera is at rest. This
+	 * is limited to MapV mode, where changes to a directory stay within
+	 * its own footprint (TreeV neighbors get pushed around) */
+	partial = (scale == 1.0) && !camera_changed && frame_cache_valid && !damage.all;
+	partial = partial && (globals.fsv_mode == FSV_MAPV) && (frame_cache_mode == FSV_MAPV) && !about( ABOUT_CHECK );
+
 	setup_projection_matrix( TRUE );
 	setup_modelview_matrix( );
 	ogl_upload_matrices(FALSE);
-	geometry_draw( TRUE );
+	if (scale == 1.0)
+		glm_mat4_mul( gl.projection, gl.modelview, frame_mvp );
+
+	if (partial) {
+		/* Redraw what is within each damaged region. The cached depth
+		 * buffer keeps the rest of the scene out of it */
+		glEnable( GL_SCISSOR_TEST );
+		for (i = 0; i < damage.num_rects; i++) {
+			cull_rect = damage.rects[i];
+			glScissor( cull_rect[0], cull_rect[1], cull_rect[2] - cull_rect[0], cull_rect[3] - cull_rect[1] );
+			glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+			geometry_draw( TRUE );
+		}
+		cull_rect = NULL;
+		glDisable( GL_SCISSOR_TEST );
+		profile_count( "render.partial_frames", 1 );
+	}
+	else {
+		glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+		geometry_draw( TRUE );
+	}
+
+	if (scale < 1.0) {
+		/* Upscale into the widget's framebuffer */
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, lowres.fbo );
+		glBindFramebuffer( GL_DRAW_FRAMEBUFFER, area_fbo );
+		glBlitFramebuffer( 0, 0, width, height, viewport[0], viewport[1], viewport[0] + viewport[2], viewport[1] + viewport[3], GL_COLOR_BUFFER_BIT, GL_LINEAR );
+
+		/* Make sure a full-resolution frame follows */
+		if (settle_source_id == 0)
+			settle_source_id = g_timeout_add( OGL_SETTLE_TIME, settle_timeout_cb, NULL );
+		profile_count( "render.reduced_frames", 1 );
+	}
+	else {
+		/* Copy into the widget's framebuffer */
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, frame_cache.fbo );
+		glBindFramebuffer( GL_DRAW_FRAMEBUFFER, area_fbo );
+		glBlitFramebuffer( 0, 0, width, height, viewport[0], viewport[1], viewport[0] + viewport[2], viewport[1] + viewport[3], GL_COLOR_BUFFER_BIT, GL_NEAREST );
+		frame_cache_valid = TRUE;
+		frame_cache_mode = globals.fsv_mode;
+	}
+	glBindFramebuffer( GL_FRAMEBUFFER, area_fbo );
+	glViewport( viewport[0], viewport[1], viewport[2], viewport[3] );
+	prev_render_reduced = scale < 1.0;
+	profile_count( "render.frames", 1 );
+	profile_gauge( "render.scale_percent", (int64)(100.0 * scale + 0.5) );
+
+	/* All damage is now accounted for */
+	damage.all = FALSE;
+	damage.num_rects = 0;
+
+	/* Overview inset goes on top, at full resolution */
+	minimap_draw( viewport );
+
+	/* Keep retained GPU resources within budget */
+	gpumem_frame_end( );
+	/* Move on to the next section of the streaming ring */
+	streambuf_frame_end( );
 
 	/* Error check */
 	ogl_error();
 
+	/* Time spent issuing the frame (not counting the wait for the
+	 * GPU to finish it) */
+	profile_sample( "render.frame_usec", (int64)(1.0e6 * (xgettime( ) - t0)) );
+
+#ifdef DEBUG
+	frame_allocs_end( globals.fsv_mode != prev_mode );
+#endif
+
 	/* First frame after a mode switch is not drawn
 	 * (with the exception of splash screen mode) */
 	if (globals.fsv_mode != prev_mode) {
@@ -451,6 +978,7 @@ ogl_select_modern(GLint x, GLint y)
 	// As this can be called outside of a render() callback, need to set
 	// the context explicitly.
 	gtk_gl_area_make_current( GTK_GL_AREA(viewport_gl_area_w) );
+	arena_reset( );
 
 	gl.render_mode = RENDERMODE_SELECT;
 	setup_projection_matrix(TRUE);
@@ -488,6 +1016,9 @@ ogl_select_modern(GLint x, GLint y)
 	//g_print("ogl_select_modern: Color red %u green %u blue %u alpha %u\n", color[0], color[1], color[2], color[3]);
 	GLuint node_id = color[0] + (color[1] << 8) + (color[2] << 16);
 
+	/* Pick pass is done with its streamed vertex data */
+	streambuf_frame_end( );
+
 	// Debugging, view pick rendering.
 	//gtk_gl_area_swapbuffers( GTK_GL_AREA(viewport_gl_area_w) );
 
@@ -40,6 +40,13 @@ typedef struct FsvGlState {
 	GLint normal_location;
 	GLint color_location;
 	GLint lightning_enabled_location;
+	// Per-vertex colors of retained geometry
+	GLint node_color_location;
+	GLint node_id_location;
+	GLint vertex_color_mode_location;
+	GLint highlight_id_location;
+	GLint selection_mask_location;
+	GLint selection_enabled_location;
 
 	// Phong lightning parameters
 	GLint ambient_location;
@@ -104,6 +111,11 @@ void ogl_upload_matrices(gboolean text);
 void ogl_enable_lightning();
 void ogl_disable_lightning();
 void ogl_draw( void );
+void ogl_damage_all( void );
+void ogl_damage_box( const XYZvec *c0, const XYZvec *c1 );
+void ogl_damage_ndc_outline( const float ndc[4] );
+boolean ogl_full_redraw_pending( void );
+boolean ogl_box_damaged( const XYZvec *c0, const XYZvec *c1 );
 void _ogl_error(const char *filename, int line_num);
 GLuint ogl_select_modern(GLint x, GLint y);
 #ifdef __GTK_H__
@@ -0,0 +1,354 @@
+/* perfctr.c */
+
+/* Hardware performance counters */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "perfctr.h"
+
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+	#define HAVE_PERF_EVENTS
+#endif
+
+#include "profile.h"
+
+
+/* Wall-clock time says how long a phase took, but not why. When enabled
+ * (--perf-counters), the major phases of work are bracketed by readings
+ * of the CPU's event counters, and the differences are added up per
+ * phase, giving instructions per cycle and cache misses per node. Event
+ * counters only count the thread which opened them, so every thread
+ * opens its own group of them, on first use. Where perf events are not
+ * permitted (perf_event_paranoid, seccomp filters, virtual machines
+ * without a PMU) whatever can be opened is used, and the rest is shown
+ * as unavailable */
+
+
+/* A thread's counters. Counters in a group are read all at once */
+struct PerfGroup {
+	int		leader;			/* Group leader fd, or -1 */
+	int		fd[NUM_PERF_EVENTS];	/* -1 if not open */
+	int		slot[NUM_PERF_EVENTS];	/* Position in group read */
+	int		num_open;
+};
+
+/* Running totals for a phase */
+struct PerfPhaseTotals {
+	int64		calls;
+	int64		nodes;
+	int64		counts[NUM_PERF_EVENTS];
+};
+
+
+/* Names as used in reports (and profiler statistic names) */
+static const char *phase_names[NUM_PERF_PHASES] = {
+	"scan", "aggregate", "sort", "layout", "color", "draw"
+};
+static const char *event_names[NUM_PERF_EVENTS] = {
+	"cycles", "instructions", "llc_misses", "page_faults", "context_switches"
+};
+
+#ifdef HAVE_PERF_EVENTS
+/* Event definitions */
+static const struct {
+	guint32		type;
+	guint64		config;
+} event_defs[NUM_PERF_EVENTS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }
+};
+#endif
+
+/* Profiler statistic names, "perf.<phase>.<event>" and "perf.<phase>.nodes"
+ * (interned in perfctr_enable( )) */
+static const char *count_stat_names[NUM_PERF_PHASES][NUM_PERF_EVENTS];
+static const char *nodes_stat_names[NUM_PERF_PHASES];
+
+/* Set once, at startup */
+static boolean enabled = FALSE;
+
+/* Totals, events which some thread managed to open, and the first error
+ * seen opening one. Updates come from pool threads, hence the lock */
+static struct PerfPhaseTotals totals[NUM_PERF_PHASES];
+static boolean event_open_ok[NUM_PERF_EVENTS];
+static int open_errno = 0;
+static GMutex totals_lock;
+
+static void group_close( struct PerfGroup *group );
+
+/* Each thread's counters */
+static GPrivate thread_group = G_PRIVATE_INIT( (GDestroyNotify)group_close );
+
+
+#ifdef HAVE_PERF_EVENTS
+/* Opens a counter for the calling thread, in the given group (-1 to start
+ * a new one). Returns the file descriptor, or -1 (with errno set) */
+static int
+event_open( PerfEvent event, int group_fd )
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset( &attr, 0, sizeof(attr) );
+	attr.size = sizeof(attr);
+	attr.type = event_defs[event].type;
+	attr.config = event_defs[event].config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_hv = 1;
+	/* Hardware events measure our own code. Software events (faults,
+	 * switches) happen in the kernel, on our behalf */
+	attr.exclude_kernel = (attr.type == PERF_TYPE_HARDWARE);
+
+	fd = (int)syscall( __NR_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC );
+	if ((fd < 0) && !attr.exclude_kernel && ((errno == EACCES) || (errno == EPERM))) {
+		/* Counting in the kernel isn't permitted, but counting
+		 * (kernel work done on behalf of) user space may be */
+		attr.exclude_kernel = 1;
+		fd = (int)syscall( __NR_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC );
+	}
+
+	return fd;
+}
+#endif
+
+
+/* Opens the calling thread's counters (as many as will open) */
+static struct PerfGroup *
+group_open( void )
+{
+	struct PerfGroup *group;
+	int first_errno = 0;
+	int e;
+
+	group = g_new(struct PerfGroup, 1);
+	group->leader = -1;
+	group->num_open = 0;
+	for (e = 0; e < NUM_PERF_EVENTS; e++) {
+		group->slot[e] = -1;
+#ifdef HAVE_PERF_EVENTS
+		group->fd[e] = event_open( e, group->leader );
+#else
+		group->fd[e] = -1;
+		errno = ENOSYS;
+#endif
+		if (group->fd[e] < 0) {
+			if (first_errno == 0)
+				first_errno = errno;
+			continue;
+		}
+		if (group->leader < 0)
+			group->leader = group->fd[e];
+		group->slot[e] = group->num_open++;
+	}
+
+	g_mutex_lock( &totals_lock );
+	for (e = 0; e < NUM_PERF_EVENTS; e++)
+		if (group->fd[e] >= 0)
+			event_open_ok[e] = TRUE;
+	if (open_errno == 0)
+		open_errno = first_errno;
+	g_mutex_unlock( &totals_lock );
+
+	return group;
+}
+
+
+/* Closes a thread's counters (at thread exit) */
+static void
+group_close( struct PerfGroup *group )
+{
+	int e;
+
+	for (e = 0; e < NUM_PERF_EVENTS; e++)
+		if (group->fd[e] >= 0)
+			close( group->fd[e] );
+	g_free( group );
+}
+
+
+/* Reads all counters of a group. Returns FALSE on failure */
+static boolean
+group_read( struct PerfGroup *group, guint64 *counts, guint64 *time_enabled, guint64 *time_running )
+{
+	/* Layout of a group read: nr, time enabled, time running, then
+	 * the nr values in order of opening */
+	guint64 buf[3 + NUM_PERF_EVENTS];
+	ssize_t len;
+	int e;
+
+	len = read( group->leader, buf, sizeof(buf) );
+	if (len < (ssize_t)((3 + group->num_open) * sizeof(guint64)))
+		return FALSE;
+
+	*time_enabled = buf[1];
+	*time_running = buf[2];
+	for (e = 0; e < NUM_PERF_EVENTS; e++)
+		counts[e] = (group->slot[e] < 0) ? 0 : buf[3 + group->slot[e]];
+
+	return TRUE;
+}
+
+
+/* Turns counting on. Call at startup, before any phase begins */
+void
+perfctr_enable( void )
+{
+	char *name;
+	int p, e;
+
+	for (p = 0; p < NUM_PERF_PHASES; p++) {
+		for (e = 0; e < NUM_PERF_EVENTS; e++) {
+			name = g_strdup_printf( "perf.%s.%s", phase_names[p], event_names[e] );
+			count_stat_names[p][e] = g_intern_string( name );
+			g_free( name );
+		}
+		name = g_strdup_printf( "perf.%s.nodes", phase_names[p] );
+		nodes_stat_names[p] = g_intern_string( name );
+		g_free( name );
+	}
+
+	enabled = TRUE;
+}
+
+
+/* Marks the beginning of a phase (on the calling thread) */
+void
+perfctr_begin( PerfScope *scope, PerfPhase phase )
+{
+	struct PerfGroup *group;
+
+	scope->phase = phase;
+	scope->group = NULL;
+	if (!enabled)
+		return;
+
+	group = g_private_get( &thread_group );
+	if (group == NULL) {
+		group = group_open( );
+		g_private_set( &thread_group, group );
+	}
+	if (group->num_open == 0)
+		return; /* nothing to count with */
+
+	if (group_read( group, scope->counts, &scope->time_enabled, &scope->time_running ))
+		scope->group = group;
+}
+
+
+/* Marks the end of a phase begun with perfctr_begin( ) on the same
+ * thread, which dealt with num_nodes nodes */
+void
+perfctr_end( PerfScope *scope, int64 num_nodes )
+{
+	struct PerfGroup *group = (struct PerfGroup *)scope->group;
+	struct PerfPhaseTotals *phase_totals;
+	guint64 counts[NUM_PERF_EVENTS];
+	guint64 time_enabled, time_running;
+	int64 delta[NUM_PERF_EVENTS];
+	double scale = 1.0;
+	int e;
+
+	if (group == NULL)
+		return;
+	if (!group_read( group, counts, &time_enabled, &time_running ))
+		return;
+
+	/* With more events than hardware counters, the kernel takes turns
+	 * among them; counts are then extrapolated from the time each was
+	 * actually running */
+	time_enabled -= scope->time_enabled;
+	time_running -= scope->time_running;
+	if (time_running == 0)
+		return;
+	if (time_running < time_enabled)
+		scale = (double)time_enabled / (double)time_running;
+	for (e = 0; e < NUM_PERF_EVENTS; e++)
+		delta[e] = (int64)(scale * (double)(counts[e] - scope->counts[e]));
+
+	g_mutex_lock( &totals_lock );
+	phase_totals = &totals[scope->phase];
+	++phase_totals->calls;
+	phase_totals->nodes += num_nodes;
+	for (e = 0; e < NUM_PERF_EVENTS; e++)
+		phase_totals->counts[e] += delta[e];
+	g_mutex_unlock( &totals_lock );
+
+	for (e = 0; e < NUM_PERF_EVENTS; e++)
+		if (group->slot[e] >= 0)
+			profile_count( count_stat_names[scope->phase][e], delta[e] );
+	profile_count( nodes_stat_names[scope->phase], num_nodes );
+}
+
+
+/* Helper function for perfctr_report( ). Formats num / den into a report
+ * column, or a dash if either event went uncounted */
+static void
+format_ratio( char *buf, size_t size, int64 num, boolean num_ok, int64 den, boolean den_ok )
+{
+	if (num_ok && den_ok && (den > 0))
+		snprintf( buf, size, "%.3f", (double)num / (double)den );
+	else
+		g_strlcpy( buf, "-", size );
+}
+
+
+/* Prints per-phase counter totals to standard output */
+void
+perfctr_report( void )
+{
+	struct PerfPhaseTotals *phase_totals;
+	char ipc[32], misses[32], faults[32], switches[32];
+	int p;
+
+	if (!enabled)
+		return;
+
+	g_mutex_lock( &totals_lock );
+	g_print( "---- hardware counters ----\n" );
+	switch (open_errno) {
+		case 0:
+		break;
+
+		case EACCES:
+		case EPERM:
+		g_print( "(some counters not permitted; see /proc/sys/kernel/perf_event_paranoid)\n" );
+		break;
+
+		case ENOENT:
+		case ENODEV:
+		case EOPNOTSUPP:
+		g_print( "(some counters not supported by this CPU)\n" );
+		break;
+
+		default:
+		g_print( "(some counters unavailable: %s)\n", g_strerror( open_errno ) );
+		break;
+	}
+	g_print( "%-10s %8s %12s %8s %12s %12s %12s\n", "phase", "calls", "nodes", "IPC", "LLC miss/n", "faults/n", "ctx sw/call" );
+	for (p = 0; p < NUM_PERF_PHASES; p++) {
+		phase_totals = &totals[p];
+		if (phase_totals->calls == 0)
+			continue;
+		format_ratio( ipc, sizeof(ipc), phase_totals->counts[PERF_INSTRUCTIONS], event_open_ok[PERF_INSTRUCTIONS], phase_totals->counts[PERF_CYCLES], event_open_ok[PERF_CYCLES] );
+		format_ratio( misses, sizeof(misses), phase_totals->counts[PERF_LLC_MISSES], event_open_ok[PERF_LLC_MISSES], phase_totals->nodes, TRUE );
+		format_ratio( faults, sizeof(faults), phase_totals->counts[PERF_PAGE_FAULTS], event_open_ok[PERF_PAGE_FAULTS], phase_totals->nodes, TRUE );
+		format_ratio( switches, sizeof(switches), phase_totals->counts[PERF_CONTEXT_SWITCHES], event_open_ok[PERF_CONTEXT_SWITCHES], phase_totals->calls, TRUE );
+		g_print( "%-10s %8" G_GINT64_FORMAT " %12" G_GINT64_FORMAT " %8s %12s %12s %12s\n", phase_names[p], phase_totals->calls, phase_totals->nodes, ipc, misses, faults, switches );
+	}
+	g_mutex_unlock( &totals_lock );
+}
+
+
+/* end perfctr.c */
@@ -0,0 +1,56 @@
+/* perfctr.h */
+
+/* Hardware performance counters */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_PERFCTR_H
+	#error
+#endif
+#define FSV_PERFCTR_H
+
+
+/* Phases of work which are counted separately */
+typedef enum {
+	PERF_PHASE_SCAN,	/* Reading directories */
+	PERF_PHASE_AGGREGATE,	/* Subtree sizes/counts */
+	PERF_PHASE_SORT,	/* Sorting directory contents */
+	PERF_PHASE_LAYOUT,	/* Laying out the tree for a mode */
+	PERF_PHASE_COLOR,	/* Assigning node colors */
+	PERF_PHASE_DRAW,	/* Draw traversal */
+	NUM_PERF_PHASES
+} PerfPhase;
+
+/* Counted events */
+typedef enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_PAGE_FAULTS,
+	PERF_CONTEXT_SWITCHES,
+	NUM_PERF_EVENTS
+} PerfEvent;
+
+/* Counter readings at the start of a phase (caller-allocated, usually
+ * on the stack) */
+typedef struct _PerfScope PerfScope;
+struct _PerfScope {
+	PerfPhase	phase;
+	void		*group;		/* NULL if not counting */
+	guint64		counts[NUM_PERF_EVENTS];
+	guint64		time_enabled;
+	guint64		time_running;
+};
+
+
+void perfctr_enable( void );
+void perfctr_begin( PerfScope *scope, PerfPhase phase );
+void perfctr_end( PerfScope *scope, int64 num_nodes );
+void perfctr_report( void );
+
+
+/* end perfctr.h */
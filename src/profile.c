@@ -0,0 +1,254 @@
+/* profile.c */
+
+/* Runtime statistics */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "profile.h"
+
+#include "perfctr.h" /* perfctr_report( ) */
+#include "task.h" /* task_queue_depth( ) */
+
+
+/* A named statistic */
+struct ProfileStat {
+	const char	*name;
+	ProfileKind	kind;
+	int64		value;
+	/* Value as of the previous report (for rates) */
+	int64		prev_value;
+	/* PROFILE_SAMPLES only: ring of the most recent measurements,
+	 * and the sum of all of them */
+	int64		*samples;
+	int64		sum;
+};
+
+
+/* Statistics, keyed by name. Updates may come from pool threads, hence
+ * the lock */
+static GHashTable *stat_table = NULL;
+static GMutex stat_lock;
+
+/* Time of the previous report */
+static double t_prev_report = -1.0;
+
+
+/* Looks up (or creates) a statistic. Lock must be held */
+static struct ProfileStat *
+stat_lookup( const char *name, ProfileKind kind )
+{
+	struct ProfileStat *stat;
+
+	if (stat_table == NULL)
+		stat_table = g_hash_table_new( g_str_hash, g_str_equal );
+
+	stat = g_hash_table_lookup( stat_table, name );
+	if (stat == NULL) {
+		stat = g_slice_new0(struct ProfileStat);
+		stat->name = name;
+		stat->kind = kind;
+		g_hash_table_insert( stat_table, (gpointer)name, stat );
+	}
+
+	return stat;
+}
+
+
+/* Adds to a counter */
+void
+profile_count( const char *name, int64 delta )
+{
+	g_mutex_lock( &stat_lock );
+	stat_lookup( name, PROFILE_COUNTER )->value += delta;
+	g_mutex_unlock( &stat_lock );
+}
+
+
+/* Sets a gauge */
+void
+profile_gauge( const char *name, int64 value )
+{
+	g_mutex_lock( &stat_lock );
+	stat_lookup( name, PROFILE_GAUGE )->value = value;
+	g_mutex_unlock( &stat_lock );
+}
+
+
+/* Records one measurement in a series */
+void
+profile_sample( const char *name, int64 value )
+{
+	struct ProfileStat *stat;
+
+	g_mutex_lock( &stat_lock );
+	stat = stat_lookup( name, PROFILE_SAMPLES );
+	if (stat->samples == NULL)
+		stat->samples = g_new(int64, PROFILE_SAMPLE_WINDOW);
+	stat->samples[stat->value % PROFILE_SAMPLE_WINDOW] = value;
+	stat->sum += value;
+	++stat->value;
+	g_mutex_unlock( &stat_lock );
+}
+
+
+/* Compare function for sorting measurements */
+static int
+compare_int64( const int64 *a, const int64 *b )
+{
+	return (*a > *b) - (*a < *b);
+}
+
+
+/* Returns the current value of a statistic (0 if never set) */
+int64
+profile_get( const char *name )
+{
+	struct ProfileStat *stat = NULL;
+	int64 value = 0;
+
+	g_mutex_lock( &stat_lock );
+	if (stat_table != NULL)
+		stat = g_hash_table_lookup( stat_table, name );
+	if (stat != NULL)
+		value = stat->value;
+	g_mutex_unlock( &stat_lock );
+
+	return value;
+}
+
+
+/* Gets quantiles (q[i] in [0, 1]) of the recent measurements in a
+ * series, and the sum of all measurements. Returns FALSE if there are
+ * none yet */
+boolean
+profile_quantiles( const char *name, const double *q, int num_q, int64 *values, int64 *sum )
+{
+	struct ProfileStat *stat = NULL;
+	int64 window[PROFILE_SAMPLE_WINDOW];
+	int n = 0, i;
+
+	g_mutex_lock( &stat_lock );
+	if (stat_table != NULL)
+		stat = g_hash_table_lookup( stat_table, name );
+	if ((stat != NULL) && (stat->samples != NULL)) {
+		n = (int)MIN(stat->value, PROFILE_SAMPLE_WINDOW);
+		memcpy( window, stat->samples, n * sizeof(int64) );
+		*sum = stat->sum;
+	}
+	g_mutex_unlock( &stat_lock );
+
+	if (n == 0)
+		return FALSE;
+
+	qsort( window, n, sizeof(int64), (int (*)( const void *, const void * ))compare_int64 );
+	for (i = 0; i < num_q; i++)
+		values[i] = window[(int)(q[i] * (n - 1) + 0.5)];
+
+	return TRUE;
+}
+
+
+/* Compare function for sorting statistics by name */
+static int
+compare_stat( const struct ProfileStat *a, const struct ProfileStat *b )
+{
+	return strcmp( a->name, b->name );
+}
+
+
+/* Returns a sorted snapshot of all statistics. Lock must be held */
+static GList *
+stat_list( void )
+{
+	GList *list;
+
+	if (stat_table == NULL)
+		return NULL;
+
+	list = g_hash_table_get_values( stat_table );
+
+	return g_list_sort( list, (GCompareFunc)compare_stat );
+}
+
+
+/* Task pool state is sampled, not pushed. This brings it up to date.
+ * (Interned strings live forever, so they are fine as statistic names) */
+static void
+sample_task_queues( void )
+{
+	int q;
+
+	for (q = 0; q < NUM_TASK_QUEUES; q++) {
+		char *name = g_strdup_printf( "task.%s.depth", task_queue_name( q ) );
+		profile_gauge( g_intern_string( name ), task_queue_depth( q ) );
+		g_free( name );
+	}
+}
+
+
+/* Calls func( ) on every statistic, in name order. The callback must
+ * not itself update statistics */
+void
+profile_foreach( void (*func)( const char *name, ProfileKind kind, int64 value, void *data ), void *data )
+{
+	struct ProfileStat *stat;
+	GList *list, *llink;
+
+	sample_task_queues( );
+
+	g_mutex_lock( &stat_lock );
+	list = stat_list( );
+	for (llink = list; llink != NULL; llink = llink->next) {
+		stat = (struct ProfileStat *)llink->data;
+		(func)( stat->name, stat->kind, stat->value, data );
+	}
+	g_mutex_unlock( &stat_lock );
+
+	g_list_free( list );
+}
+
+
+/* Prints all statistics to standard output. Counters are shown with
+ * their rate of change since the previous report, and series with the
+ * mean of their measurements, followed by hardware
+ * counter totals (if enabled) */
+void
+profile_report( void )
+{
+	struct ProfileStat *stat;
+	GList *list, *llink;
+	double t_now, delta_t;
+
+	sample_task_queues( );
+
+	t_now = xgettime( );
+	delta_t = (t_prev_report < 0.0) ? 0.0 : (t_now - t_prev_report);
+	t_prev_report = t_now;
+
+	g_mutex_lock( &stat_lock );
+	list = stat_list( );
+	g_print( "---- fsv statistics ----\n" );
+	for (llink = list; llink != NULL; llink = llink->next) {
+		stat = (struct ProfileStat *)llink->data;
+		if ((stat->kind == PROFILE_SAMPLES) && (stat->value > 0))
+			g_print( "%-32s %16" G_GINT64_FORMAT " %12.1f avg\n", stat->name, stat->value, (double)stat->sum / (double)stat->value );
+		else if ((stat->kind == PROFILE_COUNTER) && (delta_t > 0.0))
+			g_print( "%-32s %16" G_GINT64_FORMAT " %12.1f/s\n", stat->name, stat->value, (double)(stat->value - stat->prev_value) / delta_t );
+		else
+			g_print( "%-32s %16" G_GINT64_FORMAT "\n", stat->name, stat->value );
+		stat->prev_value = stat->value;
+	}
+	g_mutex_unlock( &stat_lock );
+
+	g_list_free( list );
+
+	perfctr_report( );
+}
+
+
+/* end profile.c */
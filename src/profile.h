@@ -0,0 +1,39 @@
+/* profile.h */
+
+/* Runtime statistics */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_PROFILE_H
+	#error
+#endif
+#define FSV_PROFILE_H
+
+
+/* Kinds of statistics */
+typedef enum {
+	PROFILE_COUNTER,	/* Monotonic count (rate is reported too) */
+	PROFILE_GAUGE,		/* Instantaneous value */
+	PROFILE_SAMPLES		/* Series of measurements (value is the count) */
+} ProfileKind;
+
+/* Number of most recent measurements kept for quantiles */
+#define PROFILE_SAMPLE_WINDOW	512
+
+
+/* Statistic names must be static strings, e.g. literals or
+ * g_intern_string( ) results (they are not copied) */
+void profile_count( const char *name, int64 delta );
+void profile_gauge( const char *name, int64 value );
+void profile_sample( const char *name, int64 value );
+int64 profile_get( const char *name );
+boolean profile_quantiles( const char *name, const double *q, int num_q, int64 *values, int64 *sum );
+void profile_foreach( void (*func)( const char *name, ProfileKind kind, int64 value, void *data ), void *data );
+void profile_report( void );
+
+
+/* end profile.h */
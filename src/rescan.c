@@ -0,0 +1,529 @@
+/* rescan.c */
+
+/* Background subtree rescan */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "rescan.h"
+
+#include <dirent.h>
+#include <gtk/gtk.h>
+
+#include "animation.h" /* animation_busy( ) */
+#include "dirtree.h"
+#include "extstats.h"
+#include "filelist.h"
+#include "geometry.h"
+#include "nodeattr.h"
+#include "perfctr.h"
+#include "profile.h"
+#include "sample.h"
+#include "scanfs.h"
+#include "selection.h"
+#include "task.h"
+#include "viewport.h"
+#include "window.h"
+
+
+/* A rescan reads in a directory subtree on the task pool, one task per
+ * directory, into a private snapshot. Nothing in the live tree is touched
+ * until the whole snapshot is in; then, on the main thread, it is merged
+ * into the tree in one go. Nodes that are still there (same name, same
+ * type) are kept as they are, with only their stat information updated,
+ * so their IDs, colors, expansion state and retained geometry survive.
+ * Subtree totals are patched up the ancestor chain, and only the
+ * rescanned subtree is laid out, colored and rebuilt anew */
+
+
+/* How often to check if the scene has come to rest (ms) */
+#define RESCAN_SETTLE_PERIOD	100
+
+
+/* A directory entry, as read in by a pool thread */
+struct RescanEntry {
+	char		*name;		/* Base name */
+	NodeDesc	desc;		/* Stat information */
+	NodeAttrs	attrs;		/* ditto (optional attributes) */
+	struct RescanDir *dir;		/* Contents (directories only) */
+};
+
+/* Contents of a directory */
+struct RescanDir {
+	struct RescanEntry *entries;	/* In alphabetical order */
+	int		num_entries;
+	boolean		unavailable;	/* Did not respond (left empty) */
+};
+
+/* A rescan in progress */
+struct Rescan {
+	GNode		*dnode;		/* Directory (NULL if orphaned) */
+	TaskCancel	*cancel;
+	gint		pending;	/* Directories not yet read in */
+	boolean		found;		/* Directory still exists */
+	NodeDesc	desc;		/* New stat information of directory */
+	NodeAttrs	attrs;		/* ditto (optional attributes) */
+	struct RescanDir root;		/* New contents of directory */
+};
+
+/* Unit of work: reading in one directory */
+struct RescanJob {
+	struct Rescan	*rescan;
+	struct RescanDir *dir;		/* Where the contents go */
+	char		*path;		/* Absolute name of directory */
+};
+
+
+/* Rescans in progress (elements are of type struct Rescan) */
+static GList *rescan_list = NULL;
+
+/* Tallies of nodes added/removed by the current merge */
+static int num_added;
+static int num_removed;
+
+
+/* Frees the contents of a directory snapshot */
+static void
+rescan_dir_clear( struct RescanDir *rdir )
+{
+	int i;
+
+	for (i = 0; i < rdir->num_entries; i++) {
+		g_free( rdir->entries[i].name );
+		if (rdir->entries[i].dir != NULL) {
+			rescan_dir_clear( rdir->entries[i].dir );
+			g_slice_free( struct RescanDir, rdir->entries[i].dir );
+		}
+	}
+	g_free( rdir->entries );
+}
+
+
+/* Frees a rescan record */
+static void
+rescan_free( struct Rescan *rescan )
+{
+	G_LIST_REMOVE(rescan_list, rescan);
+	rescan_dir_clear( &rescan->root );
+	task_cancel_unref( rescan->cancel );
+	xfree( rescan );
+}
+
+
+/* Copies new stat information into an existing node */
+static void
+update_desc( GNode *node, const NodeDesc *ndesc, const NodeAttrs *attrs )
+{
+	NODE_DESC(node)->size = ndesc->size;
+	NODE_DESC(node)->size_alloc = ndesc->size_alloc;
+	nodeattr_store( NODE_DESC(node)->id, attrs );
+}
+
+
+/* Helper function for discard( ). Clears out all outside references to
+ * the nodes of a subtree */
+static void
+forget_recursive( GNode *node, GNode *survivor )
+{
+	GNode *child;
+
+	if (node == globals.current_node)
+		globals.current_node = survivor;
+	while (g_list_find( globals.history, node ) != NULL)
+		G_LIST_REMOVE(globals.history, node);
+	viewport_node_table_remove( node );
+	++num_removed;
+
+	if (NODE_IS_DIR(node)) {
+		/* Row goes away in dirtree_entry_rebuild( ) */
+		if (DIR_NODE_DESC(node)->tnode != NULL) {
+			gtk_tree_path_free( DIR_NODE_DESC(node)->tnode );
+			DIR_NODE_DESC(node)->tnode = NULL;
+		}
+
+		child = node->children;
+		while (child != NULL) {
+			forget_recursive( child, survivor );
+			child = child->next;
+		}
+	}
+}
+
+
+/* Frees a node that has gone away, along with everything below it. The
+ * node must already be unlinked from the tree. If the current node is
+ * among those freed, the survivor node becomes current instead */
+static void
+discard( GNode *node, GNode *survivor )
+{
+	forget_recursive( node, survivor );
+	if (NODE_IS_DIR(node))
+		geometry_free_recursive( node );
+	scanfs_node_free( node );
+}
+
+
+/* GHFunc for gathering up the values of a hash table */
+static void
+collect_node( const char *name, GNode *node, GList **node_list )
+{
+	G_LIST_PREPEND(*node_list, node);
+}
+
+
+/* Replaces the contents of a directory with those of a snapshot,
+ * reusing nodes where possible, and recomputes its subtree totals */
+static void
+merge_dir( GNode *dnode, struct RescanDir *rdir )
+{
+	struct RescanEntry *entry;
+	GHashTable *old_nodes;
+	GNode *node;
+	GList *node_list = NULL, *node_llink;
+	int i, j;
+
+	/* Take out the old contents, indexed by name */
+	old_nodes = g_hash_table_new( g_str_hash, g_str_equal );
+	while ((node = dnode->children) != NULL) {
+		g_node_unlink( node );
+		g_hash_table_insert( old_nodes, (char *)NODE_DESC(node)->name, node );
+	}
+
+	DIR_NODE_DESC(dnode)->subtree.size = 0;
+	for (j = 0; j < NUM_NODE_TYPES; j++)
+		DIR_NODE_DESC(dnode)->subtree.counts[j] = 0;
+
+	for (i = 0; i < rdir->num_entries; i++) {
+		entry = &rdir->entries[i];
+		node = (GNode *)g_hash_table_lookup( old_nodes, entry->name );
+		if ((node != NULL) && (NODE_DESC(node)->type == entry->desc.type)) {
+			/* Same node as before */
+			g_hash_table_remove( old_nodes, entry->name );
+			update_desc( node, &entry->desc, &entry->attrs );
+		}
+		else {
+			node = scanfs_node_new( &entry->desc, entry->name );
+			nodeattr_store( NODE_DESC(node)->id, &entry->attrs );
+			viewport_node_table_add( node );
+			++num_added;
+		}
+		g_node_prepend( dnode, node ); /* (order is fixed below) */
+
+		if (NODE_IS_DIR(node)) {
+			/* (Read in fully, if it responded this time) */
+			DIR_NODE_DESC(node)->unavailable = entry->dir->unavailable;
+			DIR_NODE_DESC(node)->estimated = FALSE;
+			merge_dir( node, entry->dir );
+			DIR_NODE_DESC(dnode)->subtree.size += DIR_NODE_DESC(node)->subtree.size;
+			for (j = 0; j < NUM_NODE_TYPES; j++)
+				DIR_NODE_DESC(dnode)->subtree.counts[j] += DIR_NODE_DESC(node)->subtree.counts[j];
+		}
+		DIR_NODE_DESC(dnode)->subtree.size += NODE_DESC(node)->size;
+		++DIR_NODE_DESC(dnode)->subtree.counts[NODE_DESC(node)->type];
+	}
+
+	/* Whatever is left over has gone away */
+	g_hash_table_foreach( old_nodes, (GHFunc)collect_node, &node_list );
+	g_hash_table_destroy( old_nodes );
+	node_llink = node_list;
+	while (node_llink != NULL) {
+		discard( (GNode *)node_llink->data, dnode );
+		node_llink = node_llink->next;
+	}
+	g_list_free( node_list );
+
+	scanfs_sort_dir( dnode );
+}
+
+
+/* Merges a completed rescan into the filesystem tree */
+static void
+rescan_apply( struct Rescan *rescan )
+{
+	GNode *dnode, *parent, *up_node, *list_dnode;
+	int64 size_delta;
+	int counts_delta[NUM_NODE_TYPES];
+	boolean showing;
+	char strbuf[1024];
+	int i;
+
+	dnode = rescan->dnode;
+	num_added = 0;
+	num_removed = 0;
+
+	if (rescan->root.unavailable) {
+		/* Directory did not respond. What was known of it stays */
+		snprintf( strbuf, sizeof(strbuf), _("Not responding: %s"), node_absname( dnode ) );
+		window_statusbar( SB_RIGHT, strbuf );
+		return;
+	}
+
+	/* Selection may refer to nodes that are about to go away, and
+	 * extension totals will be out of date */
+	if (selection_active( ))
+		selection_clear( );
+	extstats_reset( );
+
+	/* Old contribution of the directory to its ancestors' totals */
+	size_delta = - NODE_DESC(dnode)->size - DIR_NODE_DESC(dnode)->subtree.size;
+	for (i = 0; i < NUM_NODE_TYPES; i++)
+		counts_delta[i] = - (int)DIR_NODE_DESC(dnode)->subtree.counts[i];
+	parent = dnode->parent;
+
+	if (!rescan->found) {
+		if (dnode == root_dnode) {
+			snprintf( strbuf, sizeof(strbuf), _("Cannot rescan: %s"), node_absname( dnode ) );
+			window_statusbar( SB_RIGHT, strbuf );
+			return;
+		}
+
+		/* Directory itself is gone */
+		snprintf( strbuf, sizeof(strbuf), _("Removed: %s"), node_absname( dnode ) );
+		--counts_delta[NODE_DIRECTORY];
+		showing = filelist_showing_subtree( parent );
+		g_node_unlink( dnode );
+		discard( dnode, parent );
+		dnode = parent;
+	}
+	else {
+		showing = filelist_showing_subtree( dnode );
+		update_desc( dnode, &rescan->desc, &rescan->attrs );
+		DIR_NODE_DESC(dnode)->unavailable = FALSE;
+		DIR_NODE_DESC(dnode)->estimated = FALSE;
+		merge_dir( dnode, &rescan->root );
+
+		size_delta += NODE_DESC(dnode)->size + DIR_NODE_DESC(dnode)->subtree.size;
+		for (i = 0; i < NUM_NODE_TYPES; i++)
+			counts_delta[i] += DIR_NODE_DESC(dnode)->subtree.counts[i];
+		snprintf( strbuf, sizeof(strbuf), _("Rescanned: %s (%d added, %d removed)"), node_absname( dnode ), num_added, num_removed );
+	}
+
+	/* Patch up subtree totals of all ancestors (up to and including
+	 * the metanode). Their own sort order and layout are left as is */
+	up_node = parent;
+	while (up_node != NULL) {
+		DIR_NODE_DESC(up_node)->subtree.size += size_delta;
+		for (i = 0; i < NUM_NODE_TYPES; i++)
+			DIR_NODE_DESC(up_node)->subtree.counts[i] += counts_delta[i];
+		up_node = up_node->parent;
+	}
+
+	dirtree_entry_rebuild( dnode );
+	geometry_subtree_changed( dnode );
+
+	if (showing) {
+		/* File list entries point at the old nodes */
+		list_dnode = globals.current_node;
+		if (!NODE_IS_DIR(list_dnode))
+			list_dnode = list_dnode->parent;
+		if ((list_dnode != dnode) && !g_node_is_ancestor( dnode, list_dnode ))
+			list_dnode = dnode;
+		filelist_populate( list_dnode );
+	}
+
+	profile_count( "rescan.nodes_added", num_added );
+	profile_count( "rescan.nodes_removed", num_removed );
+	window_statusbar( SB_RIGHT, strbuf );
+	redraw( );
+}
+
+
+/* Finishes up a rescan once its directories have all been read in.
+ * The merge waits until nothing is in motion, as morphs and camera pans
+ * hold on to nodes. Returns TRUE if it has to wait (this doubles as a
+ * GSourceFunc for polling) */
+static boolean
+rescan_finish( struct Rescan *rescan )
+{
+	if ((rescan->dnode != NULL) && !task_cancelled( rescan->cancel )) {
+		if (animation_busy( ) || selection_dragging( ))
+			return TRUE;
+		rescan_apply( rescan );
+	}
+
+	rescan_free( rescan );
+
+	return FALSE;
+}
+
+
+/* Completion callback for read_dir_task( ) */
+static void
+read_dir_done_cb( void *data, boolean cancelled )
+{
+	struct RescanJob *job = (struct RescanJob *)data;
+	struct Rescan *rescan = job->rescan;
+
+	g_free( job->path );
+	g_slice_free( struct RescanJob, job );
+
+	if (!g_atomic_int_dec_and_test( &rescan->pending ))
+		return;
+
+	if (rescan_finish( rescan ))
+		g_timeout_add( RESCAN_SETTLE_PERIOD, (GSourceFunc)rescan_finish, rescan );
+}
+
+
+/* Work function: reads in a directory, stat'ing every entry, and spawns
+ * jobs for any subdirectories found. The filesystem calls go through
+ * scanfs( )'s stat workers, so that a dead mount only holds up the
+ * rescan for the stat timeout: a directory that does not respond is
+ * left empty and marked unavailable, as in a scan */
+static void
+read_dir_task( void *data, TaskCancel *cancel )
+{
+	struct RescanJob *job = (struct RescanJob *)data, *subjob;
+	struct Rescan *rescan = job->rescan;
+	struct RescanEntry *entry;
+	ScanfsEntryStat root_stat, *stats;
+	char **names, *name, *parent_dir;
+	const char *sep;
+	PerfScope perf;
+	int num_entries, i;
+
+	if (job->dir == &rescan->root) {
+		/* Check on the directory itself first */
+		name = g_path_get_basename( job->path );
+		parent_dir = g_path_get_dirname( job->path );
+		scanfs_stat_entries( parent_dir, &name, 1, &root_stat );
+		g_free( parent_dir );
+		g_free( name );
+		if (root_stat.unavailable)
+			rescan->root.unavailable = TRUE;
+		else if (root_stat.ok && (root_stat.desc.type == NODE_DIRECTORY)) {
+			memcpy( &rescan->desc, &root_stat.desc, sizeof(NodeDesc) );
+			memcpy( &rescan->attrs, &root_stat.attrs, sizeof(NodeAttrs) );
+			rescan->found = TRUE;
+		}
+		if (!rescan->found)
+			return;
+	}
+
+	/* Scan in directory entries. An unreadable directory is taken
+	 * to be empty, as in scanfs( ) */
+	perfctr_begin( &perf, PERF_PHASE_SCAN );
+	num_entries = scanfs_list_dir( job->path, &names );
+	if (num_entries < 0) {
+		if (num_entries == SCANFS_UNAVAILABLE)
+			job->dir->unavailable = TRUE;
+		perfctr_end( &perf, 0 );
+		return;
+	}
+	stats = g_new( ScanfsEntryStat, MAX(num_entries, 1) );
+	if (!task_cancelled( cancel ))
+		scanfs_stat_entries( job->path, names, num_entries, stats );
+	else
+		num_entries = 0;
+
+	sep = g_str_has_suffix( job->path, "/" ) ? "" : "/";
+	job->dir->entries = g_new0( struct RescanEntry, MAX(num_entries, 1) );
+	for (i = 0; (i < num_entries) && !task_cancelled( cancel ); i++) {
+		/* (Entries whose stat failed are left out) */
+		if (!stats[i].ok && !stats[i].unavailable)
+			continue;
+		entry = &job->dir->entries[job->dir->num_entries];
+		entry->name = g_strdup( names[i] );
+		++job->dir->num_entries;
+		if (stats[i].unavailable) {
+			/* Placeholder: an empty directory, marked
+			 * unavailable (most likely a mount point) */
+			entry->desc.type = NODE_DIRECTORY;
+			entry->dir = g_slice_new0(struct RescanDir);
+			entry->dir->unavailable = TRUE;
+			continue;
+		}
+		memcpy( &entry->desc, &stats[i].desc, sizeof(NodeDesc) );
+		memcpy( &entry->attrs, &stats[i].attrs, sizeof(NodeAttrs) );
+		if (entry->desc.type == NODE_DIRECTORY) {
+			/* Recurse down (in parallel) */
+			entry->dir = g_slice_new0(struct RescanDir);
+			subjob = g_slice_new(struct RescanJob);
+			subjob->rescan = rescan;
+			subjob->dir = entry->dir;
+			subjob->path = g_strconcat( job->path, sep, names[i], NULL );
+			g_atomic_int_inc( &rescan->pending );
+			task_submit( TASK_QUEUE_SCAN, TASK_PRIORITY_NORMAL, cancel, read_dir_task, read_dir_done_cb, subjob );
+		}
+	}
+	g_free( stats );
+	g_strfreev( names );
+	perfctr_end( &perf, num_entries );
+
+	profile_count( "rescan.stats", num_entries );
+}
+
+
+/* Starts a background rescan of the given directory. The tree keeps
+ * showing the old contents until the new ones are all in */
+void
+rescan( GNode *dnode )
+{
+	struct Rescan *rescan;
+	struct RescanJob *job;
+	GList *rescan_llink;
+	GNode *busy_dnode;
+	char strbuf[1024];
+
+	g_assert( NODE_IS_DIR(dnode) );
+
+	/* Overlapping rescans would pull nodes out from under each other */
+	rescan_llink = rescan_list;
+	while (rescan_llink != NULL) {
+		busy_dnode = ((struct Rescan *)rescan_llink->data)->dnode;
+		if ((busy_dnode != NULL) && ((busy_dnode == dnode) || g_node_is_ancestor( busy_dnode, dnode ) || g_node_is_ancestor( dnode, busy_dnode ))) {
+			snprintf( strbuf, sizeof(strbuf), _("Already rescanning: %s"), node_absname( busy_dnode ) );
+			window_statusbar( SB_RIGHT, strbuf );
+			return;
+		}
+		rescan_llink = rescan_llink->next;
+	}
+
+	/* Sampled estimates below are about to be replaced with the
+	 * real thing */
+	sample_cancel_subtree( dnode );
+
+	rescan = NEW(struct Rescan);
+	rescan->dnode = dnode;
+	rescan->cancel = task_cancel_new( );
+	rescan->pending = 1;
+	rescan->found = FALSE;
+	rescan->root.entries = NULL;
+	rescan->root.num_entries = 0;
+	rescan->root.unavailable = FALSE;
+	G_LIST_PREPEND(rescan_list, rescan);
+
+	job = g_slice_new(struct RescanJob);
+	job->rescan = rescan;
+	job->dir = &rescan->root;
+	job->path = g_strdup( node_absname( dnode ) );
+	task_submit( TASK_QUEUE_SCAN, TASK_PRIORITY_NORMAL, rescan->cancel, read_dir_task, read_dir_done_cb, job );
+
+	snprintf( strbuf, sizeof(strbuf), _("Rescanning: %s"), node_absname( dnode ) );
+	window_statusbar( SB_RIGHT, strbuf );
+}
+
+
+/* Abandons all rescans in progress. Call this before the filesystem tree
+ * is replaced */
+void
+rescan_cancel_all( void )
+{
+	GList *rescan_llink;
+	struct Rescan *rescan;
+
+	rescan_llink = rescan_list;
+	while (rescan_llink != NULL) {
+		rescan = (struct Rescan *)rescan_llink->data;
+		task_cancel( rescan->cancel );
+		rescan->dnode = NULL;
+		rescan_llink = rescan_llink->next;
+	}
+}
+
+
+/* end rescan.c */
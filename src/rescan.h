@@ -0,0 +1,21 @@
+/* rescan.h */
+
+/* Background subtree rescan */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_RESCAN_H
+	#error
+#endif
+#define FSV_RESCAN_H
+
+
+void rescan( GNode *dnode );
+void rescan_cancel_all( void );
+
+
+/* end rescan.h */
@@ -0,0 +1,457 @@
+/* sample.c */
+
+/* Sampling estimates of unscanned subtrees */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "sample.h"
+
+#include <dirent.h>
+#include <math.h>
+#include <gtk/gtk.h>
+
+#include "animation.h" /* animation_busy( ), redraw( ) */
+#include "geometry.h"
+#include "profile.h"
+#include "scanfs.h"
+#include "selection.h" /* selection_dragging( ) */
+#include "task.h"
+#include "window.h"
+
+
+/* Directories below the sampling depth (see scanfs_set_sample_depth( ))
+ * are left empty by the scan, and their subtree totals are estimated
+ * here, on the task pool. Each probe lists a directory, stats a random
+ * sample of its entries, and goes on down into one of the sampled
+ * subdirectories, picked at random, to the bottom of the tree. What is
+ * found is scaled up by the inverse of the fraction sampled at each
+ * level, so that every probe is an unbiased (if noisy) estimate of the
+ * subtree totals. Probes are repeated until their running mean is
+ * known closely enough, and the spread between them gives a confidence
+ * interval. Every so often, the estimated sizes are put into the tree in
+ * place of the old subtree sizes, and the tree is laid out anew.
+ *
+ * Estimated node counts are only reported, not put into the tree: the
+ * subtree counts there always stay counts of nodes actually in the tree,
+ * as plenty of code allocates by them */
+
+
+/* Entries statted per directory level, per probe */
+#define SAMPLE_ENTRIES		32
+
+/* Probes per directory: at least, and at most */
+#define SAMPLE_MIN_PROBES	4
+#define SAMPLE_MAX_PROBES	64
+
+/* Probing of a directory stops once its confidence interval is within
+ * this fraction of the estimate */
+#define SAMPLE_TARGET_ERROR	0.05
+
+/* Standard score of the confidence intervals (95%) */
+#define SAMPLE_Z		1.96
+
+/* Estimates are put into the tree at intervals this far apart (ms) */
+#define SAMPLE_UPDATE_PERIOD	1000
+
+
+/* Estimate of a directory's subtree totals */
+struct SampleDir {
+	GNode		*dnode;		/* Directory (NULL once dropped) */
+	char		*path;		/* Absolute name of directory */
+	int		num_probes;	/* Probes folded in so far */
+	double		mean_size;	/* Running mean of probe estimates */
+	double		m2_size;	/* Sum of squared deviations from it */
+	double		mean_counts[NUM_NODE_TYPES];
+	boolean		probing;	/* Probe in flight */
+	boolean		settled;	/* No more probes needed */
+	boolean		changed;	/* Not yet put into the tree */
+};
+
+/* Unit of work: one probe */
+struct SampleProbe {
+	struct SampleDir *sdir;
+	char		*path;		/* (Copy, for the pool thread) */
+	double		size;		/* Estimated subtree size */
+	double		counts[NUM_NODE_TYPES]; /* ditto, node type totals */
+	boolean		exact;		/* Nothing had to be sampled */
+};
+
+
+/* Estimates in progress (or settled), by directory node */
+static GHashTable *sample_dirs = NULL;
+
+/* Cancellation token shared by all probes */
+static TaskCancel *sample_cancel = NULL;
+
+/* ID of the update timeout (0 if none) */
+static guint update_id = 0;
+
+
+/* Returns the half-width of the confidence interval of a directory's
+ * estimated subtree size */
+static double
+size_error( const struct SampleDir *sdir )
+{
+	if (sdir->settled && (sdir->m2_size == 0.0))
+		return 0.0; /* (exact) */
+	if (sdir->num_probes < 2)
+		return sdir->mean_size;
+
+	return SAMPLE_Z * sqrt( sdir->m2_size / (double)((sdir->num_probes - 1) * sdir->num_probes) );
+}
+
+
+/* Frees an estimate record */
+static void
+sample_dir_free( struct SampleDir *sdir )
+{
+	xfree( sdir->path );
+	xfree( sdir );
+}
+
+
+/* Drops an estimate. One with a probe in flight is freed once that
+ * comes back */
+static void
+sample_dir_drop( struct SampleDir *sdir )
+{
+	sdir->dnode = NULL;
+	if (!sdir->probing)
+		sample_dir_free( sdir );
+}
+
+
+/* Work function: one probe, from the top of the subtree on down. The
+ * filesystem calls go through scanfs( )'s stat workers, so that a dead
+ * mount does not hang the pool thread. Whatever does not respond is
+ * left out, and the probe counts as inexact */
+static void
+probe_task( void *data, TaskCancel *cancel )
+{
+	struct SampleProbe *probe = (struct SampleProbe *)data;
+	ScanfsEntryStat stats[SAMPLE_ENTRIES];
+	GRand *rand;
+	char **names, *name;
+	char *path, *next_path;
+	double scale = 1.0, entry_scale;
+	int num_entries, num_sampled, num_subdirs, i, j;
+
+	rand = g_rand_new_with_seed( g_random_int( ) );
+	probe->exact = TRUE;
+
+	path = g_strdup( probe->path );
+	while ((path != NULL) && !task_cancelled( cancel )) {
+		next_path = NULL;
+		num_entries = scanfs_list_dir( path, &names );
+		if (num_entries == SCANFS_UNAVAILABLE)
+			probe->exact = FALSE;
+		if (num_entries > 0) {
+			/* Sample is the first num_sampled entries, after
+			 * shuffling them in from the rest */
+			num_sampled = MIN(num_entries, SAMPLE_ENTRIES);
+			for (i = 0; i < num_sampled; i++) {
+				j = g_rand_int_range( rand, i, num_entries );
+				name = names[i];
+				names[i] = names[j];
+				names[j] = name;
+			}
+
+			/* Each entry in the sample stands for this many
+			 * nodes in the subtree */
+			entry_scale = scale * (double)num_entries / (double)num_sampled;
+
+			scanfs_stat_entries( path, names, num_sampled, stats );
+			num_subdirs = 0;
+			for (i = 0; i < num_sampled; i++) {
+				if (stats[i].unavailable)
+					probe->exact = FALSE;
+				if (!stats[i].ok)
+					continue;
+				probe->size += entry_scale * (double)stats[i].desc.size;
+				probe->counts[stats[i].desc.type] += entry_scale;
+				if (stats[i].desc.type == NODE_DIRECTORY) {
+					/* Pick one subdirectory to go down
+					 * into (reservoir-style) */
+					++num_subdirs;
+					if (g_rand_int_range( rand, 0, num_subdirs ) == 0) {
+						g_free( next_path );
+						next_path = g_build_filename( path, names[i], NULL );
+					}
+				}
+			}
+			profile_count( "sample.stats", num_sampled );
+
+			if ((num_sampled < num_entries) || (num_subdirs > 1))
+				probe->exact = FALSE;
+
+			/* The subdirectory gone down into stands for all
+			 * of the ones in the sample */
+			scale = entry_scale * (double)num_subdirs;
+		}
+		if (num_entries >= 0)
+			g_strfreev( names );
+		g_free( path );
+		path = next_path;
+	}
+	g_free( path );
+	g_rand_free( rand );
+}
+
+
+static void probe_done_cb( void *data, boolean cancelled );
+
+
+/* Sends out another probe for a directory */
+static void
+probe_submit( struct SampleDir *sdir )
+{
+	struct SampleProbe *probe;
+
+	probe = g_slice_new0(struct SampleProbe);
+	probe->sdir = sdir;
+	probe->path = g_strdup( sdir->path );
+	sdir->probing = TRUE;
+	task_submit( TASK_QUEUE_SCAN, TASK_PRIORITY_LOW, sample_cancel, probe_task, probe_done_cb, probe );
+}
+
+
+/* Completion callback for probe_task( ). Folds the probe into the
+ * running estimate, and sends out another one if need be */
+static void
+probe_done_cb( void *data, boolean cancelled )
+{
+	struct SampleProbe *probe = (struct SampleProbe *)data;
+	struct SampleDir *sdir = probe->sdir;
+	double delta;
+	int i;
+
+	sdir->probing = FALSE;
+	if (sdir->dnode == NULL)
+		sample_dir_free( sdir );
+	else if (!cancelled) {
+		profile_count( "sample.probes", 1 );
+		++sdir->num_probes;
+		delta = probe->size - sdir->mean_size;
+		sdir->mean_size += delta / (double)sdir->num_probes;
+		sdir->m2_size += delta * (probe->size - sdir->mean_size);
+		for (i = 0; i < NUM_NODE_TYPES; i++)
+			sdir->mean_counts[i] += (probe->counts[i] - sdir->mean_counts[i]) / (double)sdir->num_probes;
+		sdir->changed = TRUE;
+
+		if (probe->exact || (sdir->num_probes >= SAMPLE_MAX_PROBES))
+			sdir->settled = TRUE;
+		else if (sdir->num_probes >= SAMPLE_MIN_PROBES)
+			sdir->settled = size_error( sdir ) <= SAMPLE_TARGET_ERROR * sdir->mean_size;
+
+		if (!sdir->settled)
+			probe_submit( sdir );
+	}
+
+	g_free( probe->path );
+	g_slice_free( struct SampleProbe, probe );
+}
+
+
+/* Puts the current size estimate for a directory into the tree, patching
+ * up the subtree sizes of its ancestors (up to and including the
+ * metanode) to match */
+static void
+estimate_apply( struct SampleDir *sdir )
+{
+	GNode *up_node;
+	int64 size, size_delta;
+
+	size = (int64)(sdir->mean_size + 0.5);
+	size_delta = size - DIR_NODE_DESC(sdir->dnode)->subtree.size;
+	DIR_NODE_DESC(sdir->dnode)->subtree.size = size;
+	sdir->changed = FALSE;
+
+	up_node = sdir->dnode->parent;
+	while (up_node != NULL) {
+		DIR_NODE_DESC(up_node)->subtree.size += size_delta;
+		up_node = up_node->parent;
+	}
+}
+
+
+/* Puts new estimates into the tree, and lays it out anew. This waits
+ * until nothing is in motion, as morphs and camera pans depend on the
+ * layout staying put. Returns TRUE while probes are still out (this
+ * doubles as a GSourceFunc) */
+static boolean
+sample_update( void )
+{
+	GHashTableIter iter;
+	struct SampleDir *sdir;
+	double total = 0.0, variance = 0.0, num_nodes = 0.0, error;
+	boolean changed = FALSE, probing = FALSE;
+	char size_str[64];
+	char strbuf[1024];
+	int num_dirs = 0;
+	int i;
+
+	if (animation_busy( ) || selection_dragging( ))
+		return TRUE;
+
+	g_hash_table_iter_init( &iter, sample_dirs );
+	while (g_hash_table_iter_next( &iter, NULL, (gpointer *)&sdir )) {
+		if (sdir->changed) {
+			estimate_apply( sdir );
+			changed = TRUE;
+		}
+		probing = probing || sdir->probing;
+		error = size_error( sdir ) / SAMPLE_Z;
+		total += sdir->mean_size;
+		variance += error * error;
+		for (i = 0; i < NUM_NODE_TYPES; i++)
+			num_nodes += sdir->mean_counts[i];
+		++num_dirs;
+	}
+
+	if (changed) {
+		geometry_subtree_changed( root_dnode );
+		redraw( );
+	}
+
+	strcpy( size_str, abbrev_size( (int64)total ) );
+	if (probing)
+		snprintf( strbuf, sizeof(strbuf), _("Sampling %d directories: %s +/- %s, ~%.0f nodes"), num_dirs, size_str, abbrev_size( (int64)(SAMPLE_Z * sqrt( variance )) ), num_nodes );
+	else
+		snprintf( strbuf, sizeof(strbuf), _("Sampled %d directories: %s +/- %s, ~%.0f nodes"), num_dirs, size_str, abbrev_size( (int64)(SAMPLE_Z * sqrt( variance )) ), num_nodes );
+	window_statusbar( SB_RIGHT, strbuf );
+
+	if (!probing)
+		update_id = 0;
+
+	return probing;
+}
+
+
+/* Helper function for sample_start( ). Sets up estimates for all the
+ * directories left to be sampled in a subtree */
+static void
+start_recursive( GNode *dnode )
+{
+	struct SampleDir *sdir;
+	GNode *node;
+
+	if (DIR_NODE_DESC(dnode)->estimated) {
+		sdir = NEW(struct SampleDir);
+		memset( sdir, 0, sizeof(struct SampleDir) );
+		sdir->dnode = dnode;
+		sdir->path = xstrdup( node_absname( dnode ) );
+		g_hash_table_insert( sample_dirs, dnode, sdir );
+		probe_submit( sdir );
+		return;
+	}
+
+	node = dnode->children;
+	while (node != NULL) {
+		if (NODE_IS_DIR(node))
+			start_recursive( node );
+		node = node->next;
+	}
+}
+
+
+/* Starts estimating the subtree totals of every directory in the tree
+ * that was left to be sampled. Estimates are refined in the background,
+ * and the tree is laid out anew as they come in */
+void
+sample_start( void )
+{
+	sample_cancel_all( );
+
+	if (sample_dirs == NULL)
+		sample_dirs = g_hash_table_new( NULL, NULL );
+	sample_cancel = task_cancel_new( );
+	start_recursive( root_dnode );
+
+	if ((g_hash_table_size( sample_dirs ) > 0) && (update_id == 0))
+		update_id = g_timeout_add( SAMPLE_UPDATE_PERIOD, (GSourceFunc)sample_update, NULL );
+}
+
+
+/* Returns TRUE if the subtree totals of a directory are (in part)
+ * estimates, along with the half-width of the confidence interval of
+ * its total size */
+boolean
+sample_subtree_error( GNode *dnode, int64 *error )
+{
+	GHashTableIter iter;
+	struct SampleDir *sdir;
+	double variance = 0.0, e;
+	boolean estimated = FALSE;
+
+	if (sample_dirs == NULL)
+		return FALSE;
+
+	g_hash_table_iter_init( &iter, sample_dirs );
+	while (g_hash_table_iter_next( &iter, NULL, (gpointer *)&sdir )) {
+		if ((sdir->dnode == dnode) || g_node_is_ancestor( dnode, sdir->dnode )) {
+			e = size_error( sdir ) / SAMPLE_Z;
+			variance += e * e;
+			estimated = TRUE;
+		}
+	}
+	*error = (int64)(SAMPLE_Z * sqrt( variance ));
+
+	return estimated;
+}
+
+
+/* Stops estimating anything in the given subtree (e.g. as it is about
+ * to be read in properly). Totals already in the tree are left as is */
+void
+sample_cancel_subtree( GNode *dnode )
+{
+	GHashTableIter iter;
+	struct SampleDir *sdir;
+
+	if (sample_dirs == NULL)
+		return;
+
+	g_hash_table_iter_init( &iter, sample_dirs );
+	while (g_hash_table_iter_next( &iter, NULL, (gpointer *)&sdir )) {
+		if ((sdir->dnode == dnode) || g_node_is_ancestor( dnode, sdir->dnode )) {
+			g_hash_table_iter_remove( &iter );
+			sample_dir_drop( sdir );
+		}
+	}
+}
+
+
+/* Abandons all estimates. Call this before the filesystem tree is
+ * replaced */
+void
+sample_cancel_all( void )
+{
+	GHashTableIter iter;
+	struct SampleDir *sdir;
+
+	if (sample_cancel != NULL) {
+		task_cancel( sample_cancel );
+		task_cancel_unref( sample_cancel );
+		sample_cancel = NULL;
+	}
+
+	if (sample_dirs != NULL) {
+		g_hash_table_iter_init( &iter, sample_dirs );
+		while (g_hash_table_iter_next( &iter, NULL, (gpointer *)&sdir ))
+			sample_dir_drop( sdir );
+		g_hash_table_remove_all( sample_dirs );
+	}
+
+	if (update_id != 0) {
+		g_source_remove( update_id );
+		update_id = 0;
+	}
+}
+
+
+/* end sample.c */
@@ -0,0 +1,23 @@
+/* sample.h */
+
+/* Sampling estimates of unscanned subtrees */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_SAMPLE_H
+	#error
+#endif
+#define FSV_SAMPLE_H
+
+
+void sample_start( void );
+boolean sample_subtree_error( GNode *dnode, int64 *error );
+void sample_cancel_subtree( GNode *dnode );
+void sample_cancel_all( void );
+
+
+/* end sample.h */
@@ -16,26 +16,17 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <gtk/gtk.h>
 #include <errno.h>
 
-#include "dirtree.h"
-#include "filelist.h"
-#include "geometry.h" /* geometry_free( ) */
-#include "gui.h" /* gui_update( ) */
-#include "viewport.h" /* viewport_pass_node_table( ) */
-#include "window.h"
-
-
-#ifndef HAVE_SCANDIR
-int scandir( const char *dir, struct dirent ***namelist, int (*selector)( const struct dirent * ), int (*cmp)( const void *, const void * ) );
-int alphasort( const void *a, const void *b );
-#endif
+#include "extstats.h"
+#include "nodeattr.h"
+#include "perfctr.h"
+#include "profile.h"
 
 
 /* On-the-fly progress display is updated at intervals this far apart
  * (integer value in milliseconds) */
-#define SCAN_MONITOR_PERIOD 500
+#define SCANFS_PROGRESS_PERIOD 500
 
 
 /* Name strings are stored here */
@@ -49,45 +40,139 @@ static int node_counts[NUM_NODE_TYPES];
 static int64 size_counts[NUM_NODE_TYPES];
 static int stat_count = 0;
 
-
-/* Official stat function. Returns 0 on success, -1 on error */
-static int
-stat_node( GNode *node )
+/* Bytes of name strings stored so far */
+static int64 name_bytes;
+
+/* Callbacks for the scan in progress */
+static const ScanfsHooks *scan_hooks;
+static void *scan_hooks_data;
+
+/* Node output of a streaming scan (NULL if the tree is being built) */
+static ScanfsEmitFunc stream_emit = NULL;
+
+/* Children counted so far, for each directory being streamed */
+static GArray *stream_child_counts = NULL;
+
+/* Levels below the root of the directories read in (-1: no limit), and
+ * the level of the directory being read */
+static int sample_depth = -1;
+static int scan_depth;
+
+
+/* Result of statting one directory entry */
+struct EntryStat {
+	NodeDesc	desc;
+	NodeAttrs	attrs;
+	dev_t		dev;		/* Device the entry lives on */
+	boolean		ok;		/* Stat succeeded */
+};
+
+/* A directory being read in by the stat worker: listed (if names is
+ * NULL), then each entry statted. This is shared by the scanning thread
+ * and the worker (hence the reference count), as a worker that gets
+ * stuck on a dead mount is left behind still holding on to it */
+struct DirRead {
+	gint		ref_count;
+	char		*dir;		/* Absolute name of directory */
+	char		**names;	/* Entry names (NULL until listed) */
+	int		num_entries;
+	struct EntryStat *stats;
+	gint		listed;		/* Entries listed so far */
+	gint		done;		/* Entries statted (-1 until listed) */
+	boolean		list_only;	/* Don't stat the entries */
+	boolean		failed;		/* Directory could not be listed */
+	boolean		finished;	/* (guarded by the worker's lock) */
+};
+
+/* Thread which does the filesystem calls of a scan, one directory at a
+ * time, so that the scan can give up on a directory that stops making
+ * progress. A worker that is given up on is simply abandoned (it may
+ * be stuck in an uninterruptible call for good), and a new one takes
+ * its place */
+struct StatWorker {
+	gint		ref_count;
+	GThread		*thread;
+	GMutex		lock;
+	GCond		cond;		/* Work handed over, or finished */
+	struct DirRead	*read;		/* Work in progress, or NULL */
+	boolean		quit;		/* Finish up (or stuck, and abandoned) */
+};
+
+
+/* Time a directory may go without progress being made on it before its
+ * filesystem is given up on (seconds). 0 turns off the stat worker, and
+ * with it this protection */
+#define SCANFS_DEFAULT_STAT_TIMEOUT	5.0
+
+/* While a directory is slow to respond, the stalled( ) hook is called at
+ * intervals this far apart (integer value in milliseconds) */
+#define SCANFS_STALL_PERIOD	100
+
+
+static double stat_timeout = SCANFS_DEFAULT_STAT_TIMEOUT;
+
+/* Stat worker for the scan in progress (NULL if none yet) */
+static struct StatWorker *stat_worker = NULL;
+
+static void pool_stat_worker_free( gpointer data );
+
+/* Stat worker of the calling pool thread, for scanfs_list_dir( ) and
+ * scanfs_stat_entries( ) */
+static GPrivate pool_stat_worker = G_PRIVATE_INIT( pool_stat_worker_free );
+
+/* Devices of the mounts given up on during the scan in progress */
+static GArray *dead_devs = NULL;
+
+/* Device of the directory whose entries are being added */
+static dev_t listing_dev;
+
+
+/* Fills in the type and size of a node descriptor from the results of
+ * a stat( ), and (if attrs is not NULL) its optional attributes */
+static void
+desc_from_stat( const struct stat *st, NodeDesc *ndesc, NodeAttrs *attrs )
 {
-	struct stat st;
-
-	if (lstat( node_absname( node ), &st ))
-		return -1;
-
 	/* Determine node type */
-	if (S_ISDIR(st.st_mode))
-		NODE_DESC(node)->type = NODE_DIRECTORY;
-	else if (S_ISREG(st.st_mode))
-		NODE_DESC(node)->type = NODE_REGFILE;
-	else if (S_ISLNK(st.st_mode))
-		NODE_DESC(node)->type = NODE_SYMLINK;
-	else if (S_ISFIFO(st.st_mode))
-		NODE_DESC(node)->type = NODE_FIFO;
-	else if (S_ISSOCK(st.st_mode))
-		NODE_DESC(node)->type = NODE_SOCKET;
-	else if (S_ISCHR(st.st_mode))
-		NODE_DESC(node)->type = NODE_CHARDEV;
-	else if (S_ISBLK(st.st_mode))
-		NODE_DESC(node)->type = NODE_BLOCKDEV;
+	if (S_ISDIR(st->st_mode))
+		ndesc->type = NODE_DIRECTORY;
+	else if (S_ISREG(st->st_mode))
+		ndesc->type = NODE_REGFILE;
+	else if (S_ISLNK(st->st_mode))
+		ndesc->type = NODE_SYMLINK;
+	else if (S_ISFIFO(st->st_mode))
+		ndesc->type = NODE_FIFO;
+	else if (S_ISSOCK(st->st_mode))
+		ndesc->type = NODE_SOCKET;
+	else if (S_ISCHR(st->st_mode))
+		ndesc->type = NODE_CHARDEV;
+	else if (S_ISBLK(st->st_mode))
+		ndesc->type = NODE_BLOCKDEV;
 	else
-		NODE_DESC(node)->type = NODE_UNKNOWN;
+		ndesc->type = NODE_UNKNOWN;
 
 	/* A corrupted DOS filesystem once gave me st_size = -4GB */
-	g_assert( st.st_size >= 0 );
+	g_assert( st->st_size >= 0 );
 
-	NODE_DESC(node)->size = st.st_size;
-	NODE_DESC(node)->size_alloc = 512 * st.st_blocks;
-	NODE_DESC(node)->user_id = st.st_uid;
-	NODE_DESC(node)->group_id = st.st_gid;
-	/*NODE_DESC(node)->perms = st.st_mode;*/
-	NODE_DESC(node)->atime = st.st_atime;
-	NODE_DESC(node)->mtime = st.st_mtime;
-	NODE_DESC(node)->ctime = st.st_ctime;
+	ndesc->size = st->st_size;
+	ndesc->size_alloc = 512 * st->st_blocks;
+	/*ndesc->perms = st->st_mode;*/
+	if (attrs != NULL)
+		nodeattr_from_stat( st, attrs );
+}
+
+
+/* Fills in the type and size of a node descriptor from the file with
+ * the given absolute name, and (if attrs is not NULL) its optional
+ * attributes. Touches nothing else, so this is safe to call from pool
+ * threads. Returns 0 on success, -1 on error */
+int
+scanfs_stat( const char *absname, NodeDesc *ndesc, NodeAttrs *attrs )
+{
+	struct stat st;
+
+	if (lstat( absname, &st ))
+		return -1;
+	desc_from_stat( &st, ndesc, attrs );
 
 	return 0;
 }
@@ -95,8 +180,8 @@ stat_node( GNode *node )
 
 /* Selector function for use with scandir( ). This lets through all
  * directory entries except for "." and ".." */
-static int
-de_select( const struct dirent *de )
+int
+scanfs_de_select( const struct dirent *de )
 {
 	if (de->d_name[0] != '.')
 		return 1; /* Allow "whatever" */
@@ -112,70 +197,590 @@ de_select( const struct dirent *de )
 }
 
 
+/* Sets the time a directory may go without progress before it is given
+ * up on (seconds). 0 means wait forever */
+void
+scanfs_set_stat_timeout( double seconds )
+{
+	stat_timeout = MAX(0.0, seconds);
+}
+
+
+/* Sets how many levels below the root directory are read in. Deeper
+ * directories are left empty, and marked as estimated, for their
+ * contents to be sampled (see sample.c). A negative depth (the default)
+ * reads in everything. Streaming scans always read in everything */
+void
+scanfs_set_sample_depth( int depth )
+{
+	sample_depth = MAX(-1, depth);
+}
+
+
+/* Creates a directory read, for the given entries, or for all of them
+ * if names is NULL */
+static struct DirRead *
+dir_read_new( const char *dir, char **names, int num_names )
+{
+	struct DirRead *read;
+	int i;
+
+	read = g_new0( struct DirRead, 1 );
+	read->ref_count = 1;
+	read->dir = g_strdup( dir );
+	read->done = -1;
+	if (names != NULL) {
+		read->names = g_new( char *, MAX(num_names, 1) );
+		for (i = 0; i < num_names; i++)
+			read->names[i] = g_strdup( names[i] );
+		read->num_entries = num_names;
+		read->stats = g_new0( struct EntryStat, MAX(num_names, 1) );
+		read->done = 0;
+	}
+
+	return read;
+}
+
+
+static void
+dir_read_unref( struct DirRead *read )
+{
+	int i;
+
+	if (!g_atomic_int_dec_and_test( &read->ref_count ))
+		return;
+
+	if (read->names != NULL) {
+		for (i = 0; i < read->num_entries; i++)
+			g_free( read->names[i] );
+		g_free( read->names );
+	}
+	g_free( read->stats );
+	g_free( read->dir );
+	g_free( read );
+}
+
+
+/* GCompareFunc for sorting entry names, as alphasort( ) would */
 static int
-process_dir( const char *dir, GNode *dnode )
+compare_entry_name( const void *a, const void *b )
 {
-	union AnyNodeDesc any_node_desc, *andesc;
-	struct dirent **dir_entries;
-	GNode *node;
-	int num_entries, i;
-	char strbuf[1024];
+	return strcoll( *(const char * const *)a, *(const char * const *)b );
+}
 
-	/* Scan in directory entries */
-	num_entries = scandir( dir, &dir_entries, de_select, alphasort );
-	if (num_entries < 0)
-		return -1;
 
-	/* Update display */
-	snprintf( strbuf, sizeof(strbuf), _("Scanning: %s"), dir );
-	window_statusbar( SB_RIGHT, strbuf );
-
-	/* Process directory entries */
-	for (i = 0; i < num_entries; i++) {
-		/* Create new node */
-		node = g_node_prepend_data( dnode, &any_node_desc );
-		NODE_DESC(node)->id = node_id;
-		NODE_DESC(node)->name = g_string_chunk_insert( name_strchunk, dir_entries[i]->d_name );
-		if (stat_node( node )) {
-			/* Stat failed */
-			g_node_unlink( node );
-			g_node_destroy( node );
-			continue;
+/* Does the filesystem calls of a directory read. Touches nothing but the
+ * read itself, so this is safe to call from the stat worker. Progress is
+ * counted entry by entry, listing included, so that a big directory that
+ * is merely slow to list is not taken for a dead one */
+static void
+dir_read_run( struct DirRead *read )
+{
+	DIR *dir;
+	struct dirent *de;
+	struct stat st;
+	GPtrArray *names;
+	char *absname;
+	int i;
+
+	if (read->names == NULL) {
+		/* List directory entries */
+		dir = opendir( read->dir );
+		if (dir == NULL) {
+			read->failed = TRUE;
+			return;
+		}
+		names = g_ptr_array_new( );
+		while ((de = readdir( dir )) != NULL) {
+			if (scanfs_de_select( de ))
+				g_ptr_array_add( names, g_strdup( de->d_name ) );
+			g_atomic_int_inc( &read->listed );
 		}
-		++stat_count;
-		++node_id;
+		closedir( dir );
+		g_ptr_array_sort( names, compare_entry_name );
+		read->num_entries = names->len;
+		g_ptr_array_add( names, NULL ); /* (so that pdata is never NULL) */
+		read->names = (char **)g_ptr_array_free( names, FALSE );
+		read->stats = g_new0( struct EntryStat, MAX(read->num_entries, 1) );
+		g_atomic_int_set( &read->done, 0 );
+		if (read->list_only)
+			return;
+	}
 
-		if (NODE_IS_DIR(node)) {
-			/* Create corresponding directory tree entry */
-			dirtree_entry_new( node );
+	for (i = 0; i < read->num_entries; i++) {
+		absname = g_build_filename( read->dir, read->names[i], NULL );
+		read->stats[i].ok = !lstat( absname, &st );
+		if (read->stats[i].ok) {
+			desc_from_stat( &st, &read->stats[i].desc, &read->stats[i].attrs );
+			read->stats[i].dev = st.st_dev;
+		}
+		g_free( absname );
+		/* (Everything before this entry is complete) */
+		g_atomic_int_set( &read->done, i + 1 );
+	}
+}
+
+
+static void
+stat_worker_unref( struct StatWorker *worker )
+{
+	if (!g_atomic_int_dec_and_test( &worker->ref_count ))
+		return;
+
+	g_mutex_clear( &worker->lock );
+	g_cond_clear( &worker->cond );
+	g_free( worker );
+}
 
-			/* Recurse down */
-			process_dir( node_absname( node ), node );
 
-			/* Move new descriptor into working memory */
-			andesc = (union AnyNodeDesc *) g_slice_new(DirNodeDesc);
-			memcpy( andesc, DIR_NODE_DESC(node), sizeof(DirNodeDesc) );
-			node->data = andesc;
+/* Stat worker thread */
+static gpointer
+stat_worker_thread( gpointer data )
+{
+	struct StatWorker *worker = (struct StatWorker *)data;
+	struct DirRead *read;
+
+	g_mutex_lock( &worker->lock );
+	for (;;) {
+		while ((worker->read == NULL) && !worker->quit)
+			g_cond_wait( &worker->cond, &worker->lock );
+		if (worker->quit)
+			break;
+
+		read = worker->read;
+		g_mutex_unlock( &worker->lock );
+		dir_read_run( read );
+		g_mutex_lock( &worker->lock );
+
+		read->finished = TRUE;
+		worker->read = NULL;
+		g_cond_broadcast( &worker->cond );
+		if (worker->quit) {
+			/* Abandoned while working on the read */
+			dir_read_unref( read );
+			break;
 		}
+		dir_read_unref( read );
+	}
+	g_mutex_unlock( &worker->lock );
+
+	stat_worker_unref( worker );
+
+	return NULL;
+}
+
+
+/* Lets go of a stat worker. It stops once it is done with whatever it
+ * is doing, which for a worker stuck on a dead mount may be never */
+static void
+stat_worker_release( struct StatWorker **worker )
+{
+	if (*worker == NULL)
+		return;
+
+	g_mutex_lock( &(*worker)->lock );
+	(*worker)->quit = TRUE;
+	g_cond_broadcast( &(*worker)->cond );
+	g_mutex_unlock( &(*worker)->lock );
+
+	g_thread_unref( (*worker)->thread );
+	stat_worker_unref( *worker );
+	*worker = NULL;
+}
+
+
+/* GDestroyNotify for a pool thread's stat worker */
+static void
+pool_stat_worker_free( gpointer data )
+{
+	struct StatWorker *worker = (struct StatWorker *)data;
+
+	stat_worker_release( &worker );
+}
+
+
+/* Carries out a directory read on a stat worker (started if need be),
+ * waiting for as long as it keeps making progress. The stalled( ) hook
+ * is called meanwhile, if hooks are given. Returns TRUE if the read
+ * finished, FALSE if it was given up on (then, the entries before
+ * read->done are still good, and the worker is let go of) */
+static boolean
+dir_read_wait( struct StatWorker **worker_ptr, struct DirRead *read, const ScanfsHooks *hooks, void *hooks_data )
+{
+	struct StatWorker *worker;
+	gint64 now, last_progress;
+	int progress, last_done;
+
+	if (stat_timeout <= 0.0) {
+		/* No protection: do it right here */
+		dir_read_run( read );
+		read->finished = TRUE;
+		return TRUE;
+	}
+
+	if (*worker_ptr == NULL) {
+		worker = g_new0( struct StatWorker, 1 );
+		worker->ref_count = 2; /* ours, and the thread's */
+		g_mutex_init( &worker->lock );
+		g_cond_init( &worker->cond );
+		worker->thread = g_thread_new( "fsv-stat", stat_worker_thread, worker );
+		*worker_ptr = worker;
+	}
+	worker = *worker_ptr;
+
+	g_mutex_lock( &worker->lock );
+	g_atomic_int_inc( &read->ref_count );
+	worker->read = read;
+	g_cond_broadcast( &worker->cond );
+
+	/* (Listing and statting both count as progress) */
+	last_done = g_atomic_int_get( &read->listed ) + g_atomic_int_get( &read->done );
+	last_progress = g_get_monotonic_time( );
+	while (!read->finished) {
+		g_cond_wait_until( &worker->cond, &worker->lock, g_get_monotonic_time( ) + SCANFS_STALL_PERIOD * G_TIME_SPAN_MILLISECOND );
+		if (read->finished)
+			break;
+
+		now = g_get_monotonic_time( );
+		progress = g_atomic_int_get( &read->listed ) + g_atomic_int_get( &read->done );
+		if (progress != last_done) {
+			last_done = progress;
+			last_progress = now;
+		}
+		else if ((double)(now - last_progress) > stat_timeout * G_TIME_SPAN_SECOND) {
+			/* Give up on it */
+			g_mutex_unlock( &worker->lock );
+			stat_worker_release( worker_ptr );
+			return FALSE;
+		}
+
+		if ((now - last_progress >= SCANFS_STALL_PERIOD * G_TIME_SPAN_MILLISECOND) && (hooks != NULL) && (hooks->stalled != NULL)) {
+			/* Keep the user informed (and the interface alive) */
+			g_mutex_unlock( &worker->lock );
+			(hooks->stalled)( read->dir, hooks_data );
+			g_mutex_lock( &worker->lock );
+		}
+	}
+	g_mutex_unlock( &worker->lock );
+
+	return TRUE;
+}
+
+
+/* Returns TRUE if the given device belongs to a mount given up on */
+static boolean
+dev_dead( dev_t dev )
+{
+	int i;
+
+	for (i = 0; i < dead_devs->len; i++) {
+		if (g_array_index(dead_devs, dev_t, i) == dev)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/* Reports a path that did not respond in time */
+static void
+report_unreachable( const char *absname )
+{
+	if (scan_hooks->unreachable != NULL)
+		(scan_hooks->unreachable)( absname, scan_hooks_data );
+}
+
+
+/* Helper function for scanfs_list_dir( ) and scanfs_stat_entries( ).
+ * Carries out a directory read on the calling pool thread's own stat
+ * worker, so that a dead mount holds up only that worker */
+static boolean
+pool_read_wait( struct DirRead *read )
+{
+	struct StatWorker *worker;
+	boolean finished;
+
+	worker = (struct StatWorker *)g_private_get( &pool_stat_worker );
+	finished = dir_read_wait( &worker, read, NULL, NULL );
+	g_private_set( &pool_stat_worker, worker );
+
+	return finished;
+}
+
+
+/* Lists the entries of a directory, in alphabetical order, giving up if
+ * it stops responding (see scanfs_set_stat_timeout( )). For the pool
+ * threads, whose work must not hang on a dead mount any more than the
+ * scan's. The names are returned in a NULL-terminated array, to be
+ * freed with g_strfreev( ). Returns the number of entries, or
+ * SCANFS_UNREADABLE if the directory could not be read, or
+ * SCANFS_UNAVAILABLE if it did not respond */
+int
+scanfs_list_dir( const char *dir, char ***names )
+{
+	struct DirRead *read;
+	int num_names;
+
+	read = dir_read_new( dir, NULL, 0 );
+	read->list_only = TRUE;
+	if (!pool_read_wait( read )) {
+		dir_read_unref( read );
+		return SCANFS_UNAVAILABLE;
+	}
+	if (read->failed) {
+		dir_read_unref( read );
+		return SCANFS_UNREADABLE;
+	}
+
+	*names = read->names;
+	num_names = read->num_entries;
+	read->names = NULL;
+	read->num_entries = 0;
+	dir_read_unref( read );
+
+	return num_names;
+}
+
+
+/* Stats the given entries of a directory, as scanfs_list_dir( ) lists
+ * them. An entry whose stat does
+ * not come back is marked unavailable, and the rest are carried on with,
+ * as in process_dir( ) */
+void
+scanfs_stat_entries( const char *dir, char **names, int num_names, ScanfsEntryStat *stats )
+{
+	struct DirRead *read;
+	int first = 0, done, i;
+
+	while (first < num_names) {
+		read = dir_read_new( dir, &names[first], num_names - first );
+		pool_read_wait( read );
+		done = g_atomic_int_get( &read->done );
+		for (i = 0; i < done; i++) {
+			memcpy( &stats[first + i].desc, &read->stats[i].desc, sizeof(NodeDesc) );
+			memcpy( &stats[first + i].attrs, &read->stats[i].attrs, sizeof(NodeAttrs) );
+			stats[first + i].ok = read->stats[i].ok;
+			stats[first + i].unavailable = FALSE;
+		}
+		if (done < read->num_entries) {
+			/* Stat of entry #done did not come back */
+			memset( &stats[first + done], 0, sizeof(ScanfsEntryStat) );
+			stats[first + done].unavailable = TRUE;
+			++done;
+		}
+		dir_read_unref( read );
+		first += done;
+	}
+}
+
+
+static int process_dir( const char *dir, GNode *dnode, dev_t dev );
+
+
+/* add_entry( ) for a streaming scan. Nothing is kept: a directory gets
+ * a node only while it is being read (so that node_absname( ) works),
+ * and the entry is passed on once complete, with its subtree totals.
+ * These are added into those of the parent directory */
+static void
+stream_entry( GNode *dnode, const char *name, const struct EntryStat *estat, boolean unavailable )
+{
+	DirNodeDesc dir_desc, *parent_desc;
+	NodeDesc *ndesc;
+	NodeAttrs attrs;
+	GNode *node;
+	unsigned int num_children = 0;
+	int i;
+
+	memset( &dir_desc, 0, sizeof(DirNodeDesc) );
+	ndesc = &dir_desc.node_desc;
+	if (unavailable) {
+		ndesc->type = NODE_DIRECTORY;
+		memset( &attrs, 0, sizeof(NodeAttrs) );
+	}
+	else {
+		memcpy( ndesc, &estat->desc, sizeof(NodeDesc) );
+		memcpy( &attrs, &estat->attrs, sizeof(NodeAttrs) );
+	}
+	ndesc->id = node_id;
+	ndesc->name = name;
+	++stat_count;
+	++node_id;
+
+	parent_desc = DIR_NODE_DESC(dnode);
+	if (ndesc->type == NODE_DIRECTORY) {
+		dir_desc.unavailable = unavailable;
+		node = g_node_prepend_data( dnode, &dir_desc );
+		g_array_append_val( stream_child_counts, num_children );
+
+		/* Recurse down */
+		if (unavailable)
+			report_unreachable( node_absname( node ) );
+		else
+			process_dir( node_absname( node ), node, estat->dev );
+
+		num_children = g_array_index(stream_child_counts, unsigned int, stream_child_counts->len - 1);
+		g_array_set_size( stream_child_counts, stream_child_counts->len - 1 );
+		g_node_unlink( node );
+		g_node_destroy( node );
+
+		parent_desc->subtree.size += dir_desc.subtree.size;
+		for (i = 0; i < NUM_NODE_TYPES; i++)
+			parent_desc->subtree.counts[i] += dir_desc.subtree.counts[i];
+	}
+	parent_desc->subtree.size += ndesc->size;
+	++parent_desc->subtree.counts[ndesc->type];
+	++g_array_index(stream_child_counts, unsigned int, stream_child_counts->len - 1);
+
+	(stream_emit)( ndesc, &attrs, num_children, scan_hooks_data );
+
+	/* Add to appropriate node/size counts
+	 * (for dynamic progress display) */
+	++node_counts[ndesc->type];
+	size_counts[ndesc->type] += ndesc->size;
+
+	if (scan_hooks->entry_done != NULL)
+		(scan_hooks->entry_done)( scan_hooks_data );
+}
+
+
+/* Adds a node for a directory entry, and reads in its contents if it
+ * is a directory. An entry whose stat did not come back is added as an
+ * empty directory marked unavailable (it is most likely a mount point),
+ * so that it shows up in the visualization */
+static void
+add_entry( GNode *dnode, const char *name, const struct EntryStat *estat, boolean unavailable )
+{
+	union AnyNodeDesc any_node_desc, *andesc;
+	GNode *node;
+	NodeAttrs attrs;
+
+	if (stream_emit != NULL) {
+		stream_entry( dnode, name, estat, unavailable );
+		return;
+	}
+
+	/* Create new node */
+	node = g_node_prepend_data( dnode, &any_node_desc );
+	if (unavailable) {
+		memset( &any_node_desc, 0, sizeof(union AnyNodeDesc) );
+		NODE_DESC(node)->type = NODE_DIRECTORY;
+		memset( &attrs, 0, sizeof(NodeAttrs) );
+		nodeattr_store( node_id, &attrs );
+	}
+	else {
+		memcpy( NODE_DESC(node), &estat->desc, sizeof(NodeDesc) );
+		nodeattr_store( node_id, &estat->attrs );
+	}
+	NODE_DESC(node)->id = node_id;
+	NODE_DESC(node)->name = g_string_chunk_insert( name_strchunk, name );
+	name_bytes += strlen( name ) + 1;
+	++stat_count;
+	++node_id;
+
+	if (NODE_IS_DIR(node)) {
+		DIR_NODE_DESC(node)->unavailable = unavailable;
+		DIR_NODE_DESC(node)->estimated = FALSE;
+		if (scan_hooks->dir_found != NULL)
+			(scan_hooks->dir_found)( node, scan_hooks_data );
+
+		/* Recurse down, unless below the sampling depth */
+		if (unavailable)
+			report_unreachable( node_absname( node ) );
+		else if ((sample_depth >= 0) && (scan_depth >= sample_depth))
+			DIR_NODE_DESC(node)->estimated = TRUE;
 		else {
-			/* Move new descriptor into working memory */
-			andesc = (union AnyNodeDesc *) g_slice_new(NodeDesc);
-			memcpy( andesc, NODE_DESC(node), sizeof(NodeDesc) );
-			node->data = andesc;
+			++scan_depth;
+			process_dir( node_absname( node ), node, estat->dev );
+			--scan_depth;
 		}
 
-		/* Add to appropriate node/size counts
-		 * (for dynamic progress display) */
-		++node_counts[NODE_DESC(node)->type];
-		size_counts[NODE_DESC(node)->type] += NODE_DESC(node)->size;
+		/* Move new descriptor into working memory */
+		andesc = (union AnyNodeDesc *) g_slice_new(DirNodeDesc);
+		memcpy( andesc, DIR_NODE_DESC(node), sizeof(DirNodeDesc) );
+		node->data = andesc;
+	}
+	else {
+		/* Move new descriptor into working memory */
+		andesc = (union AnyNodeDesc *) g_slice_new(NodeDesc);
+		memcpy( andesc, NODE_DESC(node), sizeof(NodeDesc) );
+		node->data = andesc;
+	}
+
+	/* Add to appropriate node/size counts
+	 * (for dynamic progress display) */
+	++node_counts[NODE_DESC(node)->type];
+	size_counts[NODE_DESC(node)->type] += NODE_DESC(node)->size;
+
+	if (scan_hooks->entry_done != NULL)
+		(scan_hooks->entry_done)( scan_hooks_data );
+}
 
-		free( dir_entries[i] ); /* !xfree */
 
-		/* Keep the user interface responsive */
-		gui_update( );
+/* Reads in the contents of a directory (on the given device). If it
+ * stops responding, it is marked unavailable, and so is anything else
+ * later found on the same device (unless its parent directory is on that
+ * device too: then the filesystem is alive, and only this directory is
+ * in trouble) */
+static int
+process_dir( const char *dir, GNode *dnode, dev_t dev )
+{
+	struct DirRead *read, *next_read;
+	dev_t parent_dev;
+	int done, i;
+
+	if (dev_dead( dev )) {
+		DIR_NODE_DESC(dnode)->unavailable = TRUE;
+		report_unreachable( dir );
+		return -1;
 	}
 
-	free( dir_entries ); /* !xfree */
+	/* Scan in directory entries */
+	read = dir_read_new( dir, NULL, 0 );
+	if (!dir_read_wait( &stat_worker, read, scan_hooks, scan_hooks_data ) && (g_atomic_int_get( &read->done ) < 0)) {
+		/* Listing did not come back */
+		if (dev != listing_dev)
+			g_array_append_val( dead_devs, dev );
+		DIR_NODE_DESC(dnode)->unavailable = TRUE;
+		report_unreachable( dir );
+		dir_read_unref( read );
+		return -1;
+	}
+	if (read->failed) {
+		dir_read_unref( read );
+		return -1;
+	}
+
+	if (scan_hooks->dir_begin != NULL)
+		(scan_hooks->dir_begin)( dir, scan_hooks_data );
+	profile_count( "scan.stats", read->num_entries );
+
+	/* Process directory entries (this directory has responded, so
+	 * its device is known to be alive) */
+	parent_dev = listing_dev;
+	listing_dev = dev;
+	while (read != NULL) {
+		done = g_atomic_int_get( &read->done );
+		for (i = 0; i < done; i++) {
+			/* (Entries whose stat failed are left out) */
+			if (read->stats[i].ok)
+				add_entry( dnode, read->names[i], &read->stats[i], FALSE );
+		}
+
+		next_read = NULL;
+		if (done < read->num_entries) {
+			/* Stat of entry #done did not come back. Put in a
+			 * placeholder, and carry on with the rest */
+			add_entry( dnode, read->names[done], NULL, TRUE );
+			if (done + 1 < read->num_entries) {
+				next_read = dir_read_new( dir, &read->names[done + 1], read->num_entries - done - 1 );
+				dir_read_wait( &stat_worker, next_read, scan_hooks, scan_hooks_data );
+			}
+		}
+		dir_read_unref( read );
+		read = next_read;
+	}
+	listing_dev = parent_dev;
+	profile_gauge( "scan.nodes", node_id );
 
 	return 0;
 }
@@ -185,15 +790,9 @@ process_dir( const char *dir, GNode *dnode )
 static boolean
 scan_monitor(gpointer user_data)
 {
-	char strbuf[64];
-
-	/* Running totals in file list area */
-	filelist_scan_monitor( node_counts, size_counts );
-
-	/* Stats-per-second readout in left statusbar */
-	sprintf( strbuf, _("%d stats/sec"), 1000 * stat_count / SCAN_MONITOR_PERIOD );
-	window_statusbar( SB_LEFT, strbuf );
-	gui_update( );
+	if (scan_hooks->progress != NULL)
+		(scan_hooks->progress)( node_counts, size_counts, 1000 * stat_count / SCANFS_PROGRESS_PERIOD, scan_hooks_data );
+	profile_gauge( "scan.stats_per_sec", 1000 * stat_count / SCANFS_PROGRESS_PERIOD );
 	stat_count = 0;
 
 	return TRUE;
@@ -234,8 +833,8 @@ compare_node( NodeDesc *a, NodeDesc *b )
 
 
 /* This does major post-scan housekeeping on the filesystem tree. It
- * sorts everything, assigns subtree size/count information to directory
- * nodes, sets up the node table, etc. */
+ * assigns subtree size/count information to directory nodes, sets up the
+ * node table, etc. */
 static void
 setup_fstree_recursive( GNode *node, GNode **node_table )
 {
@@ -251,6 +850,10 @@ setup_fstree_recursive( GNode *node, GNode **node_table )
 		for (i = 0; i < NUM_NODE_TYPES; i++)
 			DIR_NODE_DESC(node)->subtree.counts[i] = 0;
 
+		/* No retained geometry yet */
+		DIR_NODE_DESC(node)->gpu_owner = NULL;
+		DIR_NODE_DESC(node)->geom_dirty = TRUE;
+
 		/* Recurse down */
 		child_node = node->children;
 		while (child_node != NULL) {
@@ -266,8 +869,6 @@ setup_fstree_recursive( GNode *node, GNode **node_table )
 	}
 
 	if (NODE_IS_DIR(node)) {
-		/* Sort directory contents */
-		node->children = (GNode *)g_list_sort( (GList *)node->children, (GCompareFunc)compare_node );
 		/* Propagate subtree size/counts upward */
 		DIR_NODE_DESC(node->parent)->subtree.size += DIR_NODE_DESC(node)->subtree.size;
 		for (i = 0; i < NUM_NODE_TYPES; i++)
@@ -276,6 +877,26 @@ setup_fstree_recursive( GNode *node, GNode **node_table )
 }
 
 
+/* Sorts the contents of every directory (see compare_node( )). Subtree
+ * sizes must be in place. Kept apart from setup_fstree_recursive( ) so
+ * that the two can be measured separately */
+static void
+sort_fstree_recursive( GNode *node )
+{
+	GNode *child_node;
+
+	if (NODE_IS_DIR(node))
+		scanfs_sort_dir( node );
+
+	child_node = node->children;
+	while (child_node != NULL) {
+		if (NODE_IS_DIR(child_node))
+			sort_fstree_recursive( child_node );
+		child_node = child_node->next;
+	}
+}
+
+
 // Free data in a dir or file node. Can be used as a GNodeTraverseFunc
 static gboolean
 node_data_free(GNode *node, gpointer data)
@@ -289,21 +910,76 @@ node_data_free(GNode *node, gpointer data)
 	return FALSE;
 }
 
-/* Top-level call to recursively scan a filesystem */
+
+/* Creates a node (not yet linked into the tree) from a descriptor filled
+ * in by scanfs_stat( ). The node gets a name, a fresh ID, and for
+ * directories, an empty subtree with no retained geometry */
+GNode *
+scanfs_node_new( const NodeDesc *ndesc, const char *name )
+{
+	union AnyNodeDesc *andesc;
+
+	if (ndesc->type == NODE_DIRECTORY) {
+		/* (Zeroed: empty subtree, no tree entry, collapsed) */
+		andesc = (union AnyNodeDesc *) g_slice_new0(DirNodeDesc);
+		andesc->dir_node_desc.geom_dirty = TRUE;
+	}
+	else
+		andesc = (union AnyNodeDesc *) g_slice_new0(NodeDesc);
+
+	andesc->node_desc.type = ndesc->type;
+	andesc->node_desc.size = ndesc->size;
+	andesc->node_desc.size_alloc = ndesc->size_alloc;
+	andesc->node_desc.name = g_string_chunk_insert( name_strchunk, name );
+	andesc->node_desc.id = node_id++;
+	name_bytes += strlen( name ) + 1;
+
+	return g_node_new( andesc );
+}
+
+
+/* Frees a node, and everything below it. The node must already have
+ * been unlinked from the tree */
 void
-scanfs( const char *dir )
+scanfs_node_free( GNode *node )
 {
-	const char *root_dir;
-        GNode **node_table;
-	guint handler_id;
-	char *name;
+	g_assert( G_NODE_IS_ROOT(node) );
+
+	g_node_traverse( node, G_IN_ORDER, G_TRAVERSE_ALL, -1, node_data_free, NULL );
+	g_node_destroy( node );
+}
+
+
+/* Sorts the contents of a directory (see compare_node( )) */
+void
+scanfs_sort_dir( GNode *dnode )
+{
+	dnode->children = (GNode *)g_list_sort( (GList *)dnode->children, (GCompareFunc)compare_node );
+}
+
+/* Starts a new filesystem tree, in place of the current one (which is
+ * freed). The tree gets a metanode with the given name, and nothing
+ * else; the caller adds nodes made with scanfs_node_new( ), starting
+ * with the root directory, and finishes up with scanfs_tree_done( ).
+ * Progress is reported through the given callbacks (hooks may be NULL) */
+void
+scanfs_tree_new( const char *name, const ScanfsHooks *hooks, void *data )
+{
+	static const ScanfsHooks no_hooks = { NULL };
+	int i;
+
+	scan_hooks = (hooks != NULL) ? hooks : &no_hooks;
+	scan_hooks_data = data;
+
+	if (scan_hooks->begin != NULL)
+		(scan_hooks->begin)( globals.fstree, scan_hooks_data );
 
 	if (globals.fstree != NULL) {
-		/* Free existing geometry and filesystem tree */
-		geometry_free_recursive( globals.fstree );
+		/* Free existing filesystem tree */
 		g_node_traverse(globals.fstree, G_IN_ORDER, G_TRAVERSE_ALL,
 				-1, node_data_free, NULL);
 		g_node_destroy( globals.fstree );
+		globals.fstree = NULL;
 	}
 
 	/* Setup string chunks to hold name strings */
@@ -311,11 +987,132 @@ scanfs( const char *dir )
 		g_string_chunk_free( name_strchunk );
 	name_strchunk = g_string_chunk_new( 8192 );
 
-	/* Clear out directory tree */
-	dirtree_clear( );
-
-	/* Reset node numbering */
+	/* Reset node numbering, and with it the attribute columns */
 	node_id = 0;
+	nodeattr_reset( );
+	extstats_reset( );
+
+	/* Reset progress readout */
+	for (i = 0; i < NUM_NODE_TYPES; i++) {
+		node_counts[i] = 0;
+		size_counts[i] = 0;
+	}
+	stat_count = 0;
+	name_bytes = 0;
+
+	/* Set up fstree metanode */
+	globals.fstree = g_node_new(g_slice_new0(DirNodeDesc));
+	NODE_DESC(globals.fstree)->type = NODE_METANODE;
+	NODE_DESC(globals.fstree)->id = node_id++;
+	NODE_DESC(globals.fstree)->name = g_string_chunk_insert( name_strchunk, name );
+	DIR_NODE_DESC(globals.fstree)->tnode = NULL; /* needed in dirtree_entry_new( ) */
+}
+
+
+/* Returns the memory taken up by the tree: nodes, descriptors and
+ * names (attribute columns are counted by nodeattr.c). Subtree counts
+ * must be in place */
+static int64
+tree_bytes( void )
+{
+	int64 bytes;
+	int i;
+
+	bytes = name_bytes + sizeof(GNode) + sizeof(DirNodeDesc);
+	for (i = 0; i < NUM_NODE_TYPES; i++) {
+		if (i == NODE_DIRECTORY)
+			bytes += DIR_NODE_DESC(globals.fstree)->subtree.counts[i] * (int64)(sizeof(GNode) + sizeof(DirNodeDesc));
+		else
+			bytes += DIR_NODE_DESC(globals.fstree)->subtree.counts[i] * (int64)(sizeof(GNode) + sizeof(NodeDesc));
+	}
+
+	return bytes;
+}
+
+
+/* Completes the tree begun with scanfs_tree_new( ): assigns subtree
+ * totals, sorts directories, and hands over the node table */
+void
+scanfs_tree_done( void )
+{
+	GNode **node_table;
+	PerfScope perf;
+
+	if (scan_hooks->scanned != NULL)
+		(scan_hooks->scanned)( scan_hooks_data );
+
+	/* Allocate node table and perform final tree setup */
+	node_table = NEW_ARRAY(GNode *, node_id);
+	perfctr_begin( &perf, PERF_PHASE_AGGREGATE );
+	setup_fstree_recursive( globals.fstree, node_table );
+	perfctr_end( &perf, node_id );
+	perfctr_begin( &perf, PERF_PHASE_SORT );
+	sort_fstree_recursive( globals.fstree );
+	perfctr_end( &perf, node_id );
+
+	profile_gauge( "scan.nodes", node_id );
+	profile_gauge( "scan.stats_per_sec", 0 );
+	profile_gauge( "tree.bytes", tree_bytes( ) );
+
+	/* Pass off new node table */
+	if (scan_hooks->done != NULL)
+		(scan_hooks->done)( node_table, node_id, scan_hooks_data );
+	else
+		xfree( node_table );
+}
+
+
+/* Makes a directory already in the tree the new root directory, without
+ * scanning anything. Everything outside of it is cut loose: the old root
+ * directory is returned, unlinked, for the caller to dispose of with
+ * scanfs_node_free( ). Node IDs (and with them the node table and the
+ * attribute columns) are left as they are */
+GNode *
+scanfs_reroot( GNode *dnode )
+{
+	DirNodeDesc *meta_ndesc;
+	GNode *old_root_dnode;
+	char *name;
+	int i;
+
+	g_assert( NODE_IS_DIR(dnode) && (dnode != root_dnode) );
+
+	/* The metanode stands for the new root's parent directory */
+	name = xstrdup( node_absname( dnode->parent ) );
+	NODE_DESC(globals.fstree)->name = g_string_chunk_insert( name_strchunk, name );
+	xfree( name );
+
+	extstats_reset( );
+
+	old_root_dnode = root_dnode;
+	g_node_unlink( dnode );
+	g_node_unlink( old_root_dnode );
+	g_node_prepend( globals.fstree, dnode );
+
+	/* Metanode totals are those of the new root, plus the root itself */
+	meta_ndesc = DIR_NODE_DESC(globals.fstree);
+	meta_ndesc->subtree.size = NODE_DESC(dnode)->size + DIR_NODE_DESC(dnode)->subtree.size;
+	for (i = 0; i < NUM_NODE_TYPES; i++)
+		meta_ndesc->subtree.counts[i] = DIR_NODE_DESC(dnode)->subtree.counts[i];
+	++meta_ndesc->subtree.counts[NODE_DIRECTORY];
+
+	return old_root_dnode;
+}
+
+
+/* Scans a filesystem into a tree with just the root directory, or if
+ * streaming, through stream_emit( ). The attributes of the root are
+ * returned in root_attrs (as they are not stored when streaming) */
+static void
+scan_tree( const char *dir, const ScanfsHooks *hooks, void *data, NodeAttrs *root_attrs )
+{
+	struct DirRead *read;
+	const char *root_dir;
+	PerfScope perf;
+	guint handler_id;
+	dev_t root_dev = 0;
+	boolean root_ok;
+	char *name, *parent_dir;
 
 	/* Get absolute path of desired root (top-level) directory */
 	if (chdir(dir) != 0) {
@@ -324,46 +1121,115 @@ scanfs( const char *dir )
 	}
 	root_dir = xgetcwd( );
 
-	/* Set up fstree metanode */
-	globals.fstree = g_node_new(g_slice_new(DirNodeDesc));
-	NODE_DESC(globals.fstree)->type = NODE_METANODE;
-	NODE_DESC(globals.fstree)->id = node_id++;
 	name = g_path_get_dirname( root_dir );
-	NODE_DESC(globals.fstree)->name = g_string_chunk_insert( name_strchunk, name );
+	scanfs_tree_new( name, hooks, data );
 	g_free( name );
-	DIR_NODE_DESC(globals.fstree)->tnode = NULL; /* needed in dirtree_entry_new( ) */
 
 	/* Set up root directory node */
-	g_node_append_data(globals.fstree, g_slice_new(DirNodeDesc));
+	g_node_append_data(globals.fstree, g_slice_new0(DirNodeDesc));
 	/* Note: We can now use root_dnode to refer to the node just
 	 * created (it is an alias for globals.fstree->children) */
 	NODE_DESC(root_dnode)->id = node_id++;
 	name = g_path_get_basename( root_dir );
 	NODE_DESC(root_dnode)->name = g_string_chunk_insert( name_strchunk, name );
 	g_free(name);
-	// TODO: Invalidate VBO's, need to upload new ones.
-	stat_node( root_dnode );
-	dirtree_entry_new( root_dnode );
+	DIR_NODE_DESC(root_dnode)->unavailable = FALSE;
+	if (dead_devs == NULL)
+		dead_devs = g_array_new( FALSE, FALSE, sizeof(dev_t) );
+	g_array_set_size( dead_devs, 0 );
+	scan_depth = 0;
+
+	/* The root directory may be on a dead mount as well */
+	name = g_path_get_basename( root_dir );
+	parent_dir = g_path_get_dirname( root_dir );
+	read = dir_read_new( parent_dir, &name, 1 );
+	g_free( parent_dir );
+	g_free( name );
+	root_ok = dir_read_wait( &stat_worker, read, scan_hooks, scan_hooks_data ) && read->stats[0].ok;
+	if (root_ok) {
+		root_dev = read->stats[0].dev;
+		NODE_DESC(root_dnode)->type = read->stats[0].desc.type;
+		NODE_DESC(root_dnode)->size = read->stats[0].desc.size;
+		NODE_DESC(root_dnode)->size_alloc = read->stats[0].desc.size_alloc;
+		memcpy( root_attrs, &read->stats[0].attrs, sizeof(NodeAttrs) );
+	}
+	else {
+		NODE_DESC(root_dnode)->type = NODE_DIRECTORY;
+		NODE_DESC(root_dnode)->size = 0;
+		NODE_DESC(root_dnode)->size_alloc = 0;
+		memset( root_attrs, 0, sizeof(NodeAttrs) );
+	}
+	if (stream_emit == NULL) {
+		nodeattr_store( NODE_DESC(root_dnode)->id, root_attrs );
+		if (scan_hooks->dir_found != NULL)
+			(scan_hooks->dir_found)( root_dnode, scan_hooks_data );
+	}
 
-	/* GUI stuff */
-	filelist_scan_monitor_init( );
-	handler_id = g_timeout_add( SCAN_MONITOR_PERIOD, (GSourceFunc)scan_monitor, NULL);
+	handler_id = g_timeout_add( SCANFS_PROGRESS_PERIOD, (GSourceFunc)scan_monitor, NULL);
 
 	/* Let the disk thrashing begin */
-	process_dir( root_dir, root_dnode );
+	perfctr_begin( &perf, PERF_PHASE_SCAN );
+	if (root_ok) {
+		listing_dev = root_dev;
+		process_dir( root_dir, root_dnode, root_dev );
+	}
+	else {
+		DIR_NODE_DESC(root_dnode)->unavailable = TRUE;
+		report_unreachable( root_dir );
+	}
+	perfctr_end( &perf, node_id );
+	dir_read_unref( read );
+	stat_worker_release( &stat_worker );
 
-	/* GUI stuff again */
 	g_source_remove( handler_id );
-	window_statusbar( SB_RIGHT, "" );
-	dirtree_no_more_entries( );
-	gui_update( );
+}
 
-	/* Allocate node table and perform final tree setup */
-	node_table = NEW_ARRAY(GNode *, node_id);
-	setup_fstree_recursive( globals.fstree, node_table );
 
-	/* Pass off new node table to the viewport handler */
-	viewport_pass_node_table(node_table, node_id);
+/* Top-level call to recursively scan a filesystem. Progress is reported
+ * through the given callbacks (hooks may be NULL) */
+void
+scanfs( const char *dir, const ScanfsHooks *hooks, void *data )
+{
+	NodeAttrs root_attrs;
+
+	scan_tree( dir, hooks, data, &root_attrs );
+	scanfs_tree_done( );
+}
+
+
+/* Scans a filesystem without building the tree, for when it would not
+ * fit in memory. Each node is passed to emit( ) as soon as it is
+ * complete, which is after everything below it: so directories come
+ * after their contents, with subtree totals (and the count of their
+ * children) filled in, and the root directory comes last. Only the
+ * directories being read are held onto, so memory use goes with the
+ * depth of the tree and the size of its directories, not with the
+ * number of nodes. The hooks are called as with scanfs( ), except for
+ * dir_found( ) and done( ), and data is passed to emit( ) as well.
+ * Afterward, the tree is left with the metanode and an empty root */
+void
+scanfs_stream( const char *dir, ScanfsEmitFunc emit, const ScanfsHooks *hooks, void *data )
+{
+	NodeAttrs root_attrs;
+	unsigned int num_children = 0;
+
+	stream_emit = emit;
+	if (stream_child_counts == NULL)
+		stream_child_counts = g_array_new( FALSE, FALSE, sizeof(unsigned int) );
+	g_array_set_size( stream_child_counts, 0 );
+	g_array_append_val( stream_child_counts, num_children );
+
+	scan_tree( dir, hooks, data, &root_attrs );
+
+	num_children = g_array_index(stream_child_counts, unsigned int, 0);
+	(stream_emit)( NODE_DESC(root_dnode), &root_attrs, num_children, scan_hooks_data );
+	stream_emit = NULL;
+
+	if (scan_hooks->scanned != NULL)
+		(scan_hooks->scanned)( scan_hooks_data );
+
+	profile_gauge( "scan.nodes", node_id );
+	profile_gauge( "scan.stats_per_sec", 0 );
 }
 
 
@@ -15,7 +15,78 @@
 #define FSV_SCANFS_H
 
 
-void scanfs( const char *dir );
+#include <dirent.h>
+
+
+/* Progress callbacks from scanfs( ). Any of them may be NULL. They are
+ * called from the thread doing the scan, with the data pointer that was
+ * passed to scanfs( ) */
+typedef struct _ScanfsHooks ScanfsHooks;
+struct _ScanfsHooks {
+	/* Scan is starting. The previous tree (if any) is freed next */
+	void	(*begin)( GNode *old_fstree, void *data );
+	/* A directory node has been created, before it is read */
+	void	(*dir_found)( GNode *dnode, void *data );
+	/* A directory is about to be read */
+	void	(*dir_begin)( const char *dir, void *data );
+	/* A directory entry has been processed */
+	void	(*entry_done)( void *data );
+	/* Running node/size counts by type, and stats per second. Called
+	 * from a timeout, so only if entry_done( ) runs the main loop */
+	void	(*progress)( const int *node_counts, const int64 *size_counts, int stats_per_sec, void *data );
+	/* All entries have been read in */
+	void	(*scanned)( void *data );
+	/* Tree is complete. The node table is handed over */
+	void	(*done)( GNode **node_table, unsigned int num_nodes, void *data );
+	/* A directory is being slow to respond. Called every so often
+	 * while waiting on it */
+	void	(*stalled)( const char *dir, void *data );
+	/* A path did not respond in time, and was skipped. It is left in
+	 * the tree as an empty directory, marked unavailable */
+	void	(*unreachable)( const char *absname, void *data );
+};
+
+
+/* Node output of scanfs_stream( ). Directories have their subtree
+ * totals filled in, and num_children is the count of their entries (0
+ * for anything else) */
+typedef void (*ScanfsEmitFunc)( const NodeDesc *ndesc, const NodeAttrs *attrs, unsigned int num_children, void *data );
+
+
+/* Result of statting a directory entry with scanfs_stat_entries( ) */
+typedef struct _ScanfsEntryStat ScanfsEntryStat;
+struct _ScanfsEntryStat {
+	NodeDesc	desc;		/* Stat information (if ok) */
+	NodeAttrs	attrs;		/* ditto (optional attributes) */
+	boolean		ok;		/* Stat succeeded */
+	boolean		unavailable;	/* Stat did not come back */
+};
+
+/* Return values of scanfs_list_dir( ), other than an entry count */
+#define SCANFS_UNREADABLE	-1
+#define SCANFS_UNAVAILABLE	-2
+
+
+#ifndef HAVE_SCANDIR
+int scandir( const char *dir, struct dirent ***namelist, int (*selector)( const struct dirent * ), int (*cmp)( const void *, const void * ) );
+int alphasort( const void *a, const void *b );
+#endif
+
+
+int scanfs_stat( const char *absname, NodeDesc *ndesc, NodeAttrs *attrs );
+int scanfs_de_select( const struct dirent *de );
+int scanfs_list_dir( const char *dir, char ***names );
+void scanfs_stat_entries( const char *dir, char **names, int num_names, ScanfsEntryStat *stats );
+void scanfs_set_stat_timeout( double seconds );
+void scanfs_set_sample_depth( int depth );
+GNode *scanfs_node_new( const NodeDesc *ndesc, const char *name );
+void scanfs_node_free( GNode *node );
+void scanfs_sort_dir( GNode *dnode );
+void scanfs_tree_new( const char *name, const ScanfsHooks *hooks, void *data );
+void scanfs_tree_done( void );
+GNode *scanfs_reroot( GNode *dnode );
+void scanfs( const char *dir, const ScanfsHooks *hooks, void *data );
+void scanfs_stream( const char *dir, ScanfsEmitFunc emit, const ScanfsHooks *hooks, void *data );
 
 
 /* end scanfs.h */
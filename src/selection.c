@@ -0,0 +1,576 @@
+/* selection.c */
+
+/* Marquee (rubber-band) selection */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "selection.h"
+
+#include "geometry.h" /* geometry_node_extents( ) */
+#include "nodeattr.h" /* nodeattr_lookup( ) */
+#include "ogl.h" /* gl.projection, gl.modelview */
+#include "profile.h"
+
+
+/* Maximum spatial index grid size (cells per side) */
+#define SELECTION_GRID_MAX	256
+
+
+/* Spatial index entry: one visible, non-container node, with its
+ * world-space bounding box */
+struct IndexEntry {
+	GNode	*node;
+	vec3	c0;
+	vec3	c1;
+};
+
+
+/* Spatial index of the current layout. This is a uniform grid over the
+ * x/y plane; each cell lists the entries whose boxes overlap it. It is
+ * built when a marquee drag starts, and queried on every pointer motion */
+static struct {
+	struct IndexEntry *entries;
+	unsigned int num_entries;
+	/* Cell contents, as ranges into cell_items[] */
+	guint32 *cell_start;
+	guint32 *cell_items;
+	int nx, ny;
+	/* Grid origin and cell dimensions */
+	double x0, y0;
+	double cell_w, cell_h;
+	/* Overall z range */
+	double z0, z1;
+	/* Query stamps (to visit each entry only once per query) */
+	guint32 *stamp;
+	guint32 query_id;
+} sindex;
+
+/* Marquee corners (viewport pixel coordinates, origin at upper left) */
+static int marquee_x0, marquee_y0, marquee_x1, marquee_y1;
+/* Viewport dimensions */
+static int viewport_width, viewport_height;
+
+/* TRUE while the marquee is being dragged */
+static boolean dragging = FALSE;
+
+/* TRUE if there is a selection (dragging or not) */
+static boolean active = FALSE;
+
+/* Selection mask, indexed by node ID (nonzero == selected) */
+static guint8 *mask = NULL;
+static unsigned int mask_size = 0;
+
+/* Mask values. MASK_STALE marks, during a query, nodes that were selected
+ * and have not (yet) been found in the marquee again */
+#define MASK_SELECTED	1
+#define MASK_STALE	2
+
+/* Nodes set in the mask, so that a change of selection only has to touch
+ * what was or becomes selected. The spare array holds the previous list
+ * during a query */
+static GPtrArray *selected_nodes = NULL;
+static GPtrArray *spare_nodes = NULL;
+
+/* Nodes whose selection state changed with the last update */
+static GPtrArray *changed_nodes = NULL;
+
+/* Statistics for the current selection */
+static SelectionStats stats;
+/* Modification times of stats.oldest_node and stats.newest_node */
+static time_t oldest_mtime, newest_mtime;
+
+
+/* Frees the spatial index */
+static void
+index_free( void )
+{
+	if (sindex.entries != NULL) {
+		xfree( sindex.entries );
+		xfree( sindex.cell_start );
+		xfree( sindex.cell_items );
+		xfree( sindex.stamp );
+	}
+	memset( &sindex, 0, sizeof(sindex) );
+}
+
+
+/* Helper function for index_build( ). Gathers visible nodes, skipping
+ * over expanded directories (which only contain other nodes) */
+static void
+index_collect_recursive( GNode *dnode, GArray *entry_array, unsigned int *max_id )
+{
+	struct IndexEntry entry;
+	XYZvec c0, c1;
+	GNode *node;
+
+	node = dnode->children;
+	while (node != NULL) {
+		*max_id = MAX(*max_id, NODE_DESC(node)->id);
+		if (!NODE_IS_DIR(node) || DIR_COLLAPSED(node)) {
+			if (geometry_node_extents( node, &c0, &c1 )) {
+				entry.node = node;
+				entry.c0[0] = c0.x;
+				entry.c0[1] = c0.y;
+				entry.c0[2] = c0.z;
+				entry.c1[0] = c1.x;
+				entry.c1[1] = c1.y;
+				entry.c1[2] = c1.z;
+				g_array_append_val( entry_array, entry );
+			}
+		}
+		else
+			index_collect_recursive( node, entry_array, max_id );
+		node = node->next;
+	}
+}
+
+
+/* Returns the range of grid cells overlapped by an x/y interval */
+static void
+index_cell_range( double x0, double y0, double x1, double y1, int *cx0, int *cy0, int *cx1, int *cy1 )
+{
+	*cx0 = CLAMP((int)floor( (x0 - sindex.x0) / sindex.cell_w ), 0, sindex.nx - 1);
+	*cy0 = CLAMP((int)floor( (y0 - sindex.y0) / sindex.cell_h ), 0, sindex.ny - 1);
+	*cx1 = CLAMP((int)floor( (x1 - sindex.x0) / sindex.cell_w ), 0, sindex.nx - 1);
+	*cy1 = CLAMP((int)floor( (y1 - sindex.y0) / sindex.cell_h ), 0, sindex.ny - 1);
+}
+
+
+/* Builds the spatial index for the current layout */
+static void
+index_build( void )
+{
+	struct IndexEntry *entry;
+	GArray *entry_array;
+	double x1, y1, w, h;
+	unsigned int max_id = 0;
+	unsigned int e, num_cells, num_items;
+	int cx0, cy0, cx1, cy1, cx, cy;
+	double t0;
+
+	t0 = xgettime( );
+	index_free( );
+
+	entry_array = g_array_new( FALSE, FALSE, sizeof(struct IndexEntry) );
+	index_collect_recursive( globals.fstree, entry_array, &max_id );
+	sindex.num_entries = entry_array->len;
+	sindex.entries = NEW_ARRAY(struct IndexEntry, MAX(1, sindex.num_entries));
+	memcpy( sindex.entries, entry_array->data, sindex.num_entries * sizeof(struct IndexEntry) );
+	g_array_free( entry_array, TRUE );
+
+	/* Selection mask covers every node that can be drawn. What is
+	 * already selected stays set */
+	if (mask_size < (max_id + 1)) {
+		RESIZE(mask, max_id + 1, guint8);
+		memset( mask + mask_size, 0, max_id + 1 - mask_size );
+		mask_size = max_id + 1;
+	}
+	if (selected_nodes == NULL) {
+		selected_nodes = g_ptr_array_new( );
+		spare_nodes = g_ptr_array_new( );
+		changed_nodes = g_ptr_array_new( );
+	}
+
+	/* Overall bounds */
+	sindex.x0 = sindex.y0 = sindex.z0 = G_MAXDOUBLE;
+	x1 = y1 = sindex.z1 = - G_MAXDOUBLE;
+	for (e = 0; e < sindex.num_entries; e++) {
+		entry = &sindex.entries[e];
+		sindex.x0 = MIN(sindex.x0, entry->c0[0]);
+		sindex.y0 = MIN(sindex.y0, entry->c0[1]);
+		sindex.z0 = MIN(sindex.z0, entry->c0[2]);
+		x1 = MAX(x1, entry->c1[0]);
+		y1 = MAX(y1, entry->c1[1]);
+		sindex.z1 = MAX(sindex.z1, entry->c1[2]);
+	}
+	if (sindex.num_entries == 0) {
+		sindex.x0 = sindex.y0 = sindex.z0 = 0.0;
+		x1 = y1 = sindex.z1 = 1.0;
+	}
+	w = MAX(x1 - sindex.x0, EPSILON);
+	h = MAX(y1 - sindex.y0, EPSILON);
+
+	/* Grid dimensions: about two entries per cell, square-ish cells */
+	sindex.nx = CLAMP((int)ceil( sqrt( 0.5 * sindex.num_entries * w / h ) ), 1, SELECTION_GRID_MAX);
+	sindex.ny = CLAMP((int)ceil( sqrt( 0.5 * sindex.num_entries * h / w ) ), 1, SELECTION_GRID_MAX);
+	sindex.cell_w = w / (double)sindex.nx;
+	sindex.cell_h = h / (double)sindex.ny;
+	num_cells = sindex.nx * sindex.ny;
+
+	/* Count cell occupancy... */
+	sindex.cell_start = NEW_ARRAY(guint32, num_cells + 1);
+	memset( sindex.cell_start, 0, (num_cells + 1) * sizeof(guint32) );
+	for (e = 0; e < sindex.num_entries; e++) {
+		entry = &sindex.entries[e];
+		index_cell_range( entry->c0[0], entry->c0[1], entry->c1[0], entry->c1[1], &cx0, &cy0, &cx1, &cy1 );
+		for (cy = cy0; cy <= cy1; cy++)
+			for (cx = cx0; cx <= cx1; cx++)
+				++sindex.cell_start[cy * sindex.nx + cx + 1];
+	}
+	/* ...turn counts into offsets... */
+	for (e = 1; e <= num_cells; e++)
+		sindex.cell_start[e] += sindex.cell_start[e - 1];
+	num_items = sindex.cell_start[num_cells];
+	/* ...and fill in (cell_start[c] is advanced to the end of cell c,
+	 * then shifted back afterward) */
+	sindex.cell_items = NEW_ARRAY(guint32, MAX(1, num_items));
+	for (e = 0; e < sindex.num_entries; e++) {
+		entry = &sindex.entries[e];
+		index_cell_range( entry->c0[0], entry->c0[1], entry->c1[0], entry->c1[1], &cx0, &cy0, &cx1, &cy1 );
+		for (cy = cy0; cy <= cy1; cy++)
+			for (cx = cx0; cx <= cx1; cx++)
+				sindex.cell_items[sindex.cell_start[cy * sindex.nx + cx]++] = e;
+	}
+	memmove( &sindex.cell_start[1], &sindex.cell_start[0], num_cells * sizeof(guint32) );
+	sindex.cell_start[0] = 0;
+
+	sindex.stamp = NEW_ARRAY(guint32, MAX(1, sindex.num_entries));
+	memset( sindex.stamp, 0, MAX(1, sindex.num_entries) * sizeof(guint32) );
+	sindex.query_id = 0;
+
+	profile_count( "selection.index_builds", 1 );
+	profile_gauge( "selection.index_entries", sindex.num_entries );
+	profile_gauge( "selection.index_build_usec", (int64)(1.0e6 * (xgettime( ) - t0)) );
+}
+
+
+/* Finds the x/y region of the world that can appear inside the marquee,
+ * given the z range of the layout. Returns FALSE if this cannot be
+ * bounded (e.g. the view is edge-on), in which case the whole grid has to
+ * be searched */
+static boolean
+query_xy_bounds( mat4 mvp, const float ndc[4], double *x0, double *y0, double *x1, double *y1 )
+{
+	mat4 inv;
+	vec4 p_near, p_far;
+	double z, t;
+	double px, py;
+	int c, i;
+
+	glm_mat4_inv( mvp, inv );
+
+	*x0 = *y0 = G_MAXDOUBLE;
+	*x1 = *y1 = - G_MAXDOUBLE;
+	for (c = 0; c < 4; c++) {
+		/* Ray through this marquee corner, from near to far plane */
+		vec4 n = { ndc[(c & 1) ? 2 : 0], ndc[(c & 2) ? 3 : 1], -1.0f, 1.0f };
+		vec4 f = { n[0], n[1], 1.0f, 1.0f };
+		glm_mat4_mulv( inv, n, p_near );
+		glm_mat4_mulv( inv, f, p_far );
+		if ((ABS(p_near[3]) < EPSILON) || (ABS(p_far[3]) < EPSILON))
+			return FALSE;
+		glm_vec4_scale( p_near, 1.0f / p_near[3], p_near );
+		glm_vec4_scale( p_far, 1.0f / p_far[3], p_far );
+		if (ABS(p_far[2] - p_near[2]) < EPSILON)
+			return FALSE;
+
+		/* Where it crosses the bottom and top of the layout */
+		for (i = 0; i < 2; i++) {
+			z = i ? sindex.z1 : sindex.z0;
+			t = (z - p_near[2]) / (p_far[2] - p_near[2]);
+			if ((t < 0.0) || (t > 1.0))
+				return FALSE;
+			px = p_near[0] + t * (p_far[0] - p_near[0]);
+			py = p_near[1] + t * (p_far[1] - p_near[1]);
+			*x0 = MIN(*x0, px);
+			*y0 = MIN(*y0, py);
+			*x1 = MAX(*x1, px);
+			*y1 = MAX(*y1, py);
+		}
+	}
+
+	return TRUE;
+}
+
+
+/* Tests whether the screen-space footprint of an entry's box intersects
+ * the marquee (given in normalized device coordinates) */
+static boolean
+entry_in_marquee( mat4 mvp, const struct IndexEntry *entry, const float ndc[4] )
+{
+	vec4 corner, p;
+	float bx0 = G_MAXFLOAT, by0 = G_MAXFLOAT;
+	float bx1 = - G_MAXFLOAT, by1 = - G_MAXFLOAT;
+	boolean any = FALSE;
+	int c;
+
+	for (c = 0; c < 8; c++) {
+		corner[0] = (c & 1) ? entry->c1[0] : entry->c0[0];
+		corner[1] = (c & 2) ? entry->c1[1] : entry->c0[1];
+		corner[2] = (c & 4) ? entry->c1[2] : entry->c0[2];
+		corner[3] = 1.0f;
+		glm_mat4_mulv( mvp, corner, p );
+		if (p[3] <= EPSILON)
+			continue; /* behind the camera */
+		bx0 = MIN(bx0, p[0] / p[3]);
+		by0 = MIN(by0, p[1] / p[3]);
+		bx1 = MAX(bx1, p[0] / p[3]);
+		by1 = MAX(by1, p[1] / p[3]);
+		any = TRUE;
+	}
+
+	if (!any)
+		return FALSE;
+
+	return (bx1 >= ndc[0]) && (bx0 <= ndc[2]) && (by1 >= ndc[1]) && (by0 <= ndc[3]);
+}
+
+
+/* Adds a node to the selection */
+static void
+select_node( GNode *node )
+{
+	NodeAttrs attrs;
+	unsigned int id;
+	int i;
+
+	id = NODE_DESC(node)->id;
+	if (mask[id] != MASK_STALE)
+		g_ptr_array_add( changed_nodes, node );
+	mask[id] = MASK_SELECTED;
+	g_ptr_array_add( selected_nodes, node );
+
+	++stats.num_nodes;
+	stats.size += NODE_DESC(node)->size;
+	++stats.counts[NODE_DESC(node)->type];
+	if (NODE_IS_DIR(node)) {
+		/* A collapsed directory stands for its contents */
+		stats.size += DIR_NODE_DESC(node)->subtree.size;
+		for (i = 0; i < NUM_NODE_TYPES; i++)
+			stats.counts[i] += DIR_NODE_DESC(node)->subtree.counts[i];
+	}
+
+	/* Only if timestamps are in memory (see nodeattr.c) */
+	if (!nodeattr_lookup( node, NODE_ATTR_TIMES, &attrs ))
+		return;
+	if ((stats.oldest_node == NULL) || (attrs.mtime < oldest_mtime)) {
+		stats.oldest_node = node;
+		oldest_mtime = attrs.mtime;
+	}
+	if ((stats.newest_node == NULL) || (attrs.mtime > newest_mtime)) {
+		stats.newest_node = node;
+		newest_mtime = attrs.mtime;
+	}
+}
+
+
+/* Returns the marquee in normalized device coordinates (x0, y0, x1, y1) */
+static void
+marquee_ndc( float ndc[4] )
+{
+	ndc[0] = 2.0f * MIN(marquee_x0, marquee_x1) / viewport_width - 1.0f;
+	ndc[1] = 1.0f - 2.0f * MAX(marquee_y0, marquee_y1) / viewport_height;
+	ndc[2] = 2.0f * MAX(marquee_x0, marquee_x1) / viewport_width - 1.0f;
+	ndc[3] = 1.0f - 2.0f * MIN(marquee_y0, marquee_y1) / viewport_height;
+}
+
+
+/* Recomputes the selection from the current marquee */
+static void
+selection_query( void )
+{
+	struct IndexEntry *entry;
+	GPtrArray *prev_nodes;
+	GNode *node;
+	mat4 mvp;
+	float ndc[4];
+	double x0, y0, x1, y1;
+	unsigned int i;
+	int cx0, cy0, cx1, cy1, cx, cy, c;
+	double t0;
+
+	t0 = xgettime( );
+
+	memset( &stats, 0, sizeof(SelectionStats) );
+	g_ptr_array_set_size( changed_nodes, 0 );
+
+	/* Mark what was selected, instead of clearing the whole mask */
+	prev_nodes = selected_nodes;
+	selected_nodes = spare_nodes;
+	spare_nodes = prev_nodes;
+	for (i = 0; i < prev_nodes->len; i++) {
+		node = (GNode *)g_ptr_array_index( prev_nodes, i );
+		mask[NODE_DESC(node)->id] = MASK_STALE;
+	}
+
+	marquee_ndc( ndc );
+
+	/* The camera matrices are those of the last frame drawn */
+	glm_mat4_mul( gl.projection, gl.modelview, mvp );
+
+	if (query_xy_bounds( mvp, ndc, &x0, &y0, &x1, &y1 ))
+		index_cell_range( x0, y0, x1, y1, &cx0, &cy0, &cx1, &cy1 );
+	else {
+		cx0 = cy0 = 0;
+		cx1 = sindex.nx - 1;
+		cy1 = sindex.ny - 1;
+	}
+
+	++sindex.query_id;
+	for (cy = cy0; cy <= cy1; cy++) {
+		for (cx = cx0; cx <= cx1; cx++) {
+			c = cy * sindex.nx + cx;
+			for (i = sindex.cell_start[c]; i < sindex.cell_start[c + 1]; i++) {
+				guint32 e = sindex.cell_items[i];
+				if (sindex.stamp[e] == sindex.query_id)
+					continue;
+				sindex.stamp[e] = sindex.query_id;
+				entry = &sindex.entries[e];
+				if (entry_in_marquee( mvp, entry, ndc ))
+					select_node( entry->node );
+			}
+		}
+	}
+
+	/* Whatever is still marked has left the marquee */
+	for (i = 0; i < prev_nodes->len; i++) {
+		node = (GNode *)g_ptr_array_index( prev_nodes, i );
+		if (mask[NODE_DESC(node)->id] == MASK_STALE) {
+			mask[NODE_DESC(node)->id] = 0;
+			g_ptr_array_add( changed_nodes, node );
+		}
+	}
+	g_ptr_array_set_size( prev_nodes, 0 );
+
+	geometry_selection_changed( (GNode **)changed_nodes->pdata, changed_nodes->len );
+
+	profile_count( "selection.queries", 1 );
+	profile_gauge( "selection.query_usec", (int64)(1.0e6 * (xgettime( ) - t0)) );
+}
+
+
+/* Starts a marquee drag at viewport location (x,y), for a viewport of
+ * the given pixel dimensions */
+void
+selection_begin( int x, int y, int width, int height )
+{
+	index_build( );
+
+	viewport_width = MAX(1, width);
+	viewport_height = MAX(1, height);
+	marquee_x0 = marquee_x1 = x;
+	marquee_y0 = marquee_y1 = y;
+	dragging = TRUE;
+	active = TRUE;
+
+	selection_query( );
+}
+
+
+/* Moves the free corner of the marquee */
+void
+selection_update( int x, int y )
+{
+	if (!dragging)
+		return;
+
+	marquee_x1 = x;
+	marquee_y1 = y;
+
+	selection_query( );
+}
+
+
+/* Finishes the marquee drag. The selection remains */
+void
+selection_end( void )
+{
+	dragging = FALSE;
+	index_free( );
+	/* Only the marquee goes away */
+	geometry_selection_changed( NULL, 0 );
+}
+
+
+/* Clears the selection */
+void
+selection_clear( void )
+{
+	GNode *node;
+	unsigned int i;
+
+	if (!active)
+		return;
+
+	dragging = FALSE;
+	active = FALSE;
+	index_free( );
+	memset( &stats, 0, sizeof(SelectionStats) );
+	for (i = 0; i < selected_nodes->len; i++) {
+		node = (GNode *)g_ptr_array_index( selected_nodes, i );
+		mask[NODE_DESC(node)->id] = 0;
+	}
+	geometry_selection_changed( (GNode **)selected_nodes->pdata, selected_nodes->len );
+	g_ptr_array_set_size( selected_nodes, 0 );
+}
+
+
+/* Returns TRUE while the marquee is being dragged */
+boolean
+selection_dragging( void )
+{
+	return dragging;
+}
+
+
+/* Returns TRUE if anything may be selected */
+boolean
+selection_active( void )
+{
+	return active;
+}
+
+
+/* Returns the marquee, in normalized device coordinates (x0, y0, x1, y1),
+ * for drawing. Returns FALSE if no marquee is being dragged */
+boolean
+selection_marquee( float ndc[4] )
+{
+	if (!dragging)
+		return FALSE;
+
+	marquee_ndc( ndc );
+
+	return TRUE;
+}
+
+
+/* Returns statistics for the current selection */
+const SelectionStats *
+selection_stats( void )
+{
+	return &stats;
+}
+
+
+/* Tells if the given node is selected */
+boolean
+selection_node_selected( GNode *node )
+{
+	unsigned int id = NODE_DESC(node)->id;
+
+	return active && (id < mask_size) && mask[id];
+}
+
+
+/* Returns the selection mask (one byte per node ID, nonzero for
+ * selected nodes), or NULL if there is no selection */
+const guint8 *
+selection_mask( unsigned int *size )
+{
+	if (!active) {
+		*size = 0;
+		return NULL;
+	}
+
+	*size = mask_size;
+	return mask;
+}
+
+
+/* end selection.c */
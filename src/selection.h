@@ -0,0 +1,44 @@
+/* selection.h */
+
+/* Marquee (rubber-band) selection */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_SELECTION_H
+	#error
+#endif
+#define FSV_SELECTION_H
+
+
+/* Aggregate statistics over the selected nodes. Collapsed directories
+ * stand for their whole subtree in the size and count totals */
+typedef struct _SelectionStats SelectionStats;
+struct _SelectionStats {
+	int		num_nodes;	/* Selected (visible) nodes */
+	int64		size;		/* Total size (bytes) */
+	unsigned int	counts[NUM_NODE_TYPES]; /* Node type totals */
+	/* Oldest and newest modification times among the selected
+	 * nodes themselves (subtrees are not searched). NULL if the
+	 * timestamps were not in memory */
+	GNode		*oldest_node;
+	GNode		*newest_node;
+};
+
+
+void selection_begin( int x, int y, int width, int height );
+void selection_update( int x, int y );
+void selection_end( void );
+void selection_clear( void );
+boolean selection_dragging( void );
+boolean selection_active( void );
+boolean selection_marquee( float ndc[4] );
+const SelectionStats *selection_stats( void );
+boolean selection_node_selected( GNode *node );
+const guint8 *selection_mask( unsigned int *mask_size );
+
+
+/* end selection.h */
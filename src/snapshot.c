@@ -0,0 +1,1001 @@
+/* snapshot.c */
+
+/* Filesystem tree snapshots */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "snapshot.h"
+
+#include <errno.h>
+#include <zlib.h>
+
+#include "nodeattr.h"
+#include "profile.h"
+#include "scanfs.h"
+#include "task.h"
+
+
+/* A snapshot is a scanned tree saved to a file, so that it can be looked
+ * at later, or on another machine, without scanning again. It is meant
+ * to be small enough to ship around and keep for months:
+ *
+ *   header	magic, version, attribute columns, node and block counts,
+ *		where the index is, and the metanode's name
+ *   blocks	node records in preorder, SNAPSHOT_BLOCK_NODES at a time,
+ *		each block deflated on its own (or stored, if that is no
+ *		smaller)
+ *   index	per block: stored and raw sizes, node count, codec, and
+ *		the extent of every subtree whose root is in the block
+ *
+ * A node record is the node's type, its name (front-coded against the
+ * previous name in the block), its size as a varint, its allocation size
+ * as a signed delta to its size, and for directories, the number of
+ * children. Owner IDs and timestamps, if present, are signed deltas to
+ * those of the previous record (atime and ctime are deltas to mtime).
+ * All coding state starts afresh with every block, so blocks decode in
+ * parallel; and as the subtree extents say which blocks a subtree spans,
+ * a reader needing only part of the tree can leave the rest alone.
+ * Fixed-size header fields are little-endian.
+ *
+ * A scan too big to hold in memory (see scanfs_stream( )) goes into a
+ * spill file next to the snapshot instead. The scan hands over nodes as
+ * they are completed, children before their directory, which is the
+ * reverse of the order needed here. So each spill record is followed by
+ * its length, and the snapshot is then made by reading the spill file
+ * back to front: that gives preorder, with the children of a directory
+ * in reverse (which doesn't matter, as loading sorts them anyway). Spill
+ * records carry the same fields as node records, plus the subtree extent
+ * and all attributes, none of them delta-coded */
+
+
+/* File identification */
+#define SNAPSHOT_MAGIC		"FSVSNAP"
+#define SNAPSHOT_MAGIC_LEN	8
+#define SNAPSHOT_VERSION	1
+
+/* Size of the fixed part of the header (bytes) */
+#define SNAPSHOT_HEADER_SIZE	40
+
+/* Nodes per block */
+#define SNAPSHOT_BLOCK_NODES	16384
+
+/* zlib compression level for blocks */
+#define SNAPSHOT_DEFLATE_LEVEL	6
+
+/* Smallest possible node record, and index entry: one byte per field
+ * (bytes) */
+#define SNAPSHOT_MIN_RECORD_SIZE	5
+#define SNAPSHOT_MIN_INDEX_SIZE		5
+
+/* Most that deflate can shrink anything by. A block claiming to inflate
+ * to more than this is damaged, and not to be allocated for */
+#define SNAPSHOT_MAX_DEFLATE_RATIO	1032
+
+/* Spill files are read back this much at a time (bytes) */
+#define SNAPSHOT_SPILL_CHUNK	(1 << 20)
+
+
+/* How a block is stored */
+typedef enum {
+	SNAPSHOT_CODEC_STORED,
+	SNAPSHOT_CODEC_DEFLATE,
+	NUM_SNAPSHOT_CODECS
+} SnapshotCodec;
+
+/* State of a snapshot being written */
+struct SnapWriter {
+	FILE		*fp;
+	unsigned int	columns;	/* Attribute columns saved */
+	GByteArray	*block;		/* Records of the current block */
+	GByteArray	*dirs;		/* Subtree extents, same block */
+	GByteArray	*packed;	/* Deflated block */
+	GByteArray	*index;		/* Index entries of finished blocks */
+	unsigned int	block_nodes;	/* Nodes in current block */
+	unsigned int	prev_dir;	/* Block position of last directory */
+	GString		*prev_name;	/* Name in previous record */
+	NodeAttrs	prev_attrs;	/* Attributes in previous record */
+	unsigned int	num_nodes;
+	unsigned int	num_blocks;
+	boolean		error;		/* Write failed */
+};
+
+/* Spill file of a scan on its way to becoming a snapshot */
+struct _SnapshotSpill {
+	FILE		*fp;
+	char		*filename;	/* Snapshot to be made */
+	char		*spill_filename;
+	GByteArray	*record;	/* Record being put together */
+	boolean		error;		/* Write failed */
+};
+
+/* Decoding cursor */
+struct SnapReader {
+	const guint8	*p;
+	const guint8	*end;
+	boolean		ok;		/* FALSE once anything was amiss */
+};
+
+/* Decoded node record */
+struct SnapRecord {
+	NodeType	type;
+	unsigned int	name;		/* Offset of name in block's names */
+	int64		size;
+	int64		size_alloc;
+	unsigned int	num_children;
+	NodeAttrs	attrs;
+};
+
+/* A block of a snapshot being loaded */
+struct SnapBlock {
+	const guint8	*data;		/* Block as stored */
+	gsize		stored_size;
+	gsize		raw_size;
+	unsigned int	num_nodes;
+	SnapshotCodec	codec;
+	/* Filled in by decode_block( ) */
+	struct SnapRecord *records;
+	GByteArray	*names;		/* NUL-terminated names */
+	boolean		ok;
+};
+
+/* Blocks being decoded, shared by the decoding tasks */
+struct SnapDecode {
+	struct SnapBlock *blocks;
+	unsigned int	num_blocks;
+	unsigned int	columns;
+	gint		next_block;	/* Next block to take (atomic) */
+	GMutex		lock;
+	GCond		cond;
+	int		num_tasks;	/* Tasks not yet finished */
+};
+
+
+static void
+put_u32( GByteArray *buf, guint32 value )
+{
+	value = GUINT32_TO_LE(value);
+	g_byte_array_append( buf, (const guint8 *)&value, 4 );
+}
+
+
+static void
+put_u64( GByteArray *buf, guint64 value )
+{
+	value = GUINT64_TO_LE(value);
+	g_byte_array_append( buf, (const guint8 *)&value, 8 );
+}
+
+
+/* Appends an unsigned LEB128 varint */
+static void
+put_varint( GByteArray *buf, guint64 value )
+{
+	guint8 bytes[10];
+	int n = 0;
+
+	while (value >= 0x80) {
+		bytes[n++] = (guint8)(value | 0x80);
+		value >>= 7;
+	}
+	bytes[n++] = (guint8)value;
+	g_byte_array_append( buf, bytes, n );
+}
+
+
+/* Appends a signed varint (zigzag-coded, so small negatives stay small) */
+static void
+put_svarint( GByteArray *buf, int64 value )
+{
+	put_varint( buf, ((guint64)value << 1) ^ (guint64)(value >> 63) );
+}
+
+
+static guint32
+get_u32( const guint8 *p )
+{
+	guint32 value;
+
+	memcpy( &value, p, 4 );
+	return GUINT32_FROM_LE(value);
+}
+
+
+static guint64
+get_u64( const guint8 *p )
+{
+	guint64 value;
+
+	memcpy( &value, p, 8 );
+	return GUINT64_FROM_LE(value);
+}
+
+
+static guint8
+get_byte( struct SnapReader *rd )
+{
+	if (rd->p >= rd->end) {
+		rd->ok = FALSE;
+		return 0;
+	}
+
+	return *rd->p++;
+}
+
+
+static guint64
+get_varint( struct SnapReader *rd )
+{
+	guint64 value = 0;
+	int shift;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		if (rd->p >= rd->end)
+			break;
+		value |= (guint64)(*rd->p & 0x7f) << shift;
+		if (!(*rd->p++ & 0x80))
+			return value;
+	}
+
+	rd->ok = FALSE;
+	return 0;
+}
+
+
+static int64
+get_svarint( struct SnapReader *rd )
+{
+	guint64 value;
+
+	value = get_varint( rd );
+	return (int64)(value >> 1) ^ -(int64)(value & 1);
+}
+
+
+/* Builds the snapshot header */
+static void
+header_build( GByteArray *buf, const struct SnapWriter *sw, guint64 index_offset, guint32 index_size, const char *name )
+{
+	static const char magic[SNAPSHOT_MAGIC_LEN] = SNAPSHOT_MAGIC;
+	guint32 name_len;
+
+	name_len = strlen( name );
+	g_byte_array_set_size( buf, 0 );
+	g_byte_array_append( buf, (const guint8 *)magic, SNAPSHOT_MAGIC_LEN );
+	put_u32( buf, SNAPSHOT_VERSION );
+	put_u32( buf, sw->columns );
+	put_u32( buf, sw->num_nodes );
+	put_u32( buf, sw->num_blocks );
+	put_u64( buf, index_offset );
+	put_u32( buf, index_size );
+	put_u32( buf, name_len );
+	g_assert( buf->len == SNAPSHOT_HEADER_SIZE );
+	g_byte_array_append( buf, (const guint8 *)name, name_len );
+}
+
+
+/* Writes out the current block, deflated if that makes it smaller, and
+ * adds its index entry */
+static void
+block_flush( struct SnapWriter *sw )
+{
+	SnapshotCodec codec = SNAPSHOT_CODEC_STORED;
+	const guint8 *out;
+	uLongf packed_size;
+	gsize out_size;
+	guint8 codec_byte;
+
+	if (sw->block_nodes == 0)
+		return;
+
+	out = sw->block->data;
+	out_size = sw->block->len;
+	packed_size = compressBound( sw->block->len );
+	g_byte_array_set_size( sw->packed, packed_size );
+	if (compress2( sw->packed->data, &packed_size, sw->block->data, sw->block->len, SNAPSHOT_DEFLATE_LEVEL ) == Z_OK) {
+		if (packed_size < sw->block->len) {
+			codec = SNAPSHOT_CODEC_DEFLATE;
+			out = sw->packed->data;
+			out_size = packed_size;
+		}
+	}
+	if (fwrite( out, 1, out_size, sw->fp ) != out_size)
+		sw->error = TRUE;
+
+	put_varint( sw->index, out_size );
+	put_varint( sw->index, sw->block->len );
+	put_varint( sw->index, sw->block_nodes );
+	codec_byte = codec;
+	g_byte_array_append( sw->index, &codec_byte, 1 );
+	put_varint( sw->index, sw->dirs->len );
+	g_byte_array_append( sw->index, sw->dirs->data, sw->dirs->len );
+	++sw->num_blocks;
+
+	/* Coding state starts over */
+	g_byte_array_set_size( sw->block, 0 );
+	g_byte_array_set_size( sw->dirs, 0 );
+	sw->block_nodes = 0;
+	sw->prev_dir = 0;
+	g_string_truncate( sw->prev_name, 0 );
+	memset( &sw->prev_attrs, 0, sizeof(NodeAttrs) );
+}
+
+
+/* Adds the record of a node. For a directory, num_descendants is the
+ * number of nodes below it. attrs is only looked at if attribute columns
+ * are being saved */
+static void
+write_record( struct SnapWriter *sw, const NodeDesc *ndesc, unsigned int num_children, guint64 num_descendants, const NodeAttrs *attrs )
+{
+	size_t prefix_len, len;
+	guint8 type_byte;
+
+	if (sw->block_nodes == SNAPSHOT_BLOCK_NODES)
+		block_flush( sw );
+
+	type_byte = ndesc->type;
+	g_byte_array_append( sw->block, &type_byte, 1 );
+
+	/* Front-coded name */
+	len = strlen( ndesc->name );
+	prefix_len = 0;
+	while ((prefix_len < sw->prev_name->len) && (sw->prev_name->str[prefix_len] == ndesc->name[prefix_len]))
+		++prefix_len;
+	put_varint( sw->block, prefix_len );
+	put_varint( sw->block, len - prefix_len );
+	g_byte_array_append( sw->block, (const guint8 *)ndesc->name + prefix_len, len - prefix_len );
+	g_string_assign( sw->prev_name, ndesc->name );
+
+	put_varint( sw->block, ndesc->size );
+	put_svarint( sw->block, ndesc->size_alloc - ndesc->size );
+
+	if (ndesc->type == NODE_DIRECTORY) {
+		put_varint( sw->block, num_children );
+
+		/* Subtree extent */
+		put_varint( sw->dirs, sw->block_nodes - sw->prev_dir );
+		put_varint( sw->dirs, num_descendants );
+		sw->prev_dir = sw->block_nodes;
+	}
+
+	if (sw->columns & NODE_ATTR_OWNER) {
+		put_svarint( sw->block, (int64)attrs->user_id - (int64)sw->prev_attrs.user_id );
+		put_svarint( sw->block, (int64)attrs->group_id - (int64)sw->prev_attrs.group_id );
+	}
+	if (sw->columns & NODE_ATTR_TIMES) {
+		put_svarint( sw->block, (int64)attrs->mtime - (int64)sw->prev_attrs.mtime );
+		put_svarint( sw->block, (int64)attrs->atime - (int64)attrs->mtime );
+		put_svarint( sw->block, (int64)attrs->ctime - (int64)attrs->mtime );
+	}
+	if (sw->columns != 0)
+		sw->prev_attrs = *attrs;
+
+	++sw->block_nodes;
+	++sw->num_nodes;
+}
+
+
+/* Creates a snapshot file, with room for its header, and gets ready to
+ * add records. Returns FALSE on error */
+static boolean
+writer_open( struct SnapWriter *sw, const char *filename, unsigned int columns, const char *name )
+{
+	GByteArray *header;
+
+	memset( sw, 0, sizeof(struct SnapWriter) );
+	sw->fp = fopen( filename, "wb" );
+	if (sw->fp == NULL) {
+		g_warning( "Cannot write snapshot %s: %s", filename, g_strerror( errno ) );
+		return FALSE;
+	}
+	sw->columns = columns;
+	sw->block = g_byte_array_new( );
+	sw->dirs = g_byte_array_new( );
+	sw->packed = g_byte_array_new( );
+	sw->index = g_byte_array_new( );
+	sw->prev_name = g_string_new( NULL );
+
+	/* Header goes in twice: first to make room, then for real */
+	header = g_byte_array_new( );
+	header_build( header, sw, 0, 0, name );
+	sw->error = fwrite( header->data, 1, header->len, sw->fp ) != header->len;
+	g_byte_array_free( header, TRUE );
+
+	return TRUE;
+}
+
+
+/* Finishes off a snapshot file begun with writer_open( ): the last
+ * block, the index, and the header. Returns 0 on success, -1 on error
+ * (in which case the file is removed) */
+static int
+writer_close( struct SnapWriter *sw, const char *filename, const char *name )
+{
+	GByteArray *header;
+	guint64 index_offset;
+	boolean ok;
+
+	block_flush( sw );
+
+	index_offset = ftell( sw->fp );
+	if (fwrite( sw->index->data, 1, sw->index->len, sw->fp ) != sw->index->len)
+		sw->error = TRUE;
+	header = g_byte_array_new( );
+	header_build( header, sw, index_offset, sw->index->len, name );
+	if (fseek( sw->fp, 0, SEEK_SET ) || (fwrite( header->data, 1, header->len, sw->fp ) != header->len))
+		sw->error = TRUE;
+
+	ok = !sw->error && !ferror( sw->fp );
+	ok = (fclose( sw->fp ) == 0) && ok;
+	if (!ok) {
+		g_warning( "Cannot write snapshot %s: %s", filename, g_strerror( errno ) );
+		remove( filename );
+	}
+	else {
+		profile_gauge( "snapshot.saved_bytes", (int64)(index_offset + sw->index->len) );
+		profile_gauge( "snapshot.saved_blocks", sw->num_blocks );
+	}
+
+	g_byte_array_free( header, TRUE );
+	g_byte_array_free( sw->block, TRUE );
+	g_byte_array_free( sw->dirs, TRUE );
+	g_byte_array_free( sw->packed, TRUE );
+	g_byte_array_free( sw->index, TRUE );
+	g_string_free( sw->prev_name, TRUE );
+
+	return ok ? 0 : -1;
+}
+
+
+/* Creates a spill file, from which the given snapshot is to be made.
+ * Returns NULL on error */
+SnapshotSpill *
+snapshot_spill_new( const char *filename )
+{
+	SnapshotSpill *spill;
+
+	spill = NEW(SnapshotSpill);
+	spill->filename = xstrdup( filename );
+	spill->spill_filename = g_strconcat( filename, ".spill", NULL );
+	spill->fp = fopen( spill->spill_filename, "w+b" );
+	if (spill->fp == NULL) {
+		g_warning( "Cannot write %s: %s", spill->spill_filename, g_strerror( errno ) );
+		g_free( spill->spill_filename );
+		xfree( spill->filename );
+		xfree( spill );
+		return NULL;
+	}
+	spill->record = g_byte_array_new( );
+	spill->error = FALSE;
+
+	return spill;
+}
+
+
+/* Appends the record of a completed node to a spill file (data is the
+ * SnapshotSpill). This fits the emit( ) callback of scanfs_stream( ):
+ * nodes come in postorder, directories with their subtree totals */
+void
+snapshot_spill_node( const NodeDesc *ndesc, const NodeAttrs *attrs, unsigned int num_children, void *data )
+{
+	SnapshotSpill *spill = (SnapshotSpill *)data;
+	GByteArray *rec = spill->record;
+	guint64 num_descendants = 0;
+	size_t len;
+	guint8 type_byte;
+	int i;
+
+	g_byte_array_set_size( rec, 0 );
+	type_byte = ndesc->type;
+	g_byte_array_append( rec, &type_byte, 1 );
+	len = strlen( ndesc->name );
+	put_varint( rec, len );
+	g_byte_array_append( rec, (const guint8 *)ndesc->name, len );
+	put_varint( rec, ndesc->size );
+	put_svarint( rec, ndesc->size_alloc - ndesc->size );
+	if (ndesc->type == NODE_DIRECTORY) {
+		for (i = 0; i < NUM_NODE_TYPES; i++)
+			num_descendants += ((const DirNodeDesc *)ndesc)->subtree.counts[i];
+		put_varint( rec, num_children );
+		put_varint( rec, num_descendants );
+	}
+	put_svarint( rec, attrs->user_id );
+	put_svarint( rec, attrs->group_id );
+	put_svarint( rec, attrs->mtime );
+	put_svarint( rec, attrs->atime );
+	put_svarint( rec, attrs->ctime );
+
+	/* Length goes last, for reading back to front */
+	put_u32( rec, rec->len );
+	if (fwrite( rec->data, 1, rec->len, spill->fp ) != rec->len)
+		spill->error = TRUE;
+}
+
+
+/* Helper function for snapshot_spill_finish( ). Makes sure that the
+ * window (read in from the spill file, starting at file offset
+ * *window_start) holds the given number of bytes before offset end,
+ * reading in another chunk if not. Returns FALSE on error */
+static boolean
+spill_window( FILE *fp, GByteArray *window, guint64 *window_start, guint64 end, guint64 need )
+{
+	guint64 start;
+
+	if (need > end)
+		return FALSE;
+	if (end - *window_start >= need)
+		return TRUE;
+
+	start = end - MIN(end, MAX(need, SNAPSHOT_SPILL_CHUNK));
+	g_byte_array_set_size( window, end - start );
+	if (fseeko( fp, (off_t)start, SEEK_SET ) || (fread( window->data, 1, window->len, fp ) != window->len))
+		return FALSE;
+	*window_start = start;
+
+	return TRUE;
+}
+
+
+/* Helper function for snapshot_spill_finish( ). Decodes a spill record.
+ * The name goes into name_buf. Returns FALSE if the record is damaged */
+static boolean
+spill_record_decode( struct SnapReader *rd, NodeDesc *ndesc, GString *name_buf, unsigned int *num_children, guint64 *num_descendants, NodeAttrs *attrs )
+{
+	guint64 len;
+
+	ndesc->type = get_byte( rd );
+	if ((ndesc->type == NODE_METANODE) || (ndesc->type >= NUM_NODE_TYPES))
+		return FALSE;
+	len = get_varint( rd );
+	if (len > (guint64)(rd->end - rd->p))
+		return FALSE;
+	g_string_truncate( name_buf, 0 );
+	g_string_append_len( name_buf, (const char *)rd->p, len );
+	rd->p += len;
+	ndesc->name = name_buf->str;
+	ndesc->size = get_varint( rd );
+	ndesc->size_alloc = ndesc->size + get_svarint( rd );
+	*num_children = 0;
+	*num_descendants = 0;
+	if (ndesc->type == NODE_DIRECTORY) {
+		*num_children = get_varint( rd );
+		*num_descendants = get_varint( rd );
+	}
+	attrs->user_id = get_svarint( rd );
+	attrs->group_id = get_svarint( rd );
+	attrs->mtime = get_svarint( rd );
+	attrs->atime = get_svarint( rd );
+	attrs->ctime = get_svarint( rd );
+
+	return rd->ok && (rd->p == rd->end);
+}
+
+
+/* Makes the snapshot out of a spill file, reading it back to front, and
+ * disposes of the spill. name is that of the metanode. All attribute
+ * columns are saved, as a scan gets them for free. Returns 0 on
+ * success, -1 on error */
+int
+snapshot_spill_finish( SnapshotSpill *spill, const char *name )
+{
+	struct SnapWriter sw;
+	struct SnapReader rd;
+	NodeDesc ndesc;
+	NodeAttrs attrs;
+	GByteArray *window;
+	GString *name_buf;
+	guint64 window_start, end, num_descendants;
+	guint32 rec_len;
+	unsigned int num_children;
+	int status = -1;
+
+	if (spill->error || fflush( spill->fp ))
+		g_warning( "Cannot write %s: %s", spill->spill_filename, g_strerror( errno ) );
+	else if (writer_open( &sw, spill->filename, NODE_ATTR_ALL, name )) {
+		end = (guint64)ftello( spill->fp );
+		profile_gauge( "snapshot.spill_bytes", (int64)end );
+
+		memset( &ndesc, 0, sizeof(NodeDesc) );
+		window = g_byte_array_new( );
+		name_buf = g_string_new( NULL );
+		window_start = end;
+		while ((end > 0) && !sw.error) {
+			if (!spill_window( spill->fp, window, &window_start, end, 4 )) {
+				sw.error = TRUE;
+				break;
+			}
+			rec_len = get_u32( window->data + (end - 4 - window_start) );
+			if (!spill_window( spill->fp, window, &window_start, end, (guint64)rec_len + 4 )) {
+				sw.error = TRUE;
+				break;
+			}
+			rd.p = window->data + (end - 4 - rec_len - window_start);
+			rd.end = rd.p + rec_len;
+			rd.ok = TRUE;
+			if (!spill_record_decode( &rd, &ndesc, name_buf, &num_children, &num_descendants, &attrs )) {
+				g_warning( "Spill file %s is damaged", spill->spill_filename );
+				sw.error = TRUE;
+				break;
+			}
+			write_record( &sw, &ndesc, num_children, num_descendants, &attrs );
+			end -= (guint64)rec_len + 4;
+		}
+		g_byte_array_free( window, TRUE );
+		g_string_free( name_buf, TRUE );
+
+		status = writer_close( &sw, spill->filename, name );
+	}
+
+	fclose( spill->fp );
+	remove( spill->spill_filename );
+	g_byte_array_free( spill->record, TRUE );
+	g_free( spill->spill_filename );
+	xfree( spill->filename );
+	xfree( spill );
+
+	return status;
+}
+
+
+/* Returns TRUE if the given file is a snapshot */
+boolean
+snapshot_probe( const char *filename )
+{
+	char magic[SNAPSHOT_MAGIC_LEN];
+	FILE *fp;
+	boolean is_snapshot;
+
+	if (!g_file_test( filename, G_FILE_TEST_IS_REGULAR ))
+		return FALSE;
+	fp = fopen( filename, "rb" );
+	if (fp == NULL)
+		return FALSE;
+	is_snapshot = fread( magic, 1, SNAPSHOT_MAGIC_LEN, fp ) == SNAPSHOT_MAGIC_LEN;
+	is_snapshot = is_snapshot && !memcmp( magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN );
+	fclose( fp );
+
+	return is_snapshot;
+}
+
+
+/* Decodes the records of a block. This runs on several threads at once,
+ * so no xmalloc( ) family here. Returns FALSE if the block is damaged */
+static boolean
+decode_block( struct SnapBlock *block, unsigned int columns )
+{
+	struct SnapReader rd;
+	struct SnapRecord *rec;
+	NodeAttrs prev_attrs;
+	guint8 *raw = NULL;
+	uLongf raw_size;
+	guint64 prefix_len, suffix_len;
+	unsigned int prev_name = 0, prev_len = 0;
+	unsigned int i;
+
+	if (block->codec == SNAPSHOT_CODEC_DEFLATE) {
+		raw = g_malloc( MAX(1, block->raw_size) );
+		raw_size = block->raw_size;
+		if ((uncompress( raw, &raw_size, block->data, block->stored_size ) != Z_OK) || (raw_size != block->raw_size)) {
+			g_free( raw );
+			return FALSE;
+		}
+		rd.p = raw;
+	}
+	else
+		rd.p = block->data;
+	rd.end = rd.p + block->raw_size;
+	rd.ok = TRUE;
+
+	block->records = g_new( struct SnapRecord, block->num_nodes );
+	block->names = g_byte_array_sized_new( block->raw_size );
+	memset( &prev_attrs, 0, sizeof(NodeAttrs) );
+	for (i = 0; (i < block->num_nodes) && rd.ok; i++) {
+		rec = &block->records[i];
+		rec->type = get_byte( &rd );
+		if ((rec->type == NODE_METANODE) || (rec->type >= NUM_NODE_TYPES)) {
+			rd.ok = FALSE;
+			break;
+		}
+
+		/* Name: leading part of the previous one, then the rest */
+		prefix_len = get_varint( &rd );
+		suffix_len = get_varint( &rd );
+		if ((prefix_len > prev_len) || (suffix_len > (guint64)(rd.end - rd.p))) {
+			rd.ok = FALSE;
+			break;
+		}
+		rec->name = block->names->len;
+		g_byte_array_set_size( block->names, rec->name + prefix_len + suffix_len + 1 );
+		memcpy( block->names->data + rec->name, block->names->data + prev_name, prefix_len );
+		memcpy( block->names->data + rec->name + prefix_len, rd.p, suffix_len );
+		block->names->data[rec->name + prefix_len + suffix_len] = '\0';
+		rd.p += suffix_len;
+		prev_name = rec->name;
+		prev_len = prefix_len + suffix_len;
+
+		rec->size = get_varint( &rd );
+		rec->size_alloc = rec->size + get_svarint( &rd );
+		if (rec->type == NODE_DIRECTORY)
+			rec->num_children = get_varint( &rd );
+		else
+			rec->num_children = 0;
+
+		rec->attrs = prev_attrs;
+		if (columns & NODE_ATTR_OWNER) {
+			rec->attrs.user_id = prev_attrs.user_id + get_svarint( &rd );
+			rec->attrs.group_id = prev_attrs.group_id + get_svarint( &rd );
+		}
+		if (columns & NODE_ATTR_TIMES) {
+			rec->attrs.mtime = prev_attrs.mtime + get_svarint( &rd );
+			rec->attrs.atime = rec->attrs.mtime + get_svarint( &rd );
+			rec->attrs.ctime = rec->attrs.mtime + get_svarint( &rd );
+		}
+		prev_attrs = rec->attrs;
+	}
+	g_free( raw );
+
+	return rd.ok && (i == block->num_nodes) && (rd.p == rd.end);
+}
+
+
+/* Decodes blocks until there are none left to take */
+static void
+decode_blocks( struct SnapDecode *decode )
+{
+	unsigned int b;
+
+	for (;;) {
+		b = (unsigned int)g_atomic_int_add( &decode->next_block, 1 );
+		if (b >= decode->num_blocks)
+			break;
+		decode->blocks[b].ok = decode_block( &decode->blocks[b], decode->columns );
+	}
+}
+
+
+/* Decoding task. The loading thread joins in as well, then waits for
+ * all of these to finish */
+static void
+decode_task( void *data, TaskCancel *cancel )
+{
+	struct SnapDecode *decode = (struct SnapDecode *)data;
+
+	decode_blocks( decode );
+
+	g_mutex_lock( &decode->lock );
+	if (--decode->num_tasks == 0)
+		g_cond_signal( &decode->cond );
+	g_mutex_unlock( &decode->lock );
+}
+
+
+/* Returns TRUE if the decoded records make a single tree: a directory,
+ * then as many records as it and everything after it call for */
+static boolean
+check_structure( const struct SnapBlock *blocks, unsigned int num_blocks )
+{
+	const struct SnapRecord *rec;
+	guint64 num_expected = 1;
+	unsigned int b, i;
+
+	if ((num_blocks == 0) || (blocks[0].num_nodes == 0) || (blocks[0].records[0].type != NODE_DIRECTORY))
+		return FALSE;
+
+	for (b = 0; b < num_blocks; b++) {
+		for (i = 0; i < blocks[b].num_nodes; i++) {
+			rec = &blocks[b].records[i];
+			if (num_expected == 0)
+				return FALSE;
+			num_expected = num_expected - 1 + rec->num_children;
+		}
+	}
+
+	return num_expected == 0;
+}
+
+
+/* Links up the decoded records into a new filesystem tree */
+static void
+build_tree( const struct SnapBlock *blocks, unsigned int num_blocks, unsigned int columns, const ScanfsHooks *hooks, void *data )
+{
+	struct SnapParent {
+		GNode		*dnode;
+		unsigned int	num_left;	/* Children yet to come */
+	} *parent;
+	const struct SnapRecord *rec;
+	GArray *parents;
+	NodeDesc ndesc;
+	GNode *node;
+	unsigned int b, i;
+
+	memset( &ndesc, 0, sizeof(NodeDesc) );
+	parents = g_array_new( FALSE, FALSE, sizeof(struct SnapParent) );
+	for (b = 0; b < num_blocks; b++) {
+		for (i = 0; i < blocks[b].num_nodes; i++) {
+			rec = &blocks[b].records[i];
+			ndesc.type = rec->type;
+			ndesc.size = rec->size;
+			ndesc.size_alloc = rec->size_alloc;
+			node = scanfs_node_new( &ndesc, (const char *)blocks[b].names->data + rec->name );
+			if (columns != 0)
+				nodeattr_store( NODE_DESC(node)->id, &rec->attrs );
+
+			/* Find the parent (check_structure( ) made sure
+			 * there is one, except for the root) */
+			while ((parents->len > 0) && (g_array_index(parents, struct SnapParent, parents->len - 1).num_left == 0))
+				g_array_set_size( parents, parents->len - 1 );
+			if (parents->len == 0)
+				g_node_append( globals.fstree, node );
+			else {
+				parent = &g_array_index(parents, struct SnapParent, parents->len - 1);
+				g_node_prepend( parent->dnode, node );
+				--parent->num_left;
+			}
+
+			if (NODE_IS_DIR(node)) {
+				if (hooks->dir_found != NULL)
+					(hooks->dir_found)( node, data );
+				g_array_set_size( parents, parents->len + 1 );
+				parent = &g_array_index(parents, struct SnapParent, parents->len - 1);
+				parent->dnode = node;
+				parent->num_left = rec->num_children;
+			}
+
+			if (hooks->entry_done != NULL)
+				(hooks->entry_done)( data );
+		}
+	}
+	g_array_free( parents, TRUE );
+}
+
+
+/* Loads a snapshot in place of the current filesystem tree. Progress is
+ * reported through the given callbacks (hooks may be NULL), as with
+ * scanfs( ). Blocks are decoded in parallel, and the current tree is
+ * left alone unless the whole snapshot checks out. Returns 0 on success,
+ * -1 on error */
+int
+snapshot_load( const char *filename, const ScanfsHooks *hooks, void *data )
+{
+	static const ScanfsHooks no_hooks = { NULL };
+	struct SnapDecode decode;
+	struct SnapReader rd;
+	struct SnapBlock *block;
+	GMappedFile *mapped;
+	GError *error = NULL;
+	const guint8 *contents;
+	guint64 index_offset, offset, dirs_len;
+	guint32 index_size, name_len;
+	gsize len;
+	unsigned int num_nodes, num_blocks, columns, total_nodes;
+	unsigned int b;
+	int num_tasks, t;
+	char *name;
+	boolean ok;
+
+	if (hooks == NULL)
+		hooks = &no_hooks;
+
+	mapped = g_mapped_file_new( filename, FALSE, &error );
+	if (mapped == NULL) {
+		g_warning( "Cannot read snapshot %s: %s", filename, error->message );
+		g_error_free( error );
+		return -1;
+	}
+	contents = (const guint8 *)g_mapped_file_get_contents( mapped );
+	len = g_mapped_file_get_length( mapped );
+
+	/* Header */
+	if ((len < SNAPSHOT_HEADER_SIZE) || memcmp( contents, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN ) || (get_u32( contents + 8 ) != SNAPSHOT_VERSION)) {
+		g_warning( "%s is not a snapshot this version can read", filename );
+		g_mapped_file_unref( mapped );
+		return -1;
+	}
+	columns = get_u32( contents + 12 ) & NODE_ATTR_ALL;
+	num_nodes = get_u32( contents + 16 );
+	num_blocks = get_u32( contents + 20 );
+	index_offset = get_u64( contents + 24 );
+	index_size = get_u32( contents + 32 );
+	name_len = get_u32( contents + 36 );
+	ok = (name_len <= len - SNAPSHOT_HEADER_SIZE);
+	ok = ok && (index_offset >= SNAPSHOT_HEADER_SIZE + name_len) && (index_offset <= len);
+	ok = ok && (index_size <= len - index_offset);
+	/* Every block holds at least one node, and has an index entry */
+	ok = ok && (num_blocks <= num_nodes);
+	ok = ok && (num_blocks <= index_size / SNAPSHOT_MIN_INDEX_SIZE);
+
+	/* Index */
+	decode.blocks = NULL;
+	if (ok)
+		decode.blocks = g_new0( struct SnapBlock, MAX(1, num_blocks) );
+	rd.p = contents + index_offset;
+	rd.end = rd.p + index_size;
+	rd.ok = ok;
+	offset = SNAPSHOT_HEADER_SIZE + name_len;
+	total_nodes = 0;
+	for (b = 0; (b < num_blocks) && rd.ok; b++) {
+		block = &decode.blocks[b];
+		block->stored_size = get_varint( &rd );
+		block->raw_size = get_varint( &rd );
+		block->num_nodes = get_varint( &rd );
+		block->codec = get_byte( &rd );
+		/* Subtree extents are not needed for a full load */
+		dirs_len = get_varint( &rd );
+		if (dirs_len <= (guint64)(rd.end - rd.p))
+			rd.p += dirs_len;
+		else
+			rd.ok = FALSE;
+
+		rd.ok = rd.ok && (block->codec < NUM_SNAPSHOT_CODECS);
+		rd.ok = rd.ok && (block->num_nodes > 0) && (block->num_nodes <= num_nodes - total_nodes);
+		rd.ok = rd.ok && (block->num_nodes <= SNAPSHOT_BLOCK_NODES);
+		rd.ok = rd.ok && (block->stored_size <= index_offset - offset);
+		if ((block->codec == SNAPSHOT_CODEC_STORED) && (block->raw_size != block->stored_size))
+			rd.ok = FALSE;
+		/* Sizes are checked here, as decode_block( ) allocates by
+		 * them */
+		if (block->raw_size > (guint64)block->stored_size * SNAPSHOT_MAX_DEFLATE_RATIO)
+			rd.ok = FALSE;
+		if (block->num_nodes > block->raw_size / SNAPSHOT_MIN_RECORD_SIZE)
+			rd.ok = FALSE;
+		block->data = contents + offset;
+		offset += block->stored_size;
+		total_nodes += block->num_nodes;
+	}
+	ok = rd.ok && (total_nodes == num_nodes) && (offset == index_offset);
+
+	if (ok) {
+		/* Decode blocks in parallel, on the task pool */
+		decode.num_blocks = num_blocks;
+		decode.columns = columns;
+		decode.next_block = 0;
+		g_mutex_init( &decode.lock );
+		g_cond_init( &decode.cond );
+		num_tasks = MIN((int)num_blocks, task_get_thread_count( ));
+		decode.num_tasks = num_tasks;
+		for (t = 0; t < num_tasks; t++)
+			task_submit( TASK_QUEUE_SCAN, TASK_PRIORITY_HIGH, NULL, decode_task, NULL, &decode );
+		decode_blocks( &decode );
+		g_mutex_lock( &decode.lock );
+		while (decode.num_tasks > 0)
+			g_cond_wait( &decode.cond, &decode.lock );
+		g_mutex_unlock( &decode.lock );
+		g_mutex_clear( &decode.lock );
+		g_cond_clear( &decode.cond );
+
+		for (b = 0; b < num_blocks; b++)
+			ok = ok && decode.blocks[b].ok;
+		ok = ok && check_structure( decode.blocks, num_blocks );
+	}
+
+	if (ok) {
+		name = g_strndup( (const char *)contents + SNAPSHOT_HEADER_SIZE, name_len );
+		scanfs_tree_new( name, hooks, data );
+		g_free( name );
+		nodeattr_set_complete( columns );
+		build_tree( decode.blocks, num_blocks, columns, hooks, data );
+		scanfs_tree_done( );
+		profile_gauge( "snapshot.loaded_blocks", num_blocks );
+	}
+	else
+		g_warning( "Snapshot %s is damaged", filename );
+
+	if (decode.blocks != NULL) {
+		for (b = 0; b < num_blocks; b++) {
+			g_free( decode.blocks[b].records );
+			if (decode.blocks[b].names != NULL)
+				g_byte_array_free( decode.blocks[b].names, TRUE );
+		}
+		g_free( decode.blocks );
+	}
+	g_mapped_file_unref( mapped );
+
+	return ok ? 0 : -1;
+}
+
+
+/* end snapshot.c */
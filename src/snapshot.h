@@ -0,0 +1,29 @@
+/* snapshot.h */
+
+/* Filesystem tree snapshots */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_SNAPSHOT_H
+	#error
+#endif
+#define FSV_SNAPSHOT_H
+
+
+typedef struct _SnapshotSpill SnapshotSpill;
+
+
+SnapshotSpill *snapshot_spill_new( const char *filename );
+void snapshot_spill_node( const NodeDesc *ndesc, const NodeAttrs *attrs, unsigned int num_children, void *data );
+int snapshot_spill_finish( SnapshotSpill *spill, const char *name );
+boolean snapshot_probe( const char *filename );
+#ifdef FSV_SCANFS_H
+int snapshot_load( const char *filename, const ScanfsHooks *hooks, void *data );
+#endif
+
+
+/* end snapshot.h */
@@ -0,0 +1,265 @@
+/* streambuf.c */
+
+/* Streaming vertex data */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "streambuf.h"
+
+#include <string.h> /* memcpy( ) */
+
+#include "profile.h"
+
+
+/* Vertex data which is built anew every frame (cursor, nodes in motion,
+ * highlight overlays, label quads) is written into a single buffer, used
+ * as a ring of STREAMBUF_NUM_SECTIONS sections: one for the frame being
+ * drawn, the others for frames the GPU may still be reading from. A fence
+ * at the end of each frame tells when its section is free again.
+ *
+ * Where persistent mapping is available (GL 4.4, or ARB_buffer_storage)
+ * the buffer stays mapped for its whole life, and an upload is a plain
+ * memcpy( ). Otherwise each upload maps its own range, unsynchronized;
+ * and if there are no fences either, the buffer is orphaned whenever the
+ * ring wraps around.
+ *
+ * A frame that outgrows its section spills over into side buffers, one
+ * per upload, as earlier uploads of the frame may not have been drawn
+ * yet (a vertex upload is typically followed by an index upload, then
+ * the draw). The ring is only regrown at the end of the frame, and the
+ * side buffers are let go of then */
+
+
+/* Number of ring sections */
+#define STREAMBUF_NUM_SECTIONS		3
+
+/* Initial size of a section (bytes). Grown as needed */
+#define STREAMBUF_SECTION_SIZE		(256 * 1024)
+
+/* Alignment of uploads within the buffer (bytes) */
+#define STREAMBUF_ALIGN			16
+
+/* Time to wait on a fence between checks (nanoseconds) */
+#define STREAMBUF_WAIT_TIMEOUT		1000000000
+
+
+static struct {
+	GLuint		buffer;		/* Buffer name (0 if none yet) */
+	GLsizeiptr	section_size;	/* Size of a section (bytes) */
+	int		section;	/* Section of the current frame */
+	GLintptr	offset;		/* Next free byte in buffer */
+	GLsync		fences[STREAMBUF_NUM_SECTIONS];
+	GLuint		*overflow;	/* Side buffers of the current frame */
+	int		num_overflow;
+	int		max_overflow;	/* (Allocated size of the above) */
+	GLsizeiptr	overflow_bytes;	/* Bytes spilled into them */
+	GLubyte		*map;		/* Persistent mapping, or NULL */
+	boolean		persistent;	/* Use persistent mapping */
+	boolean		have_sync;	/* Fences are available */
+	boolean		probed;		/* The above have been set */
+} ring;
+
+
+/* Determines how the GL implementation lets us stream. Setting
+ * FSV_NO_PERSISTENT_MAP in the environment forces the fallback path */
+static void
+ring_probe( void )
+{
+	int version;
+
+	version = epoxy_gl_version( );
+	ring.have_sync = (version >= 32) || epoxy_has_gl_extension( "GL_ARB_sync" );
+	ring.persistent = ring.have_sync && ((version >= 44) || epoxy_has_gl_extension( "GL_ARB_buffer_storage" ));
+	if (g_getenv( "FSV_NO_PERSISTENT_MAP" ) != NULL)
+		ring.persistent = FALSE;
+	ring.probed = TRUE;
+}
+
+
+/* Creates the ring buffer, with sections of the given size. The buffer
+ * is bound to GL_COPY_WRITE_BUFFER while it is set up, so as to leave
+ * the vertex array state alone */
+static void
+ring_create( GLsizeiptr section_size )
+{
+	static const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLsizeiptr size;
+
+	size = STREAMBUF_NUM_SECTIONS * section_size;
+	glGenBuffers( 1, &ring.buffer );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, ring.buffer );
+	if (ring.persistent) {
+		glBufferStorage( GL_COPY_WRITE_BUFFER, size, NULL, flags );
+		ring.map = glMapBufferRange( GL_COPY_WRITE_BUFFER, 0, size, flags );
+		if (ring.map == NULL) {
+			/* Advertised, but not working. Start over
+			 * without it (immutable storage cannot be
+			 * respecified) */
+			g_warning( "Persistent buffer mapping failed, falling back" );
+			ring.persistent = FALSE;
+			glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+			glDeleteBuffers( 1, &ring.buffer );
+			ring_create( section_size );
+			return;
+		}
+	}
+	else
+		glBufferData( GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+
+	ring.section_size = section_size;
+	ring.section = 0;
+	ring.offset = 0;
+	profile_gauge( "streambuf.size_bytes", (int64)size );
+}
+
+
+/* Destroys the ring buffer. Draws already issued from it are unaffected,
+ * as GL holds on to the storage until they are done */
+static void
+ring_destroy( void )
+{
+	int i;
+
+	for (i = 0; i < STREAMBUF_NUM_SECTIONS; i++) {
+		if (ring.fences[i] != NULL) {
+			glDeleteSync( ring.fences[i] );
+			ring.fences[i] = NULL;
+		}
+	}
+	/* Deleting a buffer unmaps it */
+	glDeleteBuffers( 1, &ring.buffer );
+	ring.buffer = 0;
+	ring.map = NULL;
+}
+
+
+/* Helper function for streambuf_upload( ). Puts data that did not fit in
+ * the current section into a side buffer of its own, bound to target */
+static void
+overflow_upload( GLenum target, const void *data, GLsizeiptr size )
+{
+	GLuint buffer;
+
+	if (ring.num_overflow == ring.max_overflow) {
+		ring.max_overflow = MAX(4, 2 * ring.max_overflow);
+		RESIZE(ring.overflow, ring.max_overflow, GLuint);
+	}
+	glGenBuffers( 1, &buffer );
+	ring.overflow[ring.num_overflow++] = buffer;
+	ring.overflow_bytes += size;
+
+	glBindBuffer( target, buffer );
+	glBufferData( target, size, data, GL_STREAM_DRAW );
+	profile_count( "streambuf.overflows", 1 );
+}
+
+
+/* Copies size bytes of data into the current frame's section of the
+ * ring, and leaves the ring bound to target. Returns the offset of the
+ * data within the buffer, for use in glVertexAttribPointer( ) or
+ * glDrawElements( ). The data must be drawn before the end of the frame */
+GLintptr
+streambuf_upload( GLenum target, const void *data, GLsizeiptr size )
+{
+	GLintptr offset, section_start;
+	void *dest;
+
+	if (!ring.probed)
+		ring_probe( );
+	if (ring.buffer == 0)
+		ring_create( STREAMBUF_SECTION_SIZE );
+
+	offset = (ring.offset + STREAMBUF_ALIGN - 1) & ~(GLintptr)(STREAMBUF_ALIGN - 1);
+	section_start = ring.section * ring.section_size;
+	if (offset + size > section_start + ring.section_size) {
+		/* Section is full */
+		overflow_upload( target, data, size );
+		return 0;
+	}
+
+	if (ring.persistent)
+		memcpy( ring.map + offset, data, size );
+	else {
+		glBindBuffer( GL_COPY_WRITE_BUFFER, ring.buffer );
+		dest = glMapBufferRange( GL_COPY_WRITE_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT );
+		if (dest != NULL) {
+			memcpy( dest, data, size );
+			glUnmapBuffer( GL_COPY_WRITE_BUFFER );
+		}
+		else
+			glBufferSubData( GL_COPY_WRITE_BUFFER, offset, size, data );
+		glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+	}
+	ring.offset = offset + size;
+
+	glBindBuffer( target, ring.buffer );
+
+	return offset;
+}
+
+
+/* Called at the end of every frame, and of every other pass that uploads
+ * (e.g. picking). Fences off the finished section, and moves on to the
+ * next one, waiting if the GPU is still reading from it. If the frame
+ * spilled over, the ring is replaced with one that has room for twice
+ * what the frame needed */
+void
+streambuf_frame_end( void )
+{
+	GLsizeiptr frame_bytes, section_size;
+	GLenum status;
+	int next;
+
+	if (ring.buffer == 0)
+		return;
+
+	frame_bytes = ring.offset - ring.section * ring.section_size + ring.overflow_bytes;
+	profile_gauge( "streambuf.frame_bytes", (int64)frame_bytes );
+
+	if (ring.num_overflow > 0) {
+		/* (GL holds on to the storage until draws from it are done) */
+		glDeleteBuffers( ring.num_overflow, ring.overflow );
+		ring.num_overflow = 0;
+		ring.overflow_bytes = 0;
+
+		section_size = ring.section_size;
+		while (section_size < 2 * frame_bytes)
+			section_size *= 2;
+		ring_destroy( );
+		ring_create( section_size );
+		profile_count( "streambuf.grows", 1 );
+		return;
+	}
+
+	next = (ring.section + 1) % STREAMBUF_NUM_SECTIONS;
+	if (ring.have_sync) {
+		ring.fences[ring.section] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+		if (ring.fences[next] != NULL) {
+			status = glClientWaitSync( ring.fences[next], GL_SYNC_FLUSH_COMMANDS_BIT, STREAMBUF_WAIT_TIMEOUT );
+			if (status != GL_ALREADY_SIGNALED)
+				profile_count( "streambuf.stalls", 1 );
+			while (status == GL_TIMEOUT_EXPIRED)
+				status = glClientWaitSync( ring.fences[next], 0, STREAMBUF_WAIT_TIMEOUT );
+			glDeleteSync( ring.fences[next] );
+			ring.fences[next] = NULL;
+		}
+	}
+	else if (next == 0) {
+		/* No fences: have GL hand us fresh storage */
+		glBindBuffer( GL_COPY_WRITE_BUFFER, ring.buffer );
+		glBufferData( GL_COPY_WRITE_BUFFER, STREAMBUF_NUM_SECTIONS * ring.section_size, NULL, GL_STREAM_DRAW );
+		glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+	}
+
+	ring.section = next;
+	ring.offset = next * ring.section_size;
+}
+
+
+/* end streambuf.c */
@@ -0,0 +1,24 @@
+/* streambuf.h */
+
+/* Streaming vertex data */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_STREAMBUF_H
+	#error
+#endif
+#define FSV_STREAMBUF_H
+
+
+#include <epoxy/gl.h>
+
+
+GLintptr streambuf_upload( GLenum target, const void *data, GLsizeiptr size );
+void streambuf_frame_end( void );
+
+
+/* end streambuf.h */
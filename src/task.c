@@ -0,0 +1,492 @@
+/* task.c */
+
+/* Shared background task pool */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "task.h"
+
+
+/* Time allotted to running completion callbacks in one main loop
+ * iteration (in seconds). Anything left over waits for the next one, so
+ * that a burst of finished tasks cannot stall the frame loop */
+#define TASK_COMPLETION_BUDGET	0.004
+
+/* Upper limit on the number of pool threads */
+#define TASK_MAX_THREADS	64
+
+
+/* A unit of work */
+typedef struct _Task Task;
+struct _Task {
+	TaskQueueID	queue;
+	TaskPriority	priority;
+	TaskCancel	*cancel;	/* Cancellation token (may be NULL) */
+	TaskFunc	func;		/* Work function (NULL == main-only) */
+	TaskDoneFunc	done_cb;	/* Completion callback */
+	void		*data;
+	boolean		cancelled;	/* TRUE if work function was skipped */
+};
+
+struct _TaskCancel {
+	gint	ref_count;
+	gint	cancelled;
+};
+
+/* Pool thread. Tasks submitted from within a work function go onto the
+ * submitting thread's own deque: the owner takes from the tail (most
+ * recent first, which keeps recursive work depth-first and cache-warm)
+ * and idle threads steal from the head */
+struct TaskWorker {
+	GThread	*thread;
+	GMutex	lock;
+	GQueue	deque;
+	int	index;
+};
+
+/* Pool state */
+static struct {
+	/* Guards everything but the worker deques */
+	GMutex lock;
+	GCond cond;
+	/* Shared queues, fed from the main thread */
+	GQueue queues[NUM_TASK_QUEUES][NUM_TASK_PRIORITIES];
+	/* Total number of queued tasks (shared queues and deques) */
+	int pending;
+	/* Round-robin position, so no subsystem can starve another */
+	int next_queue;
+	boolean quit;
+
+	struct TaskWorker *workers;
+	int num_workers;
+
+	/* Per-subsystem counts: queued and currently executing */
+	gint depth[NUM_TASK_QUEUES];
+	gint running[NUM_TASK_QUEUES];
+
+	/* Finished tasks awaiting their completion callbacks */
+	GAsyncQueue *done_queue;
+	GSource *done_source;
+} pool;
+
+/* Worker record of the calling thread (NULL on the main thread) */
+static GPrivate current_worker;
+
+static const char *task_queue_names[NUM_TASK_QUEUES] = {
+	"scan",
+	"layout",
+	"color",
+	"geometry",
+	"search",
+	"export"
+};
+
+
+/* Creates a new cancellation token, with one reference */
+TaskCancel *
+task_cancel_new( void )
+{
+	TaskCancel *cancel;
+
+	cancel = g_slice_new(TaskCancel);
+	cancel->ref_count = 1;
+	cancel->cancelled = FALSE;
+
+	return cancel;
+}
+
+
+TaskCancel *
+task_cancel_ref( TaskCancel *cancel )
+{
+	g_atomic_int_inc( &cancel->ref_count );
+
+	return cancel;
+}
+
+
+void
+task_cancel_unref( TaskCancel *cancel )
+{
+	if (g_atomic_int_dec_and_test( &cancel->ref_count ))
+		g_slice_free(TaskCancel, cancel);
+}
+
+
+/* Cancels all tasks holding the given token. Tasks not yet started are
+ * skipped; running ones see it through task_cancelled( ) */
+void
+task_cancel( TaskCancel *cancel )
+{
+	g_atomic_int_set( &cancel->cancelled, TRUE );
+}
+
+
+/* Safe to call from any thread, with or without a token */
+boolean
+task_cancelled( TaskCancel *cancel )
+{
+	if (cancel == NULL)
+		return FALSE;
+
+	return g_atomic_int_get( &cancel->cancelled );
+}
+
+
+/* Hands a finished task over to the main thread */
+static void
+task_finish( Task *task )
+{
+	g_async_queue_push( pool.done_queue, task );
+	g_main_context_wakeup( NULL );
+}
+
+
+/* Takes the next task from the shared queues, highest priority first.
+ * Pool lock must be held */
+static Task *
+shared_queue_pop( void )
+{
+	Task *task;
+	int p, q, i;
+
+	for (p = 0; p < NUM_TASK_PRIORITIES; p++) {
+		for (i = 0; i < NUM_TASK_QUEUES; i++) {
+			q = (pool.next_queue + i) % NUM_TASK_QUEUES;
+			task = g_queue_pop_head( &pool.queues[q][p] );
+			if (task != NULL) {
+				pool.next_queue = (q + 1) % NUM_TASK_QUEUES;
+				return task;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Finds a task for the given worker: its own deque first, then the
+ * shared queues, and finally other workers' deques */
+static Task *
+worker_next_task( struct TaskWorker *worker )
+{
+	struct TaskWorker *victim;
+	Task *task;
+	int i;
+
+	g_mutex_lock( &worker->lock );
+	task = g_queue_pop_tail( &worker->deque );
+	g_mutex_unlock( &worker->lock );
+
+	if (task == NULL) {
+		g_mutex_lock( &pool.lock );
+		task = shared_queue_pop( );
+		g_mutex_unlock( &pool.lock );
+	}
+
+	for (i = 1; (task == NULL) && (i < pool.num_workers); i++) {
+		victim = &pool.workers[(worker->index + i) % pool.num_workers];
+		g_mutex_lock( &victim->lock );
+		task = g_queue_pop_head( &victim->deque );
+		g_mutex_unlock( &victim->lock );
+	}
+
+	if (task != NULL) {
+		g_mutex_lock( &pool.lock );
+		--pool.pending;
+		g_mutex_unlock( &pool.lock );
+	}
+
+	return task;
+}
+
+
+/* Pool thread main loop */
+static gpointer
+worker_thread( gpointer data )
+{
+	struct TaskWorker *worker = (struct TaskWorker *)data;
+	Task *task;
+
+	g_private_set( &current_worker, worker );
+
+	for (;;) {
+		task = worker_next_task( worker );
+		if (task == NULL) {
+			g_mutex_lock( &pool.lock );
+			while ((pool.pending == 0) && !pool.quit)
+				g_cond_wait( &pool.cond, &pool.lock );
+			if (pool.quit) {
+				g_mutex_unlock( &pool.lock );
+				break;
+			}
+			g_mutex_unlock( &pool.lock );
+			continue;
+		}
+
+		g_atomic_int_add( &pool.depth[task->queue], -1 );
+		if (task_cancelled( task->cancel ))
+			task->cancelled = TRUE;
+		else {
+			g_atomic_int_inc( &pool.running[task->queue] );
+			(task->func)( task->data, task->cancel );
+			g_atomic_int_add( &pool.running[task->queue], -1 );
+		}
+
+		task_finish( task );
+	}
+
+	return NULL;
+}
+
+
+/* Submits a task. func runs on a pool thread; done_cb (if not NULL)
+ * then runs on the main thread. The token, if given, is referenced for
+ * the lifetime of the task. May be called from any thread */
+void
+task_submit( TaskQueueID queue, TaskPriority priority, TaskCancel *cancel, TaskFunc func, TaskDoneFunc done_cb, void *data )
+{
+	struct TaskWorker *worker;
+	Task *task;
+
+	g_assert( (queue >= 0) && (queue < NUM_TASK_QUEUES) );
+	g_assert( (priority >= 0) && (priority < NUM_TASK_PRIORITIES) );
+	g_assert( func != NULL );
+	g_assert( pool.done_queue != NULL );
+
+	task = g_slice_new(Task);
+	task->queue = queue;
+	task->priority = priority;
+	task->cancel = (cancel != NULL) ? task_cancel_ref( cancel ) : NULL;
+	task->func = func;
+	task->done_cb = done_cb;
+	task->data = data;
+	task->cancelled = FALSE;
+
+	g_atomic_int_inc( &pool.depth[queue] );
+
+	worker = (struct TaskWorker *)g_private_get( &current_worker );
+	if ((worker != NULL) && (priority != TASK_PRIORITY_HIGH)) {
+		/* Spawned from within a task: keep it local */
+		g_mutex_lock( &worker->lock );
+		g_queue_push_tail( &worker->deque, task );
+		g_mutex_unlock( &worker->lock );
+		g_mutex_lock( &pool.lock );
+	}
+	else {
+		g_mutex_lock( &pool.lock );
+		g_queue_push_tail( &pool.queues[queue][priority], task );
+	}
+	++pool.pending;
+	g_cond_signal( &pool.cond );
+	g_mutex_unlock( &pool.lock );
+}
+
+
+/* Arranges for func( data, FALSE ) to be called on the main thread.
+ * This is the way for work functions to post progress updates */
+void
+task_run_in_main( TaskDoneFunc func, void *data )
+{
+	Task *task;
+
+	task = g_slice_new0(Task);
+	task->done_cb = func;
+	task->data = data;
+
+	task_finish( task );
+}
+
+
+/* GSource callbacks for the completion queue */
+static gboolean
+done_source_prepare( GSource *source, gint *timeout )
+{
+	*timeout = -1;
+
+	return g_async_queue_length( pool.done_queue ) > 0;
+}
+
+
+static gboolean
+done_source_check( GSource *source )
+{
+	return g_async_queue_length( pool.done_queue ) > 0;
+}
+
+
+static gboolean
+done_source_dispatch( GSource *source, GSourceFunc callback, gpointer user_data )
+{
+	Task *task;
+	double t_stop;
+
+	t_stop = xgettime( ) + TASK_COMPLETION_BUDGET;
+	do {
+		task = (Task *)g_async_queue_try_pop( pool.done_queue );
+		if (task == NULL)
+			break;
+		if (task->done_cb != NULL)
+			(task->done_cb)( task->data, task->cancelled );
+		if (task->cancel != NULL)
+			task_cancel_unref( task->cancel );
+		g_slice_free(Task, task);
+	} while (xgettime( ) < t_stop);
+
+	return G_SOURCE_CONTINUE;
+}
+
+
+static GSourceFuncs done_source_funcs = {
+	done_source_prepare,
+	done_source_check,
+	done_source_dispatch,
+	NULL
+};
+
+
+/* Starts the given number of pool threads */
+static void
+workers_start( int num_threads )
+{
+	struct TaskWorker *worker;
+	char name[16];
+	int i;
+
+	pool.quit = FALSE;
+	pool.num_workers = num_threads;
+	pool.workers = g_new0(struct TaskWorker, num_threads);
+	for (i = 0; i < num_threads; i++) {
+		worker = &pool.workers[i];
+		worker->index = i;
+		g_mutex_init( &worker->lock );
+		g_queue_init( &worker->deque );
+	}
+
+	/* Threads are created only once every record is in place, as they
+	 * start stealing from each other right away */
+	for (i = 0; i < num_threads; i++) {
+		snprintf( name, sizeof(name), "fsv-task%d", i );
+		pool.workers[i].thread = g_thread_new( name, worker_thread, &pool.workers[i] );
+	}
+}
+
+
+/* Stops all pool threads. Tasks left on their deques are moved back to
+ * the shared queues, so nothing is lost */
+static void
+workers_stop( void )
+{
+	struct TaskWorker *worker;
+	Task *task;
+	int i;
+
+	g_mutex_lock( &pool.lock );
+	pool.quit = TRUE;
+	g_cond_broadcast( &pool.cond );
+	g_mutex_unlock( &pool.lock );
+
+	for (i = 0; i < pool.num_workers; i++)
+		g_thread_join( pool.workers[i].thread );
+
+	g_mutex_lock( &pool.lock );
+	for (i = 0; i < pool.num_workers; i++) {
+		worker = &pool.workers[i];
+		while ((task = g_queue_pop_head( &worker->deque )) != NULL)
+			g_queue_push_tail( &pool.queues[task->queue][task->priority], task );
+		g_mutex_clear( &worker->lock );
+	}
+	g_mutex_unlock( &pool.lock );
+
+	g_free( pool.workers );
+	pool.workers = NULL;
+	pool.num_workers = 0;
+}
+
+
+/* Sets the number of pool threads. 0 means one per processor. This is
+ * the one place where fsv's degree of parallelism is decided. Must be
+ * called from the main thread */
+void
+task_set_thread_count( int num_threads )
+{
+	g_assert( g_private_get( &current_worker ) == NULL );
+
+	if (num_threads <= 0)
+		num_threads = (int)g_get_num_processors( );
+	num_threads = CLAMP(num_threads, 1, TASK_MAX_THREADS);
+
+	if (num_threads == pool.num_workers)
+		return;
+
+	if (pool.num_workers > 0)
+		workers_stop( );
+	workers_start( num_threads );
+}
+
+
+int
+task_get_thread_count( void )
+{
+	return pool.num_workers;
+}
+
+
+/* Returns the number of tasks waiting in the given queue */
+int
+task_queue_depth( TaskQueueID queue )
+{
+	return g_atomic_int_get( &pool.depth[queue] );
+}
+
+
+/* Returns the number of tasks from the given queue now executing */
+int
+task_queue_running( TaskQueueID queue )
+{
+	return g_atomic_int_get( &pool.running[queue] );
+}
+
+
+/* Returns the number of completion callbacks not yet run */
+int
+task_completion_backlog( void )
+{
+	return g_async_queue_length( pool.done_queue );
+}
+
+
+const char *
+task_queue_name( TaskQueueID queue )
+{
+	return task_queue_names[queue];
+}
+
+
+/* First-time initialization */
+void
+task_init( int num_threads )
+{
+	int q, p;
+
+	g_mutex_init( &pool.lock );
+	g_cond_init( &pool.cond );
+	for (q = 0; q < NUM_TASK_QUEUES; q++)
+		for (p = 0; p < NUM_TASK_PRIORITIES; p++)
+			g_queue_init( &pool.queues[q][p] );
+
+	pool.done_queue = g_async_queue_new( );
+	pool.done_source = g_source_new( &done_source_funcs, sizeof(GSource) );
+	g_source_set_priority( pool.done_source, G_PRIORITY_DEFAULT_IDLE );
+	g_source_attach( pool.done_source, NULL );
+
+	task_set_thread_count( num_threads );
+}
+
+
+/* end task.c */
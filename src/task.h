@@ -0,0 +1,70 @@
+/* task.h */
+
+/* Shared background task pool */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_TASK_H
+	#error
+#endif
+#define FSV_TASK_H
+
+
+/* Per-subsystem task queues. Each one is tracked separately, so that
+ * e.g. a flood of scan work can be told apart from pending layout work */
+typedef enum {
+	TASK_QUEUE_SCAN,
+	TASK_QUEUE_LAYOUT,
+	TASK_QUEUE_COLOR,
+	TASK_QUEUE_GEOMETRY,
+	TASK_QUEUE_SEARCH,
+	TASK_QUEUE_EXPORT,
+	NUM_TASK_QUEUES
+} TaskQueueID;
+
+/* Task priorities (higher-priority work is always taken first) */
+typedef enum {
+	TASK_PRIORITY_HIGH,
+	TASK_PRIORITY_NORMAL,
+	TASK_PRIORITY_LOW,
+	NUM_TASK_PRIORITIES
+} TaskPriority;
+
+/* Cancellation token (opaque, reference-counted). One token may be
+ * shared by any number of tasks */
+typedef struct _TaskCancel TaskCancel;
+
+/* Work function. This runs on a pool thread, so it must not touch GTK+
+ * or any of the main-thread-only modules (window, filelist, dirtree...),
+ * nor use the xmalloc( ) family, as the DEBUG allocator is not
+ * thread-safe. Use g_malloc( ) or g_slice_*( ) instead. Long-running
+ * work should poll task_cancelled( ) and return early */
+typedef void (*TaskFunc)( void *data, TaskCancel *cancel );
+
+/* Completion callback. This is always called on the main thread, once
+ * the work function has returned (or immediately, if the task was
+ * cancelled before it got to run) */
+typedef void (*TaskDoneFunc)( void *data, boolean cancelled );
+
+
+TaskCancel *task_cancel_new( void );
+TaskCancel *task_cancel_ref( TaskCancel *cancel );
+void task_cancel_unref( TaskCancel *cancel );
+void task_cancel( TaskCancel *cancel );
+boolean task_cancelled( TaskCancel *cancel );
+void task_submit( TaskQueueID queue, TaskPriority priority, TaskCancel *cancel, TaskFunc func, TaskDoneFunc done_cb, void *data );
+void task_run_in_main( TaskDoneFunc func, void *data );
+void task_set_thread_count( int num_threads );
+int task_get_thread_count( void );
+int task_queue_depth( TaskQueueID queue );
+int task_queue_running( TaskQueueID queue );
+int task_completion_backlog( void );
+const char *task_queue_name( TaskQueueID queue );
+void task_init( int num_threads );
+
+
+/* end task.h */
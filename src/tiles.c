@@ -0,0 +1,529 @@
+/* tiles.c */
+
+/* MapV tile export */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#include "common.h"
+#include "tiles.h"
+
+#include <errno.h>
+
+#include "geometry.h" /* MAPV_GEOM_PARAMS( ) */
+#include "layout.h"
+#include "profile.h"
+#include "task.h"
+
+
+/* A MapV layout can be exported as a quadtree of tiles, to be looked at
+ * in a web browser (see fsv-tileviewer.html) by someone without fsv.
+ * Zoom level z has 2^z by 2^z tiles over the square enclosing the root
+ * directory, each TILES_TILE_PIXELS across. A tile holds the top faces
+ * of the nodes that come out at least TILES_MIN_AREA square pixels at
+ * its zoom level, clipped to the tile; anything smaller is left to the
+ * directory it is in, which is flagged as having more inside. A tile has
+ * child tiles only where there is more to see, so the number of tiles
+ * follows the detail in the tree rather than its extent:
+ *
+ *   <dir>/index.json		extent, deepest zoom level, metanode name
+ *   <dir>/<z>/<x>/<y>.tile	one tile (y counts from the rear)
+ *
+ * A tile is a header (magic, version, mask of child tiles present, zoom
+ * level, record count and size of the names), then the records, then
+ * the names (NUL-terminated). A record is
+ *
+ *   u16 x0, y0, x1, y1	corners, in 1/65535ths of the tile
+ *   u8 type		node type
+ *   u8 flags		TILE_* flags
+ *   u8 depth		levels below the root directory
+ *   u8 size_log2	bits in the node's size (subtree size, for dirs)
+ *   u32 name		offset of the node's name, if TILE_NAMED
+ *
+ * All fields are little-endian. The tree is only read, so tiles are
+ * built in parallel; and as they are taken depth first, memory use stays
+ * at a tile's worth per thread however large the tree is */
+
+
+/* File identification */
+#define TILES_MAGIC		"FSVT"
+#define TILES_VERSION		1
+
+/* Size of a tile header, and of a record (bytes) */
+#define TILES_HEADER_SIZE	16
+#define TILES_RECORD_SIZE	16
+
+/* Width of a tile on screen (pixels) */
+#define TILES_TILE_PIXELS	256.0
+
+/* Deepest zoom level */
+#define TILES_MAX_ZOOM		16
+
+/* Smallest node shown (square pixels) */
+#define TILES_MIN_AREA		4.0
+
+/* Smallest node given a name (pixels) */
+#define TILES_LABEL_WIDTH	48.0
+#define TILES_LABEL_HEIGHT	12.0
+
+
+/* Record flags */
+enum {
+	/* Sides of the node that are not cut off by the tile edges */
+	TILE_EDGE_LEFT		= 1 << 0,
+	TILE_EDGE_TOP		= 1 << 1,
+	TILE_EDGE_RIGHT		= 1 << 2,
+	TILE_EDGE_BOTTOM	= 1 << 3,
+	/* Directory with contents too small to show at this level */
+	TILE_PARTIAL		= 1 << 4,
+	/* A directory's small files, shown as one node */
+	TILE_SMALL_FILES	= 1 << 5,
+	/* Record has a name */
+	TILE_NAMED		= 1 << 6
+};
+
+
+/* Position of a tile in the quadtree */
+struct TileID {
+	int	z;
+	int	x;
+	int	y;
+};
+
+/* State shared by the exporting tasks */
+struct TileExport {
+	const char	*dirname;
+	/* Enclosing square of the layout: left/rear corner, and side */
+	double		x0, y1;
+	double		side;
+	GMutex		lock;
+	GCond		cond;
+	/* Tiles yet to be built (struct TileID), taken from the end */
+	GArray		*stack;
+	int		busy;		/* Tasks building a tile */
+	int		num_tasks;	/* Tasks not yet finished */
+	int		max_zoom;	/* Deepest zoom level written */
+	boolean		failed;
+};
+
+/* A tile being built */
+struct TileBuild {
+	struct TileExport *ex;
+	struct TileID	id;
+	/* Bounds of the tile (layout coordinates), and pixels per unit */
+	double		x0, y0, x1, y1;
+	double		scale;
+	GByteArray	*records;
+	GByteArray	*names;
+	unsigned int	num_records;
+	unsigned int	child_mask;
+};
+
+
+static void
+put_u16( GByteArray *buf, guint16 value )
+{
+	value = GUINT16_TO_LE(value);
+	g_byte_array_append( buf, (const guint8 *)&value, 2 );
+}
+
+
+static void
+put_u32( GByteArray *buf, guint32 value )
+{
+	value = GUINT32_TO_LE(value);
+	g_byte_array_append( buf, (const guint8 *)&value, 4 );
+}
+
+
+/* Converts a layout coordinate to a tile-relative one */
+static guint16
+tile_coord( double c, double c0, double c1 )
+{
+	return (guint16)(65535.0 * (c - c0) / (c1 - c0) + 0.5);
+}
+
+
+/* Appends a record for a node to a tile. Returns the record's offset */
+static guint
+tile_record( struct TileBuild *tb, GNode *node, int depth, int64 size, boolean named )
+{
+	MapVGeomParams *gparams = MAPV_GEOM_PARAMS(node);
+	guint offset = tb->records->len;
+	unsigned int flags = 0;
+
+	if (gparams->c0.x >= tb->x0)
+		flags |= TILE_EDGE_LEFT;
+	if (gparams->c1.y <= tb->y1)
+		flags |= TILE_EDGE_TOP;
+	if (gparams->c1.x <= tb->x1)
+		flags |= TILE_EDGE_RIGHT;
+	if (gparams->c0.y >= tb->y0)
+		flags |= TILE_EDGE_BOTTOM;
+	if (layout_is_small_files( node ))
+		flags |= TILE_SMALL_FILES;
+	if (named)
+		flags |= TILE_NAMED;
+
+	/* (y runs rear to front in the tile) */
+	put_u16( tb->records, tile_coord( MAX(gparams->c0.x, tb->x0), tb->x0, tb->x1 ) );
+	put_u16( tb->records, tile_coord( MIN(gparams->c1.y, tb->y1), tb->y1, tb->y0 ) );
+	put_u16( tb->records, tile_coord( MIN(gparams->c1.x, tb->x1), tb->x0, tb->x1 ) );
+	put_u16( tb->records, tile_coord( MAX(gparams->c0.y, tb->y0), tb->y1, tb->y0 ) );
+	g_byte_array_append( tb->records, (const guint8[]){ NODE_DESC(node)->type, flags, MIN(depth, 255), g_bit_storage( (gulong)MAX(size, 0) ) }, 4 );
+	if (named) {
+		put_u32( tb->records, tb->names->len );
+		g_byte_array_append( tb->names, (const guint8 *)NODE_DESC(node)->name, strlen( NODE_DESC(node)->name ) + 1 );
+	}
+	else
+		put_u32( tb->records, 0 );
+	++tb->num_records;
+
+	return offset;
+}
+
+
+/* Notes which child tiles a node extends into */
+static void
+tile_mark_children( struct TileBuild *tb, GNode *node )
+{
+	MapVGeomParams *gparams = MAPV_GEOM_PARAMS(node);
+	double xm, ym;
+
+	xm = 0.5 * (tb->x0 + tb->x1);
+	ym = 0.5 * (tb->y0 + tb->y1);
+
+	/* Bits 0-1 are the rear half, left to right; 2-3 the front half */
+	if ((gparams->c1.y > ym) && (gparams->c0.x < xm))
+		tb->child_mask |= 1 << 0;
+	if ((gparams->c1.y > ym) && (gparams->c1.x > xm))
+		tb->child_mask |= 1 << 1;
+	if ((gparams->c0.y < ym) && (gparams->c0.x < xm))
+		tb->child_mask |= 1 << 2;
+	if ((gparams->c0.y < ym) && (gparams->c1.x > xm))
+		tb->child_mask |= 1 << 3;
+}
+
+
+/* Adds a node to a tile, along with whatever inside it is large enough.
+ * Returns FALSE if the node is too small to show (whether it is on the
+ * tile or not) */
+static boolean
+tile_add_node( struct TileBuild *tb, GNode *node, int depth )
+{
+	MapVGeomParams *gparams = MAPV_GEOM_PARAMS(node);
+	GNode *child, *small_files;
+	double width, height;
+	int64 size;
+	guint offset;
+	boolean partial = FALSE, skip_dirs = FALSE;
+
+	width = tb->scale * (gparams->c1.x - gparams->c0.x);
+	height = tb->scale * (gparams->c1.y - gparams->c0.y);
+	if ((width * height) < TILES_MIN_AREA)
+		return FALSE;
+
+	/* Off the tile? */
+	if ((gparams->c1.x <= tb->x0) || (gparams->c0.x >= tb->x1))
+		return TRUE;
+	if ((gparams->c1.y <= tb->y0) || (gparams->c0.y >= tb->y1))
+		return TRUE;
+
+	if (layout_is_small_files( node ))
+		size = layout_small_files_size( node->parent );
+	else {
+		size = NODE_DESC(node)->size;
+		if (NODE_IS_DIR(node))
+			size += DIR_NODE_DESC(node)->subtree.size;
+	}
+	offset = tile_record( tb, node, depth, size, (width >= TILES_LABEL_WIDTH) && (height >= TILES_LABEL_HEIGHT) && !layout_is_small_files( node ) );
+
+	if (!NODE_IS_DIR(node))
+		return TRUE;
+
+	/* Children come directories first, then files, each largest
+	 * first (see scanfs.c), so the first one that is too small means
+	 * the rest of its kind are as well. Anything after the small files
+	 * node is part of it */
+	small_files = DIR_NODE_DESC(node)->small_files;
+	for (child = node->children; (child != NULL) && (child != small_files); child = child->next) {
+		if (NODE_IS_DIR(child) && skip_dirs)
+			continue;
+		if (!tile_add_node( tb, child, depth + 1 )) {
+			partial = TRUE;
+			if (!NODE_IS_DIR(child))
+				break;
+			skip_dirs = TRUE;
+		}
+	}
+	if ((small_files != NULL) && !tile_add_node( tb, small_files, depth + 1 ))
+		partial = TRUE;
+
+	if (partial) {
+		tb->records->data[offset + 9] |= TILE_PARTIAL;
+		if (tb->id.z < TILES_MAX_ZOOM)
+			tile_mark_children( tb, node );
+	}
+
+	return TRUE;
+}
+
+
+/* Builds a tile */
+static void
+tile_build( struct TileBuild *tb, const struct TileID *id )
+{
+	struct TileExport *ex = tb->ex;
+	double size;
+
+	tb->id = *id; /* struct assign */
+	size = ex->side / (double)(1 << id->z);
+	tb->x0 = ex->x0 + size * (double)id->x;
+	tb->x1 = tb->x0 + size;
+	tb->y1 = ex->y1 - size * (double)id->y;
+	tb->y0 = tb->y1 - size;
+	tb->scale = TILES_TILE_PIXELS / size;
+
+	g_byte_array_set_size( tb->records, 0 );
+	g_byte_array_set_size( tb->names, 0 );
+	tb->num_records = 0;
+	tb->child_mask = 0;
+
+	tile_add_node( tb, root_dnode, 0 );
+}
+
+
+/* Writes out a tile. Returns FALSE on error */
+static boolean
+tile_write( struct TileBuild *tb )
+{
+	GByteArray *header;
+	FILE *fp;
+	char *dirname, *filename;
+	boolean ok;
+
+	dirname = g_strdup_printf( "%s/%d/%d", tb->ex->dirname, tb->id.z, tb->id.x );
+	filename = g_strdup_printf( "%s/%d.tile", dirname, tb->id.y );
+
+	header = g_byte_array_sized_new( TILES_HEADER_SIZE );
+	g_byte_array_append( header, (const guint8 *)TILES_MAGIC, 4 );
+	g_byte_array_append( header, (const guint8[]){ TILES_VERSION, tb->child_mask }, 2 );
+	put_u16( header, tb->id.z );
+	put_u32( header, tb->num_records );
+	put_u32( header, tb->names->len );
+	g_assert( header->len == TILES_HEADER_SIZE );
+
+	fp = NULL;
+	if (g_mkdir_with_parents( dirname, 0755 ) == 0)
+		fp = fopen( filename, "wb" );
+	ok = fp != NULL;
+	if (ok) {
+		ok = fwrite( header->data, 1, header->len, fp ) == header->len;
+		ok = ok && (fwrite( tb->records->data, 1, tb->records->len, fp ) == tb->records->len);
+		ok = ok && (fwrite( tb->names->data, 1, tb->names->len, fp ) == tb->names->len);
+		ok = (fclose( fp ) == 0) && ok;
+	}
+	if (!ok)
+		g_warning( "Cannot write tile %s: %s", filename, g_strerror( errno ) );
+
+	g_byte_array_free( header, TRUE );
+	g_free( filename );
+	g_free( dirname );
+
+	return ok;
+}
+
+
+/* Builds and writes tiles until there are none left */
+static void
+build_tiles( struct TileExport *ex )
+{
+	struct TileBuild tb;
+	struct TileID id, child_id;
+	boolean ok;
+	int i;
+
+	tb.ex = ex;
+	tb.records = g_byte_array_new( );
+	tb.names = g_byte_array_new( );
+
+	for (;;) {
+		g_mutex_lock( &ex->lock );
+		/* (A busy task may yet come up with more tiles) */
+		while ((ex->stack->len == 0) && (ex->busy > 0))
+			g_cond_wait( &ex->cond, &ex->lock );
+		if (ex->stack->len == 0) {
+			g_mutex_unlock( &ex->lock );
+			break;
+		}
+		id = g_array_index(ex->stack, struct TileID, ex->stack->len - 1);
+		g_array_set_size( ex->stack, ex->stack->len - 1 );
+		++ex->busy;
+		g_mutex_unlock( &ex->lock );
+
+		tile_build( &tb, &id );
+		ok = tile_write( &tb );
+		profile_count( "tiles.written", 1 );
+		profile_count( "tiles.records", tb.num_records );
+
+		g_mutex_lock( &ex->lock );
+		ex->max_zoom = MAX(ex->max_zoom, id.z);
+		if (!ok) {
+			/* Give up */
+			ex->failed = TRUE;
+			g_array_set_size( ex->stack, 0 );
+		}
+		for (i = 0; (i < 4) && !ex->failed; i++) {
+			if (!(tb.child_mask & (1 << i)))
+				continue;
+			child_id.z = id.z + 1;
+			child_id.x = 2 * id.x + (i & 1);
+			child_id.y = 2 * id.y + (i >> 1);
+			g_array_append_val( ex->stack, child_id );
+		}
+		--ex->busy;
+		g_cond_broadcast( &ex->cond );
+		g_mutex_unlock( &ex->lock );
+	}
+
+	g_byte_array_free( tb.records, TRUE );
+	g_byte_array_free( tb.names, TRUE );
+}
+
+
+/* Export task. The exporting thread joins in as well, then waits for
+ * all of these to finish */
+static void
+export_task( void *data, TaskCancel *cancel )
+{
+	struct TileExport *ex = (struct TileExport *)data;
+
+	build_tiles( ex );
+
+	g_mutex_lock( &ex->lock );
+	if (--ex->num_tasks == 0)
+		g_cond_broadcast( &ex->cond );
+	g_mutex_unlock( &ex->lock );
+}
+
+
+/* Appends a string as a JSON string literal */
+static void
+append_json_string( GString *json, const char *str )
+{
+	const char *c;
+
+	g_string_append_c( json, '"' );
+	for (c = str; *c != '\0'; c++) {
+		if ((*c == '"') || (*c == '\\'))
+			g_string_append_printf( json, "\\%c", *c );
+		else if ((unsigned char)*c < 0x20)
+			g_string_append_printf( json, "\\u%04x", (unsigned char)*c );
+		else
+			g_string_append_c( json, *c );
+	}
+	g_string_append_c( json, '"' );
+}
+
+
+/* Writes out index.json */
+static boolean
+index_write( struct TileExport *ex )
+{
+	MapVGeomParams *gparams = MAPV_GEOM_PARAMS(root_dnode);
+	GString *json;
+	char *filename;
+	boolean ok;
+	int i;
+
+	json = g_string_new( "{\n" );
+	g_string_append_printf( json, "  \"version\": %d,\n", TILES_VERSION );
+	g_string_append_printf( json, "  \"tile_pixels\": %d,\n", (int)TILES_TILE_PIXELS );
+	g_string_append_printf( json, "  \"max_zoom\": %d,\n", ex->max_zoom );
+	/* Extent of the root directory, in units of the whole square */
+	g_string_append_printf( json, "  \"width\": %.6f,\n", (gparams->c1.x - gparams->c0.x) / ex->side );
+	g_string_append_printf( json, "  \"height\": %.6f,\n", (gparams->c1.y - gparams->c0.y) / ex->side );
+	g_string_append( json, "  \"name\": " );
+	append_json_string( json, NODE_DESC(globals.fstree)->name );
+	g_string_append( json, ",\n  \"types\": [" );
+	for (i = 0; i < NUM_NODE_TYPES; i++) {
+		if (i > 0)
+			g_string_append( json, ", " );
+		if (node_type_names[i] == NULL)
+			g_string_append( json, "null" );
+		else
+			append_json_string( json, node_type_names[i] );
+	}
+	g_string_append( json, "]\n}\n" );
+
+	filename = g_strdup_printf( "%s/index.json", ex->dirname );
+	ok = g_file_set_contents( filename, json->str, json->len, NULL );
+	if (!ok)
+		g_warning( "Cannot write %s", filename );
+	g_free( filename );
+	g_string_free( json, TRUE );
+
+	return ok;
+}
+
+
+/* Lays out the current tree in MapV mode, and exports it as tiles into
+ * the given directory (created if need be). Returns 0 on success, -1 on
+ * error */
+int
+tiles_export( const char *dirname )
+{
+	struct TileExport ex;
+	struct TileID root_id = { 0, 0, 0 };
+	MapVGeomParams *gparams;
+	int num_tasks, t;
+
+	g_assert( globals.fstree != NULL );
+
+	if (g_mkdir_with_parents( dirname, 0755 ) < 0) {
+		g_warning( "Cannot create %s: %s", dirname, g_strerror( errno ) );
+		return -1;
+	}
+
+	layout_mapv( );
+
+	memset( &ex, 0, sizeof(struct TileExport) );
+	ex.dirname = dirname;
+	gparams = MAPV_GEOM_PARAMS(root_dnode);
+	ex.x0 = gparams->c0.x;
+	ex.y1 = gparams->c1.y;
+	ex.side = MAX(gparams->c1.x - gparams->c0.x, gparams->c1.y - gparams->c0.y);
+	if (ex.side <= 0.0)
+		ex.side = 1.0; /* empty tree */
+	g_mutex_init( &ex.lock );
+	g_cond_init( &ex.cond );
+	ex.stack = g_array_new( FALSE, FALSE, sizeof(struct TileID) );
+	g_array_append_val( ex.stack, root_id );
+
+	/* Build tiles on the task pool, as many at once as it has
+	 * threads (see --threads) */
+	num_tasks = task_get_thread_count( );
+	ex.num_tasks = num_tasks;
+	for (t = 0; t < num_tasks; t++)
+		task_submit( TASK_QUEUE_EXPORT, TASK_PRIORITY_HIGH, NULL, export_task, NULL, &ex );
+	build_tiles( &ex );
+	g_mutex_lock( &ex.lock );
+	while (ex.num_tasks > 0)
+		g_cond_wait( &ex.cond, &ex.lock );
+	g_mutex_unlock( &ex.lock );
+
+	if (!ex.failed && !index_write( &ex ))
+		ex.failed = TRUE;
+
+	g_array_free( ex.stack, TRUE );
+	g_cond_clear( &ex.cond );
+	g_mutex_clear( &ex.lock );
+
+	return ex.failed ? -1 : 0;
+}
+
+
+/* end tiles.c */
@@ -0,0 +1,20 @@
+/* tiles.h */
+
+/* MapV tile export */
+
+/* fsv - 3D File System Visualizer
+ *
+ * SPDX-License-Identifier:  LGPL-2.1-or-later
+ */
+
+
+#ifdef FSV_TILES_H
+	#error
+#endif
+#define FSV_TILES_H
+
+
+int tiles_export( const char *dirname );
+
+
+/* end tiles.h */
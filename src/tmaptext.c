@@ -13,7 +13,12 @@
 #include "common.h"
 #include "tmaptext.h"
 
+#include "arena.h"
+#include "gpumem.h" /* gpumem_pin( ) */
+#include "mempressure.h" /* mempressure_rebuilt( ) */
 #include "ogl.h"
+#include "profile.h"
+#include "streambuf.h"
 
 #include <gio/gio.h>
 
@@ -26,6 +31,27 @@
 /* Text can be squeezed to at most half its normal width */
 #define TEXT_MAX_SQUEEZE 2.0
 
+/* Longest name which can be expanded on the GPU (longer ones, which would
+ * be unreadable anyway, take the CPU path) */
+#define LABEL_MAX_LEN 255
+
+/* Floats per label record (three RGBA texels) */
+#define LABEL_RECORD_SIZE 12
+
+/* Floats per label transform (four RGBA texels) */
+#define LABEL_TRANSFORM_SIZE 16
+
+/* Label length buckets. Bucket b holds names of 2^b to 2^(b+1) - 1
+ * characters */
+#define LABEL_NUM_BUCKETS 8
+
+/* Label kinds, as understood by the label vertex shader */
+enum {
+	LABEL_STRAIGHT,
+	LABEL_STRAIGHT_ROTATED,
+	LABEL_CURVED
+};
+
 
 /* Normal character aspect ratio */
 static const double char_aspect_ratio = (double)char_width / (double)char_height;
@@ -52,6 +78,63 @@ static struct FsvGlTextState {
 	// global state.
 } glt;
 
+/* Pending labels with names of similar length */
+struct LabelBucket {
+	GLfloat		*records;
+	unsigned int	num_labels;
+	unsigned int	max_labels;	/* Capacity of records */
+	int		max_len;	/* Longest name in the bucket */
+};
+
+/* Node name labels. All names are kept on the GPU in one texture buffer,
+ * with a second one giving the (offset, length) of each name by node ID.
+ * Drawing a label only appends a record (node ID, anchor, maximum
+ * dimensions, kind, color, transform) to a batch; the batch is drawn with
+ * one instanced call per length bucket, with the label vertex shader
+ * laying out the glyph quads. So the CPU cost of a label does not depend
+ * on the length of its name, and the GPU cost of a batch goes with the
+ * labels in it rather than with its longest name. Color and MVP changes
+ * go into the records, so a batch spans the whole frame */
+static struct {
+	boolean		disabled;	/* GPU path unavailable (names too big) */
+	boolean		shed;		/* Buffers to be released (see
+					 * text_names_shed( )) */
+	GLuint		program;
+	GLint		first_label_location;
+
+	/* Names and (offset, length) index, by node ID */
+	GLuint		names_buffer;
+	GLuint		names_texture;
+	GLuint		index_buffer;
+	GLuint		index_texture;
+	size_t		names_size;	/* Bytes (as pinned) */
+	size_t		index_size;	/* ditto */
+	guint8		*lengths;	/* Name lengths (0 = CPU path) */
+	unsigned int	num_ids;	/* IDs covered by the above */
+
+	/* Pending label records */
+	GLuint		labels_buffer;
+	GLuint		labels_texture;
+	size_t		labels_size;	/* Bytes (as pinned) */
+	struct LabelBucket buckets[LABEL_NUM_BUCKETS];
+	unsigned int	num_labels;	/* In all buckets */
+	unsigned int	batch_limit;	/* Most labels the buffer may hold */
+
+	/* MVP matrices used by pending labels */
+	GLuint		transforms_buffer;
+	GLuint		transforms_texture;
+	size_t		transforms_size; /* Bytes (as pinned) */
+	GLfloat		*transforms;
+	unsigned int	num_transforms;
+	unsigned int	max_transforms;	/* Capacity of transforms */
+	unsigned int	transform_limit; /* Most the buffer may hold */
+
+	float		color[3];	/* Current text color */
+	GLfloat		mvp[LABEL_TRANSFORM_SIZE]; /* Current MVP */
+	int		cur_transform;	/* Index of mvp in transforms, or
+					 * -1 if not there yet */
+} label;
+
 typedef struct {
 	GLfloat position[3];
 	GLfloat texCoord[2];
@@ -88,15 +171,15 @@ xbm_pixels( const byte *xbm_bits, int pixel_count )
 }
 
 
-// Initialize OpenGL text shaders
+// Initialize OpenGL text shaders, with the given vertex shader resource
 static GLuint
-text_init_shaders()
+text_init_shaders(const char *vertex_path)
 {
 	GBytes *source;
 	GLuint program = 0, vertex = 0, fragment = 0;
 
 	/* load the vertex shader */
-	source = g_resources_lookup_data("/jabl/fsv/fsv-text-vertex.glsl", 0, NULL);
+	source = g_resources_lookup_data(vertex_path, 0, NULL);
 	vertex = ogl_create_shader(GL_VERTEX_SHADER, g_bytes_get_data(source, NULL));
 	g_bytes_unref(source);
 	if (vertex == 0)
@@ -135,15 +218,6 @@ text_init_shaders()
 		goto out;
 	}
 
-	/* get the location of the "mvp" uniform */
-	glt.mvp_location = glGetUniformLocation(program, "mvp");
-	glt.color_location = glGetUniformLocation(program, "color");
-	glt.texture_location = glGetUniformLocation(program, "tex");
-
-	/* get the location of the "position" and "color" attributes */
-	glt.position_location = glGetAttribLocation(program, "position");
-	glt.texcoord_location = glGetAttribLocation(program, "texcoord");
-
 	/* the individual shaders can be detached and destroyed */
 	glDetachShader(program, vertex);
 	glDetachShader(program, fragment);
@@ -188,10 +262,373 @@ text_init( void )
 		     0, GL_RED, GL_UNSIGNED_BYTE, charset_pixels);
 	glGenerateMipmap(GL_TEXTURE_2D);
 	xfree( charset_pixels );
+	/* Font texture is always resident (mipmaps add about a third) */
+	gpumem_pin( 4 * charset_width * charset_height / 3 );
 
-	glt.program = text_init_shaders();
+	glt.program = text_init_shaders("/jabl/fsv/fsv-text-vertex.glsl");
 	if (!glt.program)
 		g_error("Compiling shaders failed");
+
+	/* get the location of the "mvp" uniform */
+	glt.mvp_location = glGetUniformLocation(glt.program, "mvp");
+	glt.color_location = glGetUniformLocation(glt.program, "color");
+	glt.texture_location = glGetUniformLocation(glt.program, "tex");
+
+	/* get the location of the "position" and "color" attributes */
+	glt.position_location = glGetAttribLocation(glt.program, "position");
+	glt.texcoord_location = glGetAttribLocation(glt.program, "texcoord");
+
+	/* Label shaders. The name, label and transform buffers live on
+	 * texture units 2-5 (0 is the font, 1 the selection mask) */
+	label.program = text_init_shaders("/jabl/fsv/fsv-label-vertex.glsl");
+	if (!label.program)
+		g_error("Compiling shaders failed");
+	label.first_label_location = glGetUniformLocation(label.program, "first_label");
+	glUseProgram(label.program);
+	glUniform1i(glGetUniformLocation(label.program, "tex"), 0);
+	glUniform1i(glGetUniformLocation(label.program, "labels"), 2);
+	glUniform1i(glGetUniformLocation(label.program, "name_index"), 3);
+	glUniform1i(glGetUniformLocation(label.program, "names"), 4);
+	glUniform1i(glGetUniformLocation(label.program, "transforms"), 5);
+	glUniform2f(glGetUniformLocation(label.program, "glyph_size"),
+		    (float)char_width / (float)charset_width,
+		    (float)char_height / (float)charset_height);
+	glUseProgram(0);
+
+	glGenBuffers(1, &label.names_buffer);
+	glGenTextures(1, &label.names_texture);
+	glGenBuffers(1, &label.index_buffer);
+	glGenTextures(1, &label.index_texture);
+	glGenBuffers(1, &label.labels_buffer);
+	glGenTextures(1, &label.labels_texture);
+	glGenBuffers(1, &label.transforms_buffer);
+	glGenTextures(1, &label.transforms_texture);
+	label.cur_transform = -1;
+}
+
+
+/* Helper function for label_names_rebuild( ). Finds the extent of the
+ * node IDs and the total size of the names under node */
+static void
+label_names_measure_recursive( GNode *node, unsigned int *num_ids, size_t *size )
+{
+	GNode *child;
+	size_t len;
+
+	*num_ids = MAX(*num_ids, NODE_DESC(node)->id + 1);
+	len = strlen( NODE_DESC(node)->name );
+	if (len <= LABEL_MAX_LEN)
+		*size += len;
+
+	for (child = node->children; child != NULL; child = child->next)
+		label_names_measure_recursive( child, num_ids, size );
+}
+
+
+/* Helper function for label_names_rebuild( ). Copies names into place */
+static void
+label_names_fill_recursive( GNode *node, guint8 *names, guint32 *index, size_t *offset )
+{
+	GNode *child;
+	unsigned int id;
+	size_t len;
+
+	id = NODE_DESC(node)->id;
+	len = strlen( NODE_DESC(node)->name );
+	if (len <= LABEL_MAX_LEN) {
+		memcpy( &names[*offset], NODE_DESC(node)->name, len );
+		index[2 * id] = *offset;
+		index[2 * id + 1] = len;
+		label.lengths[id] = len;
+		*offset += len;
+	}
+
+	for (child = node->children; child != NULL; child = child->next)
+		label_names_fill_recursive( child, names, index, offset );
+}
+
+
+/* Uploads the names of all nodes in the filesystem tree. Names only
+ * change when nodes are created, so this is done once per scan (and
+ * again when a rescan brings in new node IDs) */
+static void
+label_names_rebuild( void )
+{
+	guint8 *names;
+	guint32 *index;
+	size_t names_size = 0, index_size, offset = 0;
+	unsigned int num_ids = 0;
+	GLint max_texels;
+
+	label_names_measure_recursive( globals.fstree, &num_ids, &names_size );
+	names_size = MAX(names_size, 1);
+	index_size = 2 * sizeof(guint32) * num_ids;
+
+	glGetIntegerv( GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels );
+	if ((names_size > (size_t)max_texels) || (num_ids > (unsigned int)max_texels)) {
+		/* Labels will be drawn the slow way */
+		label.disabled = TRUE;
+		return;
+	}
+
+	names = NEW_ARRAY(guint8, names_size);
+	index = NEW_ARRAY(guint32, 2 * num_ids);
+	memset( index, 0, index_size );
+	RESIZE(label.lengths, num_ids, guint8);
+	memset( label.lengths, 0, num_ids );
+	label_names_fill_recursive( globals.fstree, names, index, &offset );
+
+	glBindBuffer( GL_TEXTURE_BUFFER, label.names_buffer );
+	glBufferData( GL_TEXTURE_BUFFER, names_size, names, GL_STATIC_DRAW );
+	glBindBuffer( GL_TEXTURE_BUFFER, label.index_buffer );
+	glBufferData( GL_TEXTURE_BUFFER, index_size, index, GL_STATIC_DRAW );
+	glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+	gpumem_pin( (int64)(names_size + index_size) - (int64)(label.names_size + label.index_size) );
+	label.names_size = names_size;
+	label.index_size = index_size;
+
+	glBindTexture( GL_TEXTURE_BUFFER, label.names_texture );
+	glTexBuffer( GL_TEXTURE_BUFFER, GL_R8UI, label.names_buffer );
+	glBindTexture( GL_TEXTURE_BUFFER, label.index_texture );
+	glTexBuffer( GL_TEXTURE_BUFFER, GL_RG32UI, label.index_buffer );
+	glBindTexture( GL_TEXTURE_BUFFER, 0 );
+
+	xfree( names );
+	xfree( index );
+	label.num_ids = num_ids;
+	label.batch_limit = (unsigned int)max_texels / 3;
+	label.transform_limit = (unsigned int)max_texels / 4;
+
+	profile_count( "text.name_uploads", 1 );
+	profile_gauge( "text.name_bytes", (int64)names_size );
+	mempressure_rebuilt( MEMPRESSURE_LABELS );
+}
+
+
+/* Forgets the uploaded names. Called when a new filesystem tree comes in
+ * (node IDs are reassigned by every scan) */
+void
+text_names_invalidate( void )
+{
+	label.num_ids = 0;
+	label.disabled = FALSE;
+}
+
+
+/* Gives up the uploaded names and label records, to be rebuilt when next
+ * needed. Buffers are released in text_pre( ), as there may be no current
+ * GL context here. Returns FALSE if there was nothing to give up */
+boolean
+text_names_shed( void )
+{
+	struct LabelBucket *bucket;
+	int b;
+
+	g_assert( label.num_labels == 0 );
+
+	if (label.disabled || (label.num_ids == 0))
+		return FALSE;
+
+	if (label.lengths != NULL) {
+		xfree( label.lengths );
+		label.lengths = NULL;
+	}
+	for (b = 0; b < LABEL_NUM_BUCKETS; b++) {
+		bucket = &label.buckets[b];
+		if (bucket->records != NULL) {
+			xfree( bucket->records );
+			bucket->records = NULL;
+		}
+		bucket->max_labels = 0;
+	}
+	if (label.transforms != NULL) {
+		xfree( label.transforms );
+		label.transforms = NULL;
+	}
+	label.max_transforms = 0;
+	label.num_ids = 0;
+	label.shed = TRUE;
+
+	return TRUE;
+}
+
+
+/* Helper function for text_pre( ) */
+static void
+label_buffers_release( void )
+{
+	glBindBuffer( GL_TEXTURE_BUFFER, label.names_buffer );
+	glBufferData( GL_TEXTURE_BUFFER, 0, NULL, GL_STATIC_DRAW );
+	glBindBuffer( GL_TEXTURE_BUFFER, label.index_buffer );
+	glBufferData( GL_TEXTURE_BUFFER, 0, NULL, GL_STATIC_DRAW );
+	glBindBuffer( GL_TEXTURE_BUFFER, label.labels_buffer );
+	glBufferData( GL_TEXTURE_BUFFER, 0, NULL, GL_STREAM_DRAW );
+	glBindBuffer( GL_TEXTURE_BUFFER, label.transforms_buffer );
+	glBufferData( GL_TEXTURE_BUFFER, 0, NULL, GL_STREAM_DRAW );
+	glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+
+	gpumem_pin( - (int64)(label.names_size + label.index_size + label.labels_size + label.transforms_size) );
+	label.names_size = 0;
+	label.index_size = 0;
+	label.labels_size = 0;
+	label.transforms_size = 0;
+	label.shed = FALSE;
+}
+
+
+/* Makes sure a texture buffer can hold size bytes. It grows to twice
+ * what is asked (up to limit bytes), and is reused from then on */
+static void
+label_buffer_reserve( GLuint buffer, GLuint texture, GLenum format, size_t *cur_size, size_t size, size_t limit )
+{
+	if (size <= *cur_size)
+		return;
+
+	size = MIN(2 * size, limit);
+	glBufferData( GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW );
+	gpumem_pin( (int64)size - (int64)*cur_size );
+	*cur_size = size;
+	glBindTexture( GL_TEXTURE_BUFFER, texture );
+	glTexBuffer( GL_TEXTURE_BUFFER, format, buffer );
+	glBindTexture( GL_TEXTURE_BUFFER, 0 );
+}
+
+
+/* Draws all pending labels */
+static void
+text_label_flush( void )
+{
+	struct LabelBucket *bucket;
+	size_t rec_bytes = LABEL_RECORD_SIZE * sizeof(GLfloat);
+	size_t xf_bytes = LABEL_TRANSFORM_SIZE * sizeof(GLfloat);
+	unsigned int first_label = 0;
+	int b;
+
+	if (label.num_labels == 0)
+		return;
+
+	/* Buckets go into the label buffer one after another */
+	glBindBuffer( GL_TEXTURE_BUFFER, label.labels_buffer );
+	label_buffer_reserve( label.labels_buffer, label.labels_texture, GL_RGBA32F, &label.labels_size, rec_bytes * label.num_labels, rec_bytes * label.batch_limit );
+	for (b = 0; b < LABEL_NUM_BUCKETS; b++) {
+		bucket = &label.buckets[b];
+		if (bucket->num_labels == 0)
+			continue;
+		glBufferSubData( GL_TEXTURE_BUFFER, rec_bytes * first_label, rec_bytes * bucket->num_labels, bucket->records );
+		first_label += bucket->num_labels;
+	}
+	glBindBuffer( GL_TEXTURE_BUFFER, label.transforms_buffer );
+	label_buffer_reserve( label.transforms_buffer, label.transforms_texture, GL_RGBA32F, &label.transforms_size, xf_bytes * label.num_transforms, xf_bytes * label.transform_limit );
+	glBufferSubData( GL_TEXTURE_BUFFER, 0, xf_bytes * label.num_transforms, label.transforms );
+	glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+
+	glUseProgram( label.program );
+	glActiveTexture( GL_TEXTURE2 );
+	glBindTexture( GL_TEXTURE_BUFFER, label.labels_texture );
+	glActiveTexture( GL_TEXTURE3 );
+	glBindTexture( GL_TEXTURE_BUFFER, label.index_texture );
+	glActiveTexture( GL_TEXTURE4 );
+	glBindTexture( GL_TEXTURE_BUFFER, label.names_texture );
+	glActiveTexture( GL_TEXTURE5 );
+	glBindTexture( GL_TEXTURE_BUFFER, label.transforms_texture );
+	glActiveTexture( GL_TEXTURE0 );
+
+	/* One instance per label, one quad per character (characters
+	 * past the end of a shorter name are degenerate, but within a
+	 * bucket, names are at least half as long as the longest) */
+	first_label = 0;
+	for (b = 0; b < LABEL_NUM_BUCKETS; b++) {
+		bucket = &label.buckets[b];
+		if (bucket->num_labels == 0)
+			continue;
+		glUniform1i( label.first_label_location, first_label );
+		glDrawArraysInstanced( GL_TRIANGLES, 0, 6 * bucket->max_len, bucket->num_labels );
+		first_label += bucket->num_labels;
+		bucket->num_labels = 0;
+		bucket->max_len = 0;
+		profile_count( "text.label_draws", 1 );
+	}
+	glUseProgram( 0 );
+
+	profile_count( "text.label_batches", 1 );
+	profile_count( "text.labels", label.num_labels );
+
+	label.num_labels = 0;
+	label.num_transforms = 0;
+	label.cur_transform = -1;
+}
+
+
+/* Queues a label record for the given node. Returns FALSE if the label
+ * has to be drawn on the CPU instead */
+static boolean
+text_label_add( GNode *node, int kind, double p0, double p1, double p2, double d0, double d1 )
+{
+	struct LabelBucket *bucket;
+	unsigned int id = NODE_DESC(node)->id;
+	GLfloat *rec;
+	int len;
+
+	if (label.disabled)
+		return FALSE;
+	if (id >= label.num_ids) {
+		/* (Rebuilding, like growing the record arrays below, may
+		 * allocate even in a steady frame) */
+		debug_alloc_exempt_begin( );
+		label_names_rebuild( );
+		debug_alloc_exempt_end( );
+		if (label.disabled || (id >= label.num_ids))
+			return FALSE;
+	}
+	len = label.lengths[id];
+	if (len == 0)
+		return FALSE;
+
+	if (label.num_labels == label.batch_limit)
+		text_label_flush( );
+	if ((label.cur_transform < 0) && (label.num_transforms == label.transform_limit))
+		text_label_flush( );
+
+	/* Current MVP goes in with the first label to use it */
+	if (label.cur_transform < 0) {
+		if (label.num_transforms == label.max_transforms) {
+			label.max_transforms = MIN(MAX(2 * label.max_transforms, 16), label.transform_limit);
+			debug_alloc_exempt_begin( );
+			RESIZE(label.transforms, LABEL_TRANSFORM_SIZE * label.max_transforms, GLfloat);
+			debug_alloc_exempt_end( );
+		}
+		memcpy( &label.transforms[LABEL_TRANSFORM_SIZE * label.num_transforms], label.mvp, sizeof(label.mvp) );
+		label.cur_transform = label.num_transforms++;
+	}
+
+	bucket = &label.buckets[g_bit_storage( len ) - 1];
+	if (bucket->num_labels == bucket->max_labels) {
+		bucket->max_labels = MIN(MAX(2 * bucket->max_labels, 64), label.batch_limit);
+		debug_alloc_exempt_begin( );
+		RESIZE(bucket->records, LABEL_RECORD_SIZE * bucket->max_labels, GLfloat);
+		debug_alloc_exempt_end( );
+	}
+
+	rec = &bucket->records[LABEL_RECORD_SIZE * bucket->num_labels];
+	rec[0] = p0;
+	rec[1] = p1;
+	rec[2] = p2;
+	rec[3] = (GLfloat)kind;
+	rec[4] = d0;
+	rec[5] = d1;
+	/* Node ID split in two, so that it survives being a float */
+	rec[6] = (GLfloat)(id & 0xFFFF);
+	rec[7] = (GLfloat)(id >> 16);
+	rec[8] = label.color[0];
+	rec[9] = label.color[1];
+	rec[10] = label.color[2];
+	rec[11] = (GLfloat)label.cur_transform;
+
+	++bucket->num_labels;
+	bucket->max_len = MAX(bucket->max_len, len);
+	++label.num_labels;
+
+	return TRUE;
 }
 
 
@@ -199,6 +636,8 @@ text_init( void )
 void
 text_pre( void )
 {
+	if (label.shed && (label.num_ids == 0))
+		label_buffers_release( );
 	glDisable( GL_POLYGON_OFFSET_FILL );
 	glEnable( GL_BLEND );
 	glBindTexture( GL_TEXTURE_2D, text_tobj );
@@ -209,6 +648,7 @@ text_pre( void )
 void
 text_post( void )
 {
+	text_label_flush( );
 	glDisable( GL_BLEND );
 	glEnable( GL_POLYGON_OFFSET_FILL );
 	glBindTexture(GL_TEXTURE_2D, 0);
@@ -289,21 +729,17 @@ draw_text_vertices(TextVertex *tv, size_t nchars)
 {
 	GLsizeiptr ntv = nchars * 4;
 	GLsizei idx_len = nchars * 6;
-	static GLuint vbo;
-	if (!vbo)
-		glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(TextVertex) * ntv, tv, GL_STREAM_DRAW);
+	GLintptr offset = streambuf_upload(GL_ARRAY_BUFFER, tv, sizeof(TextVertex) * ntv);
 
 	glEnableVertexAttribArray(glt.position_location);
 	glVertexAttribPointer(glt.position_location, 3, GL_FLOAT, GL_FALSE,
-			      sizeof(TextVertex), (void *)offsetof(TextVertex, position));
+			      sizeof(TextVertex), (void *)(offset + offsetof(TextVertex, position)));
 
 	glEnableVertexAttribArray(glt.texcoord_location);
 	glVertexAttribPointer(glt.texcoord_location, 2, GL_FLOAT, GL_FALSE,
-			      sizeof(TextVertex), (void *)offsetof(TextVertex, texCoord));
+			      sizeof(TextVertex), (void *)(offset + offsetof(TextVertex, texCoord)));
 
-	GLushort *idx = NEW_ARRAY(GLushort, idx_len);
+	GLushort *idx = ARENA_NEW_ARRAY(GLushort, idx_len);
 	for (size_t i = 0; i < nchars; i++) {
 		size_t j = 6 * i;  // 6 indices per char
 		GLushort v = 4 * i;  // 4 Vertices per char
@@ -317,21 +753,16 @@ draw_text_vertices(TextVertex *tv, size_t nchars)
 		idx[j + 5] = v + 3;
 	}
 
-	static GLuint ebo;
-	if (!ebo)
-		glGenBuffers(1, &ebo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * idx_len, idx, GL_STREAM_DRAW);
+	GLintptr idx_offset = streambuf_upload(GL_ELEMENT_ARRAY_BUFFER, idx, sizeof(GLushort) * idx_len);
 
 	glUseProgram(glt.program);
 
 	// Set the texture unit. TODO. Move to text_init()?
 	glUniform1i(glt.texture_location, 0);
-	glDrawElements(GL_TRIANGLES, idx_len, GL_UNSIGNED_SHORT, 0);
+	glDrawElements(GL_TRIANGLES, idx_len, GL_UNSIGNED_SHORT, (void *)idx_offset);
 	glUseProgram(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	xfree(idx);
 }
 
 /* Draws a straight line of text centered at the given position,
@@ -353,7 +784,7 @@ text_draw_straight( const char *text, const XYZvec *text_pos, const XYvec *text_
 	c1.y = c0.y + cdims.y;
 
 	GLsizeiptr nverts = len * 4;
-	TextVertex *tv = NEW_ARRAY(TextVertex, nverts);
+	TextVertex *tv = ARENA_NEW_ARRAY(TextVertex, nverts);
 	for (size_t i = 0; i < len; i++) {
 		get_char_tex_coords( text[i], &t_c0, &t_c1 );
 		size_t j = i * 4;
@@ -371,7 +802,6 @@ text_draw_straight( const char *text, const XYZvec *text_pos, const XYvec *text_
 		c1.x += cdims.x;
 	}
 	draw_text_vertices(tv, len);
-	xfree(tv);
 }
 
 
@@ -407,7 +837,7 @@ text_draw_straight_rotated( const char *text, const RTZvec *text_pos, const XYve
 	c1.y = c0.y + hdelta.y + vdelta.y;
 
 	GLsizeiptr nverts = len * 4;
-	TextVertex *tv = NEW_ARRAY(TextVertex, nverts);
+	TextVertex *tv = ARENA_NEW_ARRAY(TextVertex, nverts);
 	for (size_t i = 0; i < len; i++) {
 		get_char_tex_coords( text[i], &t_c0, &t_c1 );
 		size_t j = i * 4;
@@ -428,7 +858,6 @@ text_draw_straight_rotated( const char *text, const RTZvec *text_pos, const XYve
 		c1.y += hdelta.y;
 	}
 	draw_text_vertices(tv, len);
-	xfree(tv);
 }
 
 
@@ -461,7 +890,7 @@ text_draw_curved( const char *text, const RTZvec *text_pos, const RTvec *text_ma
 	theta = text_pos->theta + 0.5 * (double)(len - 1) * char_arc_width;
 
 	GLsizeiptr nverts = len * 4;
-	TextVertex *tv = NEW_ARRAY(TextVertex, nverts);
+	TextVertex *tv = ARENA_NEW_ARRAY(TextVertex, nverts);
 	for (size_t i = 0; i < len; i++) {
 		sin_theta = sin( RAD(theta) );
 		cos_theta = cos( RAD(theta) );
@@ -493,13 +922,47 @@ text_draw_curved( const char *text, const RTZvec *text_pos, const RTvec *text_ma
 		theta -= char_arc_width;
 	}
 	draw_text_vertices(tv, len);
-	xfree(tv);
 }
 
+/* Labels the given node with its name, as text_draw_straight( ) would */
+void
+text_label_straight( GNode *node, const XYZvec *text_pos, const XYvec *text_max_dims )
+{
+	if (!text_label_add( node, LABEL_STRAIGHT, text_pos->x, text_pos->y, text_pos->z, text_max_dims->x, text_max_dims->y ))
+		text_draw_straight( NODE_DESC(node)->name, text_pos, text_max_dims );
+}
+
+
+/* Labels the given node with its name, as text_draw_straight_rotated( )
+ * would */
+void
+text_label_straight_rotated( GNode *node, const RTZvec *text_pos, const XYvec *text_max_dims )
+{
+	if (!text_label_add( node, LABEL_STRAIGHT_ROTATED, text_pos->r, text_pos->theta, text_pos->z, text_max_dims->x, text_max_dims->y ))
+		text_draw_straight_rotated( NODE_DESC(node)->name, text_pos, text_max_dims );
+}
+
+
+/* Labels the given node with its name, as text_draw_curved( ) would */
+void
+text_label_curved( GNode *node, const RTZvec *text_pos, const RTvec *text_max_dims )
+{
+	if (!text_label_add( node, LABEL_CURVED, text_pos->r, text_pos->theta, text_pos->z, text_max_dims->r, text_max_dims->theta ))
+		text_draw_curved( NODE_DESC(node)->name, text_pos, text_max_dims );
+}
+
+
 // Set the text color
 void
 text_set_color(float red, float green, float blue)
 {
+	if ((red == label.color[0]) && (green == label.color[1]) && (blue == label.color[2]))
+		return;
+	/* (Pending labels have their color in their records) */
+	label.color[0] = red;
+	label.color[1] = green;
+	label.color[2] = blue;
+
 	glUseProgram(glt.program);
 	glUniform3f(glt.color_location, red, green, blue);
 	glUseProgram(0);
@@ -510,6 +973,10 @@ text_set_color(float red, float green, float blue)
 void
 text_upload_mvp(float* mvp)
 {
+	/* Labels pick this up as they are added */
+	memcpy( label.mvp, mvp, sizeof(label.mvp) );
+	label.cur_transform = -1;
+
 	glUseProgram(glt.program);
 	glUniformMatrix4fv(glt.mvp_location, 1, GL_FALSE, mvp);
 	glUseProgram(0);
@@ -22,6 +22,11 @@ void text_post( void );
 void text_draw_straight( const char *text, const XYZvec *text_pos, const XYvec *text_max_dims );
 void text_draw_straight_rotated( const char *text, const RTZvec *text_pos, const XYvec *text_max_dims );
 void text_draw_curved( const char *text, const RTZvec *text_pos, const RTvec *text_max_dims );
+void text_label_straight( GNode *node, const XYZvec *text_pos, const XYvec *text_max_dims );
+void text_label_straight_rotated( GNode *node, const RTZvec *text_pos, const XYvec *text_max_dims );
+void text_label_curved( GNode *node, const RTZvec *text_pos, const RTvec *text_max_dims );
+void text_names_invalidate( void );
+boolean text_names_shed( void );
 void text_set_color(float red, float green, float blue);
 void text_upload_mvp(float* mvp);
 
@@ -22,7 +22,11 @@
 #include "filelist.h" /* filelist_show_entry( ) */
 #include "geometry.h"
 #include "gui.h"
+#include "layout.h" /* layout_is_small_files( ) */
+#include "minimap.h"
 #include "ogl.h"
+#include "selection.h"
+#include "tmaptext.h" /* text_names_invalidate( ) */
 #include "window.h"
 
 
@@ -47,6 +51,42 @@ viewport_pass_node_table(GNode **new_node_table, size_t ntsize)
 
 	node_table = new_node_table;
 	node_table_size = ntsize;
+
+	/* Node IDs now refer to different names */
+	text_names_invalidate( );
+}
+
+
+/* Enters a node created after the scan (see rescan.c) into the node
+ * table, growing the table as needed */
+void
+viewport_node_table_add( GNode *node )
+{
+	unsigned int id = NODE_DESC(node)->id;
+	size_t new_size;
+
+	if (id >= node_table_size) {
+		new_size = MAX(id + 1, 2 * node_table_size);
+		RESIZE(node_table, new_size, GNode *);
+		memset( &node_table[node_table_size], 0, (new_size - node_table_size) * sizeof(GNode *) );
+		node_table_size = new_size;
+	}
+
+	node_table[id] = node;
+}
+
+
+/* Forgets a node that is about to be freed */
+void
+viewport_node_table_remove( GNode *node )
+{
+	unsigned int id = NODE_DESC(node)->id;
+
+	if (id < node_table_size)
+		node_table[id] = NULL;
+
+	if (node == indicated_node)
+		indicated_node = NULL;
 }
 
 
@@ -68,6 +108,38 @@ node_at_location( int x, int y)
 }
 
 
+/* Shows a running summary of the marquee selection in the status bar */
+static void
+selection_statusbar( void )
+{
+	const SelectionStats *stats;
+	char strbuf[256];
+
+	stats = selection_stats( );
+	sprintf( strbuf, _("%d nodes selected, %s"), stats->num_nodes, abbrev_size( stats->size ) );
+	window_statusbar( SB_RIGHT, strbuf );
+}
+
+
+/* Names the node under the pointer in the status bar */
+static void
+indicated_node_statusbar( GNode *node )
+{
+	char strbuf[1024];
+
+	if (layout_is_small_files( node )) {
+		snprintf( strbuf, sizeof(strbuf), _("%s: %u small files, %s"), node_absname( node->parent ), DIR_NODE_DESC(node->parent)->num_small_files, abbrev_size( layout_small_files_size( node->parent ) ) );
+		window_statusbar( SB_RIGHT, strbuf );
+	}
+	else if (NODE_IS_DIR(node) && DIR_NODE_DESC(node)->unavailable) {
+		snprintf( strbuf, sizeof(strbuf), _("%s (not responding)"), node_absname( node ) );
+		window_statusbar( SB_RIGHT, strbuf );
+	}
+	else
+		window_statusbar( SB_RIGHT, node_absname( node ) );
+}
+
+
 /* This callback catches all events for the viewport */
 gboolean
 viewport_cb(GtkWidget *gl_area_w, GdkEvent *event, gpointer user_data)
@@ -80,7 +152,7 @@ viewport_cb(GtkWidget *gl_area_w, GdkEvent *event, gpointer user_data)
 	/* Previous mouse pointer coordinates */
 	static double prev_x, prev_y;
 	boolean btn1, btn2, btn3;
-	boolean ctrl_key;
+	boolean ctrl_key, shift_key;
 
 	/* Handle low-level GL area widget events */
 	switch (event->type) {
@@ -119,6 +191,7 @@ viewport_cb(GtkWidget *gl_area_w, GdkEvent *event, gpointer user_data)
 		btn2 = ev_button->button == 2;
 		btn3 = ev_button->button == 3;
 		ctrl_key = ev_button->state & GDK_CONTROL_MASK;
+		shift_key = ev_button->state & GDK_SHIFT_MASK;
 		scale = gtk_widget_get_scale_factor(gl_area_w);
 		x = ev_button->x * scale;
 		y = ev_button->y * scale;
@@ -127,7 +200,25 @@ viewport_cb(GtkWidget *gl_area_w, GdkEvent *event, gpointer user_data)
 			camera_pan_finish( );
 			indicated_node = NULL;
 		}
+		else if (btn1 && shift_key && !ctrl_key && (globals.fsv_mode != FSV_DISCV)) {
+			/* Start a marquee selection */
+			gui_cursor( gl_area_w, GDK_CROSSHAIR );
+			geometry_highlight_node( NULL, FALSE );
+			indicated_node = NULL;
+			selection_begin( x, y, gtk_widget_get_allocated_width( gl_area_w ) * scale, gtk_widget_get_allocated_height( gl_area_w ) * scale );
+			selection_statusbar( );
+		}
+		else if (btn1 && !ctrl_key && minimap_contains( x, y )) {
+			/* Click on the overview map */
+			geometry_highlight_node( NULL, FALSE );
+			indicated_node = NULL;
+			node = minimap_node_at( x, y );
+			if (node != NULL)
+				camera_look_at( node );
+		}
 		else if (!ctrl_key) {
+			if (btn1)
+				selection_clear( );
 			if (btn2)
 				indicated_node = NULL;
 			else
@@ -141,7 +232,7 @@ viewport_cb(GtkWidget *gl_area_w, GdkEvent *event, gpointer user_data)
 					geometry_highlight_node( indicated_node, btn1 );
 				else
 					geometry_highlight_node( NULL, FALSE );
-				window_statusbar( SB_RIGHT, node_absname( indicated_node ) );
+				indicated_node_statusbar( indicated_node );
 				if (btn3) {
 					/* Bring up context-sensitive menu */
 					context_menu( indicated_node, ev_button );
@@ -161,8 +252,25 @@ viewport_cb(GtkWidget *gl_area_w, GdkEvent *event, gpointer user_data)
 		ev_button = (GdkEventButton *)event;
 		btn1 = ev_button->state & GDK_BUTTON1_MASK;
 		ctrl_key = ev_button->state & GDK_CONTROL_MASK;
-		if (btn1 && !ctrl_key && !camera_moving( ) && (indicated_node != NULL))
-			camera_look_at( indicated_node );
+		if (selection_dragging( )) {
+			/* Marquee selection complete */
+			selection_end( );
+			gui_cursor( gl_area_w, -1 );
+			dialog_selection_summary( );
+			break;
+		}
+		if (btn1 && !ctrl_key && !camera_moving( ) && (indicated_node != NULL)) {
+			if (layout_is_small_files( indicated_node )) {
+				/* Spread out the small files */
+				node = indicated_node->parent;
+				geometry_show_small_files( node );
+				geometry_highlight_node( NULL, FALSE );
+				indicated_node = NULL;
+				camera_look_at( node );
+			}
+			else
+				camera_look_at( indicated_node );
+		}
 		gui_cursor( gl_area_w, -1 );
 		break;
 
@@ -176,6 +284,14 @@ viewport_cb(GtkWidget *gl_area_w, GdkEvent *event, gpointer user_data)
 		x = ev_motion->x * scale;
 		y = ev_motion->y * scale;
 		if (!camera_moving( ) && !gtk_events_pending( )) {
+			if (btn1 && selection_dragging( )) {
+				/* Stretch the marquee */
+				selection_update( x, y );
+				selection_statusbar( );
+				prev_x = x;
+				prev_y = y;
+				break;
+			}
 			if (btn2) {
 				/* Dolly the camera */
 				gui_cursor( gl_area_w, GDK_DOUBLE_ARROW );
@@ -199,6 +315,8 @@ viewport_cb(GtkWidget *gl_area_w, GdkEvent *event, gpointer user_data)
 						indicated_node = NULL;
 				}
 			}
+			else if (minimap_contains( x, y ))
+				indicated_node = NULL;
                         else
 				indicated_node = node_at_location(x, y);
 			/* Update node highlighting */
@@ -211,7 +329,7 @@ viewport_cb(GtkWidget *gl_area_w, GdkEvent *event, gpointer user_data)
 					geometry_highlight_node( indicated_node, btn1 );
 				else
 					geometry_highlight_node( NULL, FALSE);
-				window_statusbar( SB_RIGHT, node_absname( indicated_node ) );
+				indicated_node_statusbar( indicated_node );
 			}
 			prev_x = x;
 			prev_y = y;
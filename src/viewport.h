@@ -16,6 +16,8 @@
 
 
 void viewport_pass_node_table(GNode **new_node_table, size_t nz);
+void viewport_node_table_add( GNode *node );
+void viewport_node_table_remove( GNode *node );
 #ifdef __GTK_H__
 int viewport_cb( GtkWidget *gl_area_w, GdkEvent *event );
 #endif
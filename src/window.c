@@ -24,6 +24,7 @@
 #include "filelist.h"
 #include "fsv.h"
 #include "gui.h"
+#include "profile.h" /* profile_report( ) */
 #include "viewport.h"
 
 /* Toolbar button icons */
@@ -144,6 +145,7 @@ window_init( FsvMode fsv_mode )
 	gui_menu_item_add( menu_w, "Memory summary", debug_show_mem_summary, NULL );
 	gui_menu_item_add( menu_w, "Memory stats", debug_show_mem_stats, NULL );
 	gui_separator_add( menu_w );
+	gui_menu_item_add( menu_w, "Runtime statistics", profile_report, NULL );
 #endif
 
 	/* Help menu (right-justified) */